@@ -0,0 +1,461 @@
+/*************************************************/
+/*FileName: abc_bench.c                          */
+/*Benchmark of every stage of the ABC chain      */
+/*************************************************/
+
+/*
+ * Synthetic day-long traces are written in native and swapped byte order,
+ * then every stage is run repeatedly on them. One JSON object per line is
+ * printed for each (stage, rate, byte order):
+ *
+ *   {"stage":"bp","rate":5,"endian":"native","npts":150000,"runs":5,
+ *    "median_s":0.0123,"p95_s":0.0131,"samples_per_s":1.2e+07,"pairs_per_s":0}
+ *
+ * npts is the number of samples the stage works on, pairs_per_s is only
+ * set for the whole pair pipeline. The byte swap kernels the CPU supports
+ * are timed on one day of samples, in place (swap4_*) and while copying
+ * (swap4_copy_*). So are the cross spectrum kernels of xspec.h, on the
+ * spectra of a cut window summed over nseg days (cross_*_d<nseg>, npts is
+ * bins times days), against the loop of cor_spec on interleaved
+ * fftw_complex spectra (cross_loop_d<nseg>). The FTAN of the correlation
+ * (ftan, npts its lags) runs the bank of ftan.h on it. The pack codecs of
+ * corcodec.h code the correlation and random float bits (codec_<name>_cor,
+ * codec_<name>_random), into a buffer of corcodec_bound bytes followed by a
+ * guard; a codec that writes past the bound, does not decode back or
+ * exceeds its error bound exits with status 1.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "sacio.h"
+#include "xspec.h"
+#include "ftan.h"
+#include "corcodec.h"
+
+#define MAX_RUNS  1000
+#define DAY       86400
+#define MAX_DAYS  30                /* days of the cross spectrum sums      */
+#define DAYS_MEM  (256 << 20)       /* bytes of their spectra at most       */
+#define GUARD     64                /* bytes checked after corcodec_bound   */
+#define USAGE "Usage: abc_bench [-r runs] [-s rate[,rate...]] [-c cut_seconds] [-d tmp_dir]\n"
+
+/* samples, stage name and timings of one benchmark */
+typedef struct bench {
+    const char *stage;
+    const char *endian;
+    int rate, npts, runs, pairs;
+    double t[MAX_RUNS];
+} BENCH;
+
+static double now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+static int cmp_double( const void *a, const void *b ) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : (x > y);
+}
+
+/* print median, 95th percentile and throughput of a benchmark as one JSON line */
+static void report( BENCH *b ) {
+    double med, p95;
+    int k;
+
+    qsort(b->t, (size_t)b->runs, sizeof(double), cmp_double);
+    med = b->runs % 2 ? b->t[b->runs/2] : 0.5 * (b->t[b->runs/2-1] + b->t[b->runs/2]);
+    k = (int)ceil(0.95 * b->runs) - 1;
+    p95 = b->t[k < 0 ? 0 : k];
+    printf("{\"stage\":\"%s\",\"rate\":%d,\"endian\":\"%s\",\"npts\":%d,\"runs\":%d,"
+           "\"median_s\":%.6g,\"p95_s\":%.6g,\"samples_per_s\":%.6g,\"pairs_per_s\":%.6g}\n",
+           b->stage, b->rate, b->endian, b->npts, b->runs, med, p95,
+           med > 0 ? b->npts / med : 0., (med > 0 && b->pairs) ? b->pairs / med : 0.);
+    fflush(stdout);
+}
+
+/* reverse the bytes of n 4-byte words */
+static void swap4( char *p, size_t n ) {
+    size_t i;
+    char t;
+    for ( i = 0; i < 4*n; i += 4 ) {
+        t = p[i]; p[i] = p[i+3]; p[i+3] = t;
+        t = p[i+1]; p[i+1] = p[i+2]; p[i+2] = t;
+    }
+}
+
+/* loop of cor_spec on interleaved spectra, the days summed as xspec_cross does */
+static void cross_loop( fftw_complex **x, fftw_complex **y, int nday, int nfft, fftw_complex *acc ) {
+    int i, k;
+
+    for ( i = 0; i < nfft; i ++ ) {
+        acc[i][0] = x[0][i][0]*y[0][i][0] + x[0][i][1]*y[0][i][1];
+        acc[i][1] = x[0][i][1]*y[0][i][0] - x[0][i][0]*y[0][i][1];
+        for ( k = 1; k < nday; k ++ ) {
+            acc[i][0] += x[k][i][0]*y[k][i][0] + x[k][i][1]*y[k][i][1];
+            acc[i][1] += x[k][i][1]*y[k][i][0] - x[k][i][0]*y[k][i][1];
+        }
+    }
+}
+
+/* cross spectrum kernels on nday days of random spectra of nfft bins, against the interleaved loop */
+static void bench_cross( BENCH *b, int nfft, int nday ) {
+    const char *impl[3] = { "scalar", "avx2", "avx512" };
+    char stage[32];
+    fftw_complex *x[MAX_DAYS], *y[MAX_DAYS], *acc;
+    XSPEC xs[MAX_DAYS], ys[MAX_DAYS], cross;
+    int i, k, e, r;
+    double t;
+
+    srand(20180118);
+    for ( k = 0; k < nday; k ++ ) {
+        x[k] = (fftw_complex *) fftw_malloc( sizeof(fftw_complex) * nfft );
+        y[k] = (fftw_complex *) fftw_malloc( sizeof(fftw_complex) * nfft );
+        for ( i = 0; i < nfft; i ++ ) {
+            x[k][i][0] = rand()/(double)RAND_MAX - 0.5; x[k][i][1] = rand()/(double)RAND_MAX - 0.5;
+            y[k][i][0] = rand()/(double)RAND_MAX - 0.5; y[k][i][1] = rand()/(double)RAND_MAX - 0.5;
+        }
+        xspec_alloc(&xs[k], nfft); xspec_split(x[k], &xs[k]);
+        xspec_alloc(&ys[k], nfft); xspec_split(y[k], &ys[k]);
+    }
+    acc = (fftw_complex *) fftw_malloc( sizeof(fftw_complex) * nfft );
+    xspec_alloc(&cross, nfft);
+
+    b->npts = nfft * nday; b->pairs = 0;
+    sprintf(stage, "cross_loop_d%d", nday);
+    b->stage = stage;
+    for ( r = 0; r < b->runs; r ++ ) {
+        t = now(); cross_loop(x, y, nday, nfft, acc); b->t[r] = now() - t;
+    }
+    report(b);
+    for ( e = XSPEC_SCALAR; e <= XSPEC_AVX512; e ++ ) {
+        if ( xspec_use(e) != e ) continue;
+        sprintf(stage, "cross_%s_d%d", impl[e], nday);
+        for ( r = 0; r < b->runs; r ++ ) {
+            t = now(); xspec_cross(xs, ys, nday, &cross, 0); b->t[r] = now() - t;
+        }
+        report(b);
+        for ( i = 0; i < nfft; i ++ )
+            if ( cross.re[i] != acc[i][0] || cross.im[i] != acc[i][1] ) {
+                fprintf(stderr, "Warning: %s differs from the loop at bin %d\n", stage, i);
+                break;
+            }
+    }
+    xspec_use(XSPEC_BEST);
+
+    for ( k = 0; k < nday; k ++ ) {
+        fftw_free(x[k]); fftw_free(y[k]);
+        xspec_free(&xs[k]); xspec_free(&ys[k]);
+    }
+    fftw_free(acc);
+    xspec_free(&cross);
+}
+
+/* largest error of the decoded y over the maximum of its block of x */
+static double codec_err( const float *x, const float *y, int npts ) {
+    double m, e, err = 0.;
+    int i, k;
+
+    for ( k = 0; k < npts; k += CORCODEC_BLOCK ) {
+        for ( m = 0., i = k; i < npts && i < k + CORCODEC_BLOCK; i ++ ) if ( fabs(x[i]) > m ) m = fabs(x[i]);
+        for ( i = k; i < npts && i < k + CORCODEC_BLOCK; i ++ )
+            if ( m > 0. && (e = fabs((double)x[i] - y[i]) / m) > err ) err = e;
+    }
+    return err;
+}
+
+/* every codec of corcodec.h on npts samples, timed, within corcodec_bound and decoded back */
+static int bench_codec( BENCH *b, const float *x, int npts, const char *what ) {
+    const char *name[4] = { "raw", "lossless", "int16", "f16" };
+    char stage[32];
+    unsigned char *buf;
+    size_t bound = corcodec_bound(npts);
+    float *y;
+    long nbytes = 0;
+    int c, i, r, status = 0;
+    double t, err;
+
+    buf = (unsigned char *) malloc(bound + GUARD);
+    y = (float *) malloc(sizeof(float) * npts);
+    b->npts = npts; b->pairs = 0;
+    b->stage = stage;
+    for ( c = COR_RAW; c <= COR_F16; c ++ ) {
+        sprintf(stage, "codec_%s_%s", name[c], what);
+        memset(buf + bound, 0xa5, GUARD);
+        for ( r = 0; r < b->runs; r ++ ) {
+            t = now(); nbytes = corcodec_encode(c, x, npts, buf); b->t[r] = now() - t;
+        }
+        report(b);
+        for ( i = 0; i < GUARD && buf[bound + i] == 0xa5; i ++ ) ;
+        if ( nbytes < 0 || (size_t)nbytes > bound || i < GUARD ) {
+            fprintf(stderr, "Error: %s wrote past corcodec_bound (%ld of %zu bytes)\n", stage, nbytes, bound);
+            status = -1;
+            continue;
+        }
+        if ( corcodec_decode(c, buf, (size_t)nbytes, y, npts) == -1 ) {
+            fprintf(stderr, "Error: %s does not decode\n", stage);
+            status = -1;
+            continue;
+        }
+        if ( c <= COR_LOSSLESS && memcmp(x, y, sizeof(float) * npts) != 0 ) {
+            fprintf(stderr, "Error: %s does not decode to its samples\n", stage);
+            status = -1;
+        }
+        if ( c >= COR_INT16 && (err = codec_err(x, y, npts)) > (c == COR_INT16 ? CORCODEC_INT16_ERR : CORCODEC_F16_ERR) ) {
+            fprintf(stderr, "Error: %s error %g of the block maximum, beyond its bound\n", stage, err);
+            status = -1;
+        }
+    }
+    free(buf); free(y);
+    return status;
+}
+
+/* rewrite a SAC file in the opposite byte order */
+static int write_swapped( const char *name, const char *swapped ) {
+    FILE *ff;
+    char *buf;
+    long n;
+
+    if ( (ff = fopen(name, "rb")) == NULL ) return -1;
+    fseek(ff, 0, SEEK_END); n = ftell(ff); fseek(ff, 0, SEEK_SET);
+    buf = (char *) malloc(n);
+    if ( fread(buf, n, 1, ff) != 1 ) { fclose(ff); free(buf); return -1; }
+    fclose(ff);
+    swap4(buf, SAC_HEADER_NUMBERS);
+    swap4(buf + SAC_HEADER_NUMBERS_SIZE + SAC_HEADER_STRINGS_SIZE,
+          (n - SAC_HEADER_NUMBERS_SIZE - SAC_HEADER_STRINGS_SIZE) / 4);
+    if ( (ff = fopen(swapped, "wb")) == NULL ) { free(buf); return -1; }
+    fwrite(buf, n, 1, ff);
+    fclose(ff); free(buf);
+    return 0;
+}
+
+/* day-long noise with a few microseism-like lines, correlated between the two stations */
+static void synth_day( const char *name1, const char *name2, int rate ) {
+    int i, npts = DAY * rate;
+    float *x, *y, dt = 1./rate, common;
+    SACHEAD hd;
+
+    x = (float *) malloc(sizeof(float) * npts);
+    y = (float *) malloc(sizeof(float) * npts);
+    srand(20171205);
+    for ( i = 0; i < npts; i ++ ) {
+        common = sin(2*M_PI*0.07*i*dt) + 0.5*sin(2*M_PI*0.15*i*dt) + (rand()/(float)RAND_MAX - 0.5);
+        x[i] = common + (rand()/(float)RAND_MAX - 0.5);
+        y[i] = (i >= 20*rate ? x[i-20*rate] : common) + 0.5*(rand()/(float)RAND_MAX - 0.5);
+    }
+    hd = new_sac_head(dt, npts, 0.);
+    hd.nzyear = 2017; hd.nzjday = 302; hd.nzhour = 0; hd.nzmin = 0; hd.nzsec = 0; hd.nzmsec = 0;
+    hd.iztype = IB;
+    write_sac(name1, hd, x);
+    write_sac(name2, hd, y);
+    free(x); free(y);
+}
+
+int main( int argc, char *argv[] ) {
+    char dir[256] = ".", *tok, raw1[300], raw2[300], sw1[300], sw2[300], cut1[300], cut2[300],
+         bp1[300], bp2[300], nm1[300], nm2[300], wh1[300], wh2[300], cor[300], out[300],
+         swap_stage[2][32], *word, *copy, *mask;
+    int c, r, k, e, runs = 5, nrate = 0, rates[16], cut_npts, status = 0;
+    unsigned int u;
+    float f1 = 0.0167, f2 = 0.02, f3 = 0.067, f4 = 0.08, lag_time = 500., cut_sec = 30000., *data;
+    double evt0, t;
+    const char *endian[2] = { "native", "swapped" };
+    const char *swap_impl[3] = { "scalar", "ssse3", "avx2" };
+    BENCH b;
+    SACHEAD hd;
+    FTANSET fset;
+    FTANPICK fpick[FTAN_NPER];
+
+    while ( (c = getopt(argc, argv, "r:s:c:d:")) != -1 ) switch ( c ) {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 's':
+            for ( tok = strtok(optarg, ","); tok != NULL && nrate < 16; tok = strtok(NULL, ",") )
+                rates[nrate++] = atoi(tok);
+            break;
+        case 'c':
+            cut_sec = atof(optarg);
+            break;
+        case 'd':
+            strncpy(dir, optarg, 255);
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(1);
+    }
+    if ( runs < 1 || runs > MAX_RUNS ) {
+        fprintf(stderr, "Number of runs must be within 1 - %d\n", MAX_RUNS);
+        exit(1);
+    }
+    if ( nrate == 0 ) {
+        rates[0] = 1; rates[1] = 5; rates[2] = 20; rates[3] = 100; nrate = 4;
+    }
+    b.runs = runs;
+
+    sprintf(raw1, "%s/bench1.SAC", dir);      sprintf(raw2, "%s/bench2.SAC", dir);
+    sprintf(sw1, "%s/bench1.swap.SAC", dir);  sprintf(sw2, "%s/bench2.swap.SAC", dir);
+    sprintf(cut1, "%s/bench1.cut", dir);      sprintf(cut2, "%s/bench2.cut", dir);
+    sprintf(bp1, "%s/bench1.bp", dir);        sprintf(bp2, "%s/bench2.bp", dir);
+    sprintf(nm1, "%s/bench1.norm", dir);      sprintf(nm2, "%s/bench2.norm", dir);
+    sprintf(wh1, "%s/bench1.whi", dir);       sprintf(wh2, "%s/bench2.whi", dir);
+    sprintf(cor, "%s/bench.cor", dir);        sprintf(out, "%s/bench.out", dir);
+    evt0 = abs_time(2017, 302, 0, 0, 0, 0.);
+
+    for ( k = 0; k < nrate; k ++ ) {
+        b.rate = rates[k];
+        cut_npts = (int)(cut_sec * rates[k]);
+        if ( cut_npts > DAY * rates[k] - 10000 * rates[k] ) cut_npts = DAY * rates[k] - 10000 * rates[k];
+        synth_day(raw1, raw2, rates[k]);
+        write_swapped(raw1, sw1);
+        write_swapped(raw2, sw2);
+
+        /* byte swap kernels, in place and while copying */
+        b.endian = endian[1]; b.pairs = 0; b.npts = DAY * rates[k];
+        word = (char *) malloc(4 * (size_t)b.npts);
+        copy = (char *) malloc(4 * (size_t)b.npts);
+        memset(word, 1, 4 * (size_t)b.npts);
+        for ( e = SAC_SWAP_SCALAR; e <= SAC_SWAP_AVX2; e ++ ) {
+            if ( sac_swap4_use(e) != e ) continue;
+            sprintf(swap_stage[0], "swap4_%s", swap_impl[e]);
+            sprintf(swap_stage[1], "swap4_copy_%s", swap_impl[e]);
+            b.stage = swap_stage[0];
+            for ( r = 0; r < runs; r ++ ) {
+                t = now(); sac_swap4(word, 4 * (size_t)b.npts); b.t[r] = now() - t;
+            }
+            report(&b);
+            b.stage = swap_stage[1];
+            for ( r = 0; r < runs; r ++ ) {
+                t = now(); sac_swap4_copy(copy, word, 4 * (size_t)b.npts); b.t[r] = now() - t;
+            }
+            report(&b);
+        }
+        sac_swap4_use(SAC_SWAP_BEST);
+        free(word); free(copy);
+
+        /* SAC I/O and cut, in both byte orders */
+        for ( e = 0; e < 2; e ++ ) {
+            b.endian = endian[e]; b.pairs = 0;
+
+            b.stage = "read_sac"; b.npts = DAY * rates[k];
+            for ( r = 0; r < runs; r ++ ) {
+                t = now(); data = read_sac(e ? sw1 : raw1, &hd); b.t[r] = now() - t;
+                free(data);
+            }
+            report(&b);
+
+            b.stage = "cut_sac"; b.npts = cut_npts;
+            for ( r = 0; r < runs; r ++ ) {
+                t = now(); cut_sac(e ? sw1 : raw1, cut1, evt0, 10000., cut_npts); b.t[r] = now() - t;
+            }
+            report(&b);
+        }
+
+        b.endian = endian[0];
+        data = read_sac(raw1, &hd);
+        b.stage = "write_sac"; b.npts = hd.npts;
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); write_sac(out, hd, data); b.t[r] = now() - t;
+        }
+        report(&b);
+        free(data);
+
+        /* processing stages on the cut window */
+        cut_sac(raw2, cut2, evt0, 10000., cut_npts);
+        b.npts = cut_npts;
+        b.stage = "bp";
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); bp(cut1, bp1, f1, f2, f3, f4, 10); b.t[r] = now() - t;
+        }
+        report(&b);
+        bp(cut2, bp2, f1, f2, f3, f4, 10);
+
+        b.stage = "normal";
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); normal(bp1, nm1, 8 * rates[k]); b.t[r] = now() - t;
+        }
+        report(&b);
+        normal(bp2, nm2, 8 * rates[k]);
+
+        b.stage = "sta_lta";
+        data = read_sac(bp1, &hd);
+        mask = (char *) malloc(hd.npts);
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); sta_lta_mask(data, hd.npts, hd.delta, 20., 600., 3., 1.5, mask); b.t[r] = now() - t;
+        }
+        report(&b);
+        free(data); free(mask);
+
+        b.stage = "spe_whi";
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); spe_whi(nm1, wh1, 20, f1, f2, f3, f4); b.t[r] = now() - t;
+        }
+        report(&b);
+        spe_whi(nm2, wh2, 20, f1, f2, f3, f4);
+
+        b.stage = "cor_in_freq";
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); cor_in_freq(wh1, wh2, lag_time, cor); b.t[r] = now() - t;
+        }
+        report(&b);
+
+        /* dispersion of the correlation, the 20 s delay of synth_day as 60 km at 3 km/s */
+        b.stage = "ftan";
+        data = read_sac(cor, &hd);
+        hd.dist = 60.;
+        ftan_parse("15/50", &fset);
+        b.npts = hd.npts;
+        for ( r = 0; r < runs; r ++ ) {
+            t = now(); ftan_run(data, &hd, &fset, fpick); b.t[r] = now() - t;
+        }
+        report(&b);
+
+        /* pack codecs on the correlation and on incompressible float bits */
+        if ( bench_codec(&b, data, hd.npts, "cor") == -1 ) status = 1;
+        srand(20180129);
+        for ( r = 0; r < hd.npts; r ++ ) {
+            u = ((unsigned int)rand() << 16 ^ (unsigned int)rand()) & 0xbf7fffffu;   /* finite, |x| < 2 */
+            memcpy(&data[r], &u, sizeof(float));
+        }
+        if ( bench_codec(&b, data, hd.npts, "random") == -1 ) status = 1;
+        free(data);
+        b.npts = cut_npts;
+
+        /* cross spectrum of a pair, of one day and summed over days */
+        e = DAYS_MEM / (int)(4 * sizeof(fftw_complex) * pow_next2(cut_npts));
+        bench_cross(&b, pow_next2(cut_npts), 1);
+        if ( e > 1 ) bench_cross(&b, pow_next2(cut_npts), e < MAX_DAYS ? e : MAX_DAYS);
+        b.endian = endian[0];
+
+        /* whole pair pipeline, as run by abc_egf, in both byte orders */
+        b.stage = "pair"; b.pairs = 1;
+        for ( e = 0; e < 2; e ++ ) {
+            b.endian = endian[e];
+            for ( r = 0; r < runs; r ++ ) {
+                t = now();
+                cut_sac(e ? sw1 : raw1, cut1, evt0, 10000., cut_npts);
+                bp(cut1, bp1, f1, f2, f3, f4, 10);
+                normal(bp1, nm1, 8 * rates[k]);
+                spe_whi(nm1, wh1, 20, f1, f2, f3, f4);
+                cut_sac(e ? sw2 : raw2, cut2, evt0, 10000., cut_npts);
+                bp(cut2, bp2, f1, f2, f3, f4, 10);
+                normal(bp2, nm2, 8 * rates[k]);
+                spe_whi(nm2, wh2, 20, f1, f2, f3, f4);
+                cor_in_freq(wh1, wh2, lag_time, cor);
+                b.t[r] = now() - t;
+            }
+            report(&b);
+        }
+    }
+
+    remove(raw1); remove(raw2); remove(sw1); remove(sw2); remove(cut1); remove(cut2);
+    remove(bp1); remove(bp2); remove(nm1); remove(nm2); remove(wh1); remove(wh2);
+    remove(cor); remove(out);
+
+    return status;
+}
@@ -0,0 +1,133 @@
+/*************************************************/
+/*FileName: abc_dvv.c                            */
+/*dv/v of daily correlations by stretching       */
+/*************************************************/
+
+/*
+ * Every line of dvv.lst is
+ *
+ *   ref.SAC day.SAC
+ *
+ * the reference stack of a pair and one daily correlation of it; the days
+ * of consecutive lines with the same reference are measured together, and
+ * one line per day is written to stdout:
+ *
+ *   ref.SAC day.SAC nzyear nzjday dv/v(%) cc
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sacio.h"
+#include "dvv.h"
+
+#define USAGE "Usage: abc_dvv [-w t1/t2] [-e eps_max] [-n neps] [-c coarse] [-j threads] dvv.lst\n"
+
+#define DVV_EPS_MAX     0.01        /* stretches of -1% to 1%               */
+#define DVV_NEPS        201
+
+/* function prototype for local use */
+static int dvv_pair ( const char *ref, char **day, int nday, float t1, float t2, float eps_max,
+                      int neps, int coarse, int nthread );
+
+int main( int argc, char *argv[] ) {
+    int c, i, nday = 0, size = 64, neps = DVV_NEPS, coarse = 1, nthread = 1, status = 0;
+    float t1 = 0., t2 = 1.e30, eps_max = DVV_EPS_MAX;
+    char line[1024], ref[256], day[256], cur[256] = "", **days;
+    FILE *fp;
+
+    while ( (c = getopt(argc, argv, "w:e:n:c:j:")) != -1 ) switch ( c ) {
+        case 'w':
+            if ( sscanf(optarg, "%f/%f", &t1, &t2) != 2 || t1 < 0. || t2 <= t1 ) {
+                fprintf(stderr, "Bad window %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'e':
+            eps_max = atof(optarg);
+            break;
+        case 'n':
+            neps = atoi(optarg);
+            break;
+        case 'c':
+            coarse = atoi(optarg);
+            break;
+        case 'j':
+            nthread = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(1);
+    }
+    if ( argc - optind != 1 || eps_max <= 0. || neps < 2 || coarse < 1 || nthread < 1 ) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    if ( (fp = fopen(argv[optind], "r")) == NULL ) {
+        fprintf(stderr, "Can not open %s\n", argv[optind]);
+        exit(1);
+    }
+    days = (char **)malloc(sizeof(char *) * size);
+
+    /* the days of a reference, then all of them at once */
+    while ( fgets(line, sizeof(line), fp) != NULL ) {
+        if ( sscanf(line, "%255s %255s", ref, day) != 2 ) continue;
+        if ( nday > 0 && strcmp(ref, cur) != 0 ) {
+            if ( dvv_pair(cur, days, nday, t1, t2, eps_max, neps, coarse, nthread) == -1 ) status = 1;
+            for ( i = 0; i < nday; i ++ ) free(days[i]);
+            nday = 0;
+        }
+        strcpy(cur, ref);
+        if ( nday == size ) days = (char **)realloc(days, sizeof(char *) * (size *= 2));
+        days[nday ++] = strdup(day);
+    }
+    if ( nday > 0 && dvv_pair(cur, days, nday, t1, t2, eps_max, neps, coarse, nthread) == -1 ) status = 1;
+    for ( i = 0; i < nday; i ++ ) free(days[i]);
+    free(days);
+    fclose(fp);
+
+    return status;
+}
+
+/*
+ *  dvv_pair: dv/v of the nday days of the reference ref, days that can not
+ *      be read or do not have the lags of the reference are skipped
+ */
+static int dvv_pair( const char *ref, char **day, int nday, float t1, float t2, float eps_max,
+                     int neps, int coarse, int nthread ) {
+    SACHEAD hr, hd, *hdays;
+    float *fr, **fd;
+    int i, n = 0, status = 0;
+    char **name;
+    DVVREF *rf;
+    DVVPICK *pick;
+
+    if ( (fr = read_sac(ref, &hr)) == NULL ) return -1;
+    if ( (rf = dvv_ref(fr, &hr, t1, t2, eps_max, neps)) == NULL ) { free(fr); return -1; }
+    fd = (float **)malloc(sizeof(float *) * nday);
+    hdays = (SACHEAD *)malloc(sizeof(SACHEAD) * nday);
+    pick = (DVVPICK *)malloc(sizeof(DVVPICK) * nday);
+    name = (char **)malloc(sizeof(char *) * nday);
+    for ( i = 0; i < nday; i ++ ) {
+        if ( (fd[n] = read_sac(day[i], &hd)) == NULL ) continue;
+        if ( hd.npts != hr.npts || hd.delta != hr.delta ) {
+            fprintf(stderr, "%s: %d lags of %g s, not those of %s\n", day[i], hd.npts, hd.delta, ref);
+            free(fd[n]);
+            continue;
+        }
+        hdays[n] = hd;
+        name[n ++] = day[i];
+    }
+
+    if ( dvv_run(rf, fd, n, coarse, nthread, pick) == 0 )
+        for ( i = 0; i < n; i ++ )
+            printf("%s %s %d %d %.5f %.4f\n", ref, name[i], hdays[i].nzyear, hdays[i].nzjday,
+                   100. * pick[i].dvv, pick[i].cc);
+    else status = -1;
+
+    for ( i = 0; i < n; i ++ ) free(fd[i]);
+    free(fd); free(hdays); free(pick); free(name); free(fr);
+    dvv_free(rf);
+    return status;
+}
@@ -1,5 +1,5 @@
 /*************************************************/
-/*FileName: test.c                               */
+/*FileName: abc_egf.c                            */
 /*Author  : xfeng                                */
 /*Mail    : geophydogvon@gmail.com               */
 /*Inst    : NJU                                  */
@@ -10,49 +10,1063 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
 #include "sacio.h"
+#include "sacidx.h"
+#include "corpack.h"
+#include "abcstat.h"
+#include "sacqc.h"
+#include "sacpz.h"
+#include "corstack.h"
+#include "abcjob.h"
+#include "abcshard.h"
+#include "corspec.h"
+#include "abctune.h"
+#include "ftan.h"
 
-int main( int argc, char *argv[] ) {
-    char buff[500], sac1[50], sac2[50], cor_name[50], sacbp1[100], sacbp2[100], saccut1[100],
-         saccut2[100], sacnorm1[100], sacnorm2[100], sacwhi1[100], sacwhi2[100];
-    int year, mon, day, jday, hour, min, sec, cut_npts, npts, count = 1;
-    float evt0, f1, f2, f3, f4, lag_time, start0;
-    FILE *ff;
+#define MAX_BANDS 16
+#define MAX_THREADS 256
+#define FFT_HUGE (1 << 22)      /* samples of a window whose pairs take all threads of -j, one at a time */
+#define FFT_MIN_SPLIT (1 << 15) /* transforms and loops over bins shorter than that are not split */
+#define USAGE "Usage: abc_egf [-i sac_index.lst] [-b f1/f2/f3/f4[,f1/f2/f3/f4...] | -c] [-o cor.pack [-z codec]]\n" \
+              "               [-q qc.conf] [-s sta/lta/on/off] [-g min_overlap] [-r pz.lst [-w water_level]]\n" \
+              "               [-m metrics.json|metrics.prom [-t seconds]] [-j threads] [-d job_dir]\n" \
+              "               [-a retries] [-e failed.lst] [--shard i/N] [--mem-limit size [--scratch file]]\n" \
+              "               [--converge snr/cc[/days]] [--ftan tmin/tmax[/alpha[/nper]] [--ftan-out file]]\n" \
+              "               file.lst\n" \
+              "       abc_egf --tune [file.lst]\n" \
+              "-j hands out blocks of 64 lines: with fewer than 64 x threads lines, the threads without a block\n" \
+              "   only help within pairs of 2^15 samples or more\n"
 
-    if ( argc != 2 ) {
-        fprintf(stderr, "Usage: run_exam file.lst\n");
-        exit(1);
+/* parse "f1/f2/f3/f4,f1/f2/f3/f4,..." into band, return number of bands or -1 */
+static int parse_bands( char *arg, float (*band)[4] ) {
+    int nband = 0;
+    char *tok;
+
+    for ( tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ",") ) {
+        if ( nband == MAX_BANDS ) return -1;
+        if ( sscanf(tok, "%f/%f/%f/%f", &band[nband][0], &band[nband][1],
+                    &band[nband][2], &band[nband][3]) != 4 ) return -1;
+        nband ++;
     }
+    return nband;
+}
 
-    ff = fopen( argv[1], "r" );
-    while ( fgets( buff, 500, ff ) ) {
-        sscanf(buff, "%s %s %d %d %d %d %d %d %f %d %f %f %f %f %d %s %f", sac1, sac2, &year, &mon, &day,\
-            &hour, &min, &sec, &start0, &cut_npts, &f1, &f2, &f3, &f4, &npts, cor_name, &lag_time );
+/* name of the correlation of band k or component pair: COR_A_B.SAC -> COR_A_B_B1.SAC, COR_A_B_ZR.SAC */
+static void cor_suffix( const char *cor_name, const char *suffix, char *name ) {
+    const char *ext = strrchr(cor_name, '.');
+
+    if ( ext == NULL ) ext = cor_name + strlen(cor_name);
+    sprintf(name, "%.*s_%s%s", (int)(ext - cor_name), cor_name, suffix, ext);
+}
+
+/* component c of a station: the last '?' of sac replaced, STA.BH?.SAC -> STA.BHE.SAC; -1 if none */
+static int cmp_name( const char *sac, char c, char *name ) {
+    char *q;
+
+    strcpy(name, sac);
+    if ( (q = strrchr(name, '?')) == NULL ) return -1;
+    *q = c;
+    return 0;
+}
+
+/* settings of the run, only read once the pairs are being correlated */
+static struct {
+    SACINDEX *idx;
+    QC       *qc;
+    int      nband, tensor;
+    float    band[MAX_BANDS][4];
+    char     *metrics;
+    double   period;
+    ABCJOB   *job;
+    unsigned long long param;       /* hash of the settings changing the results */
+    char     tag[16];               /* of the intermediate files of the process, .s<i> for --shard */
+} run;
+
+/* long options, beyond the letters */
+#define OPT_SHARD 256
+#define OPT_MEM_LIMIT 257
+#define OPT_SCRATCH 258
+#define OPT_TUNE 259
+#define OPT_CONVERGE 260
+#define OPT_FTAN 261
+#define OPT_FTAN_OUT 262
+static struct option long_opts[] = {
+    { "shard", required_argument, NULL, OPT_SHARD },
+    { "mem-limit", required_argument, NULL, OPT_MEM_LIMIT },
+    { "scratch", required_argument, NULL, OPT_SCRATCH },
+    { "tune", no_argument, NULL, OPT_TUNE },
+    { "converge", required_argument, NULL, OPT_CONVERGE },
+    { "ftan", required_argument, NULL, OPT_FTAN },
+    { "ftan-out", required_argument, NULL, OPT_FTAN_OUT },
+    { NULL, 0, NULL, 0 }
+};
+
+/* lines of file.lst for the worker threads of -j and --shard, handed out CORSTACK_BLOCK lines at a
+   time from the blocks of the run (all of them, or those of the shard); with -j, the last nblock_huge
+   blocks have windows of FFT_HUGE samples or more */
+static char (*lines)[500] = NULL;
+static long nline = 0, *blocks = NULL, nblock = 0, nblock_huge = 0, next_block = 0, end_block = 0;
+
+/* state of each of the nblock_all blocks of file.lst, by block number */
+#define BLOCK_MINE 1                    /* of the run, or of the shard */
+#define BLOCK_DONE 2                    /* handed on to the tree of the stacks */
+#define BLOCK_FAIL 4                    /* with a quarantined line */
+static char *block_flag = NULL;
+static long nblock_all = 0;
+
+/* -d with -j: the nodes of the tree of the stacks are cached instead of the lines, keyed by the keys of
+   their lines */
+static ABCJOB *node_job = NULL;
+static unsigned long long *line_keys = NULL;
+
+/* --converge: the days (lines) of each stack taken conv_days at a time, in rounds of the workers; a stack
+   whose SNR and correlation coefficient against the previous checkpoint reach conv_snr and conv_cc gets
+   no more days. line_round[i] is the round of line i, -1 once its stack has converged */
+typedef struct conv_stack {
+    char    name[CORSTACK_NAME_LEN];
+    int     nday, done;             /* days at the last checkpoint, converged */
+    float   snr, cc;                /* at the last checkpoint */
+    int     npts;
+    float   *prev;                  /* stack of the last checkpoint */
+} CONVSTACK;
+
+static CONVSTACK *conv = NULL;
+static long nconv = 0, *line_conv = NULL;
+static int *line_round = NULL, cur_round = 0, conv_days = 30;
+static float conv_snr = 0., conv_cc = 0.;
+static int (*conv_out)( const char *name, SACHEAD hd, const float *ar );
+
+/* --ftan: dispersion of every correlation or stack as it is written, into the table ftan_fp */
+static FTANSET ftan_set;
+static FTANPICK *ftan_pick = NULL;
+static FILE *ftan_fp = NULL;
+static int (*ftan_out)( const char *name, SACHEAD hd, const float *ar );
+
+/* -q: lines with a window rejected by the QC, screened before any pair is correlated */
+static char *qc_bad = NULL;
 
-        strcpy(saccut1, sac1);   strcpy(saccut2, sac2);   strcpy(sacbp1, sac1);  strcpy(sacbp2, sac2);
-        strcat(saccut1, ".cut"); strcat(saccut2, ".cut"); strcat(sacbp1, ".bp"); strcat(sacbp2, ".bp");
+/* quarantined lines of file.lst */
+typedef struct failed_line {
+    long    item;                   /* line number from 0 */
+    char    line[500];
+    char    why[128];               /* stage and file that failed */
+} FAILED;
 
-        strcpy(sacnorm1, sac1);    strcpy(sacnorm2, sac2);    strcpy(sacwhi1, sac1);   strcpy(sacwhi2, sac2);
-        strcat(sacnorm1, ".norm"); strcat(sacnorm2, ".norm"); strcat(sacwhi1, ".whi"); strcat(sacwhi2, ".whi");
+static FAILED *failed = NULL;
+static long nfail = 0, maxfail = 0;
+static pthread_mutex_t fail_lock = PTHREAD_MUTEX_INITIALIZER;
 
-        if ( count % 50 == 0 ) printf("%d\n", count);
+/* stage of a pair that failed, with its file, as the reason of the quarantine */
+static int fail( char *why, const char *stage, const char *sac ) {
+    snprintf(why, 128, "%s %s", stage, sac);
+    return -1;
+}
+
+/* correlate the pair of line item of file.lst, tag makes the intermediate files of a worker its own;
+   0 if done, 1 if nothing to correlate (blank line, rejected by the QC), -1 if a stage failed (why) */
+static int run_pair( const char *buff, long item, const char *tag, int tick, char *why ) {
+    char sac1[50], sac2[50], cor_name[50], sacbp1[100], sacbp2[100], saccut1[100],
+         saccut2[100], sacnorm1[100], sacnorm2[100], sacwhi1[100], sacwhi2[100],
+         band_cor[MAX_BANDS][64], *band_names[MAX_BANDS], suffix[16],
+         cmp_sac[6][50], cmp_cut[6][100], *cut_names[6], *cmp = "ENZ";
+    int year, mon, day, jday, hour, min, sec, cut_npts, npts, k, nf;
+    float f1, f2, f3, f4, lag_time, start0;
+    double evt0;
+
+    nf = sscanf(buff, "%s %s %d %d %d %d %d %d %f %d %f %f %f %f %d %s %f", sac1, sac2, &year, &mon, &day,\
+        &hour, &min, &sec, &start0, &cut_npts, &f1, &f2, &f3, &f4, &npts, cor_name, &lag_time );
+    if ( nf <= 0 ) return 1;
+    if ( nf != 17 ) return fail( why, "line with fewer than", "17 fields" );
+    if ( qc_bad != NULL && qc_bad[item] ) return 1;       /* a window rejected by qc_plan */
+    for ( k = 0; k < MAX_BANDS; k ++ ) band_names[k] = band_cor[k];
+    for ( k = 0; k < 6; k ++ ) cut_names[k] = cmp_cut[k];
+
+    sprintf(saccut1, "%s%s.cut", sac1, tag);   sprintf(saccut2, "%s%s.cut", sac2, tag);
+    sprintf(sacbp1, "%s%s.bp", sac1, tag);     sprintf(sacbp2, "%s%s.bp", sac2, tag);
+    sprintf(sacnorm1, "%s%s.norm", sac1, tag); sprintf(sacnorm2, "%s%s.norm", sac2, tag);
+    sprintf(sacwhi1, "%s%s.whi", sac1, tag);   sprintf(sacwhi2, "%s%s.whi", sac2, tag);
+
+    if ( (item + 1) % 50 == 0 ) printf("%ld\n", item + 1);
+    jday = julian(year, mon, day);
+    evt0 = abs_time( year, jday, hour, min, sec, 0. );
+
+    if ( run.tensor ) {
+        /* E, N and Z of both stations, all nine component pairs from one FFT of each */
+        for ( k = 0; k < 6; k ++ ) {
+            if ( cmp_name( k < 3 ? sac1 : sac2, cmp[k%3], cmp_sac[k] ) == -1 )
+                return fail( why, "no '?' for the component in", k < 3 ? sac1 : sac2 );
+            sprintf(cmp_cut[k], "%s%s.cut", cmp_sac[k], tag);
+            if ( run.idx ? sac_index_window( run.idx, cmp_sac[k], evt0 + start0, cut_npts, cmp_cut[k] ) <= 0
+                         : cut_sac( cmp_sac[k], cmp_cut[k], evt0, start0, cut_npts ) == -1 )
+                return fail( why, "cut", cmp_sac[k] );
+        }
+        for ( k = 0; k < 9; k ++ ) {
+            sprintf(suffix, "%c%c", "ZRT"[k/3], "ZRT"[k%3]);
+            cor_suffix( cor_name, suffix, band_cor[k] );
+        }
+        if ( cor_tensor( cut_names, cut_names + 3, f1, f2, f3, f4, 10, npts, 20, lag_time, band_names ) == -1 )
+            return fail( why, "cor_tensor", cor_name );
+        STAT_PAIR();
+        if ( tick ) abc_stat_tick( run.metrics, run.period );
+        return 0;
+    }
+    if ( run.idx ? sac_index_window( run.idx, sac1, evt0 + start0, cut_npts, saccut1 ) <= 0
+                 : cut_sac( sac1, saccut1, evt0, start0, cut_npts ) == -1 )
+        return fail( why, "cut", sac1 );
+    if ( run.idx ? sac_index_window( run.idx, sac2, evt0 + start0, cut_npts, saccut2 ) <= 0
+                 : cut_sac( sac2, saccut2, evt0, start0, cut_npts ) == -1 )
+        return fail( why, "cut", sac2 );
+
+    if ( run.nband > 0 ) {
+        /* all bands from one forward FFT of each cut trace */
+        for ( k = 0; k < run.nband; k ++ ) {
+            sprintf(suffix, "B%d", k+1);
+            cor_suffix( cor_name, suffix, band_cor[k] );
+        }
+        if ( cor_bands( saccut1, saccut2, run.nband, run.band, 10, npts, 20, lag_time, band_names ) == -1 )
+            return fail( why, "cor_bands", cor_name );
+        STAT_PAIR();
+        if ( tick ) abc_stat_tick( run.metrics, run.period );
+        return 0;
+    }
+
+    if ( bp( saccut1, sacbp1, f1, f2, f3, f4, 10) == -1 ) return fail( why, "bp", saccut1 );
+    if ( normal( sacbp1, sacnorm1, npts ) == -1 ) return fail( why, "normal", sacbp1 );
+    if ( spe_whi ( sacnorm1, sacwhi1, 20, f1, f2, f3, f4 ) == -1 ) return fail( why, "spe_whi", sacnorm1 );
+
+    if ( bp( saccut2, sacbp2, f1, f2, f3, f4, 10) == -1 ) return fail( why, "bp", saccut2 );
+    if ( normal( sacbp2, sacnorm2, npts ) == -1 ) return fail( why, "normal", sacbp2 );
+    if ( spe_whi ( sacnorm2, sacwhi2, 20, f1, f2, f3, f4 ) == -1 ) return fail( why, "spe_whi", sacnorm2 );
+
+    if ( cor_in_freq( sacwhi1, sacwhi2, lag_time, cor_name ) == -1 ) return fail( why, "cor_in_freq", cor_name );
+    STAT_PAIR();
+    if ( tick ) abc_stat_tick( run.metrics, run.period );
+    return 0;
+}
+
+/* -q: every station window of the lines screened once, in input order, before the pairs are correlated, so
+   that the baselines of the stations and the verdicts are those of the list whatever the threads, shards or
+   units replayed by -d; the windows are read into memory, a line with a bad one is set in qc_bad */
+static void qc_plan( void ) {
+    char sac1[50], sac2[50], sac[50], win[64], *cmp = "ENZ", *mask;
+    int year, mon, day, jday, hour, min, sec, cut_npts, k, n, bad, *verdict;
+    float start0, *x;
+    double t0;
+    long i, h, nhash;
+    unsigned long long key, *keys;
+    SACHEAD hd;
+
+    /* verdicts of the windows by the hash of station and window, in an open addressed table */
+    for ( nhash = 64; nhash < 4 * nline; nhash *= 2 ) ;
+    keys = (unsigned long long *) calloc( nhash, sizeof(unsigned long long) );
+    verdict = (int *) malloc( sizeof(int) * nhash );
+    qc_bad = (char *) calloc( nline > 0 ? nline : 1, 1 );
+    for ( i = 0; i < nline; i ++ ) {
+        if ( sscanf(lines[i], "%49s %49s %d %d %d %d %d %d %f %d", sac1, sac2, &year, &mon, &day, &hour, &min,
+                    &sec, &start0, &cut_npts) != 10 || cut_npts <= 0 ) continue;
         jday = julian(year, mon, day);
-        evt0 = abs_time( year, jday, hour, min, sec, 0. );
-        cut_sac( sac1, saccut1, evt0, start0, cut_npts );
-        bp( saccut1, sacbp1, f1, f2, f3, f4, 10);
-        normal( sacbp1, sacnorm1, npts );
-        spe_whi ( sacnorm1, sacwhi1, 20, f1, f2, f3, f4 );
+        t0 = abs_time( year, jday, hour, min, sec, 0. );
+        sprintf(win, "%04d.%03d.%02d:%02d:%02d+%g", year, jday, hour, min, sec, start0);
+        for ( bad = 0, k = 0; k < (run.tensor ? 6 : 2); k ++ ) {
+            if ( run.tensor ) {
+                if ( cmp_name( k < 3 ? sac1 : sac2, cmp[k%3], sac ) == -1 ) break;
+            }
+            else strcpy( sac, k == 0 ? sac1 : sac2 );
+            key = job_hash( job_hash( job_hash( 1, sac, strlen(sac) ), &t0, sizeof(t0) ), &start0, sizeof(start0) );
+            key = job_hash( key, &cut_npts, sizeof(cut_npts) ) | 1;    /* 0 marks a free slot */
+            for ( h = (long)(key & (nhash - 1)); keys[h] != 0 && keys[h] != key; h = (h + 1) & (nhash - 1) ) ;
+            if ( keys[h] == 0 ) {
+                /* a window not seen yet: screened, or left to the cut of run_pair if it cannot be read */
+                x = (float *) malloc( sizeof(float) * cut_npts );
+                mask = (char *) malloc( cut_npts );
+                n = run.idx ? sac_index_data( run.idx, sac, t0 + start0, cut_npts, x, mask, &hd )
+                            : cut_window( sac, t0, start0, cut_npts, x, mask, &hd );
+                keys[h] = key;
+                verdict[h] = n > 0 ? qc_window( run.qc, &hd, sac, win, x ) : 0;
+                free(x); free(mask);
+            }
+            bad |= verdict[h];
+        }
+        qc_bad[i] = (char) bad;
+    }
+    free(keys); free(verdict);
+}
+
+/* key of the unit of a line for -d: the line, the settings, every SAC file the pair reads and, with -q, the
+   verdict of qc_plan, which also depends on the other windows of its stations */
+static unsigned long long line_key( const char *buff, long item ) {
+    char sac1[50], sac2[50], sac[50], *cmp = "ENZ";
+    int year, mon, day, hour, min, sec, cut_npts, k, n, i;
+    float start0;
+    double t0;
+    const SACSEG *seg;
+    unsigned long long h;
+
+    sscanf(buff, "%s %s %d %d %d %d %d %d %f %d", sac1, sac2, &year, &mon, &day, &hour, &min, &sec,
+        &start0, &cut_npts);
+    t0 = abs_time( year, julian(year, mon, day), hour, min, sec, 0. ) + start0;
+    h = job_hash( run.param, buff, strcspn(buff, "\r\n") );
+    for ( k = 0; k < (run.tensor ? 6 : 2); k ++ ) {
+        if ( run.tensor ) cmp_name( k < 3 ? sac1 : sac2, cmp[k%3], sac );
+        else strcpy( sac, k == 0 ? sac1 : sac2 );
+        if ( run.idx == NULL ) {
+            h = job_file( h, sac );
+            continue;
+        }
+        n = sac_index_files( run.idx, sac, t0, cut_npts, &seg );
+        for ( i = 0; i < n; i ++ ) h = job_file( h, seg[i].name );
+        h = job_hash( h, &n, sizeof(n) );
+    }
+    if ( qc_bad != NULL ) h = job_hash( h, &qc_bad[item], 1 );
+    return h;
+}
+
+/* a failing line, set aside with the reason and the run going on */
+static void quarantine( long item, const char *buff, const char *why ) {
+    pthread_mutex_lock(&fail_lock);
+    if ( nfail == maxfail ) {
+        maxfail = maxfail ? 2 * maxfail : 64;
+        failed = (FAILED *) realloc( failed, sizeof(FAILED) * maxfail );
+    }
+    failed[nfail].item = item;
+    snprintf(failed[nfail].line, 500, "%.*s", (int)strcspn(buff, "\r\n"), buff);
+    strcpy(failed[nfail].why, why);
+    nfail ++;
+    pthread_mutex_unlock(&fail_lock);
+    if ( block_flag != NULL && item < nblock_all * CORSTACK_BLOCK ) block_flag[item / CORSTACK_BLOCK] |= BLOCK_FAIL;
+    fprintf(stderr, "Line %ld quarantined: %s\n", item + 1, why);
+}
+
+/* a line of file.lst: replayed from the cache of -d if it was done before, else correlated */
+static void run_line( const char *buff, long item, const char *tag, int tick ) {
+    char why[128];
+    unsigned long long key = 0;
+
+    if ( run.job != NULL ) {
+        key = line_key( buff, item );
+        if ( job_replay( run.job, key ) >= 0 ) return;
+        job_begin( key );
+    }
+    if ( run_pair( buff, item, tag, tick, why ) == -1 ) quarantine( item, buff, why );
+    else if ( run.job != NULL ) job_end( run.job );
+}
+
+static int fail_cmp( const void *a, const void *b ) {
+    long i1 = ((const FAILED *)a)->item, i2 = ((const FAILED *)b)->item;
+    return i1 < i2 ? -1 : i1 > i2;
+}
+
+/* retry pass: the lines quarantined so far once more, in input order, in the calling thread; for -j
+   their correlations are stacked as lines after all the others (block numbers from base on) */
+static void retry_failed( long base, const char *tag ) {
+    FAILED *f = failed;
+    long i, n = nfail;
+
+    failed = NULL; nfail = maxfail = 0;
+    qsort( f, n, sizeof(FAILED), fail_cmp );
+    fprintf(stderr, "Retrying %ld quarantined lines\n", n);
+    for ( i = 0; i < n; i ++ ) {
+        corstack_item( base + f[i].item );
+        shard_item( f[i].item );
+        run_line( f[i].line, f[i].item, tag, 1 );
+    }
+    free(f);
+}
+
+/* failure report: the quarantined lines as they were, the reason after '#', in input order; the
+   fields are all read before the '#', so the report can be given to abc_egf again as file.lst */
+static void report_failed( const char *report, long nitem ) {
+    FILE *fp;
+    long i;
+
+    qsort( failed, nfail, sizeof(FAILED), fail_cmp );
+    if ( (fp = fopen(report, "w")) == NULL ) {
+        fprintf(stderr, "Unable to write failure report %s\n", report);
+        return;
+    }
+    for ( i = 0; i < nfail; i ++ ) fprintf(fp, "%s   # line %ld: %s\n", failed[i].line, failed[i].item + 1, failed[i].why);
+    fclose(fp);
+    fprintf(stderr, "Failed: %ld of %ld lines, listed in %s\n", nfail, nitem, report);
+}
+
+/* hash of the settings that change the correlations of a line, for the keys of -d */
+static unsigned long long param_key( float *trig, float overlap, float wl, const SACRESP *resp ) {
+    char buff[256];
+    unsigned long long h;
+    const SACPZ *pz;
+    int i;
+
+    sprintf(buff, "%d %d %g/%g/%g/%g %g", run.nband, run.tensor, trig[0], trig[1], trig[2], trig[3], overlap);
+    h = job_hash( 0, buff, strlen(buff) );
+    h = job_hash( h, run.band, sizeof(float) * 4 * run.nband );
+    if ( run.qc ) {
+        sprintf(buff, "%g %g %g %g %g %g", run.qc->max_kurt, run.qc->max_amp, run.qc->max_zero_sec,
+            run.qc->min_eratio, run.qc->max_eratio, run.qc->alpha);
+        h = job_hash( h, buff, strlen(buff) );
+    }
+    for ( i = 0; resp != NULL && i < resp->npz; i ++ ) {
+        /* the poles and zeros themselves, the files may be edited in place */
+        pz = &resp->pz[i];
+        sprintf(buff, "%g %s %s %s %s %.6f %.6f %d %d %.10g", wl, pz->net, pz->sta, pz->loc, pz->chn,
+            pz->t0, pz->t1, pz->nzero, pz->npole, pz->constant);
+        h = job_hash( h, buff, strlen(buff) );
+        h = job_hash( h, pz->zero, sizeof(double) * 2 * pz->nzero );
+        h = job_hash( h, pz->pole, sizeof(double) * 2 * pz->npole );
+    }
+    return h;
+}
+
+/* estimated cost of the blocks of lines, for the plan of --shard: the FFTs of the cut windows */
+static double *block_cost( void ) {
+    double *cost;
+    long i;
+    int n;
+
+    cost = (double *) calloc( (nline + CORSTACK_BLOCK - 1) / CORSTACK_BLOCK + 1, sizeof(double) );
+    for ( i = 0; i < nline; i ++ ) {
+        if ( sscanf(lines[i], "%*s %*s %*d %*d %*d %*d %*d %*d %*f %d", &n) != 1 || n < 2 ) n = 2;
+        cost[i / CORSTACK_BLOCK] += n * log2(n);
+    }
+    return cost;
+}
 
-        cut_sac( sac2, saccut2, evt0, start0, cut_npts );
-        bp( saccut2, sacbp2, f1, f2, f3, f4, 10);
-        normal( sacbp2, sacnorm2, npts );
-        spe_whi ( sacnorm2, sacwhi2, 20, f1, f2, f3, f4 );
+/* threads of -j between the pairs and within a pair, block by block: the blocks with a window of FFT_HUGE
+   samples or more are put after the others, to take all threads in the transforms and loops over bins of
+   one pair at a time; return the blocks put last */
+static long split_threads( int nthread ) {
+    long b, i, n0, n1, *huge;
+    int n, big;
 
-        cor_in_freq( sacwhi1, sacwhi2, lag_time, cor_name );
-        count += 1;
+    huge = (long *) malloc( sizeof(long) * (nblock > 0 ? nblock : 1) );
+    for ( n0 = n1 = 0, b = 0; b < nblock; b ++ ) {
+        for ( big = 0, i = blocks[b] * CORSTACK_BLOCK; i < (blocks[b] + 1) * CORSTACK_BLOCK && i < nline; i ++ )
+            if ( sscanf(lines[i], "%*s %*s %*d %*d %*d %*d %*d %*d %*f %d", &n) == 1 && n >= FFT_HUGE ) big = 1;
+        if ( big ) huge[n1 ++] = blocks[b];
+        else blocks[n0 ++] = blocks[b];
+    }
+    memcpy( blocks + n0, huge, sizeof(long) * n1 );
+    free(huge);
+    if ( n0 > 0 && n1 > 0 && nthread > 1 )
+        fprintf(stderr, "%ld of %ld blocks have windows of %d samples or more: correlated after the others, "
+                        "one pair at a time on all %d threads\n", n1, nblock, FFT_HUGE, nthread);
+    return n1;
+}
+
+/* threads of each transform and loop over bins of 2^15 samples or more, from now on */
+static void fft_split( int nthread ) {
+    static int warned = 0;
+
+    if ( set_fft_threads( nthread, FFT_MIN_SPLIT ) == -1 && !warned ) {
+        fprintf(stderr, "Warning: built without FFTW_THREADS (make FFTW_THREADS=1), only the loops over "
+                        "bins of a pair use its %d threads\n", nthread);
+        warned = 1;
+    }
+}
+
+static int conv_cmp( const void *a, const void *b ) {
+    return strcmp( ((const CONVSTACK *)a)->name, ((const CONVSTACK *)b)->name );
+}
+
+/* rounds of --converge: the k-th line of a cor_name (in input order) in round k / conv_days; lines
+   without a cor_name in round 0, to be quarantined as usual */
+static void converge_plan( void ) {
+    char name[500];
+    long i, n;
+    int *seen;
+    CONVSTACK key, *c;
+
+    line_round = (int *) calloc( nline > 0 ? nline : 1, sizeof(int) );
+    line_conv = (long *) malloc( sizeof(long) * (nline > 0 ? nline : 1) );
+    conv = (CONVSTACK *) calloc( nline > 0 ? nline : 1, sizeof(CONVSTACK) );
+    for ( i = 0; i < nline; i ++ ) {
+        line_conv[i] = -1;
+        if ( sscanf(lines[i], "%*s %*s %*d %*d %*d %*d %*d %*d %*f %*d %*f %*f %*f %*f %*d %499s %*f", name) != 1 ||
+             strlen(name) >= CORSTACK_NAME_LEN ) continue;
+        strcpy( conv[nconv ++].name, name );
+    }
+    qsort( conv, nconv, sizeof(CONVSTACK), conv_cmp );
+    for ( n = 0, i = 0; i < nconv; i ++ )
+        if ( n == 0 || strcmp(conv[i].name, conv[n-1].name) != 0 ) conv[n ++] = conv[i];
+    nconv = n;
+
+    seen = (int *) calloc( nconv > 0 ? nconv : 1, sizeof(int) );
+    for ( i = 0; i < nline; i ++ ) {
+        if ( sscanf(lines[i], "%*s %*s %*d %*d %*d %*d %*d %*d %*f %*d %*f %*f %*f %*f %*d %499s %*f", key.name) != 1 ||
+             strlen(key.name) >= CORSTACK_NAME_LEN ) continue;
+        c = (CONVSTACK *) bsearch( &key, conv, nconv, sizeof(CONVSTACK), conv_cmp );
+        line_conv[i] = c - conv;
+        line_round[i] = seen[c - conv] ++ / conv_days;
+    }
+    free(seen);
+}
+
+/* checkpoint of a stack: its SNR and correlation coefficient against the previous checkpoint */
+static int conv_check( const char *name, int nday, SACHEAD hd, const float *ar ) {
+    CONVSTACK key, *c;
+
+    strcpy( key.name, name );
+    if ( (c = (CONVSTACK *) bsearch( &key, conv, nconv, sizeof(CONVSTACK), conv_cmp )) == NULL ||
+         nday == c->nday ) return 0;
+    c->snr = corstack_snr( ar, hd.npts );
+    c->cc = c->prev != NULL && c->npts == hd.npts ? corstack_cc( c->prev, ar, hd.npts ) : 0.;
+    if ( !c->done && c->prev != NULL && c->snr >= conv_snr && c->cc >= conv_cc ) c->done = 1;
+    if ( c->npts != hd.npts ) {
+        free(c->prev);
+        c->prev = (float *) malloc( sizeof(float) * hd.npts );
+        c->npts = hd.npts;
+    }
+    if ( c->prev != NULL ) memcpy( c->prev, ar, sizeof(float) * hd.npts );
+    c->nday = nday;
+    return 0;
+}
+
+/* checkpoint after round r: stacks that converged get no more days; return the lines of later rounds */
+static long converge_round( int r ) {
+    long i, left = 0;
+
+    if ( corstack_check( conv_check ) == -1 ) exit(1);
+    for ( i = 0; i < nline; i ++ ) {
+        if ( line_round[i] > r && line_conv[i] >= 0 && conv[line_conv[i]].done ) line_round[i] = -1;
+        if ( line_round[i] > r ) left ++;
+    }
+    cur_round = r + 1;
+    return left;
+}
+
+/* writer of the stacks of --converge: days stacked in user2, SNR in user3 and coefficient in user4 */
+static int converge_write( const char *name, SACHEAD hd, const float *ar ) {
+    CONVSTACK key, *c;
+
+    strcpy( key.name, name );
+    if ( (c = (CONVSTACK *) bsearch( &key, conv, nconv, sizeof(CONVSTACK), conv_cmp )) != NULL ) {
+        hd.user2 = c->nday;
+        hd.user3 = c->snr;
+        hd.user4 = c->cc;
+    }
+    return conv_out( name, hd, ar );
+}
+
+/* writer of --ftan: a row of the table per period, then the correlation written as it would be */
+static int ftan_write( const char *name, SACHEAD hd, const float *ar ) {
+    int p, n;
+
+    if ( (n = ftan_run( ar, &hd, &ftan_set, ftan_pick )) == -1 ) return -1;
+    for ( p = 0; p < n; p ++ )
+        fprintf(ftan_fp, "%s %.3f %.4f %.3f %.4f %.6g %.2f %.4f\n", name, hd.dist > 0. ? hd.dist : 0.,
+                ftan_pick[p].period, ftan_pick[p].time, ftan_pick[p].group, ftan_pick[p].amp,
+                ftan_pick[p].snr, ftan_pick[p].phase);
+    return ftan_out( name, hd, ar );
+}
+
+/* all lines of file.lst into lines */
+static void load_lines( FILE *ff ) {
+    char buff[500];
+
+    while ( fgets( buff, 500, ff ) ) {
+        if ( nline % 1024 == 0 ) lines = realloc( lines, sizeof(*lines) * (nline + 1024) );
+        strcpy( lines[nline ++], buff );
+    }
+}
+
+/* a line of --mem-limit that failed */
+static void spec_fail( long item, const char *why ) {
+    quarantine( item, lines[item], why );
+}
+
+/* the lines for --mem-limit, those with fewer than 17 fields quarantined; return their number */
+static long spec_lines( SPECLINE *sl ) {
+    int year, mon, day, hour, min, sec, nf;
+    long i, n = 0;
+    SPECLINE *l;
+
+    for ( i = 0; i < nline; i ++ ) {
+        l = &sl[n];
+        nf = sscanf(lines[i], "%s %s %d %d %d %d %d %d %f %d %f %f %f %f %d %s %f", l->sac1, l->sac2, &year, &mon,
+            &day, &hour, &min, &sec, &l->start0, &l->cut_npts, &l->band[0], &l->band[1], &l->band[2], &l->band[3],
+            &l->npts, l->cor_name, &l->lag_time );
+        if ( nf <= 0 ) continue;
+        if ( nf != 17 ) {
+            quarantine( i, lines[i], "line with fewer than 17 fields" );
+            continue;
+        }
+        l->item = i;
+        l->evt0 = abs_time( year, julian(year, mon, day), hour, min, sec, 0. );
+        n ++;
+    }
+    return n;
+}
+
+/* worker thread k of -j (0 the main thread): takes blocks of lines in turn, no lock held; a block with
+   no line left for later rounds is handed on to the tree of the stacks */
+static void *worker( void *arg ) {
+    long k = (long) arg, b, i, later;
+    char tag[32];
+
+    sprintf(tag, "%s.t%ld", run.tag, k);
+    while ( (b = __sync_fetch_and_add(&next_block, 1)) < end_block ) {
+        if ( block_flag[blocks[b]] & BLOCK_DONE ) continue;     /* from the cache of -d, or no line left */
+        for ( later = 0, i = blocks[b] * CORSTACK_BLOCK; i < (blocks[b] + 1) * CORSTACK_BLOCK && i < nline; i ++ ) {
+            if ( line_round != NULL && line_round[i] > cur_round ) later ++;
+            if ( line_round != NULL && line_round[i] != cur_round ) continue;
+            corstack_item(i);
+            run_line( lines[i], i, tag, k == 0 );
+        }
+        if ( later == 0 ) {
+            block_flag[blocks[b]] |= BLOCK_DONE;
+            if ( corstack_done( blocks[b], 0 ) == -1 ) exit(1);
+        }
+    }
+    if ( k > 0 ) pz_cache_free();
+    return NULL;
+}
+
+/* key of the node of the tree of the stacks over the 2^level blocks from block, for -d with -j */
+static unsigned long long node_key( long block, int level ) {
+    unsigned long long h;
+    long i;
+
+    h = job_hash( job_hash( 0, &block, sizeof(block) ), &level, sizeof(level) );
+    for ( i = block * CORSTACK_BLOCK; i < (block + (1L << level)) * CORSTACK_BLOCK && i < nline; i ++ )
+        h = job_hash( h, &line_keys[i], sizeof(line_keys[i]) );
+    return h;
+}
+
+/* checkpoint of -d with -j: a node summed in corstack_done is saved, unless it has a quarantined line, is
+   in the cache already, or is summed at once with its sibling into a parent which will be saved instead */
+static int keep_node( const CORRANGE *rg ) {
+    long b, n = 1L << rg->level, sib = rg->block ^ n, b0 = rg->block < sib ? rg->block : sib;
+    int fail = 0, done = 1;
+
+    for ( b = b0; b < b0 + 2 * n; b ++ ) {
+        if ( b >= nblock_all || !(block_flag[b] & BLOCK_DONE) ) done = 0;
+        else if ( block_flag[b] & BLOCK_FAIL ) {
+            if ( b >= rg->block && b < rg->block + n ) return 0;
+            fail = 1;
+        }
+    }
+    if ( done && !fail ) return 0;
+    if ( job_find( node_job, node_key( rg->block, rg->level ) ) ) return 0;
+    return job_keep( node_job, node_key( rg->block, rg->level ), rg );
+}
+
+/* -d with -j: the nodes of the run saved before, the largest first, put back into the stacks and marked
+   done, so that their blocks are not computed again */
+static void restore_nodes( long block, int level ) {
+    long b, n = 1L << level;
+
+    if ( block >= nblock_all ) return;
+    for ( b = block; b < block + n && b < nblock_all && (block_flag[b] & BLOCK_MINE); b ++ ) ;
+    if ( (b == block + n || b == nblock_all) &&
+         job_node( node_job, node_key( block, level ), corstack_put ) >= 0 ) {
+        for ( b = block; b < block + n && b < nblock_all; b ++ ) block_flag[b] |= BLOCK_DONE;
+        if ( corstack_done( block, level ) == -1 ) exit(1);
+        return;
+    }
+    if ( level > 0 ) {
+        restore_nodes( block, level - 1 );
+        restore_nodes( block + n / 2, level - 1 );
+    }
+}
+
+/* workers of -j over the blocks of the run, the calling thread as worker 0: the blocks of shorter windows
+   as many pairs at once as there are threads (fewer blocks than threads share the threads left over out
+   within their pairs), then the nblock_huge last ones one pair at a time on all threads; return the
+   threads of -j, fewer if some could not be started */
+static int run_workers( int nthread ) {
+    pthread_t *tid;
+    long nshort = nblock - nblock_huge;
+    int k, inter;
+
+    inter = nshort < nthread ? (int)(nshort > 0 ? nshort : 1) : nthread;
+    fft_split( nthread / inter );
+    next_block = 0;
+    end_block = nshort;
+    tid = (pthread_t *) malloc( sizeof(pthread_t) * inter );
+    for ( k = 1; k < inter; k ++ )
+        if ( pthread_create( &tid[k], NULL, worker, (void *)(long)k ) != 0 ) {
+            fprintf(stderr, "Warning: only %d of %d threads started\n", k, inter);
+            nthread = inter = k;
+        }
+    worker( (void *)0L );
+    for ( k = 1; k < inter; k ++ ) pthread_join( tid[k], NULL );
+    free(tid);
+
+    if ( nblock_huge > 0 ) {
+        fft_split( nthread );
+        next_block = nshort;
+        end_block = nblock;
+        worker( (void *)0L );
+    }
+    return nthread;
+}
+
+int main( int argc, char *argv[] ) {
+    char buff[500];
+    char tag[32], *ext;
+    int c, k, codec = COR_RAW, masked = 0, nthread = 0, ishard = 0, nshard = 0;
+    float trig[4] = { 0., 0., 0., 0. }, overlap = 0., wl = 0.001;
+    long item = 0, b, i;
+    double *cost;
+    unsigned long long list = 0;
+    char *pzlst = NULL, *job_dir = NULL, *report = "failed.lst";
+    int retries = 0, tune = 0, tuned = 0;
+    char profile[512];
+    ABCTUNE prof;
+    long long mem_limit = 0;
+    char *scratch = "abc_spec.tmp", *ftan_table = "ftan.txt";
+    SPECLINE *sl;
+    int (*out)( const char *name, SACHEAD hd, const float *ar );
+    FILE *ff;
+    CORPACK *pack = NULL;
+    SACRESP *resp = NULL;
+    ABCSHARD *shard = NULL;
+
+    run.period = 10.;
+    while ( (c = getopt_long(argc, argv, "i:b:co:z:q:s:g:r:w:m:t:j:d:a:e:", long_opts, NULL)) != -1 ) switch ( c ) {
+        case 'i':
+            if ( (run.idx = sac_index_load(optarg)) == NULL ) exit(1);
+            break;
+        case 'b':
+            if ( (run.nband = parse_bands(optarg, run.band)) <= 0 ) {
+                fprintf(stderr, "Bad band list (at most %d bands of f1/f2/f3/f4)\n", MAX_BANDS);
+                exit(1);
+            }
+            break;
+        case 'c':
+            run.tensor = 1;
+            break;
+        case 'o':
+            if ( (pack = corpack_open(optarg, "a")) == NULL ) exit(1);
+            corpack_use(pack);
+            break;
+        case 'z':
+            if ( (codec = corcodec_id(optarg)) == -1 ) {
+                fprintf(stderr, "Unknown codec %s (raw, lossless, int16 or f16)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'q':
+            if ( (run.qc = qc_open(optarg)) == NULL ) exit(1);
+            break;
+        case 's':
+            /* mask transients: STA and LTA lengths (s), trigger on and off ratios */
+            if ( sscanf(optarg, "%f/%f/%f/%f", &trig[0], &trig[1], &trig[2], &trig[3]) != 4 ||
+                 trig[0] <= 0. || trig[1] <= trig[0] || trig[2] <= trig[3] ) {
+                fprintf(stderr, "Bad STA/LTA setting %s (sta/lta/on/off, sta < lta, off < on)\n", optarg);
+                exit(1);
+            }
+            set_sta_lta( trig[0], trig[1], trig[2], trig[3] );
+            masked = 1;
+            break;
+        case 'g':
+            /* keep days with gaps: lags normalized by the samples valid on both traces */
+            overlap = atof(optarg);
+            if ( overlap <= 0. || overlap > 1. ) {
+                fprintf(stderr, "Bad overlap %s (fraction of a lag valid on both traces, 0 < f <= 1)\n", optarg);
+                exit(1);
+            }
+            set_gap_mask( overlap );
+            masked = 1;
+            break;
+        case 'r':
+            pzlst = optarg;
+            break;
+        case 'w':
+            wl = atof(optarg);
+            if ( wl <= 0. || wl >= 1. ) {
+                fprintf(stderr, "Bad water level %s (fraction of the largest response, 0 < wl < 1)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'm':
+            run.metrics = optarg;
+#ifndef ABC_STATS
+            fprintf(stderr, "Warning: built without ABC_STATS (make STATS=1), no metrics written\n");
+#endif
+            break;
+        case 't':
+            run.period = atof(optarg);
+            break;
+        case 'j':
+            /* threads correlating the lines, correlations of the same name stacked; auto from the profile */
+            nthread = strcmp(optarg, "auto") == 0 ? -1 : atoi(optarg);
+            if ( nthread == 0 || nthread < -1 || nthread > MAX_THREADS ) {
+                fprintf(stderr, "Bad number of threads %s (1 to %d, or auto)\n", optarg, MAX_THREADS);
+                exit(1);
+            }
+            break;
+        case 'd':
+            job_dir = optarg;
+            break;
+        case 'a':
+            /* passes over the quarantined lines, e.g. for files still being written */
+            retries = atoi(optarg);
+            break;
+        case 'e':
+            report = optarg;
+            break;
+        case OPT_SHARD:
+            /* process i of N of a shared-nothing run, merged by abc_merge */
+            if ( shard_parse(optarg, &ishard, &nshard) == -1 ) exit(1);
+            sprintf(run.tag, ".s%d", ishard);
+            break;
+        case OPT_MEM_LIMIT:
+            /* spectra of each station window once, held within the limit, the rest spilt to --scratch */
+            if ( (mem_limit = spec_size(optarg)) <= 0 ) {
+                fprintf(stderr, "Bad memory limit %s (bytes, or with K, M or G)\n", optarg);
+                exit(1);
+            }
+            break;
+        case OPT_SCRATCH:
+            scratch = optarg;
+            break;
+        case OPT_CONVERGE:
+            /* stacks of -j stop taking days once stable: SNR, coefficient against the checkpoint before */
+            if ( sscanf(optarg, "%f/%f/%d", &conv_snr, &conv_cc, &conv_days) < 2 || conv_snr <= 0. ||
+                 conv_cc <= -1. || conv_cc > 1. || conv_days < 1 ) {
+                fprintf(stderr, "Bad convergence %s (snr/cc[/days], snr > 0, -1 < cc <= 1, days >= 1)\n", optarg);
+                exit(1);
+            }
+            break;
+        case OPT_FTAN:
+            /* group velocity dispersion of the correlations, the last stage before they are written */
+            if ( ftan_parse(optarg, &ftan_set) == -1 ) exit(1);
+            ftan_pick = (FTANPICK *) malloc( sizeof(FTANPICK) * ftan_set.nper );
+            break;
+        case OPT_FTAN_OUT:
+            ftan_table = optarg;
+            break;
+        case OPT_TUNE:
+            /* profile of this host, for every later run */
+            tune = 1;
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(1);
+    }
+    if ( tune_path(profile, sizeof(profile)) == -1 ) profile[0] = '\0';
+    if ( tune ) {
+        /* kernels and threads measured on traces shaped like the first line of file.lst */
+        if ( argc - optind > 1 || profile[0] == '\0' ) {
+            fprintf(stderr, profile[0] ? USAGE : "No HOME or ABC_PROFILE for the profile\n");
+            exit(1);
+        }
+        if ( tune_run(argc > optind ? argv[optind] : NULL, &prof) == -1 || tune_save(profile, &prof) == -1 ) exit(1);
+        printf("Profile saved to %s\n", profile);
+        return 0;
+    }
+    if ( argc - optind != 1 ) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    if ( profile[0] && access(profile, F_OK) == 0 ) {
+        if ( tune_load(profile, &prof) == -1 ) exit(1);
+        if ( prof.cpus != (int)sysconf(_SC_NPROCESSORS_ONLN) )
+            fprintf(stderr, "Warning: profile %s is of %d CPUs, run abc_egf --tune again\n", profile, prof.cpus);
+        tune_use(&prof);
+        tuned = 1;
+    }
+    if ( nthread == -1 ) {
+        nthread = tuned ? prof.threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if ( nthread < 1 ) nthread = 1;
+        if ( nthread > MAX_THREADS ) nthread = MAX_THREADS;
+    }
+    if ( run.tensor && run.nband > 0 ) {
+        fprintf(stderr, "-c and -b cannot be used together\n");
+        exit(1);
+    }
+    if ( nshard > 0 && pack ) {
+        fprintf(stderr, "With --shard, -o and -z are given to abc_merge\n");
+        exit(1);
+    }
+    if ( mem_limit > 0 && (run.nband > 0 || run.tensor || overlap > 0. || run.qc || nthread > 0 ||
+                           job_dir || nshard > 0) ) {
+        fprintf(stderr, "--mem-limit is for the chain of one band, not with -b, -c, -g, -q, -j, -d or --shard\n");
+        exit(1);
+    }
+    if ( conv_snr > 0. && (nthread == 0 || run.nband > 0 || run.tensor || job_dir || nshard > 0) ) {
+        fprintf(stderr, "--converge is for the stacks of -j of one band, not with -b, -c, -d or --shard\n");
+        exit(1);
+    }
+    if ( ftan_pick != NULL && nshard > 0 ) {
+        fprintf(stderr, "With --shard, the stacks are only whole in abc_merge: --ftan is not for shards\n");
+        exit(1);
+    }
+    if ( run.tensor && masked )
+        fprintf(stderr, "Warning: -s and -g are not applied to the components of -c\n");
+    if ( pack ) corpack_codec(pack, codec);
+    if ( pzlst ) {
+        /* instrument response removed in the band-pass pass */
+        if ( (resp = pz_open(pzlst, wl)) == NULL ) exit(1);
+        pz_use(resp);
+        set_bp_response(pz_response);
+    }
+
+    /* correlations go to files, the pack or the shard, through the stacks of -j or the cache of -d */
+    out = nshard > 0 ? shard_write : pack ? corpack_write : write_sac;
+    if ( ftan_pick != NULL ) {
+        if ( (ftan_fp = fopen( ftan_table, "w" )) == NULL ) {
+            fprintf(stderr, "Unable to write %s\n", ftan_table);
+            exit(1);
+        }
+        fprintf(ftan_fp, "# cor_name dist(km) period(s) time(s) group(km/s) amp snr phase(rad)\n");
+        ftan_out = out;
+        out = ftan_write;
+    }
+    if ( job_dir && nthread > 0 ) {
+        /* nodes of the stacks done by earlier runs with the same data and settings are taken from the cache */
+        if ( (node_job = job_open(job_dir)) == NULL ) exit(1);
+        run.param = param_key( trig, overlap, wl, resp );
+        corstack_keep( keep_node );
+        set_cor_writer( corstack_add );
+    }
+    else if ( job_dir ) {
+        /* lines done by earlier runs with the same data and settings are taken from the cache */
+        if ( (run.job = job_open(job_dir)) == NULL ) exit(1);
+        run.param = param_key( trig, overlap, wl, resp );
+        job_use( run.job, out );
+        set_cor_writer(job_write);
+    }
+    else set_cor_writer( nthread > 0 ? corstack_add : out );
+
+    if ( (ff = fopen( argv[optind], "r" )) == NULL ) {
+        fprintf(stderr, "Unable to open %s\n", argv[optind]);
+        exit(1);
+    }
+    if ( mem_limit > 0 ) {
+        /* all lines first, then window by window from the spectra of the stations */
+        load_lines( ff );
+        sl = (SPECLINE *) malloc( sizeof(SPECLINE) * (nline > 0 ? nline : 1) );
+        if ( spec_run( sl, spec_lines( sl ), mem_limit, scratch, run.idx, spec_fail ) == -1 ) exit(1);
+        free(sl);
+        free(lines);
+        item = nline;
+    }
+    else if ( nthread == 0 && nshard == 0 ) {
+        if ( run.qc ) {
+            /* the windows screened first, then the lines in input order */
+            load_lines( ff );
+            qc_plan();
+            for ( i = 0; i < nline; i ++ ) run_line( lines[i], i, "", 1 );
+            free(lines);
+            item = nline;
+        }
+        else while ( fgets( buff, 500, ff ) ) run_line( buff, item ++, "", 1 );
+    }
+    else {
+        /* all lines first, then the blocks of the run, or of the shard, correlated in turn */
+        load_lines( ff );
+        if ( run.qc ) qc_plan();      /* all lines of the list, for the same baselines in every shard */
+        b = (nline + CORSTACK_BLOCK - 1) / CORSTACK_BLOCK;
+        blocks = (long *) malloc( sizeof(long) * (b > 0 ? b : 1) );
+        if ( nshard > 0 ) {
+            cost = block_cost();
+            if ( (nblock = shard_plan( cost, b, ishard, nshard, blocks )) == -1 ) exit(1);
+            free(cost);
+            if ( b < nshard )
+                fprintf(stderr, "Warning: %ld lines make %ld blocks of up to %d lines, shards %ld to %d get none\n",
+                        nline, b, CORSTACK_BLOCK, b, nshard - 1);
+            for ( i = 0; i < nline; i ++ ) list = job_hash( list, lines[i], strlen(lines[i]) );
+            if ( (shard = shard_open( ishard, nshard, nline, list )) == NULL ) exit(1);
+        }
+        else for ( nblock = 0; nblock < b; nblock ++ ) blocks[nblock] = nblock;
+        nblock_all = b;
+        block_flag = (char *) calloc( b > 0 ? b : 1, 1 );
+        for ( i = 0; i < nblock; i ++ ) block_flag[blocks[i]] |= BLOCK_MINE;
+
+        if ( nthread == 0 ) {
+            /* a shard in one thread: its lines in input order, each correlation saved as it comes */
+            for ( b = 0; b < nblock; b ++ )
+                for ( i = blocks[b] * CORSTACK_BLOCK; i < (blocks[b] + 1) * CORSTACK_BLOCK && i < nline; i ++ ) {
+                    shard_item(i);
+                    run_line( lines[i], i, run.tag, 1 );
+                }
+        }
+        else {
+            /* correlated and stacked by name in the threads, from the nodes cached by -d on */
+            if ( node_job ) {
+                line_keys = (unsigned long long *) malloc( sizeof(*line_keys) * (nline > 0 ? nline : 1) );
+                for ( i = 0; i < nline; i ++ ) line_keys[i] = line_key( lines[i], i );
+                for ( k = 0; (1L << k) < nblock_all; k ++ ) ;
+                restore_nodes( 0, k );
+            }
+            if ( !tuned ) sac_swap4_use(SAC_SWAP_BEST);
+            nblock_huge = split_threads( nthread );
+            if ( conv_snr > 0. ) {
+                /* round by round, up to conv_days more days of the stacks not converged */
+                converge_plan();
+                for ( k = 0; ; k ++ ) {
+                    nthread = run_workers( nthread );
+                    if ( converge_round( k ) == 0 ) break;
+                }
+            }
+            else nthread = run_workers( nthread );
+        }
+        free(blocks);
+        free(block_flag);
+        block_flag = NULL;
+        free(line_keys);
+        free(lines);
+        item = nline;
     }
     fclose(ff);
-    system("mkdir COR"); system("mv COR*.SAC COR/"); system("rm *.cut *.bp *.norm *.whi");
+
+    /* failing lines are set aside: retried if asked, stacked after all others, then reported */
+    sprintf(tag, "%s%s", run.tag, nthread > 0 ? ".t0" : "");
+    for ( k = 1; k <= retries && nfail > 0; k ++ )
+        retry_failed( k * ((item + CORSTACK_BLOCK - 1) / CORSTACK_BLOCK) * CORSTACK_BLOCK, tag );
+    if ( shard ) {
+        /* a shard saves its partial stacks as they are, abc_merge reduces those of all shards */
+        if ( nthread > 0 && corstack_parts( shard_part ) == -1 )
+            fprintf(stderr, "Some partial stacks could not be written\n");
+        sprintf(buff, "%s/failed.lst", shard->dir);
+        if ( nfail > 0 ) report_failed( buff, item );
+        shard_close(shard);
+    }
+    else {
+        if ( conv_snr > 0. ) {
+            /* the last checkpoint, with the retried days, goes into the headers */
+            conv_out = out;
+            out = converge_write;
+            converge_round( cur_round );
+            for ( i = 0, b = 0; i < nconv; i ++ ) b += conv[i].done;
+            fprintf(stderr, "Converged: %ld of %ld stacks\n", b, nconv);
+        }
+        if ( nthread > 0 && corstack_flush( out ) == -1 )
+            fprintf(stderr, "Some stacks could not be written\n");
+        if ( nfail > 0 ) report_failed( report, item );
+    }
+    sac_index_free(run.idx);
+    qc_close(run.qc);
+    free(qc_bad);
+    pz_close(resp);
+    job_close(run.job);
+    job_close(node_job);
+    if ( run.metrics ) abc_stat_dump( run.metrics );
+    if ( ftan_fp != NULL ) fclose(ftan_fp);
+    abc_stat_summary();
+    if ( nshard > 0 ) {
+        /* results are in the shard, only its own intermediate files to clean, other shards may be running */
+        strcpy(buff, "rm -f");
+        for ( k = 0; k < 4; k ++ ) {
+            ext = k == 0 ? "cut" : k == 1 ? "bp" : k == 2 ? "norm" : "whi";
+            sprintf(buff + strlen(buff), " *%s.%s *%s.t*.%s", run.tag, ext, run.tag, ext);
+            sprintf(buff + strlen(buff), " *%s.%s.mask *%s.t*.%s.mask", run.tag, ext, run.tag, ext);
+        }
+        system(buff);
+        return 0;
+    }
+    if ( pack ) {
+        /* correlations are all in the pack, only intermediate files to clean */
+        corpack_close(pack);
+        system("rm -f *.cut *.bp *.norm *.whi *.mask");
+        return 0;
+    }
+    system("mkdir COR"); system("mv COR*.SAC COR/"); system("rm -f *.cut *.bp *.norm *.whi *.mask");
     system("mv COR ../");
 
     return 0;
@@ -0,0 +1,218 @@
+/*************************************************/
+/*FileName: abc_merge.c                          */
+/*Merge the shards of abc_egf --shard i/N        */
+/*************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "sacio.h"
+#include "corpack.h"
+#include "corstack.h"
+#include "abcshard.h"
+
+#define USAGE "Usage: abc_merge [-o cor.pack [-z codec] | -D cor_dir] [-e failed.lst] shard-0-of-N ...\n"
+
+/* directory of the SAC files written */
+static const char *cor_dir = "../COR";
+
+/* correlation of a shard, with the order it came in */
+typedef struct merge_cor {
+    const SHARDENT *ent;
+    long    seq;
+} MERGECOR;
+
+/* partial stack of a shard, with its shard and order */
+typedef struct merge_part {
+    const SHARDENT *ent;
+    int     shard;
+    long    seq;
+} MERGEPART;
+
+/* quarantined line of a shard report */
+typedef struct merge_fail {
+    long    item;
+    char    line[700];
+} MERGEFAIL;
+
+/* write_sac into cor_dir */
+static int dir_write( const char *name, SACHEAD hd, const float *ar ) {
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/%s", cor_dir, name);
+    return write_sac( path, hd, ar );
+}
+
+/* correlations in input line order, those of a line in the order they were written */
+static int cor_cmp( const void *a, const void *b ) {
+    const MERGECOR *c1 = (const MERGECOR *)a, *c2 = (const MERGECOR *)b;
+
+    if ( c1->ent->item != c2->ent->item ) return c1->ent->item < c2->ent->item ? -1 : 1;
+    return c1->seq < c2->seq ? -1 : c1->seq > c2->seq;
+}
+
+/* partial stacks in block order, those of one block in the order of the shards given */
+static int part_cmp( const void *a, const void *b ) {
+    const MERGEPART *p1 = (const MERGEPART *)a, *p2 = (const MERGEPART *)b;
+
+    if ( p1->ent->item != p2->ent->item ) return p1->ent->item < p2->ent->item ? -1 : 1;
+    if ( p1->shard != p2->shard ) return p1->shard < p2->shard ? -1 : 1;
+    return p1->seq < p2->seq ? -1 : p1->seq > p2->seq;
+}
+
+static int fail_cmp( const void *a, const void *b ) {
+    long i1 = ((const MERGEFAIL *)a)->item, i2 = ((const MERGEFAIL *)b)->item;
+    return i1 < i2 ? -1 : i1 > i2;
+}
+
+int main( int argc, char *argv[] ) {
+    int c, k, nshard, codec = COR_RAW, status = 0;
+    long i, j, ncor = 0, nent = 0, npart = 0, nfail = 0, maxfail = 0, nblock, next;
+    char *report = "failed.lst", line[700], *p;
+    int (*out)( const char *name, SACHEAD hd, const float *ar ) = dir_write;
+    ABCSHARD **sh;
+    MERGECOR *cor;
+    MERGEPART *part;
+    MERGEFAIL *fl = NULL;
+    CORPACK *pack = NULL;
+    SACHEAD hd;
+    float *ar;
+    FILE *fp;
+
+    while ( (c = getopt(argc, argv, "o:z:D:e:")) != -1 ) switch ( c ) {
+        case 'o':
+            if ( (pack = corpack_open(optarg, "a")) == NULL ) exit(1);
+            corpack_use(pack);
+            out = corpack_write;
+            break;
+        case 'z':
+            if ( (codec = corcodec_id(optarg)) == -1 ) {
+                fprintf(stderr, "Unknown codec %s (raw, lossless, int16 or f16)\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'D':
+            cor_dir = optarg;
+            break;
+        case 'e':
+            report = optarg;
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(1);
+    }
+    if ( argc - optind < 1 ) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    if ( pack ) corpack_codec(pack, codec);
+    else if ( mkdir(cor_dir, 0755) == -1 && errno != EEXIST ) {
+        fprintf(stderr, "Unable to create %s\n", cor_dir);
+        exit(1);
+    }
+
+    /* all shards of one run, each once, and all of them done */
+    nshard = argc - optind;
+    sh = (ABCSHARD **) calloc( nshard, sizeof(ABCSHARD *) );
+    for ( k = 0; k < nshard; k ++ ) {
+        if ( (sh[k] = shard_read(argv[optind + k])) == NULL ) exit(1);
+        if ( sh[k]->nline != sh[0]->nline || sh[k]->list != sh[0]->list ) {
+            fprintf(stderr, "%s and %s are shards of different lists\n", argv[optind], argv[optind + k]);
+            exit(1);
+        }
+        if ( sh[k]->nshard != nshard ) {
+            fprintf(stderr, "%s is shard %d of %d, %d shards given\n", argv[optind + k], sh[k]->ishard,
+                sh[k]->nshard, nshard);
+            exit(1);
+        }
+        for ( c = 0; c < k; c ++ ) if ( sh[c]->ishard == sh[k]->ishard ) {
+            fprintf(stderr, "%s and %s are both shard %d\n", argv[optind + c], argv[optind + k], sh[k]->ishard);
+            exit(1);
+        }
+        nent += sh[k]->nent;
+    }
+
+    /* correlations in input line order, as a single run writes them */
+    cor = (MERGECOR *) malloc( sizeof(MERGECOR) * (nent > 0 ? nent : 1) );
+    for ( ncor = 0, k = 0; k < nshard; k ++ )
+        for ( i = 0; i < sh[k]->nent; i ++ )
+            if ( sh[k]->ent[i].kind == 'c' ) {
+                cor[ncor].ent = &sh[k]->ent[i];
+                cor[ncor].seq = ncor;
+                ncor ++;
+            }
+    qsort( cor, ncor, sizeof(MERGECOR), cor_cmp );
+    for ( i = 0; i < ncor; i ++ ) {
+        if ( (ar = read_sac(cor[i].ent->file, &hd)) == NULL || out(cor[i].ent->name, hd, ar) == -1 ) status = 1;
+        free(ar);
+    }
+    free(cor);
+
+    /* partial stacks of all shards in block order, each range done as soon as read, so that the tree of a
+       single run is summed as it goes; blocks of no shard are done empty, those of the retries (from
+       nblock on) are left to corstack_flush */
+    part = (MERGEPART *) malloc( sizeof(MERGEPART) * (nent > 0 ? nent : 1) );
+    for ( npart = 0, k = 0; k < nshard; k ++ )
+        for ( i = 0; i < sh[k]->nent; i ++ )
+            if ( sh[k]->ent[i].kind == 's' ) {
+                part[npart].ent = &sh[k]->ent[i];
+                part[npart].shard = k;
+                part[npart].seq = i;
+                npart ++;
+            }
+    qsort( part, npart, sizeof(MERGEPART), part_cmp );
+    nblock = (sh[0]->nline + CORSTACK_BLOCK - 1) / CORSTACK_BLOCK;
+    for ( next = 0, i = 0; i < npart; i = j ) {
+        for ( j = i; j < npart && part[j].ent->item == part[i].ent->item && part[j].shard == part[i].shard; j ++ ) {
+            if ( (ar = read_sac(part[j].ent->file, &hd)) == NULL ||
+                 corstack_put(part[j].ent->name, part[j].ent->item, part[j].ent->level, part[j].ent->nday, hd,
+                              ar) == -1 ) status = 1;
+            free(ar);
+        }
+        if ( part[i].ent->item >= nblock ) continue;
+        for ( ; next < part[i].ent->item; next ++ ) if ( corstack_done( next, 0 ) == -1 ) exit(1);
+        if ( corstack_done( part[i].ent->item, part[i].ent->level ) == -1 ) exit(1);
+        next = part[i].ent->item + (1L << part[i].ent->level);
+    }
+    for ( ; next < nblock; next ++ ) if ( corstack_done( next, 0 ) == -1 ) exit(1);
+    free(part);
+    if ( npart > 0 && (k = corstack_flush( out )) == -1 ) status = 1;
+    fprintf(stderr, "Merged %d shards: %ld correlations, %ld partial stacks into %d stacks\n",
+        nshard, ncor, npart, npart > 0 ? k : 0);
+
+    /* failure reports of the shards, in input line order */
+    for ( k = 0; k < nshard; k ++ ) {
+        sprintf(line, "%s/failed.lst", sh[k]->dir);
+        if ( (fp = fopen(line, "r")) == NULL ) continue;
+        while ( fgets(line, sizeof(line), fp) ) {
+            if ( nfail == maxfail ) {
+                maxfail = maxfail ? 2 * maxfail : 64;
+                fl = (MERGEFAIL *) realloc( fl, sizeof(MERGEFAIL) * maxfail );
+            }
+            fl[nfail].item = (p = strstr(line, "# line ")) != NULL ? atol(p + 7) : 0;
+            strcpy(fl[nfail ++].line, line);
+        }
+        fclose(fp);
+    }
+    if ( nfail > 0 ) {
+        qsort( fl, nfail, sizeof(MERGEFAIL), fail_cmp );
+        if ( (fp = fopen(report, "w")) == NULL ) {
+            fprintf(stderr, "Unable to write failure report %s\n", report);
+            status = 1;
+        }
+        else {
+            for ( i = 0; i < nfail; i ++ ) fputs(fl[i].line, fp);
+            fclose(fp);
+            fprintf(stderr, "Failed: %ld of %ld lines, listed in %s\n", nfail, sh[0]->nline, report);
+        }
+    }
+    free(fl);
+
+    for ( k = 0; k < nshard; k ++ ) shard_free(sh[k]);
+    free(sh);
+    if ( pack ) corpack_close(pack);
+    return status;
+}
@@ -0,0 +1,82 @@
+/*************************************************/
+/*FileName: abc_pairs.c                          */
+/*Write file.lst of abc_egf from station coords  */
+/*************************************************/
+
+/*
+ * Every station pair within the distance and azimuth range is written as
+ * one line of file.lst for abc_egf:
+ *
+ *   sta1 sta2 <-p parameters> COR_<kstnm1>_<kstnm2>.SAC lag_time
+ *
+ * in an order that keeps the pairs of a station together.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sacpair.h"
+
+#define USAGE "Usage: abc_pairs [-k] [-d dmin/dmax] [-w nwave/vel/tmax] [-a az1/az2]\n" \
+              "                 -p \"year mon day hour min sec start0 cut_npts f1 f2 f3 f4 npts\" -l lag_time sta.lst\n"
+
+int main( int argc, char *argv[] ) {
+    int c, k, nsta, npair, use_kstnm = 0;
+    double dmin = 0., dmax = 0., az1 = -1., az2 = 360., nwave = 0., vel = 0., tmax = 0.;
+    float lag_time = -1.;
+    char *par = NULL;
+    SACSTA *sta;
+    SACPAIR *pair;
+
+    while ( (c = getopt(argc, argv, "kd:w:a:p:l:")) != -1 ) switch ( c ) {
+        case 'k':
+            use_kstnm = 1;
+            break;
+        case 'd':
+            if ( sscanf(optarg, "%lf/%lf", &dmin, &dmax) != 2 ) {
+                fprintf(stderr, "Bad distance range %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'w':
+            if ( sscanf(optarg, "%lf/%lf/%lf", &nwave, &vel, &tmax) != 3 ) {
+                fprintf(stderr, "Bad wavelength limit %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'a':
+            if ( sscanf(optarg, "%lf/%lf", &az1, &az2) != 2 || az1 < 0. || az2 < 0. ) {
+                fprintf(stderr, "Bad azimuth range %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            par = optarg;
+            break;
+        case 'l':
+            lag_time = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(1);
+    }
+    if ( argc - optind != 1 || par == NULL || lag_time <= 0. ) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    /* at least nwave wavelengths of the longest period, whatever the order of -d and -w */
+    if ( nwave * vel * tmax > dmin ) dmin = nwave * vel * tmax;
+
+    if ( (sta = sac_sta_load(argv[optind], use_kstnm, &nsta)) == NULL ) exit(1);
+    if ( (npair = sac_pairs(sta, nsta, dmin, dmax, az1, az2, &pair)) == -1 ) exit(1);
+
+    for ( k = 0; k < npair; k ++ )
+        printf("%s %s %s COR_%s_%s.SAC %g\n", sta[pair[k].i].name, sta[pair[k].j].name, par,
+               sta[pair[k].i].sta, sta[pair[k].j].sta, lag_time);
+    fprintf(stderr, "%d of %d pairs of %d stations selected\n", npair,
+            nsta * (nsta - 1) / 2, nsta);
+
+    free(sta); free(pair);
+    return 0;
+}
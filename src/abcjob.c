@@ -0,0 +1,514 @@
+/*******************************************************************************
+ *                                  abcjob.c                                   *
+ *  Journal and result cache of the work units of a run, see abcjob.h:         *
+ *      job_open         open a job directory and read its journal             *
+ *      job_close        close it                                              *
+ *      job_hash         FNV-1a hash of a buffer, chained                      *
+ *      job_file         hash of the path, size and time of a file, chained    *
+ *      job_find         whether a unit is done                                *
+ *      job_replay       hand on the cached correlations of a line done before *
+ *      job_begin        start a line in the calling thread                    *
+ *      job_end          cache and journal the line of the calling thread      *
+ *      job_use          job and writer of job_write                           *
+ *      job_write        cor_writer keeping each correlation of the line       *
+ *      job_node         put back the partial stacks of a node done before     *
+ *      job_keep         cache and journal the partial stacks of a node        *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "abcjob.h"
+#include "abcstat.h"
+
+#define JOB_HASH_INIT   14695981039346656037ULL
+#define JOB_LINE_LEN    256
+
+/* job of job_write and the writer its correlations are handed on to */
+static ABCJOB *cur_job = NULL;
+static int (*next_writer)(const char *name, SACHEAD hd, const float *ar) = write_sac;
+
+/* line of the calling thread and copies of its correlations so far */
+static __thread unsigned long long unit_key;
+static __thread int unit_nout = 0, unit_bad = 0;
+static __thread char unit_name[JOB_MAX_OUT][JOB_NAME_LEN];
+static __thread SACHEAD unit_hd[JOB_MAX_OUT];
+static __thread float *unit_data[JOB_MAX_OUT];
+
+/* function prototype for local use */
+static const ABCDONE *find_done (const ABCJOB *job, unsigned long long key);
+static int   done_cmp    (const void *a, const void *b);
+static int   add_done    (ABCJOB *job, unsigned long long key, const char *line);
+static long  load_unit   (const ABCJOB *job, const ABCDONE *pd, JOBREC **rec, SACHEAD **hd, float ***data);
+static void  free_unit   (long n, JOBREC *rec, SACHEAD *hd, float **data);
+static int   put_rec     (ABCJOB *job, long long *off, const char *name, long long block, int level,
+                          int nday, const SACHEAD *hd, const float *ar);
+static int   put_journal (ABCJOB *job, unsigned long long key, long nrec, long long off);
+static void  unit_clear  (void);
+static int   cache_io    (int fd, void *buf, size_t n, long long off, int wr);
+
+/*
+ *  job_open
+ *
+ *  Description: Open the job directory dir, created if needed, and read
+ *      the units its journal records as done.
+ *
+ *  Return: pointer to the job, NULL if failed.
+ *
+ */
+ABCJOB *job_open(const char *dir)
+{
+    ABCJOB *job;
+    FILE   *fp;
+    char   name[JOB_DIR_LEN + 16], line[JOB_LINE_LEN];
+    unsigned long long key;
+    int    n;
+
+    if (strlen(dir) >= JOB_DIR_LEN) {
+        fprintf(stderr, "Job directory name too long: %s\n", dir);
+        return NULL;
+    }
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create job directory %s\n", dir);
+        return NULL;
+    }
+    job = (ABCJOB *)calloc(1, sizeof(ABCJOB));
+    strcpy(job->dir, dir);
+    job->cache = -1;
+    pthread_mutex_init(&job->lock, NULL);
+
+    sprintf(name, "%s/cache", dir);
+    if ((job->cache = open(name, O_RDWR | O_CREAT, 0644)) == -1 ||
+        (job->end = (long long)lseek(job->cache, 0, SEEK_END)) == -1) {
+        fprintf(stderr, "Unable to open %s\n", name);
+        job_close(job);
+        return NULL;
+    }
+
+    sprintf(name, "%s/journal", dir);
+    if ((fp = fopen(name, "r")) != NULL) {
+        while (fgets(line, JOB_LINE_LEN, fp)) {
+            /* a unit cut short by the end of a run has no newline */
+            if (strchr(line, '\n') == NULL) continue;
+            if (sscanf(line, "%llx%n", &key, &n) != 1) continue;
+            if (add_done(job, key, line + n) == -1) {
+                fclose(fp);
+                job_close(job);
+                return NULL;
+            }
+        }
+        fclose(fp);
+        qsort(job->done, job->ndone, sizeof(ABCDONE), done_cmp);
+    }
+    if ((job->journal = fopen(name, "a")) == NULL) {
+        fprintf(stderr, "Unable to open %s for appending\n", name);
+        job_close(job);
+        return NULL;
+    }
+    return job;
+}
+
+/*
+ *  job_close
+ *
+ *  Description: close a job, and stop job_write caching into it
+ *
+ */
+void job_close(ABCJOB *job)
+{
+    if (job == NULL) return;
+    if (cur_job == job) cur_job = NULL;
+    if (job->journal != NULL) {
+        if (job->nnode > 0 || job->nkeep > 0)
+            fprintf(stderr, "Job: %ld nodes of the stacks from the cache of %s, %ld saved\n",
+                    job->nnode, job->dir, job->nkeep);
+        else
+            fprintf(stderr, "Job: %ld units from the cache of %s, %ld computed\n",
+                    job->nreplay, job->dir, job->nrun);
+        fclose(job->journal);
+    }
+    if (job->cache >= 0) close(job->cache);
+    pthread_mutex_destroy(&job->lock);
+    free(job->done);
+    free(job);
+}
+
+/*
+ *  job_hash
+ *
+ *  Description: FNV-1a hash of n bytes, continuing from h (0 to start)
+ *
+ */
+unsigned long long job_hash(unsigned long long h, const void *buf, size_t n)
+{
+    const unsigned char *p = (const unsigned char *)buf;
+
+    if (h == 0) h = JOB_HASH_INIT;
+    while (n --) h = (h ^ *p++) * 1099511628211ULL;
+    return h;
+}
+
+/*
+ *  job_file
+ *
+ *  Description: job_hash of the path, size and modification time of a
+ *      file, continuing from h. A missing file hashes as such, so the
+ *      unit is computed again once the file is there.
+ *
+ */
+unsigned long long job_file(unsigned long long h, const char *file)
+{
+    struct stat st;
+    long long   v[3];
+
+    h = job_hash(h, file, strlen(file) + 1);
+    if (stat(file, &st) == -1) return job_hash(h, "-", 1);
+    v[0] = (long long)st.st_size;
+    v[1] = (long long)st.st_mtim.tv_sec;
+    v[2] = (long long)st.st_mtim.tv_nsec;
+    return job_hash(h, v, sizeof(v));
+}
+
+/*
+ *  job_find
+ *
+ *  Description: whether the journal read by job_open has the unit of key
+ *
+ *  Return: 1 if done, 0 if not.
+ *
+ */
+int job_find(const ABCJOB *job, unsigned long long key)
+{
+    return find_done(job, key) != NULL;
+}
+
+/*
+ *  job_replay
+ *
+ *  Description: If the line of key is done, read its correlations from
+ *      the cache and hand them on to the writer of job_use, all or none.
+ *
+ *  Return: number of correlations, -1 if the line is to be computed.
+ *
+ */
+int job_replay(ABCJOB *job, unsigned long long key)
+{
+    const ABCDONE *pd;
+    JOBREC  *rec;
+    SACHEAD *hd;
+    float   **data;
+    long    i, n;
+
+    if ((pd = find_done(job, key)) == NULL || pd->nrec > JOB_MAX_OUT) return -1;
+    if ((n = load_unit(job, pd, &rec, &hd, &data)) == -1) return -1;
+    for (i = 0; i < n; i ++) next_writer(rec[i].name, hd[i], data[i]);
+    free_unit(n, rec, hd, data);
+    pthread_mutex_lock(&job->lock);
+    job->nreplay ++;
+    pthread_mutex_unlock(&job->lock);
+    return (int)n;
+}
+
+/*
+ *  job_begin
+ *
+ *  Description: start the line of key in the calling thread, its
+ *      correlations are then kept by job_write
+ *
+ */
+void job_begin(unsigned long long key)
+{
+    unit_clear();
+    unit_key = key;
+}
+
+/*
+ *  job_end
+ *
+ *  Description: Append the correlations of the line of the calling thread
+ *      to the cache and the line to the journal, unless one of them could
+ *      not be kept.
+ *
+ *  Return: 0 if journaled, -1 if not.
+ *
+ */
+int job_end(ABCJOB *job)
+{
+    long long off;
+    int       i, err = unit_bad;
+
+    pthread_mutex_lock(&job->lock);
+    for (i = 0, off = job->end; !err && i < unit_nout; i ++)
+        err = put_rec(job, &off, unit_name[i], 0, 0, 1, &unit_hd[i], unit_data[i]);
+    if (!err) err = put_journal(job, unit_key, unit_nout, off);
+    if (!err) job->nrun ++;
+    pthread_mutex_unlock(&job->lock);
+    unit_clear();
+    return err ? -1 : 0;
+}
+
+/*
+ *  job_use
+ *
+ *  Description: cache the correlations written through job_write in job,
+ *      and hand them on to writer (write_sac if NULL)
+ *
+ */
+void job_use(ABCJOB *job, int (*writer)(const char *name, SACHEAD hd, const float *ar))
+{
+    cur_job = job;
+    next_writer = writer == NULL ? write_sac : writer;
+}
+
+/*
+ *  job_write
+ *
+ *  Description: write_sac compatible output, given to set_cor_writer:
+ *      correlation of the current line of the thread, kept for job_end
+ *      and handed on to the writer of job_use.
+ *
+ */
+int job_write(const char *name, SACHEAD hd, const float *ar)
+{
+    if (cur_job == NULL) return next_writer(name, hd, ar);
+    if (unit_nout == JOB_MAX_OUT || strlen(name) >= JOB_NAME_LEN ||
+        (unit_data[unit_nout] = (float *)malloc(sizeof(float) * hd.npts)) == NULL) {
+        fprintf(stderr, "Warning: %s not cached, its line will be computed again\n", name);
+        unit_bad = 1;
+    }
+    else {
+        memcpy(unit_data[unit_nout], ar, sizeof(float) * hd.npts);
+        unit_hd[unit_nout] = hd;
+        strcpy(unit_name[unit_nout++], name);
+    }
+    return next_writer(name, hd, ar);
+}
+
+/*
+ *  job_node
+ *
+ *  Description: If the node of key is done, read its partial stacks from
+ *      the cache and hand them on to put (corstack_put), all or none.
+ *
+ *  Return: number of partial stacks, -1 if the node is to be computed.
+ *
+ */
+long job_node(ABCJOB *job, unsigned long long key,
+              int (*put)(const char *name, long block, int level, int nday, SACHEAD hd, const float *ar))
+{
+    const ABCDONE *pd;
+    JOBREC  *rec;
+    SACHEAD *hd;
+    float   **data;
+    long    i, n;
+
+    if ((pd = find_done(job, key)) == NULL) return -1;
+    if ((n = load_unit(job, pd, &rec, &hd, &data)) == -1) return -1;
+    for (i = 0; i < n; i ++)
+        if (put(rec[i].name, (long)rec[i].block, rec[i].level, rec[i].nday, hd[i], data[i]) == -1)
+            fprintf(stderr, "Warning: cached partial stack of %s not put back\n", rec[i].name);
+    free_unit(n, rec, hd, data);
+    pthread_mutex_lock(&job->lock);
+    job->nnode ++;
+    pthread_mutex_unlock(&job->lock);
+    return n;
+}
+
+/*
+ *  job_keep
+ *
+ *  Description: Append the partial stacks of the node rg of the tree of
+ *      the stacks to the cache and the node, under key, to the journal.
+ *
+ *  Return: 0 if journaled, -1 if not.
+ *
+ */
+int job_keep(ABCJOB *job, unsigned long long key, const CORRANGE *rg)
+{
+    const CORPART *pt;
+    long long     off;
+    long          i;
+    int           err = 0;
+
+    pthread_mutex_lock(&job->lock);
+    for (i = 0, off = job->end; !err && i < rg->npart; i ++) {
+        pt = rg->part[i];
+        err = put_rec(job, &off, pt->name, pt->block, pt->level, pt->nday, &pt->hd, pt->sum);
+    }
+    if (!err) err = put_journal(job, key, rg->npart, off);
+    if (!err) job->nkeep ++;
+    pthread_mutex_unlock(&job->lock);
+    if (err) fprintf(stderr, "Warning: node of block %ld not cached\n", rg->block);
+    return err ? -1 : 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  find_done: unit of key in the journal, NULL if none
+ */
+static const ABCDONE *find_done(const ABCJOB *job, unsigned long long key)
+{
+    ABCDONE d;
+
+    d.key = key;
+    return (const ABCDONE *)bsearch(&d, job->done, job->ndone, sizeof(ABCDONE), done_cmp);
+}
+
+/*
+ *  done_cmp: by key
+ */
+static int done_cmp(const void *a, const void *b)
+{
+    unsigned long long k1 = ((const ABCDONE *)a)->key, k2 = ((const ABCDONE *)b)->key;
+
+    return k1 < k2 ? -1 : k1 > k2;
+}
+
+/*
+ *  add_done: unit of a journal line, "nrec offset" after the key
+ */
+static int add_done(ABCJOB *job, unsigned long long key, const char *line)
+{
+    long      nrec;
+    long long off;
+    int       n;
+
+    if (sscanf(line, "%ld %lld%n", &nrec, &off, &n) != 2 || nrec < 0 || off < 0 || off > job->end ||
+        line[n + strspn(line + n, " \r\n")] != '\0') return 0;
+
+    if (job->ndone == job->nmax) {
+        job->nmax = job->nmax ? 2 * job->nmax : 1024;
+        if ((job->done = (ABCDONE *)realloc(job->done, sizeof(ABCDONE) * job->nmax)) == NULL) {
+            fprintf(stderr, "Out of memory reading the journal of %s\n", job->dir);
+            return -1;
+        }
+    }
+    job->done[job->ndone].key = key;
+    job->done[job->ndone].nrec = nrec;
+    job->done[job->ndone].offset = off;
+    job->ndone ++;
+    return 0;
+}
+
+/*
+ *  load_unit: the records of a unit read from the cache, -1 if any is
+ *      missing or cut short
+ */
+static long load_unit(const ABCJOB *job, const ABCDONE *pd, JOBREC **rec, SACHEAD **hd, float ***data)
+{
+    long long off = pd->offset;
+    long      i, n = pd->nrec;
+
+    *rec = (JOBREC *)malloc(sizeof(JOBREC) * (n > 0 ? n : 1));
+    *hd = (SACHEAD *)malloc(sizeof(SACHEAD) * (n > 0 ? n : 1));
+    *data = (float **)calloc(n > 0 ? n : 1, sizeof(float *));
+    if (*rec == NULL || *hd == NULL || *data == NULL) {
+        fprintf(stderr, "Out of memory reading %ld records of %s/cache\n", n, job->dir);
+        free_unit(0, *rec, *hd, *data);
+        return -1;
+    }
+    for (i = 0; i < n; i ++) {
+        if (cache_io(job->cache, &(*rec)[i], sizeof(JOBREC), off, 0) == -1 ||
+            cache_io(job->cache, &(*hd)[i], sizeof(SACHEAD), off + sizeof(JOBREC), 0) == -1) break;
+        off += sizeof(JOBREC) + sizeof(SACHEAD);
+        (*rec)[i].name[JOB_NAME_LEN-1] = '\0';
+        if ((*hd)[i].npts <= 0 || off + (long long)sizeof(float) * (*hd)[i].npts > job->end ||
+            ((*data)[i] = (float *)malloc(sizeof(float) * (*hd)[i].npts)) == NULL ||
+            cache_io(job->cache, (*data)[i], sizeof(float) * (*hd)[i].npts, off, 0) == -1) break;
+        off += (long long)sizeof(float) * (*hd)[i].npts;
+    }
+    if (i < n) {
+        fprintf(stderr, "Warning: unit %016llx cut short in %s/cache, computed again\n", pd->key, job->dir);
+        free_unit(n, *rec, *hd, *data);
+        return -1;
+    }
+    return n;
+}
+
+/*
+ *  free_unit: release the records of load_unit
+ */
+static void free_unit(long n, JOBREC *rec, SACHEAD *hd, float **data)
+{
+    long i;
+
+    for (i = 0; data != NULL && i < n; i ++) free(data[i]);
+    free(rec); free(hd); free(data);
+}
+
+/*
+ *  put_rec: one record written to the cache at *off, moved past it; the
+ *      lock of the job held
+ */
+static int put_rec(ABCJOB *job, long long *off, const char *name, long long block, int level,
+                   int nday, const SACHEAD *hd, const float *ar)
+{
+    JOBREC r;
+
+    memset(&r, 0, sizeof(JOBREC));
+    snprintf(r.name, JOB_NAME_LEN, "%s", name);
+    r.block = block;
+    r.level = level;
+    r.nday = nday;
+    if (cache_io(job->cache, &r, sizeof(JOBREC), *off, 1) == -1 ||
+        cache_io(job->cache, (void *)hd, sizeof(SACHEAD), *off + sizeof(JOBREC), 1) == -1 ||
+        cache_io(job->cache, (void *)ar, sizeof(float) * hd->npts,
+                 *off + sizeof(JOBREC) + sizeof(SACHEAD), 1) == -1) {
+        fprintf(stderr, "Unable to write %s/cache\n", job->dir);
+        return -1;
+    }
+    *off += sizeof(JOBREC) + sizeof(SACHEAD) + sizeof(float) * hd->npts;
+    return 0;
+}
+
+/*
+ *  put_journal: the unit of the records from the end of the cache up to
+ *      off, appended to the journal once they are written; the lock of the
+ *      job held
+ */
+static int put_journal(ABCJOB *job, unsigned long long key, long nrec, long long off)
+{
+    if (fprintf(job->journal, "%016llx %ld %lld\n", key, nrec, job->end) < 0 || fflush(job->journal) == EOF) {
+        fprintf(stderr, "Unable to append to the journal of %s\n", job->dir);
+        return -1;
+    }
+    job->end = off;
+    return 0;
+}
+
+/*
+ *  unit_clear: release the correlations kept for the line of the thread
+ */
+static void unit_clear(void)
+{
+    while (unit_nout > 0) free(unit_data[--unit_nout]);
+    unit_bad = 0;
+}
+
+/*
+ *  cache_io: n bytes of buf written to, or read from, offset off of fd
+ */
+static int cache_io(int fd, void *buf, size_t n, long long off, int wr)
+{
+    char    *p = (char *)buf;
+    ssize_t got;
+
+    while (n > 0) {
+        got = wr ? pwrite(fd, p, n, (off_t)off) : pread(fd, p, n, (off_t)off);
+        if (got <= 0) return -1;
+        if (wr) STAT_WRITE_BYTES(got);
+        else STAT_READ_BYTES(got);
+        p += got; off += got; n -= (size_t)got;
+    }
+    return 0;
+}
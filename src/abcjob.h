@@ -0,0 +1,99 @@
+/*******************************************************************************
+    Name:     abcjob.h
+
+    Purpose:  journal of the work units (lines of file.lst, or nodes of the
+        tree of the stacks of -j) of a batch run and cache of their results,
+        so that an interrupted or extended run only computes the units it
+        has not done before
+
+    Notes:
+        A unit is identified by a 64-bit key (FNV-1a) of its line, of the
+        settings of the run and of the path, size and modification time of
+        every SAC file it reads. The job directory holds
+
+            cache           JOBREC, SAC header and lags of each correlation
+                            or partial stack, appended one unit at a time
+            journal         "key nrec offset" for each unit done, its nrec
+                            records in cache from offset, appended after
+                            they are written
+
+        so a unit is only found done once all its records are written, and
+        a run that dies leaves at most one partial line, which is ignored,
+        and a partial record at the end of the cache, which no line points
+        to. A unit whose inputs or settings changed gets a new key. One
+        file of cache is written instead of one small file per result; a
+        job directory is for one process at a time (one per shard).
+
+        Without -j, job_write is the cor_writer of the correlation
+        functions: it keeps each correlation of the unit of the thread and
+        hands it on to the writer given to job_use (write_sac,
+        corpack_write or shard_write); job_end appends them to the cache. A
+        unit done before is replayed from the cache through that writer
+        alone, so files and packs come out as from a full run, bit for bit.
+
+        With -j, the correlations are not cached: the units are the nodes of
+        the tree of the stacks (see corstack.h), keyed by the keys of their
+        lines. job_keep saves the partial stacks of a node as it is summed,
+        job_node puts those of a node done before back into the stacks with
+        corstack_put, and its blocks are not computed again. The tree sums
+        the same partial stacks in the same order, so the stacks of a
+        resumed run are those of a full run, bit for bit.
+
+        The unit of a thread is kept per thread; the cache and the journal
+        are appended under a lock, once per unit.
+*******************************************************************************/
+
+#ifndef _ABCJOB_H
+#define _ABCJOB_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "sacio.h"
+#include "corstack.h"
+
+#define JOB_DIR_LEN     256
+#define JOB_NAME_LEN    128         /* correlation name                     */
+#define JOB_MAX_OUT     64          /* correlations of a line at most       */
+
+/* record of the cache, before the SAC header and hd.npts lags */
+typedef struct job_rec {
+    char    name[JOB_NAME_LEN];     /* correlation or stack name            */
+    long long block;                /* first block of a partial stack, and  */
+    int     level;                  /* its level; 0 for a correlation       */
+    int     nday;                   /* correlations summed, 1 if one        */
+} JOBREC;
+
+/* unit of the journal */
+typedef struct abc_done {
+    unsigned long long key;
+    long    nrec;                   /* records of the unit                  */
+    long long offset;               /* of the first in the cache            */
+} ABCDONE;
+
+typedef struct abc_job {
+    char    dir[JOB_DIR_LEN];
+    FILE    *journal;               /* append only                          */
+    int     cache;                  /* file descriptor of the cache         */
+    long long end;                  /* its size                             */
+    ABCDONE *done;                  /* units of earlier runs, sorted by key */
+    long    ndone, nmax;
+    pthread_mutex_t lock;           /* cache, journal and counters          */
+    long    nreplay, nrun;          /* lines replayed and computed          */
+    long    nnode, nkeep;           /* nodes put back and saved             */
+} ABCJOB;
+
+ABCJOB *job_open ( const char *dir );
+void job_close ( ABCJOB *job );
+unsigned long long job_hash ( unsigned long long h, const void *buf, size_t n );
+unsigned long long job_file ( unsigned long long h, const char *file );
+int job_find ( const ABCJOB *job, unsigned long long key );
+int job_replay ( ABCJOB *job, unsigned long long key );
+void job_begin ( unsigned long long key );
+int job_end ( ABCJOB *job );
+void job_use ( ABCJOB *job, int (*writer)( const char *name, SACHEAD hd, const float *ar ) );
+int job_write ( const char *name, SACHEAD hd, const float *ar );
+long job_node ( ABCJOB *job, unsigned long long key,
+                int (*put)( const char *name, long block, int level, int nday, SACHEAD hd, const float *ar ) );
+int job_keep ( ABCJOB *job, unsigned long long key, const CORRANGE *rg );
+
+#endif /* abcjob.h */
@@ -0,0 +1,350 @@
+/*******************************************************************************
+ *                                  abcshard.c                                 *
+ *  Shards of a run and their merge, see abcshard.h:                           *
+ *      shard_parse      read "i/N"                                            *
+ *      shard_plan       blocks of lines of a shard, balanced by cost          *
+ *      shard_open       start writing shard i of N                            *
+ *      shard_close      finish it, its manifest in place                      *
+ *      shard_item       input line correlated next                            *
+ *      shard_write      cor_writer saving a correlation into the shard        *
+ *      shard_part       corstack_parts writer saving a partial stack          *
+ *      shard_read       read back the manifest of a finished shard            *
+ *      shard_free       free a shard read back                                *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "abcshard.h"
+
+/* shard written by shard_write and shard_part, and the line of its next correlation */
+static ABCSHARD *cur_shard = NULL;
+static long cur_item = 0;
+
+/* block and its cost, for the plan */
+typedef struct shard_cost {
+    double  cost;
+    long    block;
+} SHARDCOST;
+
+/* function prototype for local use */
+static int  cost_cmp   (const void *a, const void *b);
+static int  ent_add    (ABCSHARD *sh, const SHARDENT *e);
+static void file_name  (ABCSHARD *sh, char *name);
+
+/*
+ *  shard_parse
+ *
+ *  Description: read the shard "i/N" of --shard, 0 <= i < N
+ *
+ *  Return: 0 if succeed, -1 if not a shard.
+ *
+ */
+int shard_parse(const char *arg, int *ishard, int *nshard)
+{
+    char c;
+
+    if (sscanf(arg, "%d/%d%c", ishard, nshard, &c) != 2 ||
+        *nshard < 1 || *ishard < 0 || *ishard >= *nshard) {
+        fprintf(stderr, "Bad shard %s (i/N, 0 <= i < N)\n", arg);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ *  shard_plan
+ *
+ *  Description: Deal the blocks of lines out to nshard shards, in aligned
+ *      groups of 2^g blocks, at least SHARD_GROUPS groups per shard: the
+ *      largest estimated cost first, each to the shard with the least cost
+ *      so far, and keep those of shard ishard. Ties go to the lower group
+ *      and the lower shard, so every shard makes the same plan. A group is
+ *      a node of the tree of the stacks, summed in the shard that has it.
+ *
+ *  IN:
+ *      const double *cost : estimated cost of each block
+ *      long nblock        : number of blocks
+ *      int  ishard        : shard to plan for
+ *      int  nshard        : number of shards
+ *  OUT:
+ *      long *blocks       : blocks of the shard, in increasing order
+ *
+ *  Return: number of blocks of the shard, -1 if out of memory.
+ *
+ */
+long shard_plan(const double *cost, long nblock, int ishard, int nshard, long *blocks)
+{
+    SHARDCOST *c;
+    double    *load;
+    long      b, n = 0, ngroup, m, j, t;
+    int       i, k, g;
+
+    for (g = 0; (nblock >> (g + 1)) >= (long)SHARD_GROUPS * nshard; g ++) ;
+    ngroup = (nblock + (1L << g) - 1) >> g;
+    if ((c = (SHARDCOST *)calloc(ngroup > 0 ? ngroup : 1, sizeof(SHARDCOST))) == NULL ||
+        (load = (double *)calloc(nshard, sizeof(double))) == NULL) {
+        fprintf(stderr, "Out of memory planning %ld blocks\n", nblock);
+        free(c);
+        return -1;
+    }
+    for (b = 0; b < ngroup; b ++) c[b].block = b;
+    for (b = 0; b < nblock; b ++) c[b >> g].cost += cost[b];
+    qsort(c, ngroup, sizeof(SHARDCOST), cost_cmp);
+
+    for (b = 0; b < ngroup; b ++) {
+        for (k = 0, i = 1; i < nshard; i ++) if (load[i] < load[k]) k = i;
+        load[k] += c[b].cost;
+        if (k == ishard) blocks[n++] = c[b].block;
+    }
+    /* groups in input order, as the threads take them */
+    for (b = 1; b < n; b ++) {
+        long t = blocks[b], j;
+        for (j = b; j > 0 && blocks[j-1] > t; j --) blocks[j] = blocks[j-1];
+        blocks[j] = t;
+    }
+    /* then their blocks, spread from the end so that no group is overwritten before it is read */
+    for (m = 0, b = 0; b < n; b ++) m += ((blocks[b] + 1) << g) < nblock ? 1L << g : nblock - (blocks[b] << g);
+    for (j = m, b = n - 1; b >= 0; b --)
+        for (t = ((blocks[b] + 1) << g) < nblock ? (blocks[b] + 1) << g : nblock; t > blocks[b] << g; )
+            blocks[--j] = -- t;
+    free(load);
+    free(c);
+    return m;
+}
+
+/*
+ *  shard_open
+ *
+ *  Description: Start shard ishard of nshard of a file.lst of nline lines
+ *      and hash list: its directory shard-i-of-N is created if needed, the
+ *      manifest and failure report of an earlier run of the shard removed.
+ *      The shard becomes the one of shard_write and shard_part.
+ *
+ *  Return: pointer to the shard, NULL if failed.
+ *
+ */
+ABCSHARD *shard_open(int ishard, int nshard, long nline, unsigned long long list)
+{
+    ABCSHARD *sh;
+    char     name[SHARD_DIR_LEN + 32];
+
+    if ((sh = (ABCSHARD *)calloc(1, sizeof(ABCSHARD))) == NULL) return NULL;
+    sh->ishard = ishard;
+    sh->nshard = nshard;
+    sh->nline = nline;
+    sh->list = list;
+    sprintf(sh->dir, "shard-%d-of-%d", ishard, nshard);
+    if (mkdir(sh->dir, 0755) == -1 && errno != EEXIST) {
+        fprintf(stderr, "Unable to create shard directory %s\n", sh->dir);
+        free(sh);
+        return NULL;
+    }
+    sprintf(name, "%s/manifest", sh->dir);
+    unlink(name);
+    sprintf(name, "%s/failed.lst", sh->dir);
+    unlink(name);
+    sprintf(name, "%s/manifest.tmp", sh->dir);
+    if ((sh->manifest = fopen(name, "w")) == NULL) {
+        fprintf(stderr, "Unable to open %s for writing\n", name);
+        free(sh);
+        return NULL;
+    }
+    fprintf(sh->manifest, "abc_shard %d %d %ld %016llx\n", ishard, nshard, nline, list);
+    cur_shard = sh;
+    return sh;
+}
+
+/*
+ *  shard_close
+ *
+ *  Description: Finish a shard opened by shard_open: its manifest is put in
+ *      place, so that abc_merge takes the shard as done.
+ *
+ *  Return: 0 if succeed, -1 if the manifest could not be written.
+ *
+ */
+int shard_close(ABCSHARD *sh)
+{
+    char tmp[SHARD_DIR_LEN + 32], name[SHARD_DIR_LEN + 32];
+    int  err;
+
+    if (sh == NULL) return 0;
+    if (cur_shard == sh) cur_shard = NULL;
+    err = ferror(sh->manifest) | fclose(sh->manifest);
+    sprintf(tmp, "%s/manifest.tmp", sh->dir);
+    sprintf(name, "%s/manifest", sh->dir);
+    if (err || rename(tmp, name) == -1) {
+        fprintf(stderr, "Unable to write %s, shard %d of %d not done\n", name, sh->ishard, sh->nshard);
+        free(sh);
+        return -1;
+    }
+    fprintf(stderr, "Shard %d of %d: %ld files in %s\n", sh->ishard, sh->nshard, sh->nfile, sh->dir);
+    free(sh);
+    return 0;
+}
+
+/*
+ *  shard_item
+ *
+ *  Description: set the input line (from 0) whose correlations come next
+ *
+ */
+void shard_item(long item)
+{
+    cur_item = item;
+}
+
+/*
+ *  shard_write
+ *
+ *  Description: write_sac compatible output, given to set_cor_writer:
+ *      correlation of the current input line, saved into the shard. Not
+ *      for several threads, whose correlations go through corstack_add.
+ *
+ */
+int shard_write(const char *name, SACHEAD hd, const float *ar)
+{
+    char file[SHARD_DIR_LEN + 32];
+
+    if (cur_shard == NULL) return write_sac(name, hd, ar);
+    file_name(cur_shard, file);
+    if (write_sac(file, hd, ar) == -1) return -1;
+    fprintf(cur_shard->manifest, "c %ld %s %s\n", cur_item, strrchr(file, '/') + 1, name);
+    return 0;
+}
+
+/*
+ *  shard_part
+ *
+ *  Description: writer of corstack_parts: partial stack of nday
+ *      correlations of name in the 2^level blocks from block, saved into
+ *      the shard
+ *
+ */
+int shard_part(const char *name, long block, int level, int nday, SACHEAD hd, const float *ar)
+{
+    char file[SHARD_DIR_LEN + 32];
+
+    if (cur_shard == NULL) return -1;
+    file_name(cur_shard, file);
+    if (write_sac(file, hd, ar) == -1) return -1;
+    fprintf(cur_shard->manifest, "s %ld %d %d %s %s\n", block, level, nday, strrchr(file, '/') + 1, name);
+    return 0;
+}
+
+/*
+ *  shard_read
+ *
+ *  Description: read the manifest of the finished shard in directory dir,
+ *      its entries with the files given as paths
+ *
+ *  Return: pointer to the shard, NULL if not done or failed.
+ *
+ */
+ABCSHARD *shard_read(const char *dir)
+{
+    ABCSHARD *sh;
+    SHARDENT e;
+    FILE     *fp;
+    char     name[SHARD_DIR_LEN + 32], line[SHARD_DIR_LEN + CORSTACK_NAME_LEN + 64], file[64];
+    int      ok;
+
+    if (strlen(dir) >= SHARD_DIR_LEN) {
+        fprintf(stderr, "Shard directory name too long: %s\n", dir);
+        return NULL;
+    }
+    sprintf(name, "%s/manifest", dir);
+    if ((fp = fopen(name, "r")) == NULL) {
+        fprintf(stderr, "No %s, shard not done\n", name);
+        return NULL;
+    }
+    sh = (ABCSHARD *)calloc(1, sizeof(ABCSHARD));
+    strcpy(sh->dir, dir);
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        sscanf(line, "abc_shard %d %d %ld %llx", &sh->ishard, &sh->nshard, &sh->nline, &sh->list) != 4) {
+        fprintf(stderr, "%s is not a shard manifest\n", name);
+        fclose(fp);
+        shard_free(sh);
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        memset(&e, 0, sizeof(e));
+        e.kind = line[0];
+        if (e.kind == 'c')
+            ok = sscanf(line + 1, "%ld %63s %127s", &e.item, file, e.name) == 3;
+        else if (e.kind == 's')
+            ok = sscanf(line + 1, "%ld %d %d %63s %127s", &e.item, &e.level, &e.nday, file, e.name) == 5;
+        else ok = 0;
+        if (!ok) {
+            fprintf(stderr, "Bad line in %s: %s", name, line);
+            fclose(fp);
+            shard_free(sh);
+            return NULL;
+        }
+        sprintf(e.file, "%s/%s", dir, file);
+        if (ent_add(sh, &e) == -1) {
+            fclose(fp);
+            shard_free(sh);
+            return NULL;
+        }
+    }
+    fclose(fp);
+    return sh;
+}
+
+/*
+ *  shard_free
+ *
+ *  Description: free a shard read back by shard_read
+ *
+ */
+void shard_free(ABCSHARD *sh)
+{
+    if (sh == NULL) return;
+    free(sh->ent);
+    free(sh);
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  cost_cmp: by decreasing cost, then block
+ */
+static int cost_cmp(const void *a, const void *b)
+{
+    const SHARDCOST *ca = (const SHARDCOST *)a, *cb = (const SHARDCOST *)b;
+
+    if (ca->cost != cb->cost) return ca->cost > cb->cost ? -1 : 1;
+    return ca->block < cb->block ? -1 : ca->block > cb->block;
+}
+
+/*
+ *  ent_add: append an entry read back
+ */
+static int ent_add(ABCSHARD *sh, const SHARDENT *e)
+{
+    if (sh->nent % 1024 == 0 &&
+        (sh->ent = (SHARDENT *)realloc(sh->ent, sizeof(SHARDENT) * (sh->nent + 1024))) == NULL) {
+        fprintf(stderr, "Out of memory reading the manifest of %s\n", sh->dir);
+        return -1;
+    }
+    sh->ent[sh->nent++] = *e;
+    return 0;
+}
+
+/*
+ *  file_name: path of the next file k.SAC of a shard
+ */
+static void file_name(ABCSHARD *sh, char *name)
+{
+    sprintf(name, "%s/%ld.SAC", sh->dir, sh->nfile++);
+}
@@ -0,0 +1,78 @@
+/*******************************************************************************
+    Name:     abcshard.h
+
+    Purpose:  shared-nothing runs of one file.lst by several processes
+        (abc_egf --shard i/N) on nodes that share only a filesystem, and the
+        merge of their results by abc_merge
+
+    Notes:
+        Every shard reads the whole file.lst and makes the same plan: the
+        blocks of CORSTACK_BLOCK lines, in aligned groups of 2^g blocks (at
+        least SHARD_GROUPS groups per shard), are dealt out to the N shards
+        largest estimated cost first, each to the shard with the least cost
+        so far (ties to the lower group and shard), so that no two shards
+        share a block and none has to talk to another. A group is a node of
+        the tree of the stacks, so a shard hands on one partial stack per
+        name and group rather than per name and block.
+
+        Shard i writes into its own directory shard-i-of-N, in the working
+        directory:
+
+            k.SAC           correlation or partial stack k of the shard
+            manifest        "abc_shard i N nline hash" of file.lst, then
+                                c item k.SAC name               correlation
+                                s block level nday k.SAC name   partial stack
+            failed.lst      quarantined lines, as abc_egf -e
+
+        The manifest is written as manifest.tmp and renamed once the shard
+        is done, so a shard that has not finished has none. abc_merge checks
+        that all N shards are there for the same file.lst, writes the
+        correlations in input line order and reduces the partial stacks
+        with corstack_flush, so the results are bit for bit those of a
+        single run, whatever N.
+*******************************************************************************/
+
+#ifndef _ABCSHARD_H
+#define _ABCSHARD_H
+
+#include <stdio.h>
+#include "sacio.h"
+#include "corstack.h"
+
+#define SHARD_DIR_LEN   256
+#define SHARD_GROUPS    8           /* least groups of blocks per shard     */
+
+/* entry of a manifest */
+typedef struct shard_ent {
+    char    kind;                   /* 'c' correlation, 's' partial stack   */
+    long    item;                   /* line of a correlation, first block   */
+                                    /* of a partial stack                   */
+    int     level;                  /* partial stack of 2^level blocks      */
+    int     nday;                   /* correlations of a partial stack      */
+    char    file[SHARD_DIR_LEN + 32];
+    char    name[CORSTACK_NAME_LEN];
+} SHARDENT;
+
+/* shard of a run, written or read back */
+typedef struct abc_shard {
+    int     ishard, nshard;
+    long    nline;                  /* lines of file.lst                    */
+    unsigned long long list;        /* hash of file.lst                     */
+    char    dir[SHARD_DIR_LEN];
+    FILE    *manifest;              /* manifest.tmp, while written          */
+    long    nfile;                  /* k of the next k.SAC                  */
+    SHARDENT *ent;                  /* entries read back                    */
+    long    nent;
+} ABCSHARD;
+
+int shard_parse ( const char *arg, int *ishard, int *nshard );
+long shard_plan ( const double *cost, long nblock, int ishard, int nshard, long *blocks );
+ABCSHARD *shard_open ( int ishard, int nshard, long nline, unsigned long long list );
+int shard_close ( ABCSHARD *sh );
+void shard_item ( long item );
+int shard_write ( const char *name, SACHEAD hd, const float *ar );
+int shard_part ( const char *name, long block, int level, int nday, SACHEAD hd, const float *ar );
+ABCSHARD *shard_read ( const char *dir );
+void shard_free ( ABCSHARD *sh );
+
+#endif /* abcshard.h */
@@ -0,0 +1,202 @@
+/*******************************************************************************
+    Name:     abcstat.c
+
+    Purpose:  run telemetry of the ABC chain, see abcstat.h
+*******************************************************************************/
+
+#ifdef ABC_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "abcstat.h"
+
+static const char *stage_name[STAT_NSTAGE] = {
+    "read", "write", "cut", "bp", "normal", "whiten", "cor", "fft_plan", "fft_exec"
+};
+
+static __thread ABCSTAT *local = NULL;
+static ABCSTAT *threads = NULL;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static double start = -1., last = -1.;
+
+/*******************************************************************************
+    abc_stat_now:
+        monotonic clock in seconds
+*******************************************************************************/
+double abc_stat_now( void ) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+/*******************************************************************************
+    abc_stat_local:
+        counters of the calling thread, registered on first use. They are
+        never freed, so a dump still sees threads that have exited.
+*******************************************************************************/
+ABCSTAT *abc_stat_local( void ) {
+    ABCSTAT *st;
+
+    if ( local != NULL ) return local;
+    if ( (st = (ABCSTAT *) calloc(1, sizeof(ABCSTAT))) == NULL ) {
+        static __thread ABCSTAT spare;      /* counted but never dumped */
+        return local = &spare;
+    }
+    pthread_mutex_lock(&threads_lock);
+    if ( start < 0. ) start = last = abc_stat_now();
+    st->next = threads;
+    threads = st;
+    pthread_mutex_unlock(&threads_lock);
+    return local = st;
+}
+
+/*******************************************************************************
+    abc_stat_fft:
+        count one transform of length n
+*******************************************************************************/
+void abc_stat_fft( int n ) {
+    int k = 0;
+    while ( k < STAT_NFFT - 1 && (n >> (k+1)) > 0 ) k ++;
+    abc_stat_local()->fft[k] ++;
+}
+
+/*******************************************************************************
+    abc_stat_sum:
+        sum of the counters of all threads. Other threads may be updating
+        theirs meanwhile, so a sum taken during a run is approximate.
+*******************************************************************************/
+void abc_stat_sum( ABCSTAT *sum ) {
+    ABCSTAT *st;
+    int i;
+
+    memset(sum, 0, sizeof(ABCSTAT));
+    pthread_mutex_lock(&threads_lock);
+    for ( st = threads; st != NULL; st = st->next ) {
+        for ( i = 0; i < STAT_NSTAGE; i ++ ) {
+            sum->time[i] += st->time[i];
+            sum->calls[i] += st->calls[i];
+        }
+        for ( i = 0; i < STAT_NFFT; i ++ ) sum->fft[i] += st->fft[i];
+        sum->bytes_read += st->bytes_read;
+        sum->bytes_written += st->bytes_written;
+        sum->allocs += st->allocs;
+        sum->alloc_bytes += st->alloc_bytes;
+        sum->pairs += st->pairs;
+    }
+    pthread_mutex_unlock(&threads_lock);
+}
+
+static void dump_json( FILE *ff, ABCSTAT *s, double wall ) {
+    int i, first = 1;
+
+    fprintf(ff, "{\"wall_s\":%.6g,\"pairs\":%lld,\"pairs_per_s\":%.6g,", wall, s->pairs,
+            wall > 0 ? s->pairs / wall : 0.);
+    fprintf(ff, "\"bytes_read\":%lld,\"bytes_written\":%lld,\"allocs\":%lld,\"alloc_bytes\":%lld,",
+            s->bytes_read, s->bytes_written, s->allocs, s->alloc_bytes);
+    fprintf(ff, "\"stages\":{");
+    for ( i = 0; i < STAT_NSTAGE; i ++ )
+        fprintf(ff, "%s\"%s\":{\"calls\":%lld,\"seconds\":%.6g}", i ? "," : "",
+                stage_name[i], s->calls[i], s->time[i]);
+    fprintf(ff, "},\"fft_sizes\":{");
+    for ( i = 0; i < STAT_NFFT; i ++ ) {
+        if ( s->fft[i] == 0 ) continue;
+        fprintf(ff, "%s\"%d\":%lld", first ? "" : ",", 1 << i, s->fft[i]);
+        first = 0;
+    }
+    fprintf(ff, "}}\n");
+}
+
+static void dump_prom( FILE *ff, ABCSTAT *s, double wall ) {
+    int i;
+
+    fprintf(ff, "# TYPE abc_wall_seconds gauge\nabc_wall_seconds %.6g\n", wall);
+    fprintf(ff, "# TYPE abc_pairs_total counter\nabc_pairs_total %lld\n", s->pairs);
+    fprintf(ff, "# TYPE abc_read_bytes_total counter\nabc_read_bytes_total %lld\n", s->bytes_read);
+    fprintf(ff, "# TYPE abc_written_bytes_total counter\nabc_written_bytes_total %lld\n", s->bytes_written);
+    fprintf(ff, "# TYPE abc_allocs_total counter\nabc_allocs_total %lld\n", s->allocs);
+    fprintf(ff, "# TYPE abc_alloc_bytes_total counter\nabc_alloc_bytes_total %lld\n", s->alloc_bytes);
+    fprintf(ff, "# TYPE abc_stage_calls_total counter\n");
+    for ( i = 0; i < STAT_NSTAGE; i ++ )
+        fprintf(ff, "abc_stage_calls_total{stage=\"%s\"} %lld\n", stage_name[i], s->calls[i]);
+    fprintf(ff, "# TYPE abc_stage_seconds_total counter\n");
+    for ( i = 0; i < STAT_NSTAGE; i ++ )
+        fprintf(ff, "abc_stage_seconds_total{stage=\"%s\"} %.6g\n", stage_name[i], s->time[i]);
+    fprintf(ff, "# TYPE abc_fft_total counter\n");
+    for ( i = 0; i < STAT_NFFT; i ++ )
+        if ( s->fft[i] ) fprintf(ff, "abc_fft_total{size=\"%d\"} %lld\n", 1 << i, s->fft[i]);
+}
+
+/*******************************************************************************
+    abc_stat_dump:
+        write the counters of all threads to name, as Prometheus text if name
+        ends with ".prom" and as one JSON object otherwise. The file is
+        written aside and renamed, so a reader never sees half of it.
+
+    IN:
+        const char *name    file name
+
+    Return:
+        0 if succeed; -1 if fail
+*******************************************************************************/
+int abc_stat_dump( const char *name ) {
+    char tmp[512];
+    size_t len = strlen(name);
+    ABCSTAT sum;
+    FILE *ff;
+
+    abc_stat_sum(&sum);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+    if ( (ff = fopen(tmp, "w")) == NULL ) {
+        fprintf(stderr, "Error in opening %s\n", tmp);
+        return -1;
+    }
+    if ( len > 5 && strcmp(name + len - 5, ".prom") == 0 )
+        dump_prom(ff, &sum, start < 0 ? 0. : abc_stat_now() - start);
+    else
+        dump_json(ff, &sum, start < 0 ? 0. : abc_stat_now() - start);
+    if ( fclose(ff) != 0 || rename(tmp, name) != 0 ) {
+        fprintf(stderr, "Error in writing %s\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+    abc_stat_tick:
+        dump the counters to name if period seconds have passed since the
+        last dump; cheap enough to call after every pair
+*******************************************************************************/
+void abc_stat_tick( const char *name, double period ) {
+    double t = abc_stat_now();
+
+    if ( name == NULL || last < 0. || t - last < period ) return;
+    last = t;
+    abc_stat_dump(name);
+}
+
+/*******************************************************************************
+    abc_stat_summary:
+        print the share of every stage and the I/O totals to stderr
+*******************************************************************************/
+void abc_stat_summary( void ) {
+    ABCSTAT s;
+    double wall = start < 0 ? 0. : abc_stat_now() - start;
+    int i;
+
+    abc_stat_sum(&s);
+    fprintf(stderr, "---- run summary: %lld pairs in %.3f s (%.3g pairs/s)\n", s.pairs, wall,
+            wall > 0 ? s.pairs / wall : 0.);
+    fprintf(stderr, "%-10s %10s %12s %7s\n", "stage", "calls", "seconds", "wall%");
+    for ( i = 0; i < STAT_NSTAGE; i ++ )
+        fprintf(stderr, "%-10s %10lld %12.4f %6.1f%%\n", stage_name[i], s.calls[i], s.time[i],
+                wall > 0 ? 100. * s.time[i] / wall : 0.);
+    fprintf(stderr, "read %.3f MB, written %.3f MB, %lld allocations (%.3f MB)\n",
+            s.bytes_read / 1.0e6, s.bytes_written / 1.0e6, s.allocs, s.alloc_bytes / 1.0e6);
+    for ( i = 0; i < STAT_NFFT; i ++ )
+        if ( s.fft[i] ) fprintf(stderr, "fft size %d-%d: %lld\n", 1 << i, (2 << i) - 1, s.fft[i]);
+}
+
+#endif /* ABC_STATS */
@@ -0,0 +1,84 @@
+/*******************************************************************************
+    Name:     abcstat.h
+
+    Purpose:  run telemetry of the ABC chain: time spent per stage, bytes
+        read and written, FFT sizes and allocations
+
+    Notes:
+        Everything is compiled in only with -DABC_STATS (make STATS=1).
+        Otherwise every macro and function below expands to nothing, so the
+        hot path carries no cost at all.
+
+        Counters are kept per thread without locking; a thread registers its
+        counters the first time it records something. abc_stat_dump sums the
+        counters of all threads and writes them as JSON, or as Prometheus
+        text when the file name ends with ".prom".
+*******************************************************************************/
+
+#ifndef _ABCSTAT_H
+#define _ABCSTAT_H
+
+/* stages timed separately */
+#define STAT_READ       0           /* SAC reads                              */
+#define STAT_WRITE      1           /* SAC writes                             */
+#define STAT_CUT        2           /* cut_sac and stitched windows           */
+#define STAT_BP         3           /* band-pass filtering                    */
+#define STAT_NORMAL     4           /* temporal normalization                 */
+#define STAT_WHITEN     5           /* spectral whitening                     */
+#define STAT_COR        6           /* cross-correlation                      */
+#define STAT_FFT_PLAN   7           /* FFTW planning                          */
+#define STAT_FFT_EXEC   8           /* FFTW transforms                        */
+#define STAT_NSTAGE     9
+
+#define STAT_NFFT       32          /* FFT sizes counted by power of two      */
+
+#ifdef ABC_STATS
+
+typedef struct abc_stat {
+    double      time[STAT_NSTAGE];  /* seconds spent in each stage            */
+    long long   calls[STAT_NSTAGE]; /* number of calls of each stage          */
+    long long   bytes_read;
+    long long   bytes_written;
+    long long   allocs;             /* number of buffers allocated            */
+    long long   alloc_bytes;
+    long long   fft[STAT_NFFT];     /* transforms of size within [2^k, 2^k+1) */
+    long long   pairs;              /* station pairs done                     */
+    struct abc_stat *next;          /* registry of all threads                */
+} ABCSTAT;
+
+double abc_stat_now ( void );
+ABCSTAT *abc_stat_local ( void );
+void abc_stat_fft ( int n );
+void abc_stat_sum ( ABCSTAT *sum );
+int abc_stat_dump ( const char *name );
+void abc_stat_tick ( const char *name, double period );
+void abc_stat_summary ( void );
+
+#define STAT_BEGIN(s)       double stat_t0_##s = abc_stat_now()
+#define STAT_END(s)         do { ABCSTAT *st_ = abc_stat_local();                  \
+                                 st_->time[s] += abc_stat_now() - stat_t0_##s;     \
+                                 st_->calls[s] ++; } while (0)
+#define STAT_READ_BYTES(n)  (abc_stat_local()->bytes_read += (long long)(n))
+#define STAT_WRITE_BYTES(n) (abc_stat_local()->bytes_written += (long long)(n))
+#define STAT_ALLOC(n)       do { ABCSTAT *st_ = abc_stat_local();                  \
+                                 st_->allocs ++; st_->alloc_bytes += (long long)(n); } while (0)
+#define STAT_FFT(n)         abc_stat_fft(n)
+#define STAT_PAIR()         (abc_stat_local()->pairs ++)
+
+#else
+
+#define STAT_BEGIN(s)       do { } while (0)
+#define STAT_END(s)         do { } while (0)
+#define STAT_READ_BYTES(n)  ((void)(n))
+#define STAT_WRITE_BYTES(n) ((void)(n))
+#define STAT_ALLOC(n)       ((void)(n))
+#define STAT_FFT(n)         ((void)(n))
+#define STAT_PAIR()         do { } while (0)
+
+#define abc_stat_dump(name)         ((void)(name))
+#define abc_stat_tick(name, period) ((void)(name), (void)(period))
+#define abc_stat_summary()          do { } while (0)
+
+#endif /* ABC_STATS */
+
+#endif /* abcstat.h */
@@ -0,0 +1,367 @@
+/*******************************************************************************
+ *                                  abctune.c                                  *
+ *  Profile of the host, see abctune.h:                                        *
+ *      tune_path        file of the profile of this host                      *
+ *      tune_load        read a profile                                        *
+ *      tune_save        write a profile                                       *
+ *      tune_run         measure the kernels and threads for a job             *
+ *      tune_use         choose the kernels of a profile                       *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "sacio.h"
+#include "xspec.h"
+#include "abctune.h"
+
+#define TUNE_RUNS       5           /* runs of a kernel, the median kept    */
+#define TUNE_MAX_THREADS 256
+#define TUNE_MARGIN     0.05        /* fewer threads within 5% of the best  */
+
+/* synthetic pair of the job, shared by the threads of tune_pairs */
+static struct {
+    float   *x, *y;
+    SACHEAD hd;
+    int     npts;                   /* half window of the normalization     */
+    float   band[4];
+    long    npair, next;
+} job;
+
+/* function prototype for local use */
+static double now          (void);
+static int    cmp_double   (const void *a, const void *b);
+static double median       (double *t, int n);
+static void   job_shape    (const char *lst);
+static double time_swap    (int level, char *buf, size_t n);
+static double time_cross   (int level, XSPEC *x, XSPEC *y, XSPEC *acc);
+static double tune_pairs   (int nthread);
+static void  *pair_worker  (void *arg);
+
+/*
+ *  tune_path
+ *
+ *  Description: file of the profile of this host, $ABC_PROFILE if set,
+ *      else ~/.abc_profile.<host>
+ *
+ *  Return: 0 if succeed, -1 if there is no home directory.
+ *
+ */
+int tune_path(char *path, size_t n)
+{
+    char host[TUNE_HOST_LEN], *home;
+
+    if ((home = getenv("ABC_PROFILE")) != NULL && home[0] != '\0') {
+        snprintf(path, n, "%s", home);
+        return 0;
+    }
+    if ((home = getenv("HOME")) == NULL) return -1;
+    if (gethostname(host, sizeof(host)) == -1) strcpy(host, "localhost");
+    host[sizeof(host) - 1] = '\0';
+    snprintf(path, n, "%s/.abc_profile.%s", home, host);
+    return 0;
+}
+
+/*
+ *  tune_load
+ *
+ *  Description: read the profile in path
+ *
+ *  Return: 0 if succeed, -1 if there is none or it is not a profile.
+ *
+ */
+int tune_load(const char *path, ABCTUNE *tp)
+{
+    FILE *fp;
+    char line[256], key[32];
+    int  v, got = 0;
+
+    if ((fp = fopen(path, "r")) == NULL) return -1;
+    memset(tp, 0, sizeof(ABCTUNE));
+    if (fgets(line, sizeof(line), fp) == NULL ||
+        sscanf(line, "abc_profile %63s %d %d %f", tp->host, &tp->cpus, &tp->cut_npts, &tp->delta) != 4) {
+        fprintf(stderr, "%s is not a profile of abc_egf --tune\n", path);
+        fclose(fp);
+        return -1;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "%31s %d", key, &v) != 2) continue;
+        if (strcmp(key, "swap") == 0)         { tp->swap = v;    got |= 1; }
+        else if (strcmp(key, "cross") == 0)   { tp->cross = v;   got |= 2; }
+        else if (strcmp(key, "threads") == 0) { tp->threads = v; got |= 4; }
+    }
+    fclose(fp);
+    if (got != 7 || tp->threads < 1) {
+        fprintf(stderr, "Profile %s is incomplete, run abc_egf --tune again\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ *  tune_save
+ *
+ *  Description: write the profile into path
+ *
+ *  Return: 0 if succeed, -1 if failed.
+ *
+ */
+int tune_save(const char *path, const ABCTUNE *tp)
+{
+    FILE *fp;
+    int  err;
+
+    if ((fp = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Unable to write profile %s\n", path);
+        return -1;
+    }
+    fprintf(fp, "abc_profile %s %d %d %g\n", tp->host, tp->cpus, tp->cut_npts, tp->delta);
+    fprintf(fp, "swap %d\ncross %d\nthreads %d\n", tp->swap, tp->cross, tp->threads);
+    err = ferror(fp) | fclose(fp);
+    if (err) fprintf(stderr, "Unable to write profile %s\n", path);
+    return err ? -1 : 0;
+}
+
+/*
+ *  tune_run
+ *
+ *  Description: Measure the kernels and numbers of threads on synthetic
+ *      traces shaped like the first line of lst (window, normalization,
+ *      band, and the sampling interval of its first file), or like the
+ *      example of the README if lst is NULL or has none; the times are
+ *      reported on stderr.
+ *
+ *  OUT:
+ *      ABCTUNE *tp : profile of this host
+ *
+ *  Return: 0 if succeed, -1 if out of memory.
+ *
+ */
+int tune_run(const char *lst, ABCTUNE *tp)
+{
+    const char *swap_impl[3] = { "scalar", "ssse3", "avx2" }, *cross_impl[3] = { "scalar", "avx2", "avx512" };
+    XSPEC  x, y, acc;
+    char   *buf;
+    double t, best, rate[TUNE_MAX_THREADS + 1];
+    int    level, k, n, nfft, ncpu;
+
+    memset(tp, 0, sizeof(ABCTUNE));
+    if (gethostname(tp->host, sizeof(tp->host)) == -1) strcpy(tp->host, "localhost");
+    tp->host[sizeof(tp->host) - 1] = '\0';
+    ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    tp->cpus = ncpu = ncpu < 1 ? 1 : ncpu > TUNE_MAX_THREADS ? TUNE_MAX_THREADS : ncpu;
+    job_shape(lst);
+    n = job.hd.npts;
+    tp->cut_npts = n;
+    tp->delta = job.hd.delta;
+    nfft = pow_next2(n);
+    fprintf(stderr, "Tuning %s (%d CPUs) for windows of %d samples of %g s\n", tp->host, ncpu, n, job.hd.delta);
+
+    /* byte swap of a window read in the other byte order */
+    if ((buf = (char *)calloc(n, 4)) == NULL) return -1;
+    for (best = 0., level = SAC_SWAP_SCALAR; level <= SAC_SWAP_AVX2; level ++) {
+        if (sac_swap4_use(level) != level) continue;
+        t = time_swap(level, buf, 4 * (size_t)n);
+        fprintf(stderr, "  swap4 %-8s %.6f s\n", swap_impl[level], t);
+        if (best == 0. || t < best) { best = t; tp->swap = level; }
+    }
+    free(buf);
+
+    /* cross spectrum of a pair */
+    if (xspec_alloc(&x, nfft) == -1 || xspec_alloc(&y, nfft) == -1 || xspec_alloc(&acc, nfft) == -1) return -1;
+    for (k = 0; k < nfft; k ++) {
+        x.re[k] = rand() / (double)RAND_MAX - 0.5; x.im[k] = rand() / (double)RAND_MAX - 0.5;
+        y.re[k] = rand() / (double)RAND_MAX - 0.5; y.im[k] = rand() / (double)RAND_MAX - 0.5;
+    }
+    for (best = 0., level = XSPEC_SCALAR; level <= XSPEC_AVX512; level ++) {
+        if (xspec_use(level) != level) continue;
+        t = time_cross(level, &x, &y, &acc);
+        fprintf(stderr, "  cross %-8s %.6f s\n", cross_impl[level], t);
+        if (best == 0. || t < best) { best = t; tp->cross = level; }
+    }
+    xspec_free(&x); xspec_free(&y); xspec_free(&acc);
+    tune_use(tp);
+
+    /* pairs per second: 1, 2, 4, ... threads and all CPUs, the fewest within the margin of the best */
+    for (best = 0., k = 1; ; k = k * 2 < ncpu ? k * 2 : ncpu) {
+        rate[k] = tune_pairs(k);
+        fprintf(stderr, "  %3d threads  %.3f pairs/s\n", k, rate[k]);
+        if (rate[k] > best) best = rate[k];
+        if (k == ncpu) break;
+    }
+    for (k = 1; ; k = k * 2 < ncpu ? k * 2 : ncpu) {
+        if (rate[k] >= (1. - TUNE_MARGIN) * best || k == ncpu) break;
+    }
+    tp->threads = k;
+    free(job.x); free(job.y);
+    fprintf(stderr, "Chosen: swap4 %s, cross %s, %d threads for -j auto\n", swap_impl[tp->swap],
+        cross_impl[tp->cross], tp->threads);
+    return 0;
+}
+
+/*
+ *  tune_use
+ *
+ *  Description: choose the kernels of a profile, those the CPU lacks
+ *      lowered to what it supports
+ *
+ */
+void tune_use(const ABCTUNE *tp)
+{
+    sac_swap4_use(tp->swap);
+    xspec_use(tp->cross);
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0e-9 * ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+/*
+ *  median: of n times
+ */
+static double median(double *t, int n)
+{
+    qsort(t, n, sizeof(double), cmp_double);
+    return n % 2 ? t[n/2] : 0.5 * (t[n/2-1] + t[n/2]);
+}
+
+/*
+ *  job_shape: the synthetic pair of the first line of lst, noise with a
+ *      common part delayed by 20 s between the stations
+ */
+static void job_shape(const char *lst)
+{
+    char   line[500], sac1[256];
+    int    i, n = 150000, lag;
+    float  delta = 0.2, common;
+    FILE   *fp;
+    SACHEAD hd;
+
+    job.npts = 40;
+    job.band[0] = 0.0167; job.band[1] = 0.02; job.band[2] = 0.067; job.band[3] = 0.08;
+    if (lst != NULL && (fp = fopen(lst, "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp))
+            if (sscanf(line, "%255s %*s %*d %*d %*d %*d %*d %*d %*f %d %f %f %f %f %d", sac1, &n,
+                       &job.band[0], &job.band[1], &job.band[2], &job.band[3], &job.npts) == 7) {
+                if (read_sac_head(sac1, &hd) == 0 && hd.delta > 0.) delta = hd.delta;
+                break;
+            }
+        fclose(fp);
+    }
+    if (n < 2) n = 2;
+
+    job.hd = new_sac_head(delta, n, 0.);
+    job.x = (float *)malloc(sizeof(float) * n);
+    job.y = (float *)malloc(sizeof(float) * n);
+    lag = (int)(20. / delta);
+    srand(20180120);
+    for (i = 0; i < n; i ++) {
+        common = sin(2*M_PI*0.07*i*delta) + (rand()/(float)RAND_MAX - 0.5);
+        job.x[i] = common + (rand()/(float)RAND_MAX - 0.5);
+        job.y[i] = (i >= lag ? job.x[i-lag] : common) + 0.5*(rand()/(float)RAND_MAX - 0.5);
+    }
+}
+
+/*
+ *  time_swap: median time of the byte swap of n bytes by a kernel
+ */
+static double time_swap(int level, char *buf, size_t n)
+{
+    double t[TUNE_RUNS], t0;
+    int    r;
+
+    (void)level;
+    for (r = 0; r < TUNE_RUNS; r ++) {
+        t0 = now(); sac_swap4(buf, n); t[r] = now() - t0;
+    }
+    return median(t, TUNE_RUNS);
+}
+
+/*
+ *  time_cross: median time of a cross spectrum by a kernel
+ */
+static double time_cross(int level, XSPEC *x, XSPEC *y, XSPEC *acc)
+{
+    double t[TUNE_RUNS], t0;
+    int    r;
+
+    (void)level;
+    for (r = 0; r < TUNE_RUNS; r ++) {
+        t0 = now(); xspec_cross(x, y, 1, acc, 0); t[r] = now() - t0;
+    }
+    return median(t, TUNE_RUNS);
+}
+
+/*
+ *  tune_pairs: pairs per second of nthread threads, each taking pairs in
+ *      turn through the stages of the chain, in memory
+ */
+static double tune_pairs(int nthread)
+{
+    pthread_t tid[TUNE_MAX_THREADS];
+    double    t0;
+    int       k;
+
+    job.npair = 2 * nthread > 4 ? 2 * nthread : 4;
+    job.next = 0;
+    t0 = now();
+    for (k = 1; k < nthread; k ++)
+        if (pthread_create(&tid[k], NULL, pair_worker, NULL) != 0) {
+            nthread = k;
+            break;
+        }
+    pair_worker(NULL);
+    for (k = 1; k < nthread; k ++) pthread_join(tid[k], NULL);
+    return job.npair / (now() - t0);
+}
+
+/*
+ *  pair_worker: bp, normal, spe_whi of both traces and their correlation,
+ *      for the pairs left
+ */
+static void *pair_worker(void *arg)
+{
+    int     n = job.hd.npts;
+    float   *w0, *w1, *w2, *cor;
+    float   *f = job.band;
+    SACHEAD hd;
+
+    (void)arg;
+    w0 = (float *)malloc(sizeof(float) * n);
+    w1 = (float *)malloc(sizeof(float) * n);
+    w2 = (float *)malloc(sizeof(float) * n);
+    cor = (float *)malloc(sizeof(float) * cor_size(&job.hd, 500.));
+    while (__sync_fetch_and_add(&job.next, 1) < job.npair) {
+        bp_data(job.x, w0, &job.hd, f[0], f[1], f[2], f[3], 10);
+        normal_data(w0, w1, n, job.npts);
+        spe_whi_data(w1, w1, n, job.hd.delta, 20, f[0], f[1], f[2], f[3]);
+        bp_data(job.y, w0, &job.hd, f[0], f[1], f[2], f[3], 10);
+        normal_data(w0, w2, n, job.npts);
+        spe_whi_data(w2, w2, n, job.hd.delta, 20, f[0], f[1], f[2], f[3]);
+        cor_data(w1, NULL, &job.hd, w2, NULL, &job.hd, 500., cor, &hd);
+    }
+    free(w0); free(w1); free(w2); free(cor);
+    return NULL;
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+    Name:     abctune.h
+
+    Purpose:  profile of the host a run is on (abc_egf --tune): the fastest
+        kernels and number of threads measured on synthetic traces shaped
+        like the job, saved per host and loaded by every run
+
+    Notes:
+        Only settings that leave the correlations as they are, bit for bit,
+        are tuned:
+
+            swap        byte swap kernel of sacio (sac_swap4_use)
+            cross       cross spectrum kernel of xspec (xspec_use)
+            threads     pairs correlated at once, for abc_egf -j auto
+
+        The kernel a CPU supports is not always its fastest (e.g. AVX-512
+        lowering the clock), and the best number of threads depends on its
+        cores, caches and memory. The FFT length, the windows of the
+        normalization and whitening, the taper order and decimation change
+        the correlations themselves and stay as file.lst and the options
+        give them.
+
+        The profile is a text file, $ABC_PROFILE or ~/.abc_profile.<host>,
+        so that nodes sharing a home directory keep one each:
+
+            abc_profile <host> <cpus> <cut_npts> <delta>
+            swap <level>
+            cross <level>
+            threads <n>
+*******************************************************************************/
+
+#ifndef _ABCTUNE_H
+#define _ABCTUNE_H
+
+#include <stddef.h>
+
+#define TUNE_HOST_LEN   64
+
+/* profile of a host */
+typedef struct abc_tune {
+    char    host[TUNE_HOST_LEN];
+    int     cpus;                   /* online when tuned                    */
+    int     cut_npts;               /* window tuned for (samples)           */
+    float   delta;                  /* and its sampling interval (s)        */
+    int     swap;                   /* SAC_SWAP_* kernel                    */
+    int     cross;                  /* XSPEC_* kernel                       */
+    int     threads;                /* for -j auto                          */
+} ABCTUNE;
+
+int tune_path ( char *path, size_t n );
+int tune_load ( const char *path, ABCTUNE *tp );
+int tune_save ( const char *path, const ABCTUNE *tp );
+int tune_run ( const char *lst, ABCTUNE *tp );
+void tune_use ( const ABCTUNE *tp );
+
+#endif /* abctune.h */
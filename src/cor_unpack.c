@@ -0,0 +1,59 @@
+/*************************************************/
+/*FileName: cor_unpack.c                         */
+/*Export correlations of a pack to SAC files     */
+/*************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sacio.h"
+#include "corpack.h"
+
+#define USAGE "Usage: cor_unpack [-l] cor.pack [cor_name ...]\n"
+
+int main( int argc, char *argv[] ) {
+    int i, k, c, list = 0, status = 0;
+    CORREC rec;
+    CORDEC dec;
+    CORPACK *pk;
+
+    while ( (c = getopt(argc, argv, "l")) != -1 ) switch ( c ) {
+        case 'l':
+            list = 1;
+            break;
+        default:
+            fprintf(stderr, USAGE);
+            exit(1);
+    }
+    if ( argc - optind < 1 ) {
+        fprintf(stderr, USAGE);
+        exit(1);
+    }
+    if ( (pk = corpack_open(argv[optind], "r")) == NULL ) exit(1);
+
+    /* list or export every correlation */
+    if ( argc - optind == 1 ) {
+        for ( i = 0; i < pk->nrec; i ++ ) {
+            if ( corpack_decoder(pk, i, &rec, &dec) == -1 ) { status = 1; continue; }
+            if ( list ) printf("%d %s %s %s %d %g %g %g %d %d\n", i, rec.name, rec.sta1, rec.sta2,
+                               rec.npts, rec.delta, rec.b, rec.dist, rec.codec, rec.nbytes);
+            else if ( corpack_export(pk, i, rec.name) == -1 ) status = 1;
+        }
+        corpack_close(pk);
+        return status;
+    }
+
+    /* export the named correlations only */
+    for ( k = optind + 1; k < argc; k ++ ) {
+        if ( (i = corpack_find(pk, argv[k])) == -1 ) {
+            fprintf(stderr, "%s not in %s\n", argv[k], argv[optind]);
+            status = 1;
+            continue;
+        }
+        if ( corpack_export(pk, i, argv[k]) == -1 ) status = 1;
+    }
+    corpack_close(pk);
+
+    return status;
+}
@@ -0,0 +1,519 @@
+/*******************************************************************************
+ *                                 corcodec.c                                  *
+ *  Block codecs of correlation lags:                                          *
+ *      corcodec_id      codec number of a codec name                          *
+ *      corcodec_bound   largest coded size of npts samples                    *
+ *      corcodec_encode  code npts samples                                     *
+ *      cordec_init      start streaming decode of a coded record              *
+ *      cordec_next      decode the next block                                 *
+ *      corcodec_decode  decode a whole record                                 *
+ *                                                                             *
+ *  The entropy coder is a static order-0 byte-wise rANS coder with 12 bit     *
+ *  frequencies, after F. Giesen's public domain rans_byte.h.                  *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "corcodec.h"
+
+#define BLOCK_HEAD      12          /* n, nbytes, scale                         */
+#define RANS_BITS       12          /* frequencies sum up to 1 << RANS_BITS     */
+#define RANS_M          (1u << RANS_BITS)
+#define RANS_L          (1u << 23)  /* lower bound of the coder state           */
+
+#define PLANE_CONST     0           /* all bytes of the plane are equal         */
+#define PLANE_RAW       1           /* bytes stored as they are                 */
+#define PLANE_RANS      2           /* bytes coded with rANS                    */
+#define PLANE_MAX       (3 + 3*256 + 4 + CORCODEC_BLOCK + 8)   /* rANS plane at most */
+
+/* function prototype for local use */
+static int      plane_encode  (const uint8_t *in, int n, uint8_t *out);
+static int      plane_decode  (const uint8_t *in, const uint8_t *end, int n, uint8_t *out);
+static int      rans_encode   (const uint8_t *in, int n, const uint32_t *freq,
+                               const uint32_t *start, uint8_t *out);
+static void     norm_freq     (const uint32_t *count, int n, uint32_t *freq);
+static uint32_t float_order   (float x);
+static float    order_float   (uint32_t u);
+static uint16_t float_half    (float x);
+static float    half_float    (uint16_t h);
+static long     block_encode  (int codec, const float *x, int n, uint8_t *out);
+static int      block_decode  (int codec, const uint8_t *in, const uint8_t *end,
+                               float *x, int *used);
+
+/*
+ *  corcodec_id
+ *
+ *  Description: codec number of "raw", "lossless", "int16" or "f16"
+ *
+ *  Return: codec number, -1 if unknown
+ *
+ */
+int corcodec_id(const char *name)
+{
+    if (strcmp(name, "raw")      == 0) return COR_RAW;
+    if (strcmp(name, "lossless") == 0) return COR_LOSSLESS;
+    if (strcmp(name, "int16")    == 0) return COR_INT16;
+    if (strcmp(name, "f16")      == 0) return COR_F16;
+    return -1;
+}
+
+/*
+ *  corcodec_bound
+ *
+ *  Description: size of the output buffer needed by corcodec_encode for
+ *      npts samples, whatever the codec
+ *
+ */
+size_t corcodec_bound(int npts)
+{
+    size_t nblock = ((size_t)npts + CORCODEC_BLOCK - 1) / CORCODEC_BLOCK;
+
+    return nblock * (BLOCK_HEAD + 4) + (size_t)npts * 4;
+}
+
+/*
+ *  corcodec_encode
+ *
+ *  Description: code npts samples with codec
+ *
+ *  IN:
+ *      int         codec : COR_RAW, COR_LOSSLESS, COR_INT16 or COR_F16
+ *      const float *x    : samples
+ *      int         npts  : number of samples
+ *  OUT:
+ *      unsigned char *out: coded record, corcodec_bound(npts) bytes at most
+ *
+ *  Return: size of the coded record, -1 if failed
+ *
+ */
+long corcodec_encode(int codec, const float *x, int npts, unsigned char *out)
+{
+    long nbytes = 0, nb;
+    int  i, n;
+
+    if (codec == COR_RAW) {
+        memcpy(out, x, (size_t)npts * sizeof(float));
+        return (long)npts * (long)sizeof(float);
+    }
+    if (codec < COR_LOSSLESS || codec > COR_F16) {
+        fprintf(stderr, "Unknown codec %d\n", codec);
+        return -1;
+    }
+
+    for (i = 0; i < npts; i += CORCODEC_BLOCK) {
+        n = npts - i < CORCODEC_BLOCK ? npts - i : CORCODEC_BLOCK;
+        if ((nb = block_encode(codec, x + i, n, out + nbytes)) == -1) return -1;
+        nbytes += nb;
+    }
+    return nbytes;
+}
+
+/*
+ *  cordec_init
+ *
+ *  Description: start streaming decode of a record of nbytes coded bytes
+ *
+ */
+void cordec_init(CORDEC *dec, int codec, const void *buf, size_t nbytes)
+{
+    dec->codec = codec;
+    dec->p     = (const unsigned char *)buf;
+    dec->end   = dec->p + nbytes;
+}
+
+/*
+ *  cordec_next
+ *
+ *  Description: decode the next block of a record
+ *
+ *  OUT:
+ *      float *out : CORCODEC_BLOCK samples at most
+ *
+ *  Return: number of samples decoded, 0 at the end of the record,
+ *      -1 if the record is corrupted
+ *
+ */
+int cordec_next(CORDEC *dec, float *out)
+{
+    int n, used;
+
+    if (dec->p >= dec->end) return 0;
+
+    if (dec->codec == COR_RAW) {
+        n = (int)((dec->end - dec->p) / sizeof(float));
+        if (n > CORCODEC_BLOCK) n = CORCODEC_BLOCK;
+        memcpy(out, dec->p, (size_t)n * sizeof(float));
+        dec->p += (size_t)n * sizeof(float);
+        return n;
+    }
+
+    if ((n = block_decode(dec->codec, dec->p, dec->end, out, &used)) == -1) {
+        fprintf(stderr, "Corrupted block in coded record\n");
+        dec->p = dec->end;
+        return -1;
+    }
+    dec->p += used;
+    return n;
+}
+
+/*
+ *  corcodec_decode
+ *
+ *  Description: decode a whole record of npts samples
+ *
+ *  Return: 0 if success, -1 if failed
+ *
+ */
+int corcodec_decode(int codec, const void *buf, size_t nbytes, float *x, int npts)
+{
+    CORDEC dec;
+    float  blk[CORCODEC_BLOCK];
+    int    n, k = 0;
+
+    cordec_init(&dec, codec, buf, nbytes);
+    while ((n = cordec_next(&dec, blk)) > 0) {
+        if (k + n > npts) return -1;
+        memcpy(x + k, blk, (size_t)n * sizeof(float));
+        k += n;
+    }
+    return (n == -1 || k != npts) ? -1 : 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  block_encode: one block of n samples, return its coded size
+ */
+static long block_encode(int codec, const float *x, int n, uint8_t *out)
+{
+    uint32_t v[CORCODEC_BLOCK], prev = 0, u;
+    uint8_t  plane[CORCODEC_BLOCK];
+    float    scale = 0.;
+    int      i, k, width, nbytes = 0;
+
+    if (codec != COR_LOSSLESS) {
+        for (i = 0; i < n; i ++) if (fabsf(x[i]) > scale) scale = fabsf(x[i]);
+    }
+    width = codec == COR_LOSSLESS ? 4 : 2;
+
+    /* integer values, delta coded and zigzagged */
+    for (i = 0; i < n; i ++) {
+        if (codec == COR_LOSSLESS)
+            u = float_order(x[i]);
+        else if (codec == COR_INT16) {
+            /* in double, so the only error is the rounding to 1/32767 of scale */
+            k = scale > 0. ? (int)lrint((double)x[i] / scale * 32767.) : 0;
+            u = (uint16_t)(int16_t)(k > 32767 ? 32767 : (k < -32767 ? -32767 : k));
+        }
+        else {
+            u = float_half(scale > 0. ? x[i] / scale : 0.f);
+            u = (u & 0x8000u) ? (~u & 0xffffu) : (u | 0x8000u);
+        }
+        if (width == 2) {
+            k = (int16_t)(uint16_t)(u - prev);
+            v[i] = (uint16_t)((k << 1) ^ (k >> 15));
+        }
+        else {
+            k = (int32_t)(u - prev);
+            v[i] = ((uint32_t)k << 1) ^ (uint32_t)(k >> 31);
+        }
+        prev = u;
+    }
+
+    /* byte planes */
+    for (k = 0; k < width; k ++) {
+        for (i = 0; i < n; i ++) plane[i] = (uint8_t)(v[i] >> (8*k));
+        nbytes += plane_encode(plane, n, out + BLOCK_HEAD + nbytes);
+    }
+
+    memcpy(out,     &n,      4);
+    memcpy(out + 4, &nbytes, 4);
+    memcpy(out + 8, &scale,  4);
+
+    return BLOCK_HEAD + nbytes;
+}
+
+/*
+ *  block_decode: one block into x, return the number of samples, -1 if failed
+ */
+static int block_decode(int codec, const uint8_t *in, const uint8_t *end, float *x, int *used)
+{
+    uint32_t v[CORCODEC_BLOCK], prev = 0, z, u;
+    uint8_t  plane[CORCODEC_BLOCK];
+    const uint8_t *p;
+    float    scale;
+    int      i, k, n, nbytes, width, np;
+
+    if (end - in < BLOCK_HEAD) return -1;
+    memcpy(&n,      in,     4);
+    memcpy(&nbytes, in + 4, 4);
+    memcpy(&scale,  in + 8, 4);
+    if (n <= 0 || n > CORCODEC_BLOCK || nbytes < 0 || end - in - BLOCK_HEAD < nbytes) return -1;
+    end = in + BLOCK_HEAD + nbytes;
+    width = codec == COR_LOSSLESS ? 4 : 2;
+
+    memset(v, 0, sizeof(uint32_t) * n);
+    for (k = 0, p = in + BLOCK_HEAD; k < width; k ++) {
+        if ((np = plane_decode(p, end, n, plane)) == -1) return -1;
+        for (i = 0; i < n; i ++) v[i] |= (uint32_t)plane[i] << (8*k);
+        p += np;
+    }
+
+    for (i = 0; i < n; i ++) {
+        z = v[i];
+        if (width == 2) u = (uint16_t)(prev + (uint16_t)((z >> 1) ^ (0u - (z & 1))));
+        else            u = prev + ((z >> 1) ^ (0u - (z & 1)));
+        prev = u;
+        if (codec == COR_LOSSLESS)   x[i] = order_float(u);
+        else if (codec == COR_INT16) x[i] = (float)((int16_t)(uint16_t)u * (double)scale / 32767.);
+        else {
+            u = (u & 0x8000u) ? (u & 0x7fffu) : (~u & 0xffffu);
+            x[i] = half_float((uint16_t)u) * scale;
+        }
+    }
+    *used = BLOCK_HEAD + nbytes;
+
+    return n;
+}
+
+/*
+ *  plane_encode: code n bytes as constant, raw or rANS, return coded size
+ */
+static int plane_encode(const uint8_t *in, int n, uint8_t *out)
+{
+    uint32_t count[256], freq[256], start[257];
+    uint16_t f16;
+    uint8_t  tmp[PLANE_MAX];                /* rANS plane, out only gets n + 1 bytes */
+    int      i, nsym = 0, nhead, nrans;
+
+    memset(count, 0, sizeof(count));
+    for (i = 0; i < n; i ++) count[in[i]] ++;
+    for (i = 0; i < 256; i ++) if (count[i]) nsym ++;
+
+    if (nsym == 1) {
+        out[0] = PLANE_CONST;
+        out[1] = in[0];
+        return 2;
+    }
+
+    /* frequency table: nsym, then (symbol, frequency) pairs */
+    norm_freq(count, n, freq);
+    start[0] = 0;
+    for (i = 0; i < 256; i ++) start[i+1] = start[i] + freq[i];
+
+    nhead = 3;
+    for (i = 0; i < 256; i ++) {
+        if (!freq[i]) continue;
+        f16 = (uint16_t)freq[i];
+        tmp[nhead] = (uint8_t)i;
+        memcpy(tmp + nhead + 1, &f16, 2);
+        nhead += 3;
+    }
+
+    /* raw bytes unless the coded plane is smaller */
+    nrans = nhead + 4 < n + 1 ? rans_encode(in, n, freq, start, tmp + nhead + 4) : -1;
+    if (nrans < 0 || nhead + 4 + nrans >= n + 1) {
+        out[0] = PLANE_RAW;
+        memcpy(out + 1, in, (size_t)n);
+        return n + 1;
+    }
+
+    tmp[0] = PLANE_RANS;
+    f16 = (uint16_t)nsym;                   /* 256 symbols wrap to 0 */
+    memcpy(tmp + 1, &f16, 2);
+    memcpy(tmp + nhead, &nrans, 4);
+    memcpy(out, tmp, (size_t)(nhead + 4 + nrans));
+
+    return nhead + 4 + nrans;
+}
+
+/*
+ *  plane_decode: decode n bytes of a plane, return its coded size, -1 if failed
+ */
+static int plane_decode(const uint8_t *in, const uint8_t *end, int n, uint8_t *out)
+{
+    uint32_t freq[256], start[256], x, slot;
+    uint16_t f16;
+    uint8_t  sym[RANS_M];
+    const uint8_t *p, *pend;
+    int      i, k, s, nsym, nrans;
+
+    if (end - in < 2) return -1;
+    if (in[0] == PLANE_CONST) {
+        memset(out, in[1], (size_t)n);
+        return 2;
+    }
+    if (in[0] == PLANE_RAW) {
+        if (end - in < n + 1) return -1;
+        memcpy(out, in + 1, (size_t)n);
+        return n + 1;
+    }
+    if (in[0] != PLANE_RANS || end - in < 3) return -1;
+
+    memcpy(&f16, in + 1, 2);
+    nsym = f16 == 0 ? 256 : f16;
+    if (end - in < 3 + 3*nsym + 4) return -1;
+
+    memset(freq, 0, sizeof(freq));
+    for (i = 0, p = in + 3; i < nsym; i ++, p += 3) {
+        memcpy(&f16, p + 1, 2);
+        freq[p[0]] = f16;
+    }
+    for (i = 0, k = 0; i < 256; i ++) {
+        start[i] = (uint32_t)k;
+        if (k + (int)freq[i] > (int)RANS_M) return -1;
+        memset(sym + k, i, freq[i]);
+        k += (int)freq[i];
+    }
+    if (k != (int)RANS_M) return -1;
+
+    memcpy(&nrans, p, 4);
+    p += 4;
+    if (nrans < 4 || end - p < nrans) return -1;
+    pend = p + nrans;
+
+    x = (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    p += 4;
+    for (i = 0; i < n; i ++) {
+        slot = x & (RANS_M - 1);
+        s = sym[slot];
+        out[i] = (uint8_t)s;
+        x = freq[s] * (x >> RANS_BITS) + slot - start[s];
+        while (x < RANS_L && p < pend) x = (x << 8) | *p ++;
+    }
+
+    return (int)(pend - in);
+}
+
+/*
+ *  rans_encode: code n bytes into n + 8 bytes at most, return the coded
+ *      size, -1 if it would not fit. Symbols are coded in reverse so that
+ *      they decode forward.
+ */
+static int rans_encode(const uint8_t *in, int n, const uint32_t *freq,
+                       const uint32_t *start, uint8_t *out)
+{
+    uint8_t  *buf, *ptr;
+    uint32_t x = RANS_L, xmax, f;
+    int      i, nbytes;
+
+    buf = (uint8_t *)malloc((size_t)n + 8);
+    ptr = buf + n + 8;
+    for (i = n - 1; i >= 0; i --) {
+        f = freq[in[i]];
+        xmax = ((RANS_L >> RANS_BITS) << 8) * f;
+        while (x >= xmax) {
+            *-- ptr = (uint8_t)(x & 0xff);
+            x >>= 8;
+            if (ptr - buf < 4) {
+                free(buf);
+                return -1;
+            }
+        }
+        x = ((x / f) << RANS_BITS) + (x % f) + start[in[i]];
+    }
+    ptr -= 4;
+    ptr[0] = (uint8_t)x; ptr[1] = (uint8_t)(x >> 8); ptr[2] = (uint8_t)(x >> 16); ptr[3] = (uint8_t)(x >> 24);
+
+    nbytes = (int)(buf + n + 8 - ptr);
+    memcpy(out, ptr, (size_t)nbytes);
+    free(buf);
+
+    return nbytes;
+}
+
+/*
+ *  norm_freq: scale symbol counts of n bytes to frequencies summing to RANS_M,
+ *      keeping every present symbol at least 1
+ */
+static void norm_freq(const uint32_t *count, int n, uint32_t *freq)
+{
+    uint32_t sum = 0;
+    int      i, imax = 0;
+
+    for (i = 0; i < 256; i ++) {
+        freq[i] = count[i] ? (uint32_t)((uint64_t)count[i] * RANS_M / (uint32_t)n) : 0;
+        if (count[i] && freq[i] == 0) freq[i] = 1;
+        sum += freq[i];
+        if (freq[i] > freq[imax]) imax = i;
+    }
+    if (sum < RANS_M) freq[imax] += RANS_M - sum;
+    while (sum > RANS_M) {
+        for (i = 0, imax = 0; i < 256; i ++) if (freq[i] > freq[imax]) imax = i;
+        freq[imax] --;
+        sum --;
+    }
+}
+
+/*
+ *  float_order: map float bits to unsigned integers of the same order, so
+ *      that close values differ by small integers
+ */
+static uint32_t float_order(float x)
+{
+    uint32_t u;
+
+    memcpy(&u, &x, 4);
+    return (u & 0x80000000u) ? ~u : (u | 0x80000000u);
+}
+
+static float order_float(uint32_t u)
+{
+    float x;
+
+    u = (u & 0x80000000u) ? (u & 0x7fffffffu) : ~u;
+    memcpy(&x, &u, 4);
+    return x;
+}
+
+/*
+ *  float_half: IEEE half float nearest to x (|x| <= 1 here), round to even
+ */
+static uint16_t float_half(float x)
+{
+    uint32_t u, sign, mant;
+    int      e;
+
+    memcpy(&u, &x, 4);
+    sign = (u >> 16) & 0x8000u;
+    e    = (int)((u >> 23) & 0xff) - 127 + 15;
+    mant = u & 0x7fffffu;
+
+    if (e >= 31) return (uint16_t)(sign | 0x7c00u);
+    if (e <= 0) {                               /* subnormal half */
+        if (e < -10) return (uint16_t)sign;
+        mant |= 0x800000u;
+        u = mant >> (14 - e);
+        if ((mant >> (13 - e)) & 1u && ((mant & ((1u << (13 - e)) - 1)) || (u & 1u))) u ++;
+        return (uint16_t)(sign | u);
+    }
+    u = ((uint32_t)e << 10) | (mant >> 13);
+    if ((mant & 0x1000u) && ((mant & 0xfffu) || (u & 1u))) u ++;
+    return (uint16_t)(sign | u);
+}
+
+/*
+ *  half_float: float value of an IEEE half float
+ */
+static float half_float(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000u) << 16, e = (h >> 10) & 0x1f, mant = h & 0x3ffu, u;
+    float    x;
+
+    if (e == 0) {
+        x = ldexpf((float)mant, -24);
+        return sign ? -x : x;
+    }
+    if (e == 31) u = sign | 0x7f800000u | (mant << 13);
+    else         u = sign | ((e - 15 + 127) << 23) | (mant << 13);
+    memcpy(&x, &u, 4);
+    return x;
+}
@@ -0,0 +1,57 @@
+/*******************************************************************************
+    Name:     corcodec.h
+
+    Purpose:  compression of correlation lags stored in a pack (corpack.h)
+
+    Notes:
+        Samples are coded in independent blocks of CORCODEC_BLOCK samples so
+        that a decoder can stream a record block by block, e.g. to stack it
+        without materializing the whole trace.
+
+        COR_LOSSLESS    float bits mapped to ordered integers, delta coded
+                        and zigzagged, split into byte planes (byte shuffle)
+                        and each plane entropy coded with a static rANS coder.
+        COR_INT16       lossy: samples scaled by the maximum absolute value
+                        of the block and rounded to int16, then coded as
+                        above. Error <= block maximum * (1/65534 + 2^-24),
+                        the last term the rounding of the decoded float.
+        COR_F16         lossy: samples divided by the block maximum and
+                        stored as IEEE half floats, then coded as above.
+                        Error <= block maximum * (2^-11 + 2^-24).
+
+        Each block is
+            int     n       samples in the block
+            int     nbytes  bytes following this 12 byte block header
+            float   scale   block maximum (lossy codecs), 0 otherwise
+        followed by one coded byte plane per byte of the integer values.
+*******************************************************************************/
+
+#ifndef _CORCODEC_H
+#define _CORCODEC_H
+
+#include <stddef.h>
+
+#define COR_RAW         0           /* float32 samples as written by write_sac  */
+#define COR_LOSSLESS    1
+#define COR_INT16       2
+#define COR_F16         3
+
+#define CORCODEC_BLOCK  4096        /* samples per block                        */
+#define CORCODEC_INT16_ERR  (1. / 65534. + 1. / 16777216.)    /* of the block maximum */
+#define CORCODEC_F16_ERR    (1. / 2048. + 1. / 16777216.)
+
+/* streaming decoder of one coded record */
+typedef struct cor_dec {
+    int     codec;
+    const unsigned char *p;         /* next block                               */
+    const unsigned char *end;       /* end of the coded record                  */
+} CORDEC;
+
+int corcodec_id ( const char *name );
+size_t corcodec_bound ( int npts );
+long corcodec_encode ( int codec, const float *x, int npts, unsigned char *out );
+void cordec_init ( CORDEC *dec, int codec, const void *buf, size_t nbytes );
+int cordec_next ( CORDEC *dec, float *out );
+int corcodec_decode ( int codec, const void *buf, size_t nbytes, float *x, int npts );
+
+#endif /* corcodec.h */
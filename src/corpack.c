@@ -0,0 +1,444 @@
+/*******************************************************************************
+ *                                  corpack.c                                  *
+ *  Container of many cross-correlations in one append-only file:              *
+ *      corpack_open     open a pack for appending ("a") or reading ("r")      *
+ *      corpack_close    close a pack                                          *
+ *      corpack_append   append one correlation                                *
+ *      corpack_codec    choose the codec of appended correlations             *
+ *      corpack_get      header and samples of the i-th correlation            *
+ *      corpack_read     decode the i-th correlation into a buffer             *
+ *      corpack_decoder  stream the i-th correlation block by block            *
+ *      corpack_find     look up a correlation by name                         *
+ *      corpack_export   write the i-th correlation as a SAC file              *
+ *      corpack_use      send correlations of cor_in_freq to a pack            *
+ *      corpack_write    write_sac compatible output into that pack            *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "corpack.h"
+#include "abcstat.h"
+
+/* pack receiving the correlations written through corpack_write */
+static CORPACK *cur_pack = NULL;
+
+/* function prototype for local use */
+static const char *record  (const CORPACK *pk, int i, CORREC *rec);
+static char   *map_file    (const char *name, size_t *len);
+static void    copy_str    (char *dst, const char *src, int n);
+static void    pad_str     (char *dst, const char *src, int n);
+
+/*
+ *  corpack_open
+ *
+ *  Description: Open a pack. In append mode ("a") the pack is created if
+ *      it does not exist. In read mode ("r") data and index are mapped.
+ *
+ *  IN:
+ *      const char *name : data file name, the index is name.idx
+ *      const char *mode : "a" or "r"
+ *
+ *  Return: pointer to the pack, NULL if failed.
+ *
+ */
+CORPACK *corpack_open(const char *name, const char *mode)
+{
+    CORPACK *pk;
+    char    idxname[512], head[CORPACK_HEAD_SIZE];
+
+    if (sizeof(CORREC) != 192 || sizeof(CORIDX) != 16) {
+        fprintf(stderr, "Mismatch in size of pack headers!\n");
+        return NULL;
+    }
+    snprintf(idxname, 512, "%s.idx", name);
+
+    pk = (CORPACK *)calloc(1, sizeof(CORPACK));
+
+    if (mode[0] == 'a') {
+        if ((pk->data = fopen(name, "ab")) == NULL ||
+            (pk->idx = fopen(idxname, "ab")) == NULL) {
+            fprintf(stderr, "Unable to open %s for appending\n", name);
+            corpack_close(pk);
+            return NULL;
+        }
+        fseek(pk->data, 0, SEEK_END);
+        if (ftell(pk->data) == 0) {
+            memset(head, 0, CORPACK_HEAD_SIZE);
+            memcpy(head, CORPACK_MAGIC, 8);
+            if (fwrite(head, CORPACK_HEAD_SIZE, 1, pk->data) != 1) {
+                fprintf(stderr, "Error in writing pack header %s\n", name);
+                corpack_close(pk);
+                return NULL;
+            }
+        }
+        fseek(pk->idx, 0, SEEK_END);
+        pk->nrec = (int)(ftell(pk->idx) / sizeof(CORIDX));
+        return pk;
+    }
+
+    if ((pk->map = map_file(name, &pk->maplen)) == NULL) {
+        corpack_close(pk);
+        return NULL;
+    }
+    if (pk->maplen < CORPACK_HEAD_SIZE || memcmp(pk->map, CORPACK_MAGIC, 8) != 0) {
+        fprintf(stderr, "Warning: %s not a correlation pack of this byte order.\n", name);
+        corpack_close(pk);
+        return NULL;
+    }
+    pk->index = (CORIDX *)map_file(idxname, &pk->idxlen);
+    pk->nrec = (int)(pk->idxlen / sizeof(CORIDX));
+
+    return pk;
+}
+
+/*
+ *  corpack_close
+ *
+ *  Description: flush and close an appended pack, or unmap a read pack
+ *
+ */
+void corpack_close(CORPACK *pk)
+{
+    if (pk == NULL) return;
+    if (cur_pack == pk) cur_pack = NULL;
+    if (pk->data != NULL) fclose(pk->data);
+    if (pk->idx  != NULL) fclose(pk->idx);
+    if (pk->buf  != NULL) free(pk->buf);
+    if (pk->map  != NULL) munmap(pk->map, pk->maplen);
+    if (pk->index != NULL) munmap(pk->index, pk->idxlen);
+    free(pk);
+}
+
+/*
+ *  corpack_append
+ *
+ *  Description: Append one correlation. The two stations are taken from
+ *      the correlation header as written by cor_in_freq: the event fields
+ *      hold the first station and the station fields the second one.
+ *      Coded lags are padded to 4 bytes so that every record stays aligned.
+ *
+ *  IN:
+ *      CORPACK     *pk   : pack opened in append mode
+ *      const char  *name : correlation name
+ *      SACHEAD     *hd   : header of the correlation
+ *      const float *data : hd->npts lags
+ *
+ *  Return: index of the new record, -1 if failed.
+ *
+ */
+int corpack_append(CORPACK *pk, const char *name, SACHEAD *hd, const float *data)
+{
+    CORREC  rec;
+    CORIDX  ent;
+    const void *lags = data;
+    long    nbytes = (long)hd->npts * (long)sizeof(float);
+    char    pad[4] = {0, 0, 0, 0};
+    STAT_BEGIN(STAT_WRITE);
+
+    if (pk->data == NULL) {
+        fprintf(stderr, "Pack not opened for appending\n");
+        return -1;
+    }
+
+    if (pk->codec != COR_RAW) {
+        if (pk->buflen < corcodec_bound(hd->npts)) {
+            pk->buflen = corcodec_bound(hd->npts);
+            pk->buf = (unsigned char *)realloc(pk->buf, pk->buflen);
+        }
+        if ((nbytes = corcodec_encode(pk->codec, data, hd->npts, pk->buf)) == -1) return -1;
+        lags = pk->buf;
+    }
+
+    memset(&rec, 0, sizeof(CORREC));
+    copy_str(rec.name, name, CORPACK_NAME_LEN);
+    copy_str(rec.sta1, hd->kevnm, CORPACK_STA_LEN);
+    copy_str(rec.sta2, hd->kstnm, CORPACK_STA_LEN);
+    rec.stla1 = hd->evla; rec.stlo1 = hd->evlo;
+    rec.stla2 = hd->stla; rec.stlo2 = hd->stlo;
+    rec.delta = hd->delta;
+    rec.b     = hd->b;
+    rec.dist  = hd->dist; rec.az = hd->az; rec.baz = hd->baz;
+    rec.npts  = hd->npts;
+    rec.nzyear = hd->nzyear; rec.nzjday = hd->nzjday; rec.nzhour = hd->nzhour;
+    rec.nzmin  = hd->nzmin;  rec.nzsec  = hd->nzsec;  rec.nzmsec = hd->nzmsec;
+    rec.codec  = pk->codec;
+    rec.nbytes = pk->codec == COR_RAW ? 0 : (int)nbytes;
+
+    memset(&ent, 0, sizeof(CORIDX));
+    ent.offset = (long long)ftell(pk->data);
+    ent.npts   = hd->npts;
+
+    if (fwrite(&rec, sizeof(CORREC), 1, pk->data) != 1 ||
+        fwrite(lags, 1, (size_t)nbytes, pk->data) != (size_t)nbytes ||
+        fwrite(pad, 1, (size_t)(-nbytes & 3), pk->data) != (size_t)(-nbytes & 3) ||
+        fflush(pk->data) != 0) {
+        fprintf(stderr, "Error in appending %s to pack\n", name);
+        return -1;
+    }
+    if (fwrite(&ent, sizeof(CORIDX), 1, pk->idx) != 1 || fflush(pk->idx) != 0) {
+        fprintf(stderr, "Error in appending %s to pack index\n", name);
+        return -1;
+    }
+
+    STAT_WRITE_BYTES(sizeof(CORREC) + nbytes + (-nbytes & 3) + sizeof(CORIDX));
+    STAT_END(STAT_WRITE);
+    return pk->nrec ++;
+}
+
+/*
+ *  corpack_codec
+ *
+ *  Description: code correlations appended from now on with codec
+ *      (COR_RAW, COR_LOSSLESS, COR_INT16 or COR_F16)
+ *
+ */
+void corpack_codec(CORPACK *pk, int codec)
+{
+    pk->codec = codec;
+}
+
+/*
+ *  corpack_get
+ *
+ *  Description: header and samples of the i-th correlation of a pack
+ *      opened in read mode. The samples are not copied.
+ *
+ *  OUT:
+ *      CORREC *rec : header of the record, may be NULL
+ *
+ *  Return: pointer to the rec->npts lags inside the mapped pack, NULL if
+ *      failed or if the lags are compressed (see corpack_read).
+ *
+ */
+const float *corpack_get(const CORPACK *pk, int i, CORREC *rec)
+{
+    CORREC  r;
+    const char *lags;
+
+    if ((lags = record(pk, i, &r)) == NULL || r.codec != COR_RAW) return NULL;
+    if (rec != NULL) *rec = r;
+
+    return (const float *)lags;
+}
+
+/*
+ *  corpack_read
+ *
+ *  Description: header and samples of the i-th correlation of a pack
+ *      opened in read mode, decoded if compressed
+ *
+ *  OUT:
+ *      CORREC *rec  : header of the record, may be NULL
+ *      float  *data : rec->npts lags (npts of the index entry)
+ *
+ *  Return: 0 if success, -1 if failed
+ *
+ */
+int corpack_read(const CORPACK *pk, int i, CORREC *rec, float *data)
+{
+    CORREC  r;
+    const char *lags;
+
+    if ((lags = record(pk, i, &r)) == NULL) return -1;
+    if (rec != NULL) *rec = r;
+    if (r.codec == COR_RAW) {
+        memcpy(data, lags, (size_t)r.npts * sizeof(float));
+        return 0;
+    }
+    return corcodec_decode(r.codec, lags, (size_t)r.nbytes, data, r.npts);
+}
+
+/*
+ *  corpack_decoder
+ *
+ *  Description: start decoding the i-th correlation block by block with
+ *      cordec_next, without copying or decoding the whole record
+ *
+ *  Return: 0 if success, -1 if failed
+ *
+ */
+int corpack_decoder(const CORPACK *pk, int i, CORREC *rec, CORDEC *dec)
+{
+    CORREC  r;
+    const char *lags;
+
+    if ((lags = record(pk, i, &r)) == NULL) return -1;
+    if (rec != NULL) *rec = r;
+    cordec_init(dec, r.codec, lags, r.codec == COR_RAW ?
+                (size_t)r.npts * sizeof(float) : (size_t)r.nbytes);
+
+    return 0;
+}
+
+/*
+ *  corpack_find
+ *
+ *  Description: index of the last correlation named name, -1 if none;
+ *      entries of the index beyond the end of the pack are passed over
+ *
+ */
+int corpack_find(const CORPACK *pk, const char *name)
+{
+    int i;
+
+    if (pk->map == NULL) return -1;
+    for (i = pk->nrec - 1; i >= 0; i --)
+        if ((size_t)pk->index[i].offset + sizeof(CORREC) <= pk->maplen &&
+            strncmp(pk->map + pk->index[i].offset, name, CORPACK_NAME_LEN) == 0) return i;
+
+    return -1;
+}
+
+/*
+ *  corpack_export
+ *
+ *  Description: write the i-th correlation of a pack as a SAC file
+ *
+ *  Return: 0 if success, -1 if failed
+ *
+ */
+int corpack_export(const CORPACK *pk, int i, const char *sacout)
+{
+    CORREC  rec;
+    SACHEAD hd;
+    float   *data;
+    int     error;
+
+    if (i < 0 || i >= pk->nrec) return -1;
+    data = (float *)malloc(sizeof(float) * pk->index[i].npts);
+    if (corpack_read(pk, i, &rec, data) == -1) {
+        free(data);
+        return -1;
+    }
+
+    hd = new_sac_head(rec.delta, rec.npts, rec.b);
+    hd.evla = rec.stla1; hd.evlo = rec.stlo1;
+    hd.stla = rec.stla2; hd.stlo = rec.stlo2;
+    hd.dist = rec.dist;  hd.az = rec.az; hd.baz = rec.baz;
+    hd.nzyear = rec.nzyear; hd.nzjday = rec.nzjday; hd.nzhour = rec.nzhour;
+    hd.nzmin  = rec.nzmin;  hd.nzsec  = rec.nzsec;  hd.nzmsec = rec.nzmsec;
+    hd.iztype = IB;
+    pad_str(hd.kevnm, rec.sta1, 16);
+    pad_str(hd.kstnm, rec.sta2, 8);
+
+    error = write_sac(sacout, hd, data);
+    free(data);
+    return error;
+}
+
+/*
+ *  corpack_use
+ *
+ *  Description: make corpack_write append to pk, NULL to stop
+ *
+ */
+void corpack_use(CORPACK *pk)
+{
+    cur_pack = pk;
+}
+
+/*
+ *  corpack_write
+ *
+ *  Description: same interface as write_sac, but appends the correlation
+ *      to the pack selected with corpack_use. Given to set_cor_writer, it
+ *      redirects the output of cor_in_freq and cor_bands into the pack.
+ *
+ *  Return: 0 if success, -1 if failed
+ *
+ */
+int corpack_write(const char *name, SACHEAD hd, const float *data)
+{
+    if (cur_pack == NULL) return write_sac(name, hd, data);
+    return corpack_append(cur_pack, name, &hd, data) == -1 ? -1 : 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  record: header of the i-th record and pointer to its (coded) lags,
+ *      checked against the size of the pack
+ */
+static const char *record(const CORPACK *pk, int i, CORREC *rec)
+{
+    const CORIDX *ent;
+    size_t  nbytes;
+
+    if (pk->map == NULL || i < 0 || i >= pk->nrec) return NULL;
+    ent = &pk->index[i];
+    if ((size_t)ent->offset + sizeof(CORREC) > pk->maplen) {
+        fprintf(stderr, "Record %d beyond the end of pack\n", i);
+        return NULL;
+    }
+    memcpy(rec, pk->map + ent->offset, sizeof(CORREC));
+    nbytes = rec->codec == COR_RAW ? (size_t)rec->npts * sizeof(float) : (size_t)rec->nbytes;
+    if ((size_t)ent->offset + sizeof(CORREC) + nbytes > pk->maplen) {
+        fprintf(stderr, "Record %d beyond the end of pack\n", i);
+        return NULL;
+    }
+
+    return pk->map + ent->offset + sizeof(CORREC);
+}
+
+/*
+ *  map_file: map a whole file read-only, NULL if failed or empty
+ */
+static char *map_file(const char *name, size_t *len)
+{
+    struct stat st;
+    char   *map;
+    int    fd;
+
+    *len = 0;
+    if ((fd = open(name, O_RDONLY)) == -1) {
+        fprintf(stderr, "Unable to open %s\n", name);
+        return NULL;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    map = (char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s\n", name);
+        return NULL;
+    }
+    *len = (size_t)st.st_size;
+
+    return map;
+}
+
+/*
+ *  copy_str: copy a string into a field of n bytes without trailing blanks
+ */
+static void copy_str(char *dst, const char *src, int n)
+{
+    int i;
+
+    snprintf(dst, (size_t)n, "%.*s", n - 1, src);
+    for (i = (int)strlen(dst); i > 0 && dst[i-1] == ' '; i --) dst[i-1] = '\0';
+}
+
+/*
+ *  pad_str: a string into a SAC header field of n characters, padded with
+ *      blanks as SAC writes them
+ */
+static void pad_str(char *dst, const char *src, int n)
+{
+    int i;
+
+    snprintf(dst, (size_t)n + 1, "%.*s", n, src);
+    for (i = (int)strlen(dst); i < n; i ++) dst[i] = ' ';
+    dst[n] = '\0';
+}
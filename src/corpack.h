@@ -0,0 +1,91 @@
+/*******************************************************************************
+    Name:     corpack.h
+
+    Purpose:  append-only container holding many cross-correlations in one
+        file, instead of one small SAC file per station pair
+
+    Notes:
+        A pack is two files:
+            name        file header, then for each correlation a compact
+                        CORREC header followed by its npts float samples
+            name.idx    one CORIDX entry per correlation, giving the offset
+                        of its CORREC in the data file
+
+        Correlations are only ever appended. The data of a record is written
+        before its index entry, so a run that dies while appending leaves a
+        pack whose index still describes only complete records.
+
+        For reading, both files are mapped into memory, so record i is found
+        in O(1) through the index and its samples are used in place.
+
+        Values are stored in the byte order of the machine that wrote the
+        pack; CORPACK_MAGIC tells whether it matches the reader.
+
+        The lags of a record may be compressed with one of the codecs of
+        corcodec.h, chosen per pack with corpack_codec. Compressed records
+        are read with corpack_read, or block by block with corpack_decoder.
+*******************************************************************************/
+
+#ifndef _CORPACK_H
+#define _CORPACK_H
+
+#include <stdio.h>
+#include "sacio.h"
+#include "corcodec.h"
+
+#define CORPACK_MAGIC       "ABCPACK1"
+#define CORPACK_HEAD_SIZE   64          /* size of the file header on disk  */
+#define CORPACK_NAME_LEN    64
+#define CORPACK_STA_LEN     16
+
+/* compact header of one correlation, 192 bytes on disk */
+typedef struct cor_rec {
+    char    name[CORPACK_NAME_LEN]; /* correlation name (COR_STA1_STA2.SAC)  */
+    char    sta1[CORPACK_STA_LEN];  /* first station, the virtual source     */
+    char    sta2[CORPACK_STA_LEN];  /* second station, the virtual receiver  */
+    float   stla1, stlo1;           /* coordinates of the first station      */
+    float   stla2, stlo2;           /* coordinates of the second station     */
+    float   delta;                  /* sampling interval                     */
+    float   b;                      /* lag time of the first sample          */
+    float   dist, az, baz;          /* interstation distance and azimuths    */
+    int     npts;                   /* number of lags                        */
+    int     nzyear, nzjday, nzhour; /* reference time of the data window     */
+    int     nzmin, nzsec, nzmsec;
+    int     codec;                  /* codec of the lags, COR_RAW if 0       */
+    int     nbytes;                 /* size of the coded lags, 0 if raw      */
+    int     reserved[6];
+} CORREC;
+
+/* index entry of one correlation, 16 bytes on disk */
+typedef struct cor_idx {
+    long long offset;               /* offset of the CORREC in data file     */
+    int     npts;                   /* number of lags                        */
+    int     reserved;
+} CORIDX;
+
+typedef struct cor_pack {
+    FILE    *data;                  /* data file, append mode only           */
+    FILE    *idx;                   /* index file, append mode only          */
+    char    *map;                   /* mapped data file, read mode only      */
+    size_t  maplen;
+    CORIDX  *index;                 /* mapped index file, read mode only     */
+    size_t  idxlen;
+    int     nrec;                   /* number of correlations                */
+    int     codec;                  /* codec of appended records             */
+    unsigned char *buf;             /* coding buffer of appended records     */
+    size_t  buflen;
+} CORPACK;
+
+CORPACK *corpack_open ( const char *name, const char *mode );
+void corpack_close ( CORPACK *pk );
+int corpack_append ( CORPACK *pk, const char *name, SACHEAD *hd, const float *data );
+void corpack_codec ( CORPACK *pk, int codec );
+const float *corpack_get ( const CORPACK *pk, int i, CORREC *rec );
+int corpack_read ( const CORPACK *pk, int i, CORREC *rec, float *data );
+int corpack_decoder ( const CORPACK *pk, int i, CORREC *rec, CORDEC *dec );
+int corpack_find ( const CORPACK *pk, const char *name );
+int corpack_export ( const CORPACK *pk, int i, const char *sacout );
+void corpack_use ( CORPACK *pk );
+int corpack_write ( const char *name, SACHEAD hd, const float *data );
+
+#endif /* corpack.h */
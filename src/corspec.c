@@ -0,0 +1,511 @@
+/*******************************************************************************
+ *                                  corspec.c                                  *
+ *  Correlation from spectra held within a memory budget, see corspec.h:       *
+ *      spec_size        read a size "512M", "4G"                              *
+ *      spec_run         correlate the lines, window by window                 *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fftw3.h>
+#include "corspec.h"
+#include "xspec.h"
+#include "abcstat.h"
+
+/* station window of a window of lines */
+typedef struct spec_sta {
+    const char *name;
+    long    first;                  /* first mention in the window          */
+    int     k;                      /* station of the window, in order of   */
+                                    /* first mention                        */
+    SACHEAD hd;                     /* of the cut window                    */
+    char    why[128];               /* stage that failed, "" if good        */
+} SPECSTA;
+
+/* line of a window, by the pair of tiles of its stations */
+typedef struct spec_pair {
+    int     a, b;                   /* tiles, a <= b                        */
+    long    j;                      /* line of the window                   */
+} SPECPAIR;
+
+/* spectra of the tiles held, and the scratch file of all of them */
+typedef struct spec_tiles {
+    double  *buf[2];                /* tiles held, spectra of 2*nfft: the   */
+                                    /* real parts, then the imaginary ones  */
+    fftw_complex *work;             /* spectrum of FFTW, of a station or of */
+                                    /* a pair                               */
+    XSPEC   cross;                  /* cross spectrum of a pair             */
+    int     held[2];                /* which, -1 for none                   */
+    int     tile, nfft;             /* spectra per tile, points of one      */
+    int     fd;                     /* scratch file, -1 until spilt         */
+    long    nspill, nread;          /* tiles written and read back          */
+} SPECTILES;
+
+/* function prototype for local use */
+static int  line_cmp     (const void *a, const void *b);
+static int  group_cmp    (const void *a, const void *b);
+static int  name_cmp     (const void *a, const void *b);
+static int  key_cmp      (const void *a, const void *b);
+static int  first_cmp    (const void *a, const void *b);
+static int  pair_cmp     (const void *a, const void *b);
+static int  window_run   (SPECLINE *ln, const long *ix, long m, long long budget, const char *scratch,
+                          const SACINDEX *idx, void (*fail)( long item, const char *why ), SPECTILES *tl);
+static void line_cor     (const SPECLINE *l, const SPECSTA *s1, const SPECSTA *s2, SPECTILES *tl,
+                          void (*fail)( long item, const char *why ));
+static int  sta_spec     (SPECSTA *st, const SPECLINE *l, const SACINDEX *idx, float **w, char *mask,
+                          fftw_complex *work, XSPEC *spec);
+static int  tiles_hold   (SPECTILES *tl, int a, int b, int nsta);
+static XSPEC tile_spec   (SPECTILES *tl, int k);
+static int  scratch_io   (int fd, char *buf, size_t n, off_t off, int wr);
+
+/* lines of spec_run, for the comparisons of qsort */
+static const SPECLINE *cmp_ln = NULL;
+
+/*
+ *  spec_size
+ *
+ *  Description: read a size of bytes, with K, M or G for 2^10, 2^20 or
+ *      2^30 of them
+ *
+ *  Return: number of bytes, -1 if not a size.
+ *
+ */
+long long spec_size(const char *arg)
+{
+    double v;
+    char   u = '\0', c;
+    int    nf;
+
+    nf = sscanf(arg, "%lf%c%c", &v, &u, &c);
+    if (nf < 1 || nf > 2 || !(v > 0.)) return -1;
+    switch (u) {
+        case '\0':           break;
+        case 'k': case 'K':  v *= 1024.; break;
+        case 'm': case 'M':  v *= 1024. * 1024.; break;
+        case 'g': case 'G':  v *= 1024. * 1024. * 1024.; break;
+        default:             return -1;
+    }
+    return (long long)v;
+}
+
+/*
+ *  spec_run
+ *
+ *  Description: Correlate n lines of file.lst from the spectra of their
+ *      station windows, the spectra of a window held within budget bytes
+ *      and spilt to the file scratch if they do not fit. The windows are
+ *      taken in the order of their first lines, the correlations go out
+ *      through the cor_writer of sacio.
+ *
+ *  IN:
+ *      SPECLINE *ln        : the lines
+ *      long n              : number of lines
+ *      long long budget    : bytes of spectra held in memory
+ *      const char *scratch : scratch file, made and removed by spec_run
+ *      const SACINDEX *idx : index the windows are stitched from, NULL to
+ *                            cut them from the files of the lines
+ *      fail                : called with the line and reason of each line
+ *                            that failed
+ *
+ *  Return: 0 if succeed, -1 if the budget is too small for the spectra of
+ *      a window or the scratch file could not be used.
+ *
+ */
+int spec_run(SPECLINE *ln, long n, long long budget, const char *scratch, const SACINDEX *idx,
+             void (*fail)( long item, const char *why ))
+{
+    SPECTILES tl;
+    long      *ix, (*grp)[2], ngrp = 0, i, nsta = 0;
+    int       ret = 0;
+
+    if (n == 0) return 0;
+    ix = (long *)malloc(sizeof(long) * n);
+    grp = (long (*)[2])malloc(sizeof(long) * 2 * n);
+    if (ix == NULL || grp == NULL) {
+        fprintf(stderr, "Out of memory planning %ld lines\n", n);
+        free(ix); free(grp);
+        return -1;
+    }
+
+    /* lines of a window together, in input order; the windows in the order of their first lines */
+    for (i = 0; i < n; i ++) ix[i] = i;
+    cmp_ln = ln;
+    qsort(ix, n, sizeof(long), line_cmp);
+    for (i = 0; i < n; i ++) {
+        if (i == 0 || group_cmp(&ln[ix[i-1]], &ln[ix[i]]) != 0) {
+            grp[ngrp][0] = i;
+            ngrp ++;
+        }
+    }
+    for (i = 0; i < ngrp; i ++) grp[i][1] = ln[ix[grp[i][0]]].item;
+    /* by first line: insertion, the windows come mostly in order already */
+    for (i = 1; i < ngrp; i ++) {
+        long g0 = grp[i][0], g1 = grp[i][1], j;
+        for (j = i; j > 0 && grp[j-1][1] > g1; j --) { grp[j][0] = grp[j-1][0]; grp[j][1] = grp[j-1][1]; }
+        grp[j][0] = g0; grp[j][1] = g1;
+    }
+
+    memset(&tl, 0, sizeof(tl));
+    tl.fd = -1;
+    for (i = 0; i < ngrp && ret == 0; i ++) {
+        long b = grp[i][0], e;
+        for (e = b + 1; e < n && group_cmp(&ln[ix[b]], &ln[ix[e]]) == 0; e ++) ;
+        if ((ret = window_run(ln, ix + b, e - b, budget, scratch, idx, fail, &tl)) > 0) {
+            nsta += ret;
+            ret = 0;
+        }
+    }
+    if (tl.fd != -1) close(tl.fd);
+    fftw_free(tl.buf[0]); fftw_free(tl.buf[1]);
+    fftw_free(tl.work); xspec_free(&tl.cross);
+    fprintf(stderr, "Spectra: %ld station windows of %ld windows, %ld tiles spilt, %ld read back\n",
+        nsta, ngrp, tl.nspill, tl.nread);
+    free(ix); free(grp);
+    return ret;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  group_cmp: windows of two lines, 0 if the same one
+ */
+static int group_cmp(const void *a, const void *b)
+{
+    const SPECLINE *l1 = (const SPECLINE *)a, *l2 = (const SPECLINE *)b;
+    int k;
+
+    if (l1->evt0 != l2->evt0) return l1->evt0 < l2->evt0 ? -1 : 1;
+    if (l1->start0 != l2->start0) return l1->start0 < l2->start0 ? -1 : 1;
+    if (l1->cut_npts != l2->cut_npts) return l1->cut_npts < l2->cut_npts ? -1 : 1;
+    if (l1->npts != l2->npts) return l1->npts < l2->npts ? -1 : 1;
+    for (k = 0; k < 4; k ++)
+        if (l1->band[k] != l2->band[k]) return l1->band[k] < l2->band[k] ? -1 : 1;
+    return 0;
+}
+
+/*
+ *  line_cmp: by window, then line
+ */
+static int line_cmp(const void *a, const void *b)
+{
+    long i1 = *(const long *)a, i2 = *(const long *)b;
+    int  c = group_cmp(&cmp_ln[i1], &cmp_ln[i2]);
+
+    if (c != 0) return c;
+    return i1 < i2 ? -1 : i1 > i2;
+}
+
+/*
+ *  name_cmp: by station, then first mention
+ */
+static int name_cmp(const void *a, const void *b)
+{
+    const SPECSTA *s1 = (const SPECSTA *)a, *s2 = (const SPECSTA *)b;
+    int c = strcmp(s1->name, s2->name);
+
+    if (c != 0) return c;
+    return s1->first < s2->first ? -1 : s1->first > s2->first;
+}
+
+/*
+ *  key_cmp: by station only, for bsearch
+ */
+static int key_cmp(const void *a, const void *b)
+{
+    return strcmp(((const SPECSTA *)a)->name, ((const SPECSTA *)b)->name);
+}
+
+/*
+ *  first_cmp: stations by first mention
+ */
+static int first_cmp(const void *a, const void *b)
+{
+    long f1 = (*(SPECSTA * const *)a)->first, f2 = (*(SPECSTA * const *)b)->first;
+
+    return f1 < f2 ? -1 : f1 > f2;
+}
+
+/*
+ *  pair_cmp: by row a, tile b, then line
+ */
+static int pair_cmp(const void *a, const void *b)
+{
+    const SPECPAIR *p1 = (const SPECPAIR *)a, *p2 = (const SPECPAIR *)b;
+
+    if (p1->a != p2->a) return p1->a < p2->a ? -1 : 1;
+    if (p1->b != p2->b) return p1->b < p2->b ? -1 : 1;
+    return p1->j < p2->j ? -1 : p1->j > p2->j;
+}
+
+/*
+ *  window_run: the m lines ix of a window, return its number of stations,
+ *      -1 if its spectra could not be held or spilt
+ */
+static int window_run(SPECLINE *ln, const long *ix, long m, long long budget, const char *scratch,
+                      const SACINDEX *idx, void (*fail)( long item, const char *why ), SPECTILES *tl)
+{
+    SPECSTA  *st, **ord, key;
+    SPECPAIR *pr;
+    const SPECLINE *l = &ln[ix[0]];
+    float    *w[3] = { NULL, NULL, NULL };
+    char     *mask;
+    int      *k1, *k2, nsta, nfft, ntile, t, s, a, dir = 1, ret = -1;
+    long     j, e, r, q, b0, b1, nst = 0;
+    long long size, fit;
+
+    st = (SPECSTA *)calloc(2 * m, sizeof(SPECSTA));
+    ord = (SPECSTA **)malloc(sizeof(SPECSTA *) * 2 * m);
+    pr = (SPECPAIR *)malloc(sizeof(SPECPAIR) * m);
+    k1 = (int *)malloc(sizeof(int) * m);
+    k2 = (int *)malloc(sizeof(int) * m);
+    for (t = 0; t < 3; t ++) w[t] = (float *)malloc(sizeof(float) * l->cut_npts);
+    mask = (char *)malloc(l->cut_npts);
+    if (st == NULL || ord == NULL || pr == NULL || k1 == NULL || k2 == NULL ||
+        w[0] == NULL || w[1] == NULL || w[2] == NULL || mask == NULL) {
+        fprintf(stderr, "Out of memory for a window of %ld lines\n", m);
+        goto done;
+    }
+
+    /* stations of the window, once each, in the order they first come */
+    for (j = 0; j < m; j ++) {
+        st[2*j].name = ln[ix[j]].sac1;   st[2*j].first = 2*j;
+        st[2*j+1].name = ln[ix[j]].sac2; st[2*j+1].first = 2*j+1;
+    }
+    qsort(st, 2 * m, sizeof(SPECSTA), name_cmp);
+    for (j = 0; j < 2 * m; j ++)
+        if (nst == 0 || strcmp(st[nst-1].name, st[j].name) != 0) st[nst++] = st[j];
+    for (j = 0; j < nst; j ++) ord[j] = &st[j];
+    qsort(ord, nst, sizeof(SPECSTA *), first_cmp);
+    for (j = 0; j < nst; j ++) ord[j]->k = (int)j;
+    for (j = 0; j < m; j ++) {
+        key.name = ln[ix[j]].sac1;
+        k1[j] = ((SPECSTA *)bsearch(&key, st, nst, sizeof(SPECSTA), key_cmp))->k;
+        key.name = ln[ix[j]].sac2;
+        k2[j] = ((SPECSTA *)bsearch(&key, st, nst, sizeof(SPECSTA), key_cmp))->k;
+    }
+    nsta = (int)nst;
+
+    /* tiles of the spectra: all of them if they fit, else as many as two tiles hold */
+    nfft = pow_next2(l->cut_npts);
+    size = (long long)sizeof(fftw_complex) * nfft;
+    fit = (long long)nsta * size <= budget ? nsta : budget / (2 * size);
+    if (fit < 1) {
+        fprintf(stderr, "A memory limit of %lld bytes holds not two spectra of %lld bytes\n", budget, size);
+        goto done;
+    }
+    t = fit < nsta ? (int)fit : nsta;
+    ntile = (nsta + t - 1) / t;
+    if (tl->tile != t || tl->nfft != nfft || (ntile > 1 && tl->buf[1] == NULL)) {
+        fftw_free(tl->buf[0]); fftw_free(tl->buf[1]);
+        fftw_free(tl->work); xspec_free(&tl->cross);
+        tl->buf[0] = (double *)fftw_malloc(size * t);
+        tl->buf[1] = ntile > 1 ? (double *)fftw_malloc(size * t) : NULL;
+        tl->work = (fftw_complex *)fftw_malloc(size);
+        tl->tile = t;
+        tl->nfft = nfft;
+        if (tl->buf[0] == NULL || (ntile > 1 && tl->buf[1] == NULL) || tl->work == NULL ||
+            xspec_alloc(&tl->cross, nfft) == -1) {
+            fprintf(stderr, "Out of memory for %d spectra of %lld bytes\n", 2 * t, size);
+            fftw_free(tl->buf[0]); fftw_free(tl->buf[1]);
+            fftw_free(tl->work); xspec_free(&tl->cross);
+            tl->buf[0] = tl->buf[1] = NULL;
+            tl->work = NULL;
+            tl->tile = 0;
+            goto done;
+        }
+        STAT_ALLOC(size * t * (ntile > 1 ? 2 : 1));
+    }
+    tl->held[0] = tl->held[1] = -1;
+    if (ntile > 1 && tl->fd == -1) {
+        /* removed at once, nothing is left behind however the run ends */
+        if ((tl->fd = open(scratch, O_RDWR | O_CREAT | O_TRUNC, 0600)) == -1) {
+            fprintf(stderr, "Unable to open scratch file %s\n", scratch);
+            goto done;
+        }
+        unlink(scratch);
+    }
+
+    /* spectra of each tile once, spilt in tile order */
+    for (a = 0; a < ntile; a ++) {
+        tl->held[0] = a;
+        for (s = a * t; s < nsta && s < (a + 1) * t; s ++) {
+            XSPEC spec = tile_spec(tl, s);
+            sta_spec(ord[s], l, idx, w, mask, tl->work, &spec);
+        }
+        if (ntile == 1) break;
+        if (scratch_io(tl->fd, (char *)tl->buf[0], size * (s - a * t), (off_t)size * t * a, 1) == -1) {
+            fprintf(stderr, "Unable to spill spectra to %s\n", scratch);
+            goto done;
+        }
+        tl->nspill ++;
+    }
+
+    /* lines by the pair of tiles of their stations, the rows up and down in turn */
+    for (j = 0; j < m; j ++) {
+        pr[j].a = (k1[j] < k2[j] ? k1[j] : k2[j]) / t;
+        pr[j].b = (k1[j] < k2[j] ? k2[j] : k1[j]) / t;
+        pr[j].j = j;
+    }
+    qsort(pr, m, sizeof(SPECPAIR), pair_cmp);
+    for (r = 0; r < m; r = e) {
+        for (e = r; e < m && pr[e].a == pr[r].a; e ++) ;
+        for (q = dir > 0 ? r : e - 1; q >= r && q < e; q = dir > 0 ? b1 : b0 - 1) {
+            /* lines [b0, b1) of tiles (a, b), in input order whichever way the row goes */
+            for (b0 = q; b0 > r && pr[b0-1].b == pr[q].b; b0 --) ;
+            for (b1 = q + 1; b1 < e && pr[b1].b == pr[q].b; b1 ++) ;
+            if (tiles_hold(tl, pr[q].a, pr[q].b, nsta) == -1) {
+                fprintf(stderr, "Unable to read spectra back from %s\n", scratch);
+                goto done;
+            }
+            for (j = b0; j < b1; j ++)
+                line_cor(&ln[ix[pr[j].j]], ord[k1[pr[j].j]], ord[k2[pr[j].j]], tl, fail);
+        }
+        dir = -dir;
+    }
+    ret = nsta;
+
+done:
+    free(st); free(ord); free(pr); free(k1); free(k2);
+    for (t = 0; t < 3; t ++) free(w[t]);
+    free(mask);
+    return ret;
+}
+
+/*
+ *  line_cor: correlation of a line from the spectra of its stations s1 and
+ *      s2, as cor_data makes it, the cross spectrum by the kernel of xspec
+ */
+static void line_cor(const SPECLINE *l, const SPECSTA *s1, const SPECSTA *s2, SPECTILES *tl,
+                     void (*fail)( long item, const char *why ))
+{
+    SACHEAD hd = s1->hd, h2 = s2->hd;
+    XSPEC   x, y;
+    float   *cor_xy;
+    char    why[128];
+    int     lag_n, nfft = tl->nfft;
+    STAT_BEGIN(STAT_COR);
+
+    if (s1->why[0] || s2->why[0]) {
+        fail(l->item, s1->why[0] ? s1->why : s2->why);
+        return;
+    }
+    snprintf(why, sizeof(why), "cor_in_freq %s", l->cor_name);
+    if (fabs(hd.delta - h2.delta) >= 1.0e-4) {
+        fprintf(stderr, "Temporal sampling intervals %g and %g are not same!\n", hd.delta, h2.delta);
+        fail(l->item, why);
+        return;
+    }
+    lag_n = (int)(l->lag_time / hd.delta);
+    if (lag_n > nfft / 2) {
+        fprintf(stderr, "Lag time is too long!\n");
+        lag_n = nfft / 2 - 1;
+    }
+    cor_xy = (float *)malloc(sizeof(float) * (2 * lag_n + 1));
+    x = tile_spec(tl, s1->k);
+    y = tile_spec(tl, s2->k);
+    xspec_cross(&x, &y, 1, &tl->cross, 0);
+    xspec_join(&tl->cross, tl->work);
+    cor_lags(tl->work, nfft, lag_n, cor_xy);
+    cor_head(&hd, &h2, lag_n);
+    if (cor_write(l->cor_name, hd, cor_xy, 2 * lag_n + 1) == -1) fail(l->item, why);
+    else STAT_PAIR();
+    free(cor_xy);
+    STAT_END(STAT_COR);
+}
+
+/*
+ *  sta_spec: cut, band-pass, normalization and whitening of a station window
+ *      as the chain of files does them, and its spectrum; -1 with the stage
+ *      in st->why if failed
+ */
+static int sta_spec(SPECSTA *st, const SPECLINE *l, const SACINDEX *idx, float **w, char *mask,
+                    fftw_complex *work, XSPEC *spec)
+{
+    int n = l->cut_npts;
+
+    st->why[0] = '\0';
+    STAT_BEGIN(STAT_CUT);
+    if (idx ? sac_index_data(idx, st->name, l->evt0 + l->start0, n, w[0], mask, &st->hd) <= 0
+            : cut_window(st->name, l->evt0, l->start0, n, w[0], mask, &st->hd) == -1) {
+        snprintf(st->why, sizeof(st->why), "cut %s", st->name);
+        return -1;
+    }
+    STAT_END(STAT_CUT);
+
+    STAT_BEGIN(STAT_BP);
+    bp_data(w[0], w[1], &st->hd, l->band[0], l->band[1], l->band[2], l->band[3], 10);
+    STAT_END(STAT_BP);
+    STAT_BEGIN(STAT_NORMAL);
+    normal_transient(w[1], w[2], n, st->hd.delta, l->npts, NULL);
+    STAT_END(STAT_NORMAL);
+    STAT_BEGIN(STAT_WHITEN);
+    spe_whi_data(w[2], w[2], n, st->hd.delta, 20, l->band[0], l->band[1], l->band[2], l->band[3]);
+    cor_fft(w[2], n, spec->n, work);
+    xspec_split(work, spec);
+    STAT_END(STAT_WHITEN);
+    return 0;
+}
+
+/*
+ *  tiles_hold: tiles a and b held, one read back at most if the last one
+ *      read is either of them; -1 if a read failed
+ */
+static int tiles_hold(SPECTILES *tl, int a, int b, int nsta)
+{
+    long long size = (long long)sizeof(fftw_complex) * tl->nfft;
+    double *p;
+    int  i, t, c;
+
+    for (i = 0; i < 2; i ++) {
+        t = i == 0 ? a : b;
+        if (tl->held[0] == t || tl->held[1] == t) continue;
+        /* into the buffer of the tile not needed */
+        c = tl->held[0] == a || tl->held[0] == b ? 1 : 0;
+        p = tl->buf[c];
+        if (scratch_io(tl->fd, (char *)p, size * ((t + 1) * tl->tile < nsta ? tl->tile : nsta - t * tl->tile),
+                       (off_t)size * tl->tile * t, 0) == -1) return -1;
+        tl->held[c] = t;
+        tl->nread ++;
+    }
+    return 0;
+}
+
+/*
+ *  tile_spec: spectrum of station k of the window, in a tile held
+ */
+static XSPEC tile_spec(SPECTILES *tl, int k)
+{
+    XSPEC x;
+    int   c = tl->held[0] == k / tl->tile ? 0 : 1;
+
+    x.n = tl->nfft;
+    x.re = tl->buf[c] + (size_t)(k % tl->tile) * 2 * tl->nfft;
+    x.im = x.re + tl->nfft;
+    return x;
+}
+
+/*
+ *  scratch_io: n bytes of buf written to, or read from, offset off of fd
+ */
+static int scratch_io(int fd, char *buf, size_t n, off_t off, int wr)
+{
+    ssize_t got;
+
+    while (n > 0) {
+        got = wr ? pwrite(fd, buf, n, off) : pread(fd, buf, n, off);
+        if (got <= 0) return -1;
+        if (wr) STAT_WRITE_BYTES(got);
+        else STAT_READ_BYTES(got);
+        buf += got; off += got; n -= (size_t)got;
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*******************************************************************************
+    Name:     corspec.h
+
+    Purpose:  correlation of the lines of file.lst from the whitened spectra
+        of their station windows, each computed once and held within a
+        memory budget (abc_egf --mem-limit), the spectra that do not fit
+        spilt to a scratch file
+
+    Notes:
+        The lines of a window (same time, cut_npts, band and npts) share the
+        spectra of their stations: a station of k pairs is cut, filtered,
+        normalized, whitened and transformed once instead of k times. The
+        stations of a window, in the order they first appear in file.lst,
+        are tiled into tiles of as many spectra as two tiles take within
+        the budget (all of them if they fit at once):
+
+            1. the spectra of tile t are computed and written at offset
+               t * tile bytes of the scratch file, so the file is written
+               from start to end and a tile is read back in one piece;
+            2. the pairs of tiles (a, b), a <= b, that have lines are taken
+               a row a at a time, tile a held, the tiles b of a row read in
+               turn, up a row and down the next: the last tile of a row is
+               the first of the next one, or its tile a, and is not read
+               again.
+
+        The correlations are bit for bit those of the chain of files; those
+        of a window come out in the order of its tiles, in input line order
+        within a pair of tiles, which is input line order if all spectra of
+        the window fit. A station window that failed quarantines its lines
+        with the stage and file, as the chain does.
+
+        The spectra are held with their real and imaginary parts apart
+        (xspec.h), so the cross spectrum of a pair is made by the vector
+        kernel of xspec_cross.
+
+        The budget is for the spectra (16 bytes per point of the FFT) only:
+        the work traces of a window and the list take memory besides.
+*******************************************************************************/
+
+#ifndef _CORSPEC_H
+#define _CORSPEC_H
+
+#include "sacio.h"
+#include "sacidx.h"
+
+/* line of file.lst, as the planner takes it */
+typedef struct spec_line {
+    long    item;                   /* line of file.lst, from 0             */
+    char    sac1[50], sac2[50], cor_name[50];
+    double  evt0;                   /* day and time of the line (abs_time)  */
+    float   start0;                 /* window from evt0 + start0 (s)        */
+    int     cut_npts, npts;         /* window and normalization (samples)   */
+    float   band[4];                /* f1/f2/f3/f4 (Hz)                     */
+    float   lag_time;               /* lags of the correlation (s)          */
+} SPECLINE;
+
+long long spec_size ( const char *arg );
+int spec_run ( SPECLINE *ln, long n, long long budget, const char *scratch, const SACINDEX *idx,
+               void (*fail)( long item, const char *why ) );
+
+#endif /* corspec.h */
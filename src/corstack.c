@@ -0,0 +1,804 @@
+/*******************************************************************************
+ *                                 corstack.c                                  *
+ *  Stacks of correlations summed by several threads, see corstack.h:          *
+ *      corstack_item    input line correlated next by the calling thread      *
+ *      corstack_add     cor_writer adding into the stacks of the thread       *
+ *      corstack_done    hand on the stacks of a finished block to the tree    *
+ *      corstack_keep    function called with each node of the tree summed     *
+ *      corstack_flush   reduce the stacks of all threads and write them       *
+ *      corstack_parts   hand on the partial stacks unreduced, for --shard     *
+ *      corstack_put     add a partial stack handed on by corstack_parts       *
+ *      corstack_check   stacks so far, for checkpoints between rounds         *
+ *      corstack_snr     signal to noise ratio of a stack                      *
+ *      corstack_cc      correlation coefficient of two stacks                 *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "corstack.h"
+#include "abcstat.h"
+
+/* partial stacks and input line of the calling thread */
+static __thread CORSTACK *local = NULL;
+static __thread long cur_item = 0;
+
+/* all threads that have added, taken only to register and to flush */
+static CORSTACK *threads = NULL;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* partial stacks parked by corstack_check, a list per block: the thread adding to a block next takes
+   them back, and only that thread touches the list of the block while the others add */
+static CORPART **parked = NULL;
+static long nparked = 0, maxparked = 0;
+
+/* ranges of blocks done and not yet summed with their sibling, in a hash table by block and level */
+static CORRANGE **ranges = NULL;
+static long nrange = 0, nrange_bucket = 0;
+static pthread_mutex_t ranges_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* checkpoint of the nodes, NULL if none */
+static int (*keeper)(const CORRANGE *rg) = NULL;
+
+/* function prototype for local use */
+static CORSTACK *stack_local (void);
+static int       stack_grow  (CORSTACK *st);
+static int       part_add    (const char *name, long block, int level, int nday, SACHEAD hd, const float *ar);
+static CORPART **part_take   (long *n);
+static CORPART **part_range  (CORSTACK *st, long block, int level, long *n);
+static int       part_park   (void);
+static CORPART  *part_unpark (const char *name, long block);
+static unsigned  part_hash   (const char *name, long block);
+static int       part_cmp    (const void *a, const void *b);
+static long      part_end    (const CORPART *pt);
+static void      part_sum    (CORPART *l, const CORPART *r);
+static void      part_free   (CORPART *pt);
+static CORPART  *part_reduce (CORPART **pt, int n, long b0, long b1);
+static CORRANGE *range_take  (long block, int level);
+static void      range_put   (CORRANGE *rg);
+static CORRANGE *range_fold  (CORRANGE *l, CORRANGE *r);
+static unsigned  range_hash  (long block, int level);
+
+/*
+ *  corstack_item
+ *
+ *  Description: set the input line (from 0) whose correlations the calling
+ *      thread adds next. The lines of a block must all be added by one
+ *      thread, in increasing order.
+ *
+ */
+void corstack_item(long item)
+{
+    cur_item = item;
+}
+
+/*
+ *  corstack_add
+ *
+ *  Description: add a correlation to the partial stack of its name in the
+ *      block of the current input line. Only memory of the calling thread
+ *      is touched, so no lock is taken.
+ *
+ *  IN:
+ *      const char *name : correlation name, the key of the stack
+ *      SACHEAD     hd   : header of the correlation
+ *      const float *ar  : hd.npts lags
+ *
+ *  Return: 0 if succeed, -1 if the lags do not match those of the stack.
+ *
+ */
+int corstack_add(const char *name, SACHEAD hd, const float *ar)
+{
+    return part_add(name, cur_item / CORSTACK_BLOCK, 0, 1, hd, ar);
+}
+
+/*
+ *  corstack_done
+ *
+ *  Description: Hand on the partial stacks of the calling thread in the
+ *      2^level blocks from block, all lines of which have been added. They
+ *      are summed into one per name, then with the ranges done before into
+ *      the nodes of the tree of corstack_flush, as far as all blocks of a
+ *      node are done. A thread calls it for each block it finishes, after
+ *      its last round; abc_merge for each node handed on by a shard.
+ *
+ *  IN:
+ *      long block  : first block, a multiple of 2^level
+ *      int  level  : 0 for one block
+ *
+ *  Return: 0 if succeed, -1 if out of memory.
+ *
+ */
+int corstack_done(long block, int level)
+{
+    CORSTACK *st;
+    CORRANGE *rg, *sib;
+
+    if ((st = stack_local()) == NULL) return -1;
+    if ((rg = (CORRANGE *)malloc(sizeof(CORRANGE))) == NULL ||
+        (rg->part = part_range(st, block, level, &rg->npart)) == NULL) {
+        fprintf(stderr, "Out of memory handing on the stacks of block %ld\n", block);
+        free(rg);
+        return -1;
+    }
+    rg->block = block;
+    rg->level = level;
+
+    /* the sibling is taken out under the lock, the two are summed outside it */
+    for (;;) {
+        if (keeper != NULL) keeper(rg);
+        pthread_mutex_lock(&ranges_lock);
+        if ((sib = range_take(rg->block ^ (1L << rg->level), rg->level)) == NULL) {
+            range_put(rg);
+            pthread_mutex_unlock(&ranges_lock);
+            return 0;
+        }
+        pthread_mutex_unlock(&ranges_lock);
+        rg = sib->block < rg->block ? range_fold(sib, rg) : range_fold(rg, sib);
+        if (rg == NULL) return -1;
+    }
+}
+
+/*
+ *  corstack_keep
+ *
+ *  Description: call keep with each node summed by corstack_done, before
+ *      it is summed with its sibling or left for it, from the thread that
+ *      summed it, e.g. to save it for a resumed run (abc_egf -d). The
+ *      node is not changed. NULL for none.
+ *
+ */
+void corstack_keep(int (*keep)(const CORRANGE *rg))
+{
+    keeper = keep;
+}
+
+/*
+ *  corstack_flush
+ *
+ *  Description: Reduce the partial stacks of all threads, and the nodes
+ *      of the ranges done, and write one stack per name. Partial stacks of
+ *      a name are summed in a binary tree over their block numbers, the
+ *      halves of [0, 2^k) summed recursively, so the result depends on the
+ *      input order only. Must not run while any thread adds; the partial
+ *      stacks are released.
+ *
+ *  IN:
+ *      writer : output of the stacks, write_sac or corpack_write
+ *
+ *  Return: number of stacks written, -1 if any failed.
+ *
+ */
+int corstack_flush(int (*writer)(const char *name, SACHEAD hd, const float *ar))
+{
+    CORPART  **all, *top;
+    long     n, i, j, b1;
+    int      nout = 0, err = 0;
+
+    if ((all = part_take(&n)) == NULL) return -1;
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && strcmp(all[j]->name, all[i]->name) == 0; j ++) ;
+        for (b1 = 1; b1 < part_end(all[j-1]); b1 <<= 1) ;
+        top = part_reduce(all + i, (int)(j - i), 0, b1);
+        if (writer(top->name, top->hd, top->sum) == 0) nout ++;
+        else err = 1;
+    }
+
+    for (i = 0; i < n; i ++) part_free(all[i]);
+    free(all);
+    return err ? -1 : nout;
+}
+
+/*
+ *  corstack_parts
+ *
+ *  Description: Hand on the partial stacks of all threads and the nodes of
+ *      the ranges done as they are, in order of name and block, instead of
+ *      reducing them: a shard of the input lines saves them, and
+ *      corstack_put adds them back where all shards are merged. Must not
+ *      run while any thread adds; the partial stacks are released.
+ *
+ *  IN:
+ *      writer : output of a partial stack of a name, first block, level
+ *               and day count
+ *
+ *  Return: number of partial stacks written, -1 if any failed.
+ *
+ */
+int corstack_parts(int (*writer)(const char *name, long block, int level, int nday, SACHEAD hd,
+                                 const float *ar))
+{
+    CORPART **all;
+    long    n, i;
+    int     nout = 0, err = 0;
+
+    if ((all = part_take(&n)) == NULL) return -1;
+    for (i = 0; i < n; i ++) {
+        if (writer(all[i]->name, all[i]->block, all[i]->level, all[i]->nday, all[i]->hd, all[i]->sum) == 0)
+            nout ++;
+        else err = 1;
+        part_free(all[i]);
+    }
+    free(all);
+    return err ? -1 : nout;
+}
+
+/*
+ *  corstack_put
+ *
+ *  Description: add a partial stack of nday correlations in the 2^level
+ *      blocks from block, as handed on by corstack_parts, into the stacks
+ *      of the calling thread. corstack_done or corstack_flush then sums it
+ *      in the same tree as if it had been computed here, so merged shards
+ *      give the stacks of a single run.
+ *
+ *  Return: 0 if succeed, -1 if the lags do not match those of the stack.
+ *
+ */
+int corstack_put(const char *name, long block, int level, int nday, SACHEAD hd, const float *ar)
+{
+    return part_add(name, block, level, nday, hd, ar);
+}
+
+/*
+ *  corstack_check
+ *
+ *  Description: Stack of every name so far, summed in the tree of
+ *      corstack_flush, for a checkpoint between rounds of the workers. The
+ *      partial stacks and the nodes of the ranges done are left as they are: those of a block are taken back
+ *      by the thread adding to that block next, which goes on summing them
+ *      in input order, so a run checked between rounds gives the stacks of
+ *      one without checks. Must not run while any thread adds.
+ *
+ *  IN:
+ *      check : called with the name, the number of correlations and the
+ *              header and lags of each stack, in order of name
+ *
+ *  Return: number of stacks checked, -1 if out of memory.
+ *
+ */
+int corstack_check(int (*check)(const char *name, int nday, SACHEAD hd, const float *ar))
+{
+    CORPART  **all, *cp, **pcp, *top;
+    CORRANGE *rg;
+    long     n = 0, i, j, k, b1;
+    int      nout = 0;
+
+    if (part_park() == -1) return -1;
+    for (i = 0; i < nparked; i ++)
+        for (top = parked[i]; top != NULL; top = top->next) n ++;
+    for (i = 0; i < nrange_bucket; i ++)
+        for (rg = ranges[i]; rg != NULL; rg = rg->next) n += rg->npart;
+    if ((all = (CORPART **)malloc(sizeof(CORPART *) * (n > 0 ? n : 1))) == NULL) {
+        fprintf(stderr, "Out of memory checking %ld partial stacks\n", n);
+        return -1;
+    }
+    for (n = 0, i = 0; i < nparked; i ++)
+        for (top = parked[i]; top != NULL; top = top->next) all[n++] = top;
+    for (i = 0; i < nrange_bucket; i ++)
+        for (rg = ranges[i]; rg != NULL; rg = rg->next)
+            for (k = 0; k < rg->npart; k ++) all[n++] = rg->part[k];
+    qsort(all, n, sizeof(CORPART *), part_cmp);
+
+    /* the tree of a name is summed on copies of its partial stacks */
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && strcmp(all[j]->name, all[i]->name) == 0; j ++) ;
+        for (b1 = 1; b1 < part_end(all[j-1]); b1 <<= 1) ;
+        cp = (CORPART *)malloc(sizeof(CORPART) * (j - i));
+        pcp = (CORPART **)malloc(sizeof(CORPART *) * (j - i));
+        for (k = 0; cp != NULL && pcp != NULL && k < j - i; k ++) {
+            cp[k] = *all[i+k];
+            if ((cp[k].sum = (float *)malloc(sizeof(float) * cp[k].hd.npts)) == NULL) break;
+            memcpy(cp[k].sum, all[i+k]->sum, sizeof(float) * cp[k].hd.npts);
+            pcp[k] = cp + k;
+        }
+        if (cp == NULL || pcp == NULL || k < j - i) {
+            fprintf(stderr, "Out of memory checking the stack of %s\n", all[i]->name);
+            while (cp != NULL && k > 0) free(cp[--k].sum);
+            free(cp); free(pcp); free(all);
+            return -1;
+        }
+        top = part_reduce(pcp, (int)(j - i), 0, b1);
+        check(top->name, top->nday, top->hd, top->sum);
+        nout ++;
+        for (k = 0; k < j - i; k ++) free(cp[k].sum);
+        free(cp); free(pcp);
+    }
+    free(all);
+    return nout;
+}
+
+/*
+ *  corstack_snr
+ *
+ *  Description: Signal to noise ratio of a stack of n lags: its largest
+ *      absolute lag over the root mean square of the outer half of the lags
+ *      of each side, where no surface wave is expected.
+ *
+ *  Return: the ratio, 0 if there is no noise window or it is all zero.
+ *
+ */
+float corstack_snr(const float *ar, int n)
+{
+    double peak = 0., ss = 0.;
+    int    i, half = n / 2, m = 0;
+
+    for (i = 0; i < n; i ++) {
+        if (fabs(ar[i]) > peak) peak = fabs(ar[i]);
+        if (i < half - half / 2 || i > half + half / 2) {
+            ss += (double)ar[i] * ar[i];
+            m ++;
+        }
+    }
+    return m > 0 && ss > 0. ? (float)(peak / sqrt(ss / m)) : 0.;
+}
+
+/*
+ *  corstack_cc
+ *
+ *  Description: correlation coefficient of two stacks of n lags, e.g. of a
+ *      pair at two checkpoints
+ *
+ *  Return: the coefficient in [-1, 1], 0 if a stack is constant.
+ *
+ */
+float corstack_cc(const float *a, const float *b, int n)
+{
+    double ma = 0., mb = 0., sab = 0., saa = 0., sbb = 0.;
+    int    i;
+
+    for (i = 0; i < n; i ++) {
+        ma += a[i];
+        mb += b[i];
+    }
+    ma /= n > 0 ? n : 1;
+    mb /= n > 0 ? n : 1;
+    for (i = 0; i < n; i ++) {
+        sab += (a[i] - ma) * (b[i] - mb);
+        saa += (a[i] - ma) * (a[i] - ma);
+        sbb += (b[i] - mb) * (b[i] - mb);
+    }
+    return saa > 0. && sbb > 0. ? (float)(sab / sqrt(saa * sbb)) : 0.;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  stack_local: partial stacks of the calling thread, registered on first
+ *      use and kept (empty after a flush) to the end of the run
+ */
+static CORSTACK *stack_local(void)
+{
+    CORSTACK *st;
+
+    if (local != NULL) return local;
+    if ((st = (CORSTACK *)calloc(1, sizeof(CORSTACK))) == NULL ||
+        (st->bucket = (CORPART **)calloc(CORSTACK_BUCKETS, sizeof(CORPART *))) == NULL) {
+        fprintf(stderr, "Out of memory for the stacks of a thread\n");
+        free(st);
+        return NULL;
+    }
+    st->nbucket = CORSTACK_BUCKETS;
+    pthread_mutex_lock(&threads_lock);
+    st->next = threads;
+    threads = st;
+    pthread_mutex_unlock(&threads_lock);
+    return local = st;
+}
+
+/*
+ *  stack_grow: twice the buckets of the table of a thread, its partial
+ *      stacks hashed again; -1 if out of memory, the table left as it is
+ */
+static int stack_grow(CORSTACK *st)
+{
+    CORPART **bucket, *pt, *next;
+    long    h;
+    unsigned k;
+
+    if ((bucket = (CORPART **)calloc(2 * st->nbucket, sizeof(CORPART *))) == NULL) return -1;
+    for (h = 0; h < st->nbucket; h ++)
+        for (pt = st->bucket[h]; pt != NULL; pt = next) {
+            next = pt->next;
+            k = part_hash(pt->name, pt->block) & (2 * st->nbucket - 1);
+            pt->next = bucket[k];
+            bucket[k] = pt;
+        }
+    free(st->bucket);
+    st->bucket = bucket;
+    st->nbucket *= 2;
+    return 0;
+}
+
+/*
+ *  part_add: add nday correlations summed in ar to the partial stack of
+ *      name in the 2^level blocks from block of the calling thread, a new
+ *      one if there is none
+ */
+static int part_add(const char *name, long block, int level, int nday, SACHEAD hd, const float *ar)
+{
+    CORSTACK *st;
+    CORPART  *pt;
+    unsigned h;
+    int      i;
+
+    if (strlen(name) >= CORSTACK_NAME_LEN) {
+        fprintf(stderr, "Name too long to stack: %s\n", name);
+        return -1;
+    }
+    if ((st = stack_local()) == NULL) return -1;
+
+    h = part_hash(name, block) & (st->nbucket - 1);
+    for (pt = st->bucket[h]; pt != NULL; pt = pt->next)
+        if (pt->block == block && strcmp(pt->name, name) == 0) break;
+    if (pt == NULL && (pt = part_unpark(name, block)) != NULL) {
+        pt->next = st->bucket[h];
+        st->bucket[h] = pt;
+        st->npart ++;
+    }
+
+    if (pt == NULL) {
+        if (st->npart >= 2 * st->nbucket && stack_grow(st) == 0) h = part_hash(name, block) & (st->nbucket - 1);
+        if ((pt = (CORPART *)malloc(sizeof(CORPART))) == NULL ||
+            (pt->sum = (float *)malloc(sizeof(float) * hd.npts)) == NULL) {
+            fprintf(stderr, "Out of memory stacking %s\n", name);
+            free(pt);
+            return -1;
+        }
+        STAT_ALLOC(sizeof(CORPART) + sizeof(float) * hd.npts);
+        strcpy(pt->name, name);
+        pt->block = block;
+        pt->level = level;
+        pt->hd = hd;
+        pt->nday = nday;
+        memcpy(pt->sum, ar, sizeof(float) * hd.npts);
+        pt->next = st->bucket[h];
+        st->bucket[h] = pt;
+        st->npart ++;
+        return 0;
+    }
+
+    if (hd.npts != pt->hd.npts || hd.delta != pt->hd.delta) {
+        fprintf(stderr, "Cannot stack %s: %d lags of %g s, stack has %d of %g s\n",
+                name, hd.npts, hd.delta, pt->hd.npts, pt->hd.delta);
+        return -1;
+    }
+    for (i = 0; i < hd.npts; i ++) pt->sum[i] += ar[i];
+    pt->nday += nday;
+    return 0;
+}
+
+/*
+ *  part_take: the partial stacks of all threads and of the ranges done,
+ *      taken out of them and sorted by name and block, n of them; NULL if
+ *      out of memory
+ */
+static CORPART **part_take(long *n)
+{
+    CORSTACK *st;
+    CORRANGE *rg, *next;
+    CORPART  **all, *pt;
+    long     m = 0, b, h, k;
+
+    if (part_park() == -1) return NULL;
+    pthread_mutex_lock(&threads_lock);
+    for (st = threads; st != NULL; st = st->next) m += st->npart;
+    for (b = 0; b < nparked; b ++)
+        for (pt = parked[b]; pt != NULL; pt = pt->next) m ++;
+    for (h = 0; h < nrange_bucket; h ++)
+        for (rg = ranges[h]; rg != NULL; rg = rg->next) m += rg->npart;
+    if ((all = (CORPART **)malloc(sizeof(CORPART *) * (m > 0 ? m : 1))) == NULL) {
+        pthread_mutex_unlock(&threads_lock);
+        fprintf(stderr, "Out of memory reducing %ld partial stacks\n", m);
+        return NULL;
+    }
+    for (m = 0, st = threads; st != NULL; st = st->next) {
+        for (h = 0; h < st->nbucket; h ++) {
+            for (pt = st->bucket[h]; pt != NULL; pt = pt->next) all[m++] = pt;
+            st->bucket[h] = NULL;
+        }
+        st->npart = 0;
+    }
+    for (b = 0; b < nparked; b ++) {
+        for (pt = parked[b]; pt != NULL; pt = pt->next) all[m++] = pt;
+        parked[b] = NULL;
+    }
+    for (h = 0; h < nrange_bucket; h ++) {
+        for (rg = ranges[h]; rg != NULL; rg = next) {
+            next = rg->next;
+            for (k = 0; k < rg->npart; k ++) all[m++] = rg->part[k];
+            free(rg->part);
+            free(rg);
+        }
+        ranges[h] = NULL;
+    }
+    nrange = 0;
+    pthread_mutex_unlock(&threads_lock);
+
+    qsort(all, m, sizeof(CORPART *), part_cmp);
+    *n = m;
+    return all;
+}
+
+/*
+ *  part_range: the partial stacks of the calling thread, parked or not, in
+ *      the 2^level blocks from block, taken out and summed into one per
+ *      name, sorted by name, n of them; NULL if out of memory
+ */
+static CORPART **part_range(CORSTACK *st, long block, int level, long *n)
+{
+    CORPART  **all, **pp, *pt, *next;
+    long     end = block + (1L << level), m = 0, h, b, i, j, k;
+
+    for (h = 0; h < st->nbucket; h ++)
+        for (pt = st->bucket[h]; pt != NULL; pt = pt->next)
+            if (pt->block >= block && pt->block < end) m ++;
+    for (b = block; b < end && b < nparked; b ++)
+        for (pt = parked[b]; pt != NULL; pt = pt->next) m ++;
+    if ((all = (CORPART **)malloc(sizeof(CORPART *) * (m > 0 ? m : 1))) == NULL) return NULL;
+
+    for (m = 0, h = 0; h < st->nbucket; h ++)
+        for (pp = &st->bucket[h]; (pt = *pp) != NULL; )
+            if (pt->block >= block && pt->block < end) {
+                *pp = pt->next;
+                all[m++] = pt;
+                st->npart --;
+            }
+            else pp = &pt->next;
+    for (b = block; b < end && b < nparked; b ++) {
+        for (pt = parked[b]; pt != NULL; pt = next) {
+            next = pt->next;
+            all[m++] = pt;
+        }
+        parked[b] = NULL;
+    }
+    qsort(all, m, sizeof(CORPART *), part_cmp);
+
+    for (k = 0, i = 0; i < m; i = j) {
+        for (j = i + 1; j < m && strcmp(all[j]->name, all[i]->name) == 0; j ++) ;
+        pt = part_reduce(all + i, (int)(j - i), block, end);
+        for (b = i + 1; b < j; b ++) part_free(all[b]);
+        pt->block = block;
+        pt->level = level;
+        all[k++] = pt;
+    }
+    *n = k;
+    return all;
+}
+
+/*
+ *  part_park: the partial stacks of all threads moved to the lists of
+ *      their blocks; -1 if out of memory, with nothing moved
+ */
+static int part_park(void)
+{
+    CORSTACK *st;
+    CORPART  *pt, *next, **grown;
+    long     nb = nparked, h;
+
+    pthread_mutex_lock(&threads_lock);
+    for (st = threads; st != NULL; st = st->next)
+        for (h = 0; h < st->nbucket; h ++)
+            for (pt = st->bucket[h]; pt != NULL; pt = pt->next)
+                if (pt->block >= nb) nb = pt->block + 1;
+    if (nb > maxparked) {
+        if ((grown = (CORPART **)realloc(parked, sizeof(CORPART *) * nb)) == NULL) {
+            pthread_mutex_unlock(&threads_lock);
+            fprintf(stderr, "Out of memory parking the partial stacks of %ld blocks\n", nb);
+            return -1;
+        }
+        parked = grown;
+        maxparked = nb;
+    }
+    for (; nparked < nb; nparked ++) parked[nparked] = NULL;
+
+    for (st = threads; st != NULL; st = st->next) {
+        for (h = 0; h < st->nbucket; h ++) {
+            for (pt = st->bucket[h]; pt != NULL; pt = next) {
+                next = pt->next;
+                pt->next = parked[pt->block];
+                parked[pt->block] = pt;
+            }
+            st->bucket[h] = NULL;
+        }
+        st->npart = 0;
+    }
+    pthread_mutex_unlock(&threads_lock);
+    return 0;
+}
+
+/*
+ *  part_unpark: the parked partial stack of name in block taken out of its
+ *      list, NULL if there is none
+ */
+static CORPART *part_unpark(const char *name, long block)
+{
+    CORPART **pp, *pt;
+
+    if (block >= nparked) return NULL;
+    for (pp = &parked[block]; (pt = *pp) != NULL; pp = &pt->next)
+        if (strcmp(pt->name, name) == 0) {
+            *pp = pt->next;
+            return pt;
+        }
+    return NULL;
+}
+
+/*
+ *  part_hash: hash of a name and block (FNV-1a), masked by the caller
+ */
+static unsigned part_hash(const char *name, long block)
+{
+    unsigned h = 2166136261u;
+
+    for (; *name != '\0'; name ++) h = (h ^ (unsigned char)*name) * 16777619u;
+    h = (h ^ (unsigned)block) * 16777619u;
+    return h;
+}
+
+/*
+ *  part_cmp: by name, then block
+ */
+static int part_cmp(const void *a, const void *b)
+{
+    const CORPART *pa = *(const CORPART * const *)a, *pb = *(const CORPART * const *)b;
+    int c = strcmp(pa->name, pb->name);
+
+    if (c != 0) return c;
+    return pa->block < pb->block ? -1 : pa->block > pb->block;
+}
+
+/*
+ *  part_end: block after the range of a partial stack
+ */
+static long part_end(const CORPART *pt)
+{
+    return pt->block + (1L << pt->level);
+}
+
+/*
+ *  part_sum: the partial stack r of the blocks after those of l added
+ *      into l
+ */
+static void part_sum(CORPART *l, const CORPART *r)
+{
+    int i;
+
+    if (r->hd.npts != l->hd.npts || r->hd.delta != l->hd.delta) {
+        fprintf(stderr, "Cannot stack %s: %d lags of %g s, stack has %d of %g s\n",
+                r->name, r->hd.npts, r->hd.delta, l->hd.npts, l->hd.delta);
+        return;
+    }
+    for (i = 0; i < l->hd.npts; i ++) l->sum[i] += r->sum[i];
+    l->nday += r->nday;
+}
+
+/*
+ *  part_free: release a partial stack
+ */
+static void part_free(CORPART *pt)
+{
+    free(pt->sum);
+    free(pt);
+}
+
+/*
+ *  part_reduce: sum of the n partial stacks pt (sorted, blocks in [b0, b1))
+ *      into the first one, the halves of [b0, b1) summed first; a partial
+ *      stack of a range is one leaf of the tree
+ */
+static CORPART *part_reduce(CORPART **pt, int n, long b0, long b1)
+{
+    CORPART *l, *r;
+    long    mid;
+    int     k;
+
+    if (n == 1) return pt[0];
+    mid = b0 + (b1 - b0) / 2;
+    for (k = 0; k < n && pt[k]->block < mid; k ++) ;
+    if (k == 0) return part_reduce(pt, n, mid, b1);
+    if (k == n) return part_reduce(pt, n, b0, mid);
+
+    l = part_reduce(pt, k, b0, mid);
+    r = part_reduce(pt + k, n - k, mid, b1);
+    part_sum(l, r);
+    return l;
+}
+
+/*
+ *  range_take: the range of 2^level blocks from block taken out of the
+ *      ranges done, NULL if it is not done. Under ranges_lock.
+ */
+static CORRANGE *range_take(long block, int level)
+{
+    CORRANGE **pp, *rg;
+
+    if (nrange_bucket == 0) return NULL;
+    for (pp = &ranges[range_hash(block, level) & (nrange_bucket - 1)]; (rg = *pp) != NULL; pp = &rg->next)
+        if (rg->block == block && rg->level == level) {
+            *pp = rg->next;
+            nrange --;
+            return rg;
+        }
+    return NULL;
+}
+
+/*
+ *  range_put: a range added to the ranges done, the table grown when it
+ *      fills (left as it is if out of memory). Under ranges_lock.
+ */
+static void range_put(CORRANGE *rg)
+{
+    CORRANGE **bucket, *r, *next;
+    long     n = nrange_bucket > 0 ? 2 * nrange_bucket : CORSTACK_BUCKETS, h;
+    unsigned k;
+
+    if (nrange >= nrange_bucket && (bucket = (CORRANGE **)calloc(n, sizeof(CORRANGE *))) != NULL) {
+        for (h = 0; h < nrange_bucket; h ++)
+            for (r = ranges[h]; r != NULL; r = next) {
+                next = r->next;
+                k = range_hash(r->block, r->level) & (n - 1);
+                r->next = bucket[k];
+                bucket[k] = r;
+            }
+        free(ranges);
+        ranges = bucket;
+        nrange_bucket = n;
+    }
+    k = range_hash(rg->block, rg->level) & (nrange_bucket - 1);
+    rg->next = ranges[k];
+    ranges[k] = rg;
+    nrange ++;
+}
+
+/*
+ *  range_fold: the two halves l and r of a range, both done, summed name
+ *      by name into the range, which is returned in place of l; NULL if out
+ *      of memory
+ */
+static CORRANGE *range_fold(CORRANGE *l, CORRANGE *r)
+{
+    CORPART **part;
+    long    i = 0, j = 0, n = 0;
+    int     c;
+
+    if ((part = (CORPART **)malloc(sizeof(CORPART *) * (l->npart + r->npart + 1))) == NULL) {
+        fprintf(stderr, "Out of memory summing the stacks of blocks %ld to %ld\n",
+                l->block, r->block + (1L << r->level) - 1);
+        return NULL;
+    }
+    while (i < l->npart || j < r->npart) {
+        c = i == l->npart ? 1 : j == r->npart ? -1 : strcmp(l->part[i]->name, r->part[j]->name);
+        if (c < 0) part[n++] = l->part[i++];
+        else if (c > 0) part[n++] = r->part[j++];
+        else {
+            part_sum(l->part[i], r->part[j]);
+            part_free(r->part[j++]);
+            part[n++] = l->part[i++];
+        }
+        part[n-1]->block = l->block;
+        part[n-1]->level = l->level + 1;
+    }
+    free(l->part);
+    free(r->part);
+    free(r);
+    l->part = part;
+    l->npart = n;
+    l->level ++;
+    return l;
+}
+
+/*
+ *  range_hash: hash of the first block and level of a range
+ */
+static unsigned range_hash(long block, int level)
+{
+    return part_hash("", block) ^ (unsigned)level * 2654435761u;
+}
@@ -0,0 +1,97 @@
+/*******************************************************************************
+    Name:     corstack.h
+
+    Purpose:  stacking of the correlations of many days of a station pair by
+        the worker threads of abc_egf -j, without locks in the compute loop
+        and with results that do not depend on the number of threads
+
+    Notes:
+        corstack_add replaces write_sac as the output of cor_in_freq,
+        cor_bands and cor_tensor (set_cor_writer). Each thread adds into
+        partial stacks of its own, in a hash map keyed by the correlation
+        name and the block of input lines (CORSTACK_BLOCK lines of file.lst)
+        of the correlation. A block is processed by one thread in input
+        order, so the sum of a partial stack is the same whichever thread
+        computes it.
+
+        The partial stacks of a name are reduced in a fixed binary tree over
+        the block numbers. A thread that finishes a block hands its partial
+        stacks on with corstack_done; as soon as all blocks of an aligned
+        range of 2^k blocks are done, its two halves are summed into one
+        partial stack per name, the node of the tree. The stacks held are
+        then about one per name and level of the tree, not one per name
+        and block, whatever the order of file.lst. corstack_flush, called
+        once the workers are joined, sums the nodes left and writes the
+        stack through the given writer. Since neither the blocks nor the
+        tree depend on the thread count, the stacks are bit for bit the
+        same for any number of threads.
+
+        The header of a stack is that of its first correlation in input
+        order.
+
+        corstack_keep hands each node on as it is summed, so that abc_egf -d
+        saves the nodes instead of the correlations of their lines.
+
+        A shard of the input lines (abc_egf --shard) reduces only the ranges
+        of blocks that are all its own and hands the nodes on with
+        corstack_parts; abc_merge adds those of all shards back with
+        corstack_put in block order, marks them done, and reduces them with
+        corstack_flush, in the same tree as a single run.
+
+        corstack_check gives the stacks so far, between rounds of the
+        workers, without changing the sums: abc_egf --converge stops adding
+        the days of a pair once its stack is stable (corstack_snr, and
+        corstack_cc against the stack of the previous checkpoint).
+*******************************************************************************/
+
+#ifndef _CORSTACK_H
+#define _CORSTACK_H
+
+#include "sacio.h"
+
+#define CORSTACK_BLOCK      64          /* input lines summed in order      */
+#define CORSTACK_BUCKETS    64          /* first hash buckets of a table    */
+#define CORSTACK_NAME_LEN   128
+
+/* partial stack of one name over 2^level blocks of input lines */
+typedef struct cor_part {
+    char    name[CORSTACK_NAME_LEN];
+    long    block;                  /* input line / CORSTACK_BLOCK, the     */
+                                    /* first of the range                   */
+    int     level;                  /* 0 for one block                      */
+    SACHEAD hd;                     /* header of its first correlation      */
+    int     nday;                   /* correlations summed                  */
+    float   *sum;                   /* hd.npts lags                         */
+    struct cor_part *next;          /* chain of the hash bucket             */
+} CORPART;
+
+/* partial stacks of one thread, in a hash table that grows */
+typedef struct cor_stack {
+    CORPART **bucket;
+    long    nbucket;                /* a power of 2                         */
+    long    npart;
+    struct cor_stack *next;         /* registry of all threads              */
+} CORSTACK;
+
+/* range of 2^level blocks all done, its partial stacks sorted by name */
+typedef struct cor_range {
+    long    block;                  /* a multiple of 2^level                */
+    int     level;
+    CORPART **part;
+    long    npart;
+    struct cor_range *next;         /* chain of the hash bucket             */
+} CORRANGE;
+
+void corstack_item ( long item );
+int corstack_add ( const char *name, SACHEAD hd, const float *ar );
+int corstack_done ( long block, int level );
+void corstack_keep ( int (*keep)( const CORRANGE *rg ) );
+int corstack_flush ( int (*writer)( const char *name, SACHEAD hd, const float *ar ) );
+int corstack_parts ( int (*writer)( const char *name, long block, int level, int nday, SACHEAD hd,
+                     const float *ar ) );
+int corstack_put ( const char *name, long block, int level, int nday, SACHEAD hd, const float *ar );
+int corstack_check ( int (*check)( const char *name, int nday, SACHEAD hd, const float *ar ) );
+float corstack_snr ( const float *ar, int n );
+float corstack_cc ( const float *a, const float *b, int n );
+
+#endif /* corstack.h */
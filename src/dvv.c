@@ -0,0 +1,313 @@
+/*******************************************************************************
+ *                                    dvv.c                                    *
+ *  dv/v of daily correlations by the stretching method, see dvv.h:            *
+ *      dvv_ref          reference stretched over the grid                     *
+ *      dvv_free         free it                                               *
+ *      dvv_run          dv/v of many days, in batches on threads              *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "dvv.h"
+#include "abcstat.h"
+
+#define DVV_LANES       8           /* partial sums of a dot product        */
+#define DVV_MAX_THREADS 256
+#define DVV_NONE        -2.         /* coefficient not computed             */
+
+/* days of dvv_run shared by its threads */
+typedef struct dvv_job {
+    const DVVREF *rf;
+    float   *d;                     /* nday windows, normalized             */
+    int     nday, coarse;
+    float   *cc;                    /* nday x neps coefficients             */
+    DVVPICK *pick;
+    long    next;                   /* next batch                           */
+} DVVJOB;
+
+/* function prototype for local use */
+static void   spline_coef (const float *y, int n, double *m2);
+static double spline_at   (const float *y, const double *m2, int n, double x);
+static void   normalize   (float *w, int m);
+static void   dot_batch   (const float *s, const float *d, int nb, int m, float *out);
+static void   batch_run   (DVVJOB *job, int b0, int nb);
+static void  *dvv_worker  (void *arg);
+
+/*
+ *  dvv_ref
+ *
+ *  Description: the window t1 <= |t| <= t2 of the reference ref (hd->npts
+ *      lags, zero lag in the middle) stretched by each of the neps
+ *      stretches of [-eps_max, eps_max], interpolated by a natural cubic
+ *      spline, mean removed and of unit norm
+ *
+ *  Return: the stretched reference, NULL if the window is empty or out of
+ *          memory.
+ *
+ */
+DVVREF *dvv_ref(const float *ref, const SACHEAD *hd, float t1, float t2, float eps_max, int neps)
+{
+    DVVREF  *rf;
+    double  *m2, eps, x;
+    int     lag_n, i, j, k, n = hd->npts;
+    float   t;
+
+    lag_n = (n - 1) / 2;
+    if ((rf = (DVVREF *)calloc(1, sizeof(DVVREF))) == NULL ||
+        (rf->lag = (int *)malloc(sizeof(int) * n)) == NULL) {
+        fprintf(stderr, "Out of memory for the reference of dv/v\n");
+        free(rf);
+        return NULL;
+    }
+    rf->npts = n;
+    rf->delta = hd->delta;
+    rf->neps = neps < 1 ? 1 : neps;
+    rf->eps_max = rf->neps > 1 ? eps_max : 0.;
+    for (i = 0; i < n; i ++) {
+        t = fabs((i - lag_n) * hd->delta);
+        if (t >= t1 && t <= t2) rf->lag[rf->m ++] = i;
+    }
+    if (rf->m < 2) {
+        fprintf(stderr, "No lags within %g - %g s for dv/v\n", t1, t2);
+        dvv_free(rf);
+        return NULL;
+    }
+    m2 = (double *)malloc(sizeof(double) * n);
+    rf->win = (float *)malloc(sizeof(float) * rf->m * rf->neps);
+    if (m2 == NULL || rf->win == NULL) {
+        fprintf(stderr, "Out of memory for %d stretches of the reference\n", rf->neps);
+        free(m2);
+        dvv_free(rf);
+        return NULL;
+    }
+    STAT_ALLOC(sizeof(float) * rf->m * rf->neps);
+
+    spline_coef(ref, n, m2);
+    for (k = 0; k < rf->neps; k ++) {
+        eps = rf->neps > 1 ? -rf->eps_max + 2. * rf->eps_max * k / (rf->neps - 1) : 0.;
+        for (j = 0; j < rf->m; j ++) {
+            x = lag_n + (rf->lag[j] - lag_n) * (1. + eps);
+            rf->win[(size_t)k * rf->m + j] = spline_at(ref, m2, n, x);
+        }
+        normalize(rf->win + (size_t)k * rf->m, rf->m);
+    }
+    free(m2);
+    return rf;
+}
+
+/*
+ *  dvv_free
+ *
+ *  Description: free a reference of dvv_ref
+ *
+ */
+void dvv_free(DVVREF *rf)
+{
+    if (rf == NULL) return;
+    free(rf->lag);
+    free(rf->win);
+    free(rf);
+}
+
+/*
+ *  dvv_run
+ *
+ *  Description: dv/v of nday days against the stretched reference
+ *
+ *  IN:
+ *      const DVVREF *rf : of dvv_ref
+ *      float **day      : nday correlations of rf->npts lags
+ *      int coarse       : step of the coarse search, 1 for every stretch
+ *      int nthread      : threads sharing the batches of days
+ *  OUT:
+ *      DVVPICK *pick    : nday picks
+ *
+ *  Return: 0 if succeed, -1 if out of memory.
+ *
+ */
+int dvv_run(const DVVREF *rf, float **day, int nday, int coarse, int nthread, DVVPICK *pick)
+{
+    DVVJOB    job;
+    pthread_t tid[DVV_MAX_THREADS];
+    int       i, j, k;
+
+    job.rf = rf;
+    job.nday = nday;
+    job.coarse = coarse < 1 ? 1 : coarse;
+    job.pick = pick;
+    job.next = 0;
+    job.d = (float *)malloc(sizeof(float) * rf->m * (nday > 0 ? nday : 1));
+    job.cc = (float *)malloc(sizeof(float) * rf->neps * (nday > 0 ? nday : 1));
+    if (job.d == NULL || job.cc == NULL) {
+        fprintf(stderr, "Out of memory for dv/v of %d days\n", nday);
+        free(job.d); free(job.cc);
+        return -1;
+    }
+    STAT_ALLOC(sizeof(float) * (rf->m + rf->neps) * nday);
+
+    /* windows of the days, as those of the reference */
+    for (i = 0; i < nday; i ++) {
+        for (j = 0; j < rf->m; j ++) job.d[(size_t)i * rf->m + j] = day[i][rf->lag[j]];
+        normalize(job.d + (size_t)i * rf->m, rf->m);
+    }
+
+    if (nthread < 1) nthread = 1;
+    if (nthread > DVV_MAX_THREADS) nthread = DVV_MAX_THREADS;
+    for (k = 1; k < nthread; k ++)
+        if (pthread_create(&tid[k], NULL, dvv_worker, &job) != 0) {
+            nthread = k;
+            break;
+        }
+    dvv_worker(&job);
+    for (k = 1; k < nthread; k ++) pthread_join(tid[k], NULL);
+
+    free(job.d); free(job.cc);
+    return 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  spline_coef: second derivatives m2 of the natural cubic spline through
+ *      the n samples y (unit spacing), by the tridiagonal system
+ */
+static void spline_coef(const float *y, int n, double *m2)
+{
+    double *c, w;
+    int    i;
+
+    m2[0] = 0.;
+    if (n < 3) {
+        for (i = 0; i < n; i ++) m2[i] = 0.;
+        return;
+    }
+    c = (double *)malloc(sizeof(double) * n);
+    c[0] = 0.;
+    for (i = 1; i < n - 1; i ++) {
+        w = 4. - c[i-1];
+        c[i] = 1. / w;
+        m2[i] = (6. * (y[i+1] - 2. * y[i] + y[i-1]) - m2[i-1]) / w;
+    }
+    m2[n-1] = 0.;
+    for (i = n - 2; i > 0; i --) m2[i] -= c[i] * m2[i+1];
+    free(c);
+}
+
+/*
+ *  spline_at: the spline at x (in samples), 0 outside the trace
+ */
+static double spline_at(const float *y, const double *m2, int n, double x)
+{
+    int    i;
+    double a, b;
+
+    if (x < 0. || x > n - 1) return 0.;
+    i = (int)x;
+    if (i >= n - 1) return y[n-1];
+    b = x - i;
+    a = 1. - b;
+    return a * y[i] + b * y[i+1] + ((a * a * a - a) * m2[i] + (b * b * b - b) * m2[i+1]) / 6.;
+}
+
+/*
+ *  normalize: mean removed and unit norm, zeros if the window is constant
+ */
+static void normalize(float *w, int m)
+{
+    double mean = 0., ss = 0.;
+    int    j;
+
+    for (j = 0; j < m; j ++) mean += w[j];
+    mean /= m;
+    for (j = 0; j < m; j ++) {
+        w[j] -= mean;
+        ss += (double)w[j] * w[j];
+    }
+    ss = ss > 0. ? 1. / sqrt(ss) : 0.;
+    for (j = 0; j < m; j ++) w[j] *= ss;
+}
+
+/*
+ *  dot_batch: dot products of the window s with the nb (<= DVV_BATCH)
+ *      windows of d, m samples each, in DVV_LANES partial sums per window
+ */
+static void dot_batch(const float *s, const float *d, int nb, int m, float *out)
+{
+    float acc[DVV_BATCH][DVV_LANES], sv;
+    int   b, j, l, mv = m - m % DVV_LANES;
+
+    memset(acc, 0, sizeof(acc));
+    for (j = 0; j < mv; j += DVV_LANES)
+        for (b = 0; b < nb; b ++)
+            for (l = 0; l < DVV_LANES; l ++) acc[b][l] += s[j+l] * d[(size_t)b * m + j + l];
+    for (b = 0; b < nb; b ++) {
+        for (sv = 0., l = 0; l < DVV_LANES; l ++) sv += acc[b][l];
+        for (j = mv; j < m; j ++) sv += s[j] * d[(size_t)b * m + j];
+        out[b] = sv;
+    }
+}
+
+/*
+ *  batch_run: the nb days from b0, every coarse-th stretch for all of them
+ *      at once, then those around the best of each day, and the pick
+ */
+static void batch_run(DVVJOB *job, int b0, int nb)
+{
+    const DVVREF *rf = job->rf;
+    float   out[DVV_BATCH], *cc, c, cl, cr, d;
+    int     b, k, best, lo, hi, step = job->coarse;
+
+    for (b = 0; b < nb; b ++)
+        for (k = 0; k < rf->neps; k ++) job->cc[(size_t)(b0 + b) * rf->neps + k] = DVV_NONE;
+    for (k = 0; k < rf->neps; k += step) {
+        dot_batch(rf->win + (size_t)k * rf->m, job->d + (size_t)b0 * rf->m, nb, rf->m, out);
+        for (b = 0; b < nb; b ++) job->cc[(size_t)(b0 + b) * rf->neps + k] = out[b];
+        if (k + step >= rf->neps && k != rf->neps - 1) k = rf->neps - 1 - step;   /* the last one too */
+    }
+
+    for (b = 0; b < nb; b ++) {
+        cc = job->cc + (size_t)(b0 + b) * rf->neps;
+        for (best = 0, k = 1; k < rf->neps; k ++) if (cc[k] > cc[best]) best = k;
+        if (step > 1) {
+            lo = best - step < 0 ? 0 : best - step;
+            hi = best + step >= rf->neps ? rf->neps - 1 : best + step;
+            for (k = lo; k <= hi; k ++)
+                if (cc[k] == DVV_NONE)
+                    dot_batch(rf->win + (size_t)k * rf->m, job->d + (size_t)(b0 + b) * rf->m, 1, rf->m, &cc[k]);
+            for (k = lo; k <= hi; k ++) if (cc[k] > cc[best]) best = k;
+        }
+
+        /* parabola through the neighbours of the best stretch */
+        c = cc[best]; d = 0.;
+        if (best > 0 && best < rf->neps - 1) {
+            cl = cc[best-1]; cr = cc[best+1];
+            if (cl - 2. * c + cr < 0.) {
+                d = 0.5 * (cl - cr) / (cl - 2. * c + cr);
+                c -= 0.25 * (cl - cr) * d;
+            }
+        }
+        job->pick[b0 + b].dvv = rf->neps > 1 ? -rf->eps_max + 2. * rf->eps_max * (best + d) / (rf->neps - 1) : 0.;
+        job->pick[b0 + b].cc = c;
+    }
+}
+
+/*
+ *  dvv_worker: batches of days taken in turn, no lock held
+ */
+static void *dvv_worker(void *arg)
+{
+    DVVJOB *job = (DVVJOB *)arg;
+    long   b;
+
+    while ((b = __sync_fetch_and_add(&job->next, 1) * DVV_BATCH) < job->nday)
+        batch_run(job, (int)b, job->nday - b < DVV_BATCH ? (int)(job->nday - b) : DVV_BATCH);
+    return NULL;
+}
@@ -0,0 +1,59 @@
+/*******************************************************************************
+    Name:     dvv.h
+
+    Purpose:  relative velocity change (dv/v) of daily correlations against
+        a reference stack by the stretching method, for many days at once
+        (abc_dvv)
+
+    Notes:
+        A velocity change dv/v moves the arrivals of a day to t (1 - dv/v),
+        so the day matches the reference stretched by eps = dv/v:
+
+            ref_eps(t) = ref( t (1 + eps) )
+
+        and dv/v is the eps of the grid [-eps_max, eps_max] (neps points)
+        with the largest correlation coefficient between the day and the
+        stretched reference over the coda window t1 <= |t| <= t2.
+
+        dvv_ref interpolates the reference once, by a natural cubic spline
+        of its lags, at every stretch of the grid, and keeps the stretched
+        windows with their mean removed and unit norm. The coefficient of a
+        day is then a dot product with each of them: dvv_run takes the days
+        DVV_BATCH at a time against every stretch, the window of a stretch
+        loaded once for the batch, in loops of independent partial sums the
+        compiler vectorizes, and the batches are shared by the threads.
+
+        With a coarse step k > 1 every k-th stretch is tried first and then
+        all within k of the best one. The best stretch is refined by a
+        parabola through the coefficients of its neighbours.
+*******************************************************************************/
+
+#ifndef _DVV_H
+#define _DVV_H
+
+#include "sacio.h"
+
+#define DVV_BATCH       4           /* days against a stretch at once       */
+
+/* reference stretched over the grid */
+typedef struct dvv_ref {
+    int     npts;                   /* lags of the correlations             */
+    float   delta;
+    int     m;                      /* samples of the window, both sides    */
+    int     *lag;                   /* their lags (index in the trace)      */
+    int     neps;
+    float   eps_max;
+    float   *win;                   /* neps windows of m samples            */
+} DVVREF;
+
+/* dv/v of a day */
+typedef struct dvv_pick {
+    float   dvv;                    /* eps of the best stretch              */
+    float   cc;                     /* its correlation coefficient          */
+} DVVPICK;
+
+DVVREF *dvv_ref ( const float *ref, const SACHEAD *hd, float t1, float t2, float eps_max, int neps );
+void dvv_free ( DVVREF *rf );
+int dvv_run ( const DVVREF *rf, float **day, int nday, int coarse, int nthread, DVVPICK *pick );
+
+#endif /* dvv.h */
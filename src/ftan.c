@@ -0,0 +1,198 @@
+/*******************************************************************************
+ *                                   ftan.c                                    *
+ *  Frequency-time analysis of correlations in memory, see ftan.h:             *
+ *      ftan_parse       read the settings "tmin/tmax[/alpha[/nper]]"          *
+ *      ftan_run         group velocity dispersion of a correlation            *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fftw3.h>
+#include "ftan.h"
+#include "abcstat.h"
+
+#define FTAN_CUT    40.         /* filters taken as zero below exp(-FTAN_CUT) */
+
+/* function prototype for local use */
+static void bank_filter (const fftw_complex *spec, int nfft, float delta, const FTANSET *set,
+                         fftw_complex *bank);
+static void bank_pick   (const fftw_complex *band, int n, int nfft, int i0, int i1, float delta,
+                         float dist, FTANPICK *pick);
+
+/*
+ *  ftan_parse
+ *
+ *  Description: settings of the analysis from "tmin/tmax[/alpha[/nper]]",
+ *      FTAN_ALPHA and FTAN_NPER if not given, group velocities of
+ *      FTAN_VMIN to FTAN_VMAX
+ *
+ *  Return: 0 if succeed, -1 if the settings are bad.
+ *
+ */
+int ftan_parse(const char *arg, FTANSET *set)
+{
+    int n;
+
+    set->alpha = FTAN_ALPHA;
+    set->nper = FTAN_NPER;
+    set->vmin = FTAN_VMIN;
+    set->vmax = FTAN_VMAX;
+    n = sscanf(arg, "%f/%f/%f/%d", &set->tmin, &set->tmax, &set->alpha, &set->nper);
+    if (n < 2 || set->tmin <= 0. || set->tmax < set->tmin || set->alpha <= 0. || set->nper < 1) {
+        fprintf(stderr, "Bad FTAN setting %s (tmin/tmax[/alpha[/nper]], 0 < tmin <= tmax)\n", arg);
+        return -1;
+    }
+    if (set->tmax == set->tmin) set->nper = 1;
+    return 0;
+}
+
+/*
+ *  ftan_run
+ *
+ *  Description: Group velocity dispersion of the correlation cor of
+ *      header hd (hd->npts lags, zero lag in the middle), one pick per
+ *      period of the bank, from the shortest period to the longest.
+ *
+ *  IN:
+ *      const float   *cor : lags of the correlation
+ *      const SACHEAD *hd  : its header, dist (km) for the velocities
+ *      const FTANSET *set : periods and filters
+ *  OUT:
+ *      FTANPICK     *pick : set->nper picks
+ *
+ *  Return: number of picks, -1 if out of memory.
+ *
+ */
+int ftan_run(const float *cor, const SACHEAD *hd, const FTANSET *set, FTANPICK *pick)
+{
+    int          lag_n, n, nfft, i, i0, i1, p;
+    float        dist, ratio;
+    fftw_complex *sym, *spec, *bank;
+    fftw_plan    pf, pb;
+
+    lag_n = (hd->npts - 1) / 2;
+    n = lag_n + 1;
+    nfft = pow_next2(2 * n);
+    dist = hd->dist > 0. && hd->dist != -12345. ? hd->dist : 0.;
+
+    sym = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * nfft);
+    spec = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * nfft);
+    bank = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * nfft * set->nper);
+    if (sym == NULL || spec == NULL || bank == NULL) {
+        fprintf(stderr, "Out of memory for FTAN of %d periods on %d points\n", set->nper, nfft);
+        fftw_free(sym); fftw_free(spec); fftw_free(bank);
+        return -1;
+    }
+    STAT_ALLOC(sizeof(fftw_complex) * nfft * (2 + set->nper));
+
+    /* symmetric part: causal and acausal lags averaged, zero padded */
+    for (i = 0; i < nfft; i ++) {
+        sym[i][0] = i < n ? 0.5 * (cor[lag_n + i] + cor[lag_n - i]) : 0.;
+        sym[i][1] = 0.;
+    }
+    pf = fft_plan_many(nfft, 1, sym, spec, FFTW_FORWARD);
+    fftw_execute(pf);
+    fft_plan_free(pf);
+
+    /* the bank on the one spectrum, then all bands back at once */
+    bank_filter(spec, nfft, hd->delta, set, bank);
+    pb = fft_plan_many(nfft, set->nper, bank, bank, FFTW_BACKWARD);
+    fftw_execute(pb);
+    fft_plan_free(pb);
+
+    /* window of the group arrivals */
+    i0 = 0; i1 = n - 1;
+    if (dist > 0.) {
+        i0 = (int)ceil(dist / set->vmax / hd->delta);
+        i1 = (int)floor(dist / set->vmin / hd->delta);
+        if (i1 > n - 1) i1 = n - 1;
+    }
+    ratio = set->nper > 1 ? pow(set->tmax / set->tmin, 1. / (set->nper - 1)) : 1.;
+    for (p = 0; p < set->nper; p ++) {
+        pick[p].period = set->tmin * pow(ratio, p);
+        bank_pick(bank + (size_t)p * nfft, n, nfft, i0, i1, hd->delta, dist, &pick[p]);
+    }
+
+    fftw_free(sym); fftw_free(spec); fftw_free(bank);
+    return set->nper;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  bank_filter: the nper bands of the spectrum spec, analytic (positive
+ *      frequencies doubled, negative ones zero), band after band in bank;
+ *      a Gaussian is only evaluated on the bins it does not vanish on
+ */
+static void bank_filter(const fftw_complex *spec, int nfft, float delta, const FTANSET *set,
+                        fftw_complex *bank)
+{
+    double  fc, df = 1. / (nfft * delta), ratio, w, x, xm = sqrt(FTAN_CUT / set->alpha);
+    fftw_complex *band;
+    int     p, i, lo, hi, half = nfft / 2;
+
+    ratio = set->nper > 1 ? pow(set->tmax / set->tmin, 1. / (set->nper - 1)) : 1.;
+    for (p = 0; p < set->nper; p ++) {
+        band = bank + (size_t)p * nfft;
+        fc = 1. / (set->tmin * pow(ratio, p));
+
+        /* bins where the filter is above exp(-FTAN_CUT), the others zero */
+        lo = (int)ceil(fc * (1. - xm) / df);
+        hi = (int)floor(fc * (1. + xm) / df);
+        if (lo < 0) lo = 0;
+        if (hi > half) hi = half;
+        memset(band, 0, sizeof(fftw_complex) * nfft);
+        for (i = lo; i <= hi; i ++) {
+            x = (i * df - fc) / fc;
+            w = (i == 0 || i == half ? 1. : 2.) * exp(-set->alpha * x * x);
+            band[i][0] = w * spec[i][0];
+            band[i][1] = w * spec[i][1];
+        }
+    }
+}
+
+/*
+ *  bank_pick: group arrival of a band, the largest envelope in [i0, i1]
+ */
+static void bank_pick(const fftw_complex *band, int n, int nfft, int i0, int i1, float delta,
+                      float dist, FTANPICK *pick)
+{
+    double  e, em = -1., el, er, d, ss = 0.;
+    int     i, m = -1, nn = 0;
+
+    pick->time = pick->group = pick->amp = pick->snr = pick->phase = 0.;
+    for (i = i0; i <= i1; i ++) {
+        e = hypot(band[i][0], band[i][1]);
+        if (e > em) { em = e; m = i; }
+    }
+    if (m < 0) return;
+
+    /* parabola through the neighbours of the largest envelope, unless it is on the edge of a slope */
+    d = 0.;
+    if (m > 0 && m < n - 1) {
+        el = hypot(band[m-1][0], band[m-1][1]);
+        er = hypot(band[m+1][0], band[m+1][1]);
+        if (el <= em && er <= em && el - 2. * em + er < 0.) d = 0.5 * (el - er) / (el - 2. * em + er);
+    }
+    pick->time = (m + d) * delta;
+    pick->group = dist > 0. && pick->time > 0. ? dist / pick->time : 0.;
+    pick->amp = em / nfft;
+    pick->phase = atan2(band[m][1], band[m][0]);
+
+    /* noise after the window of arrivals, or outside it if the lags end there */
+    for (i = i1 + 1; i < n; i ++, nn ++) ss += pow(hypot(band[i][0], band[i][1]), 2.);
+    if (nn == 0)
+        for (i = 0; i < n; i ++)
+            if (i < i0 || i > i1) {
+                ss += pow(hypot(band[i][0], band[i][1]), 2.);
+                nn ++;
+            }
+    pick->snr = nn > 0 && ss > 0. ? em / sqrt(ss / nn) : 0.;
+}
@@ -0,0 +1,65 @@
+/*******************************************************************************
+    Name:     ftan.h
+
+    Purpose:  frequency-time analysis (FTAN) of a correlation in memory: the
+        group velocity dispersion curve of its symmetric part, picked as the
+        correlation is written (abc_egf --ftan)
+
+    Notes:
+        The causal and acausal lags of the correlation are averaged into the
+        symmetric part, transformed once, and passed through a bank of nper
+        Gaussian filters centred on periods spaced evenly in log from tmin
+        to tmax:
+
+            H(f) = exp( -alpha * ((f - fc) / fc)^2 ),   fc = 1 / period
+
+        applied to the positive frequencies only, so that the inverse
+        transforms are the analytic signals of the bands. The filters are
+        applied over the bank in one pass and the nper inverse transforms
+        done as one batch of FFTW (fft_plan_many of sacio); the envelopes
+        are their moduli.
+
+        The group arrival of a period is the largest envelope between the
+        times dist / vmax and dist / vmin (dist of the header, all lags if it
+        is not set), refined by a parabola through its neighbours. The SNR
+        of a pick is its envelope over the root mean square of the envelope
+        after that window, and its phase the instantaneous phase of the
+        analytic signal there, for picking phase velocities.
+
+        FFTW plans are made and destroyed under the lock of the planner of
+        sacio (fft_plan_many, fft_plan_free), so ftan_run may run while
+        stages plan in other threads.
+*******************************************************************************/
+
+#ifndef _FTAN_H
+#define _FTAN_H
+
+#include "sacio.h"
+
+#define FTAN_NPER       30          /* periods of the bank                  */
+#define FTAN_ALPHA      20.         /* width of the Gaussian filters        */
+#define FTAN_VMIN       1.          /* window of group velocities (km/s)    */
+#define FTAN_VMAX       5.
+
+/* settings of the analysis */
+typedef struct ftan_set {
+    float   tmin, tmax;             /* periods (s)                          */
+    int     nper;                   /* filters of the bank                  */
+    float   alpha;
+    float   vmin, vmax;             /* km/s                                 */
+} FTANSET;
+
+/* pick of one period */
+typedef struct ftan_pick {
+    float   period;                 /* centre period of the filter (s)      */
+    float   time;                   /* group arrival (s), 0 if none         */
+    float   group;                  /* velocity (km/s), 0 if no dist        */
+    float   amp;                    /* envelope at the arrival              */
+    float   snr;
+    float   phase;                  /* instantaneous phase there (rad)      */
+} FTANPICK;
+
+int ftan_parse ( const char *arg, FTANSET *set );
+int ftan_run ( const float *cor, const SACHEAD *hd, const FTANSET *set, FTANPICK *pick );
+
+#endif /* ftan.h */
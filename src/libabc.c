@@ -0,0 +1,316 @@
+/*******************************************************************************
+ *                                   libabc.c                                  *
+ *  Processing of abc_egf on samples in memory, see libabc.h:                  *
+ *      abc_new          context of a band                                     *
+ *      abc_free         free a context                                        *
+ *      abc_set_norm     windows of the normalization and of the whitening     *
+ *      abc_set_sta_lta  mask transients before the normalization              *
+ *      abc_bp           band-pass filtering, as bp                            *
+ *      abc_normal       run absolute mean normalization, as normal            *
+ *      abc_whiten       spectral whitening, as spe_whi                        *
+ *      abc_cor_size     lags abc_cor writes at most                           *
+ *      abc_cor          cross correlation, as cor_in_freq                     *
+ *      abc_pair         all stages of a pair of cut windows                   *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "sacio.h"
+#include "libabc.h"
+
+struct abc_ctx {
+    float   f1, f2, f3, f4;             /* band (Hz)                        */
+    int     npow;                       /* order of the band-pass taper     */
+    int     norm_npts, whi_npts;        /* half windows (samples)           */
+    float   sta, lta, on, off;          /* transient masking, off if sta 0  */
+    float   *w[3];                      /* work traces of abc_pair          */
+    char    *mask;                      /* work mask of abc_normal          */
+    int     nw, nmask;                  /* their sizes                      */
+};
+
+/* function prototype for local use */
+static int     trace_ok    (const ABCTRACE *tr);
+static SACHEAD trace_head  (const ABCTRACE *tr);
+
+/*
+ *  abc_new
+ *
+ *  Description: context of the band f1 < f2 < f3 < f4 (Hz), with the
+ *      settings of abc_egf: taper order 10, normalization and whitening
+ *      half windows of 40 and 20 samples, no transient masking
+ *
+ *  Return: pointer to the context, NULL if failed.
+ *
+ */
+ABCCTX *abc_new(float f1, float f2, float f3, float f4)
+{
+    ABCCTX *ctx;
+
+    if (!(0. <= f1 && f1 < f2 && f2 <= f3 && f3 < f4)) {
+        fprintf(stderr, "Bad band %g/%g/%g/%g (f1 < f2 <= f3 < f4)\n", f1, f2, f3, f4);
+        return NULL;
+    }
+    if ((ctx = (ABCCTX *)calloc(1, sizeof(ABCCTX))) == NULL) {
+        fprintf(stderr, "Out of memory for a context\n");
+        return NULL;
+    }
+    ctx->f1 = f1; ctx->f2 = f2; ctx->f3 = f3; ctx->f4 = f4;
+    ctx->npow = 10;
+    ctx->norm_npts = 40;
+    ctx->whi_npts = 20;
+    return ctx;
+}
+
+/*
+ *  abc_free
+ *
+ *  Description: free a context and its work arrays
+ *
+ */
+void abc_free(ABCCTX *ctx)
+{
+    int k;
+
+    if (ctx == NULL) return;
+    for (k = 0; k < 3; k ++) free(ctx->w[k]);
+    free(ctx->mask);
+    free(ctx);
+}
+
+/*
+ *  abc_set_norm
+ *
+ *  Description: half windows (samples) of the running absolute mean of
+ *      the normalization (npts of file.lst) and of the smoothing of the
+ *      amplitude spectrum in the whitening
+ *
+ *  Return: 0 if succeed, -1 if not positive.
+ *
+ */
+int abc_set_norm(ABCCTX *ctx, int norm_npts, int whi_npts)
+{
+    if (norm_npts < 1 || whi_npts < 1) {
+        fprintf(stderr, "Bad normalization windows %d and %d (samples > 0)\n", norm_npts, whi_npts);
+        return -1;
+    }
+    ctx->norm_npts = norm_npts;
+    ctx->whi_npts = whi_npts;
+    return 0;
+}
+
+/*
+ *  abc_set_sta_lta
+ *
+ *  Description: mask transients before the normalization, as abc_egf -s:
+ *      STA and LTA lengths (s), trigger on and off ratios; sta 0 for none
+ *
+ *  Return: 0 if succeed, -1 if not sta < lta and off < on.
+ *
+ */
+int abc_set_sta_lta(ABCCTX *ctx, float sta, float lta, float on, float off)
+{
+    if (sta > 0. && (lta <= sta || on <= off)) {
+        fprintf(stderr, "Bad STA/LTA setting %g/%g/%g/%g (sta < lta, off < on)\n", sta, lta, on, off);
+        return -1;
+    }
+    ctx->sta = sta; ctx->lta = lta; ctx->on = on; ctx->off = off;
+    return 0;
+}
+
+/*
+ *  abc_bp
+ *
+ *  Description: band-pass filtering of the tr->npts samples x into y
+ *
+ *  Return: 0 if succeed, -1 if the trace is bad.
+ *
+ */
+int abc_bp(ABCCTX *ctx, const float *x, float *y, const ABCTRACE *tr)
+{
+    SACHEAD hd;
+
+    if (trace_ok(tr) == -1) return -1;
+    hd = trace_head(tr);
+    bp_data(x, y, &hd, ctx->f1, ctx->f2, ctx->f3, ctx->f4, ctx->npow);
+    return 0;
+}
+
+/*
+ *  abc_normal
+ *
+ *  Description: run absolute mean normalization of the tr->npts samples x
+ *      into y, another array, transients masked to 0 if abc_set_sta_lta
+ *      was called
+ *
+ *  Return: 0 if succeed, -1 if the trace is bad.
+ *
+ */
+int abc_normal(ABCCTX *ctx, const float *x, float *y, const ABCTRACE *tr)
+{
+    if (trace_ok(tr) == -1) return -1;
+    if (x == y) {
+        fprintf(stderr, "abc_normal cannot write over its input\n");
+        return -1;
+    }
+    if (ctx->sta <= 0.) {
+        normal_data(x, y, tr->npts, ctx->norm_npts);
+        return 0;
+    }
+    if (ctx->nmask < tr->npts) {
+        free(ctx->mask);
+        if ((ctx->mask = (char *)malloc(tr->npts)) == NULL) {
+            ctx->nmask = 0;
+            fprintf(stderr, "Out of memory for a mask of %d samples\n", tr->npts);
+            return -1;
+        }
+        ctx->nmask = tr->npts;
+    }
+    sta_lta_mask(x, tr->npts, tr->delta, ctx->sta, ctx->lta, ctx->on, ctx->off, ctx->mask);
+    normal_mask(x, ctx->mask, y, tr->npts, ctx->norm_npts);
+    return 0;
+}
+
+/*
+ *  abc_whiten
+ *
+ *  Description: spectral whitening of the tr->npts samples x into y
+ *
+ *  Return: 0 if succeed, -1 if the trace is bad.
+ *
+ */
+int abc_whiten(ABCCTX *ctx, const float *x, float *y, const ABCTRACE *tr)
+{
+    if (trace_ok(tr) == -1) return -1;
+    spe_whi_data(x, y, tr->npts, tr->delta, ctx->whi_npts, ctx->f1, ctx->f2, ctx->f3, ctx->f4);
+    return 0;
+}
+
+/*
+ *  abc_cor_size
+ *
+ *  Description: number of lags abc_cor and abc_pair write at most for a
+ *      first trace tr and lags up to lag_time (s), the size of their cor
+ *
+ */
+int abc_cor_size(const ABCTRACE *tr, float lag_time)
+{
+    SACHEAD hd = trace_head(tr);
+
+    return cor_size(&hd, lag_time);
+}
+
+/*
+ *  abc_cor
+ *
+ *  Description: cross correlation of x (trace t1) and y (trace t2), lags
+ *      [-lag_time, lag_time] into cor (abc_cor_size of them at most)
+ *
+ *  OUT:
+ *      float  *cor  : info->npts lags
+ *      ABCCOR *info : lags and stations of the correlation
+ *
+ *  Return: number of lags, -1 if the traces differ in sampling interval
+ *      or the lags are not finite numbers (e.g. of a trace of zeros).
+ *
+ */
+int abc_cor(ABCCTX *ctx, const float *x, const ABCTRACE *t1, const float *y, const ABCTRACE *t2,
+            float lag_time, float *cor, ABCCOR *info)
+{
+    SACHEAD hd1, hd2, hd;
+    int     n, i;
+
+    (void)ctx;
+    if (trace_ok(t1) == -1 || trace_ok(t2) == -1) return -1;
+    hd1 = trace_head(t1);
+    hd2 = trace_head(t2);
+    if ((n = cor_data(x, NULL, &hd1, y, NULL, &hd2, lag_time, cor, &hd)) == -1) return -1;
+    for (i = 0; i < n; i ++) if (!isfinite(cor[i])) {
+        fprintf(stderr, "Non-finite lags of the correlation\n");
+        return -1;
+    }
+
+    info->npts = hd.npts;
+    info->delta = hd.delta;
+    info->b = hd.b;
+    info->dist = hd.dist;
+    info->az = hd.az;
+    info->baz = hd.baz;
+    info->gcarc = hd.gcarc;
+    return n;
+}
+
+/*
+ *  abc_pair
+ *
+ *  Description: band-pass filtering, normalization and whitening of the
+ *      cut windows x and y in the work arrays of the context, then their
+ *      cross correlation into cor, as abc_egf does for a line of file.lst.
+ *      x and y are left as they are.
+ *
+ *  Return: number of lags, -1 if failed.
+ *
+ */
+int abc_pair(ABCCTX *ctx, const float *x, const ABCTRACE *t1, const float *y, const ABCTRACE *t2,
+             float lag_time, float *cor, ABCCOR *info)
+{
+    float **w = ctx->w;
+    int   n, k;
+
+    if (trace_ok(t1) == -1 || trace_ok(t2) == -1) return -1;
+    n = t1->npts > t2->npts ? t1->npts : t2->npts;
+    if (ctx->nw < n) {
+        for (k = 0; k < 3; k ++) {
+            free(w[k]);
+            w[k] = (float *)malloc(sizeof(float) * n);
+        }
+        if (w[0] == NULL || w[1] == NULL || w[2] == NULL) {
+            for (k = 0; k < 3; k ++) { free(w[k]); w[k] = NULL; }
+            ctx->nw = 0;
+            fprintf(stderr, "Out of memory for traces of %d samples\n", n);
+            return -1;
+        }
+        ctx->nw = n;
+    }
+
+    /* bp into w[0], normalization into w[1] (w[2]) and whitening there in place */
+    abc_bp(ctx, x, w[0], t1);
+    if (abc_normal(ctx, w[0], w[1], t1) == -1) return -1;
+    abc_whiten(ctx, w[1], w[1], t1);
+    abc_bp(ctx, y, w[0], t2);
+    if (abc_normal(ctx, w[0], w[2], t2) == -1) return -1;
+    abc_whiten(ctx, w[2], w[2], t2);
+
+    return abc_cor(ctx, w[1], t1, w[2], t2, lag_time, cor, info);
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  trace_ok: 0 if tr has samples and a sampling interval, -1 if not
+ */
+static int trace_ok(const ABCTRACE *tr)
+{
+    if (tr->npts < 1 || !(tr->delta > 0.)) {
+        fprintf(stderr, "Bad trace of %d samples of %g s\n", tr->npts, tr->delta);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ *  trace_head: SAC header of a trace of the caller
+ */
+static SACHEAD trace_head(const ABCTRACE *tr)
+{
+    SACHEAD hd = new_sac_head(tr->delta, tr->npts, 0.);
+
+    hd.stla = tr->stla;
+    hd.stlo = tr->stlo;
+    return hd;
+}
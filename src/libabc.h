@@ -0,0 +1,70 @@
+/*******************************************************************************
+    Name:     libabc.h
+
+    Purpose:  the processing of abc_egf on samples in memory, for programs
+        that hold the data already (e.g. acquisition software), built as
+        libabc.a and libabc.so by make lib
+
+    Notes:
+        The stages take the samples of the caller and write into arrays of
+        the caller: nothing is copied in or out and no file is read or
+        written. A trace is described by an ABCTRACE, a correlation by an
+        ABCCOR, both small structures of the caller.
+
+            ABCCTX *ctx = abc_new( 0.0167, 0.02, 0.067, 0.08 );
+            float  *cor = malloc( sizeof(float) * abc_cor_size( &t1, 500. ) );
+            ABCCOR info;
+
+            abc_pair( ctx, x, &t1, y, &t2, 500., cor, &info );
+
+        gives the lags of COR_*.SAC of abc_egf for the cut windows x and y,
+        bit for bit. abc_bp, abc_normal, abc_whiten and abc_cor are the
+        stages of abc_pair; abc_bp and abc_whiten may write over their
+        input (y the same array as x), abc_normal may not.
+
+        The context holds the band and the settings of the stages, and work
+        arrays that abc_pair reuses from one call to the next. A context is
+        used by one thread at a time; threads with contexts of their own
+        run the stages at the same time. Errors are reported on stderr and
+        return -1. Instrument responses (abc_egf -r) and gap masks (-g) are
+        not applied.
+*******************************************************************************/
+
+#ifndef _LIBABC_H
+#define _LIBABC_H
+
+#define ABC_UNDEF   (-12345.)           /* as SAC_FLOAT_UNDEF               */
+
+typedef struct abc_ctx ABCCTX;          /* opaque                           */
+
+/* trace of the caller */
+typedef struct abc_trace {
+    int     npts;                       /* number of samples                */
+    float   delta;                      /* sampling interval (s)            */
+    float   stla, stlo;                 /* station, ABC_UNDEF if unknown    */
+} ABCTRACE;
+
+/* correlation written by abc_cor and abc_pair */
+typedef struct abc_cor {
+    int     npts;                       /* lags written, 2*lag_n+1          */
+    float   delta;                      /* lag interval (s)                 */
+    float   b;                          /* lag of the first one (s)         */
+    float   dist, az, baz, gcarc;       /* km and degrees, from the first   */
+                                        /* station to the second, ABC_UNDEF */
+                                        /* if the stations are unknown      */
+} ABCCOR;
+
+ABCCTX *abc_new ( float f1, float f2, float f3, float f4 );
+void abc_free ( ABCCTX *ctx );
+int abc_set_norm ( ABCCTX *ctx, int norm_npts, int whi_npts );
+int abc_set_sta_lta ( ABCCTX *ctx, float sta, float lta, float on, float off );
+int abc_bp ( ABCCTX *ctx, const float *x, float *y, const ABCTRACE *tr );
+int abc_normal ( ABCCTX *ctx, const float *x, float *y, const ABCTRACE *tr );
+int abc_whiten ( ABCCTX *ctx, const float *x, float *y, const ABCTRACE *tr );
+int abc_cor_size ( const ABCTRACE *tr, float lag_time );
+int abc_cor ( ABCCTX *ctx, const float *x, const ABCTRACE *t1, const float *y, const ABCTRACE *t2,
+              float lag_time, float *cor, ABCCOR *info );
+int abc_pair ( ABCCTX *ctx, const float *x, const ABCTRACE *t1, const float *y, const ABCTRACE *t2,
+               float lag_time, float *cor, ABCCOR *info );
+
+#endif /* libabc.h */
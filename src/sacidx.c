@@ -0,0 +1,352 @@
+/*******************************************************************************
+ *                                  sacidx.c                                   *
+ *  Time index of continuous SAC files:                                        *
+ *      sac_index_load   build a sorted index from a list of SAC files         *
+ *      sac_index_free   release an index                                      *
+ *      sac_index_query  stitch an absolute time window across files           *
+ *      sac_index_window write a stitched window as a SAC file                 *
+ *      sac_index_data   a stitched window in memory                           *
+ *      sac_index_files  files that a window is stitched from                  *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sacidx.h"
+#include "abcstat.h"
+
+/* function prototype for local use */
+static int  seg_cmp       (const void *a, const void *b);
+static void trim_key      (char *key, const char *str);
+static int  first_seg     (const SACINDEX *idx, const char *key, double t);
+
+/*
+ *  sac_index_load
+ *
+ *  Description: Build a sorted time index from a list file. Each line of
+ *      the list holds a SAC file name, optionally followed by a station
+ *      key. Without a key, kstnm of the SAC header is used.
+ *
+ *  IN:
+ *      const char *lst : list file name
+ *
+ *  Return: pointer to the index, NULL if failed.
+ *
+ */
+SACINDEX *sac_index_load(const char *lst)
+{
+    FILE     *ff;
+    SACINDEX *idx;
+    SACSEG   *seg;
+    SACHEAD  hd;
+    char     buff[512], name[SACIDX_NAME_LEN], key[SACIDX_KEY_LEN];
+    double   tend;
+    int      nmax = 64, n, i;
+
+    if ((ff = fopen(lst, "r")) == NULL) {
+        fprintf(stderr, "Unable to open %s\n", lst);
+        return NULL;
+    }
+
+    idx = (SACINDEX *)malloc(sizeof(SACINDEX));
+    idx->nseg = 0;
+    idx->seg = (SACSEG *)malloc(sizeof(SACSEG) * nmax);
+
+    while (fgets(buff, 512, ff)) {
+        key[0] = '\0';
+        n = sscanf(buff, "%255s %31s", name, key);
+        if (n < 1 || name[0] == '#') continue;
+        if (read_sac_head(name, &hd) == -1) continue;
+
+        if (idx->nseg == nmax) {
+            nmax *= 2;
+            idx->seg = (SACSEG *)realloc(idx->seg, sizeof(SACSEG) * nmax);
+        }
+        seg = &idx->seg[idx->nseg];
+        if (n == 2) trim_key(seg->key, key);
+        else        trim_key(seg->key, hd.kstnm);
+        strcpy(seg->name, name);
+        seg->t0    = sac_begin_time(&hd);
+        seg->delta = hd.delta;
+        seg->npts  = hd.npts;
+        idx->nseg ++;
+    }
+    fclose(ff);
+
+    qsort(idx->seg, (size_t)idx->nseg, sizeof(SACSEG), seg_cmp);
+
+    /* latest end so far of the files of each key, for first_seg */
+    for (i = 0; i < idx->nseg; i ++) {
+        seg = &idx->seg[i];
+        tend = seg->t0 + seg->npts * (double)seg->delta;
+        if (i > 0 && strcmp(idx->seg[i-1].key, seg->key) == 0 && idx->seg[i-1].tend > tend)
+            tend = idx->seg[i-1].tend;
+        seg->tend = tend;
+    }
+
+    return idx;
+}
+
+/*
+ *  sac_index_free
+ *
+ *  Description: release memory of an index
+ *
+ */
+void sac_index_free(SACINDEX *idx)
+{
+    if (idx == NULL) return;
+    free(idx->seg);
+    free(idx);
+}
+
+/*
+ *  sac_index_query
+ *
+ *  Description: Read the samples of station key in the absolute window
+ *      [t0, t1), sampled at t0 + k*delta, from every file covering it.
+ *      Each file is aligned to the nearest sample of this grid and only
+ *      the overlapping byte range is read. Samples not covered by any file
+ *      are zero-filled and flagged in mask. Where files overlap, the
+ *      earlier file wins.
+ *
+ *  IN:
+ *      const SACINDEX *idx : index
+ *      const char     *key : station key
+ *      double         t0   : absolute begin time (inclusive)
+ *      double         t1   : absolute end time (exclusive)
+ *      float          delta: sampling interval, must match the files
+ *  OUT:
+ *      float          *data: lround((t1-t0)/delta) samples
+ *      char           *mask: 1 for data, 0 for gap, may be NULL
+ *
+ *  Return: number of valid samples, -1 if failed.
+ *
+ */
+int sac_index_query(const SACINDEX *idx, const char *key, double t0, double t1,
+                    float delta, float *data, char *mask)
+{
+    SACHEAD hd;
+    SACSEG  *seg;
+    float   *buf;
+    char    *valid, *got;
+    long    j0;
+    int     i, k, k1, k2, n, nvalid = 0;
+
+    n = (int)lround((t1 - t0) / delta);
+    if (n <= 0) return 0;
+
+    valid = (char *)calloc((size_t)n, 1);
+    buf   = (float *)malloc(sizeof(float) * n);
+    got   = (char *)malloc((size_t)n);
+    memset(data, 0, sizeof(float) * n);
+
+    for (i = first_seg(idx, key, t0); i < idx->nseg; i ++) {
+        seg = &idx->seg[i];
+        if (strcmp(seg->key, key) != 0 || seg->t0 >= t1) break;
+        if (fabs(seg->delta - delta) > 1.0e-4 * delta) {
+            fprintf(stderr, "Sampling interval of %s differs from %g, skipped\n",
+                    seg->name, delta);
+            continue;
+        }
+
+        /* file sample j0 + k falls on output sample k */
+        j0 = lround((t0 - seg->t0) / delta);
+        k1 = j0 < 0 ? (int)(-j0) : 0;
+        k2 = seg->npts - j0 < n ? (int)(seg->npts - j0) : n;
+        if (k1 >= k2) continue;
+
+        if (read_sac_range(seg->name, &hd, j0 + k1, k2 - k1, buf, got) == -1) {
+            free(valid); free(buf); free(got);
+            return -1;
+        }
+        for (k = k1; k < k2; k ++) {
+            if (valid[k] || !got[k-k1]) continue;
+            data[k]  = buf[k-k1];
+            valid[k] = 1;
+            nvalid ++;
+        }
+    }
+
+    if (mask != NULL) memcpy(mask, valid, (size_t)n);
+    free(valid); free(buf); free(got);
+
+    return nvalid;
+}
+
+/*
+ *  sac_index_window
+ *
+ *  Description: Stitch npts samples of station key from absolute time t0
+ *      and write them as a SAC file, in the same form as cut_sac, with
+ *      the mask of its gaps if set_gap_mask was called.
+ *
+ *  Return: number of valid samples, -1 if failed.
+ *
+ */
+int sac_index_window(const SACINDEX *idx, const char *key, double t0, int npts,
+                     char *sacout)
+{
+    SACHEAD hd;
+    float   *data;
+    char    *mask;
+    int     nvalid;
+    STAT_BEGIN(STAT_CUT);
+
+    data = (float *)malloc(sizeof(float) * npts);
+    mask = (char *)malloc(npts);
+    STAT_ALLOC((sizeof(float) + 1) * npts);
+    if ((nvalid = sac_index_data(idx, key, t0, npts, data, mask, &hd)) == -1) {
+        free(data); free(mask);
+        return -1;
+    }
+    write_sac(sacout, hd, data);
+    mask_save(sacout, mask, npts);
+    free(data); free(mask);
+
+    STAT_END(STAT_CUT);
+    return nvalid;
+}
+
+/*
+ *  sac_index_data
+ *
+ *  Description: the window of sac_index_window into data and mask in
+ *      memory, its header, as of cut_sac, into hd
+ *
+ *  Return: number of valid samples, -1 if failed.
+ *
+ */
+int sac_index_data(const SACINDEX *idx, const char *key, double t0, int npts,
+                   float *data, char *mask, SACHEAD *hd)
+{
+    SACSEG  *seg;
+    int     i, nvalid;
+
+    i = first_seg(idx, key, t0);
+    if (i >= idx->nseg || strcmp(idx->seg[i].key, key) != 0) {
+        fprintf(stderr, "No data of %s in index\n", key);
+        return -1;
+    }
+    seg = &idx->seg[i];
+    if (read_sac_head(seg->name, hd) == -1) return -1;
+
+    nvalid = sac_index_query(idx, key, t0, t0 + (double)npts * seg->delta,
+                             seg->delta, data, mask);
+    if (nvalid == -1) return -1;
+    if (nvalid < npts)
+        fprintf(stderr, "Warning: %d of %d samples of %s missing, zero filled\n",
+                npts - nvalid, npts, key);
+
+    hd->b = 0.; hd->e = (npts-1) * hd->delta; hd->npts = npts;
+    return nvalid;
+}
+
+/*
+ *  sac_index_files
+ *
+ *  Description: files of station key that sac_index_window may read for
+ *      npts samples from absolute time t0, e.g. to tell whether the data
+ *      of a window changed since it was last correlated.
+ *
+ *  OUT:
+ *      const SACSEG **seg : first of the files, consecutive in the index
+ *
+ *  Return: number of files, 0 if the station has no data there.
+ *
+ */
+int sac_index_files(const SACINDEX *idx, const char *key, double t0, int npts,
+                    const SACSEG **seg)
+{
+    double t1;
+    int    i, n;
+
+    i = first_seg(idx, key, t0);
+    *seg = NULL;
+    if (i >= idx->nseg) return 0;
+    t1 = t0 + (double)npts * idx->seg[i].delta;
+    for (n = 0; i + n < idx->nseg; n ++)
+        if (strcmp(idx->seg[i+n].key, key) != 0 || idx->seg[i+n].t0 >= t1) break;
+    if (n > 0) *seg = &idx->seg[i];
+    return n;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  seg_cmp: order segments by key, then by begin time
+ */
+static int seg_cmp(const void *a, const void *b)
+{
+    const SACSEG *s1 = (const SACSEG *)a;
+    const SACSEG *s2 = (const SACSEG *)b;
+    int c;
+
+    if ((c = strcmp(s1->key, s2->key)) != 0) return c;
+    if (s1->t0 < s2->t0) return -1;
+    if (s1->t0 > s2->t0) return 1;
+    return 0;
+}
+
+/*
+ *  trim_key: copy a station name without the trailing blanks of SAC strings
+ */
+static void trim_key(char *key, const char *str)
+{
+    int n;
+
+    snprintf(key, SACIDX_KEY_LEN, "%.*s", SACIDX_KEY_LEN-1, str);
+    for (n = (int)strlen(key); n > 0 && key[n-1] == ' '; n --) key[n-1] = '\0';
+}
+
+/*
+ *  first_seg
+ *
+ *  Description: binary search for the first segment of key whose data may
+ *      reach time t: the first one, up to the last beginning at or before
+ *      t, after which some file of key ends later than t (tend), so an
+ *      earlier, longer file is found however many files lie between. The
+ *      last one beginning at or before t if none reaches t, or the first
+ *      one of key if all begin later.
+ *
+ *  Return: segment index, idx->nseg if key is not in the index.
+ */
+static int first_seg(const SACINDEX *idx, const char *key, double t)
+{
+    int lo = 0, hi = idx->nseg, mid, c, first;
+
+    /* lower bound of key */
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (strcmp(idx->seg[mid].key, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+    first = lo;
+
+    /* last segment of key with t0 <= t */
+    hi = idx->nseg;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        c = strcmp(idx->seg[mid].key, key);
+        if (c < 0 || (c == 0 && idx->seg[mid].t0 <= t)) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo > first) lo --;
+
+    /* first segment up to it whose latest end so far passes t, tend rising with the index */
+    hi = lo;
+    lo = first;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (idx->seg[mid].tend > t) hi = mid;
+        else lo = mid + 1;
+    }
+
+    return (first < idx->nseg && strcmp(idx->seg[first].key, key) == 0) ? lo : idx->nseg;
+}
@@ -0,0 +1,53 @@
+/*******************************************************************************
+    Name:     sacidx.h
+
+    Purpose:  sorted time index over continuous SAC files, and query of an
+        absolute time window that may span several files (e.g. across
+        day boundaries)
+
+    Notes:
+        Times are absolute epoch seconds in double precision (see abs_time),
+        which resolve well below one sample for any realistic sampling rate.
+
+        Each entry of the index is one SAC file of one station. Entries are
+        sorted by station and begin time so that the files covering a window
+        are found by binary search; the running latest end time of the files
+        of a station finds an earlier, longer file that still covers it.
+*******************************************************************************/
+
+#ifndef _SACIDX_H
+#define _SACIDX_H
+
+#include "sacio.h"
+
+/* Maximum length of a station key and of a file name in the index */
+#define SACIDX_KEY_LEN      32
+#define SACIDX_NAME_LEN     256
+
+typedef struct sac_seg {
+    char    key[SACIDX_KEY_LEN];    /* station key                          */
+    char    name[SACIDX_NAME_LEN];  /* SAC file name                        */
+    double  t0;                     /* absolute time of the first sample    */
+    float   delta;                  /* sampling interval                    */
+    int     npts;                   /* number of samples in the file        */
+    double  tend;                   /* latest end of the files of the key   */
+                                    /* up to this one                       */
+} SACSEG;
+
+typedef struct sac_index {
+    int     nseg;                   /* number of files in the index         */
+    SACSEG  *seg;                   /* files sorted by key then t0          */
+} SACINDEX;
+
+SACINDEX *sac_index_load ( const char *lst );
+void sac_index_free ( SACINDEX *idx );
+int sac_index_query ( const SACINDEX *idx, const char *key, double t0, double t1,
+                      float delta, float *data, char *mask );
+int sac_index_window ( const SACINDEX *idx, const char *key, double t0, int npts,
+                       char *sacout );
+int sac_index_data ( const SACINDEX *idx, const char *key, double t0, int npts,
+                     float *data, char *mask, SACHEAD *hd );
+int sac_index_files ( const SACINDEX *idx, const char *key, double t0, int npts,
+                      const SACSEG **seg );
+
+#endif /* sacidx.h */
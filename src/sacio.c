@@ -5,11 +5,15 @@
  *      read_sac         read SAC binary data                                  *
  *      read_sac_xy      read SAC binary XY data                               *
  *      read_sac_pdw     read SAC data in a partial data window (cut option)   *
+ *      read_sac_range   read a range of samples, zero-filled outside the file *
  *      write_sac        Write SAC binary data                                 *
  *      write_sac_xy     Write SAC binary XY data                              *
  *      new_sac_head     Create a new minimal SAC header                       *
  *      sac_head_index   Find the offset of specified SAC head fields          *
  *      issac            Check if a file in in SAC format                      *
+ *      sac_swap4        Reverse the byte order of 4-byte words                *
+ *      sac_swap4_copy   Copy 4-byte words reversing their byte order          *
+ *      sac_swap4_use    Choose the scalar, SSSE3 or AVX2 byte swap            *
  *                                                                             *
  *  Author: Dongdong Tian @ USTC                                               *
  *                                                                             *
@@ -35,16 +39,52 @@
 #include <math.h>
 #include <ctype.h>
 #include <fftw3.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SWAP_X86
+#include <immintrin.h>
+#endif
 //#include </home/feng_xuping/MY_LIB/FFTW3/include/fftw3.h>
 #include "sacio.h"
+#include "abcstat.h"
+
+#define SWAP_CHUNK  32768       /* bytes of swapped data read at a time */
+#define FFT_MAX_THREADS 256     /* threads of set_fft_threads at most */
+
+/* arrays of a per-bin loop that bin_loop splits over threads, those the loop uses */
+typedef struct bins {
+    const fftw_complex *x, *y;  /* spectra read */
+    const fftw_complex *inv;    /* inverse response of taper_bins, or NULL */
+    fftw_complex *z;            /* spectrum written, may be x */
+    float *w, *v;               /* weights read or amplitudes written */
+    int lo, hi;                 /* bins kept by whiten_bins */
+} BINS;
 
 /* function prototype for local use */
 static void    byte_swap       (char *pt, size_t n);
+static int     read_words      (FILE *strm, char *ar, size_t sz, int lswap);
 static int     check_sac_nvhdr (const int nvhdr);
 static void    map_chdr_in     (char *memar, char *buff);
 static int     read_head_in    (const char *name, SACHEAD *hd, FILE *strm);
 static void    map_chdr_out    (char *memar, char *buff);
 static int     write_head_out  (const char *name, SACHEAD hd, FILE *strm);
+static fftw_complex *fft_alloc (int n);
+static fftw_plan fft_plan      (int n, fftw_complex *in, fftw_complex *out, int sign);
+static void    fft_destroy     (fftw_plan p);
+static void    fft_exec        (fftw_plan p, int n, fftw_complex *in, fftw_complex *out);
+static void    bin_loop        (int n, void (*body)(void *arg, int i0, int i1), void *arg);
+static void    taper_bins      (void *arg, int i0, int i1);
+static void    whiten_bins     (void *arg, int i0, int i1);
+static void    amp_bins        (void *arg, int i0, int i1);
+static void    cross_bins      (void *arg, int i0, int i1);
+static int     mask_pass       (const char *sacin, const char *sacout, int n);
+static int     lags_finite     (const float *x, int n);
+static void    resp_spec       (fftw_complex *spec, const fftw_complex *inv, int n);
+static void    edge_taper      (float *x, int n);
+static void    hermitian_part  (fftw_complex *whi, int nfft);
+static float   mask_scale      (const char *mask, int n);
+static void    mask_spec       (fftw_complex *whi, const char *mask, int n, int nfft,
+                                fftw_complex *tmp, fftw_plan pb, fftw_plan pf);
 
 /* a SAC structure containing all null values */
 static SACHEAD sac_null = {
@@ -133,6 +173,7 @@ float *read_sac(const char *name, SACHEAD *hd)
     float   *ar;
     int     lswap;
     size_t  sz;
+    STAT_BEGIN(STAT_READ);
 
     if ((strm = fopen(name, "rb")) == NULL) {
         fprintf(stderr, "Unable to open %s\n", name);
@@ -154,8 +195,9 @@ float *read_sac(const char *name, SACHEAD *hd)
         fclose(strm);
         return NULL;
     }
+    STAT_ALLOC(sz);
 
-    if (fread((char*)ar, sz, 1, strm) != 1) {
+    if (read_words(strm, (char*)ar, sz, lswap) == -1) {
         fprintf(stderr, "Error in reading SAC data %s\n", name);
         free(ar);
         fclose(strm);
@@ -163,8 +205,8 @@ float *read_sac(const char *name, SACHEAD *hd)
     }
     fclose(strm);
 
-    if (lswap == TRUE) byte_swap((char*)ar, sz);
-
+    STAT_READ_BYTES(SAC_HEADER_NUMBERS_SIZE + SAC_HEADER_STRINGS_SIZE + sz);
+    STAT_END(STAT_READ);
     return ar;
 }
 
@@ -226,6 +268,7 @@ int write_sac(const char *name, SACHEAD hd, const float *ar)
 {
     FILE    *strm;
     size_t  sz;
+    STAT_BEGIN(STAT_WRITE);
 
     if ((strm = fopen(name, "wb")) == NULL) {
         fprintf(stderr, "Error in opening file for writing %s\n", name);
@@ -246,6 +289,9 @@ int write_sac(const char *name, SACHEAD hd, const float *ar)
         return -1;
     }
     fclose(strm);
+
+    STAT_WRITE_BYTES(SAC_HEADER_NUMBERS_SIZE + SAC_HEADER_STRINGS_SIZE + sz);
+    STAT_END(STAT_WRITE);
     return 0;
 }
 
@@ -378,7 +424,7 @@ float *read_sac_pdw(const char *name, SACHEAD *hd, int tmark, float t1, float t2
     if (nt2>npts) nt2 = npts;
     nn = nt2 - nt1;
 
-    if (fread((char *)fpt, (size_t)nn * SAC_DATA_SIZEOF, 1, strm) != 1) {
+    if (read_words(strm, (char *)fpt, (size_t)nn * SAC_DATA_SIZEOF, lswap) == -1) {
         fprintf(stderr, "Error in reading SAC data %s\n", name);
         free(ar);
         fclose(strm);
@@ -386,11 +432,81 @@ float *read_sac_pdw(const char *name, SACHEAD *hd, int tmark, float t1, float t2
     }
     fclose(strm);
 
-    if (lswap == TRUE) byte_swap((char*)ar, (size_t)nn*SAC_DATA_SIZEOF);
-
     return ar;
 }
 
+/*
+ *  read_sac_range
+ *
+ *  Description:
+ *      Read npts samples starting at sample index first into a caller
+ *      provided array. Only the requested byte range is read from disk.
+ *      Samples outside of the file are set to zero and flagged in mask.
+ *
+ *  Arguments:
+ *      const char  *name   :   file name
+ *      SACHEAD     *hd     :   SAC header to be filled (not modified for cut)
+ *      long        first   :   index of the first sample, may be negative
+ *      int         npts    :   number of samples to read
+ *      float       *ar     :   output array of npts samples
+ *      char        *mask   :   output validity of each sample (1 for data,
+ *                              0 for zero-filled), may be NULL
+ *
+ *  Return:
+ *      number of samples actually read from file, -1 if failed.
+ *
+ */
+int read_sac_range(const char *name, SACHEAD *hd, long first, int npts,
+                   float *ar, char *mask)
+{
+    FILE    *strm;
+    int     lswap;
+    long    nt1, nt2;
+    size_t  nn;
+    STAT_BEGIN(STAT_READ);
+
+    if ((strm = fopen(name, "rb")) == NULL) {
+        fprintf(stderr, "Error in opening %s\n", name);
+        return -1;
+    }
+
+    lswap = read_head_in(name, hd, strm);
+    if (lswap == -1) {
+        fclose(strm);
+        return -1;
+    }
+
+    memset(ar, 0, (size_t)npts * SAC_DATA_SIZEOF);
+    if (mask != NULL) memset(mask, 0, (size_t)npts);
+
+    nt1 = first < 0 ? 0 : first;
+    nt2 = first + npts > hd->npts ? hd->npts : first + npts;
+    if (nt1 >= nt2) {                   /* window entirely outside of file */
+        fclose(strm);
+        STAT_READ_BYTES(SAC_HEADER_NUMBERS_SIZE + SAC_HEADER_STRINGS_SIZE);
+        STAT_END(STAT_READ);
+        return 0;
+    }
+    nn = (size_t)(nt2 - nt1);
+
+    if (fseek(strm, nt1*SAC_DATA_SIZEOF, SEEK_CUR) < 0) {
+        fprintf(stderr, "Error in seek %s\n", name);
+        fclose(strm);
+        return -1;
+    }
+    if (read_words(strm, (char *)(ar + nt1 - first), nn * SAC_DATA_SIZEOF, lswap) == -1) {
+        fprintf(stderr, "Error in reading SAC data %s\n", name);
+        fclose(strm);
+        return -1;
+    }
+    fclose(strm);
+    if (mask != NULL) memset(mask + nt1 - first, 1, nn);
+
+    STAT_READ_BYTES(SAC_HEADER_NUMBERS_SIZE + SAC_HEADER_STRINGS_SIZE + nn*SAC_DATA_SIZEOF);
+    STAT_END(STAT_READ);
+    return (int)nn;
+}
+
 /*
  *  new_sac_head
  *
@@ -498,6 +614,93 @@ int issac(const char *name)
     else return TRUE;
 }
 
+/* byte swap kernels, the best one the CPU supports is picked on first use, once for all threads */
+static void swap4_scalar(char *dst, const char *src, size_t n);
+#ifdef SWAP_X86
+static void swap4_ssse3(char *dst, const char *src, size_t n);
+static void swap4_avx2(char *dst, const char *src, size_t n);
+#endif
+static void (*swap4_kernel)(char *dst, const char *src, size_t n) = NULL;
+static int swap4_level = -1;
+static pthread_once_t swap4_once = PTHREAD_ONCE_INIT;
+static void swap4_default(void);
+
+/*
+ *  sac_swap4_use
+ *
+ *  Description: choose the byte swap kernel used from now on, before any
+ *      thread swaps bytes (the kernel is not switched under them)
+ *
+ *  IN:
+ *      int level   :   SAC_SWAP_SCALAR, SAC_SWAP_SSSE3, SAC_SWAP_AVX2, or
+ *                      SAC_SWAP_BEST for the best one the CPU supports
+ *
+ *  Return: level of the kernel actually chosen, lowered to what the CPU
+ *          supports
+ *
+ */
+int sac_swap4_use(int level)
+{
+    int best = SAC_SWAP_SCALAR;
+
+#ifdef SWAP_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) best = SAC_SWAP_SSSE3;
+    if (__builtin_cpu_supports("avx2"))  best = SAC_SWAP_AVX2;
+#endif
+    if (level < 0 || level > best) level = best;
+
+    switch (level) {
+#ifdef SWAP_X86
+        case SAC_SWAP_AVX2:  swap4_kernel = swap4_avx2;  break;
+        case SAC_SWAP_SSSE3: swap4_kernel = swap4_ssse3; break;
+#endif
+        default:             swap4_kernel = swap4_scalar; level = SAC_SWAP_SCALAR;
+    }
+    return swap4_level = level;
+}
+
+/*
+ *  sac_swap4
+ *
+ *  Description: reverse the byte order of n bytes of 4-byte words in place
+ *
+ *  IN:
+ *      char    *pt :   pointer to byte array
+ *      size_t   n  :   number of bytes, a multiple of 4
+ *
+ */
+void sac_swap4(char *pt, size_t n)
+{
+    pthread_once(&swap4_once, swap4_default);
+    swap4_kernel(pt, pt, n);
+}
+
+/*
+ *  sac_swap4_copy
+ *
+ *  Description: copy n bytes of 4-byte words from src to dst reversing
+ *      their byte order, in the same single pass as a plain memcpy
+ *
+ *  IN:
+ *      const char  *src    :   source bytes
+ *      size_t       n      :   number of bytes, a multiple of 4
+ *  OUT:
+ *      char        *dst    :   destination, may be src itself
+ *
+ */
+void sac_swap4_copy(char *dst, const char *src, size_t n)
+{
+    pthread_once(&swap4_once, swap4_default);
+    swap4_kernel(dst, src, n);
+}
+
+/* the best kernel on first use, unless sac_swap4_use chose one before */
+static void swap4_default(void)
+{
+    if (swap4_kernel == NULL) sac_swap4_use(SAC_SWAP_BEST);
+}
+
 /******************************************************************************
  *                                                                            *
  *              Functions below are only for local use!                       *
@@ -518,18 +721,84 @@ int issac(const char *name)
  *      and turning it into [3][2][1][0]
  */
 static void byte_swap(char *pt, size_t n)
+{
+    sac_swap4(pt, n);
+}
+
+/*
+ *  swap4_scalar, swap4_ssse3, swap4_avx2 : kernels of sac_swap4_copy.
+ *      The SIMD ones reverse 16 or 32 bytes per shuffle and leave the tail
+ *      to the scalar one. They are compiled for their own target only and
+ *      never called on a CPU lacking it.
+ */
+static void swap4_scalar(char *dst, const char *src, size_t n)
 {
     size_t  i   ;
-    char    tmp ;
-    for (i=0; i<n; i+=4) {
-        tmp     =   pt[i+3];
-        pt[i+3] =   pt[i];
-        pt[i]   =   tmp;
+    char    b0, b1;
+    for (i=0; i+4<=n; i+=4) {
+        b0       =   src[i];
+        b1       =   src[i+1];
+        dst[i]   =   src[i+3];
+        dst[i+1] =   src[i+2];
+        dst[i+2] =   b1;
+        dst[i+3] =   b0;
+    }
+}
 
-        tmp     =   pt[i+2];
-        pt[i+2] =   pt[i+1];
-        pt[i+1] =   tmp;
+#ifdef SWAP_X86
+__attribute__((target("ssse3")))
+static void swap4_ssse3(char *dst, const char *src, size_t n)
+{
+    const __m128i rev = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t  i;
+
+    for (i=0; i+16<=n; i+=16)
+        _mm_storeu_si128((__m128i *)(dst+i),
+                         _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src+i)), rev));
+    swap4_scalar(dst+i, src+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void swap4_avx2(char *dst, const char *src, size_t n)
+{
+    const __m256i rev = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                         3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    __m256i a, b;
+    size_t  i;
+
+    for (i=0; i+64<=n; i+=64) {
+        a = _mm256_loadu_si256((const __m256i *)(src+i));
+        b = _mm256_loadu_si256((const __m256i *)(src+i+32));
+        _mm256_storeu_si256((__m256i *)(dst+i),    _mm256_shuffle_epi8(a, rev));
+        _mm256_storeu_si256((__m256i *)(dst+i+32), _mm256_shuffle_epi8(b, rev));
+    }
+    for (; i+32<=n; i+=32)
+        _mm256_storeu_si256((__m256i *)(dst+i),
+                            _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(src+i)), rev));
+    swap4_scalar(dst+i, src+i, n-i);
+}
+#endif
+
+/*
+ *  read_words : read sz bytes of 4-byte words into ar. Swapped words are
+ *      read through a small buffer that stays in cache and swapped on the
+ *      way out of it, so ar is written once as with a native file.
+ *
+ *  Return: 0 if succeed, -1 if fail
+ */
+static int read_words(FILE *strm, char *ar, size_t sz, int lswap)
+{
+    char    buf[SWAP_CHUNK];
+    size_t  n;
+
+    if (lswap != TRUE) return fread(ar, sz, 1, strm) == 1 ? 0 : -1;
+    while (sz > 0) {
+        n = sz < SWAP_CHUNK ? sz : SWAP_CHUNK;
+        if (fread(buf, n, 1, strm) != 1) return -1;
+        sac_swap4_copy(ar, buf, n);
+        ar += n; sz -= n;
     }
+    return 0;
 }
 
 /*
@@ -799,33 +1068,188 @@ void norm( char *sacin, char *sacout, int npts ) {
     fclose(ff); system("sh norm.sh"); system("rm norm.sh");
 }
 
-/*++++++++++++++++++++++++++++++++++++++++++++++normalization in time domain++++++++++++++++++++++++++++++++++++++++*/
-void normal( char *sacin, char *sacout, int npts ) {
-    int i;
-    float tmp = 0, *data, *mean;
+/*+++++++++++++++++++++++++++++++++++normalization in time domain, -1 if failed+++++++++++++++++++++++++++++++++++++*/
+int normal( char *sacin, char *sacout, int npts ) {
+    float *data, *mean;
+    char *mask;
+    int ret;
     SACHEAD hd;
-    data = read_sac(sacin, &hd);
+    STAT_BEGIN(STAT_NORMAL);
+    if ( (data = read_sac(sacin, &hd)) == NULL ) return -1;
     mean = (float *) malloc( sizeof(float) * hd.npts );
+    STAT_ALLOC(sizeof(float) * hd.npts);
+    mask = mask_load( sacin, hd.npts );
+    normal_transient( data, mean, hd.npts, hd.delta, npts, mask );
+    ret = write_sac(sacout, hd, mean) == -1 || mask_save( sacout, mask, hd.npts ) == -1 ? -1 : 0;
+    free(data); free(mean); free(mask);
+    STAT_END(STAT_NORMAL);
+    return ret;
+}
+
+/* ------ STA/LTA masking of transients in normal and cor_bands, off unless set_sta_lta is called ------ */
+static struct { float sta, lta, on, off; } trig = { 0., 0., 0., 0. };
+
+void set_sta_lta( float sta, float lta, float on, float off ) {
+    trig.sta = sta; trig.lta = lta; trig.on = on; trig.off = off;
+}
+
+/* ------ normal_data, or normal_mask over the valid samples of mask (if not NULL) less the transients
+          detected by STA/LTA if set_sta_lta was called; mask is updated with the transients ------ */
+void normal_transient( const float *data, float *mean, int n, float delta, int npts, char *mask ) {
+    char *m = mask, *t;
+    int i;
+
+    if ( trig.sta <= 0. && mask == NULL ) {
+        normal_data( data, mean, n, npts );
+        return;
+    }
+    if ( mask == NULL ) {
+        m = (char *) malloc( n );
+        STAT_ALLOC(n);
+    }
+    if ( trig.sta > 0. ) {
+        t = mask == NULL ? m : (char *) malloc( n );
+        sta_lta_mask( data, n, delta, trig.sta, trig.lta, trig.on, trig.off, t );
+        if ( t != m ) {
+            for ( i = 0; i < n; i ++ ) m[i] &= t[i];
+            free(t);
+        }
+    }
+    normal_mask( data, m, mean, n, npts );
+    if ( m != mask ) free(m);
+}
+
+/* ------ validity masks of the traces with gaps, one byte per sample (1 for data) in a file <trace>.mask
+          beside each trace; off unless set_gap_mask is called with the smallest fraction of the samples
+          of a lag that must be valid on both traces ------ */
+static float min_overlap = 0.;
+
+void set_gap_mask( float frac ) {
+    min_overlap = frac;
+}
+
+/* ------ mask of the n samples of trace sac: NULL if masks are off, all valid if it has no mask file ------ */
+char *mask_load( const char *sac, int n ) {
+    FILE *ff;
+    char name[256], *mask;
+
+    if ( min_overlap <= 0. ) return NULL;
+    mask = (char *) malloc( n );
+    STAT_ALLOC(n);
+    memset( mask, 1, n );
+    sprintf( name, "%.250s.mask", sac );
+    if ( (ff = fopen(name, "rb")) == NULL ) return mask;
+    if ( fread(mask, 1, n, ff) != (size_t)n ) {
+        fprintf(stderr, "Warning: %s does not match %s, all samples taken as valid\n", name, sac);
+        memset( mask, 1, n );
+    }
+    fclose(ff);
+    return mask;
+}
+
+/* ------ write the mask of the n samples of trace sac, nothing if masks are off or mask is NULL ------ */
+int mask_save( const char *sac, const char *mask, int n ) {
+    FILE *ff;
+    char name[256];
+
+    if ( min_overlap <= 0. || mask == NULL ) return 0;
+    sprintf( name, "%.250s.mask", sac );
+    if ( (ff = fopen(name, "wb")) == NULL ) {
+        fprintf(stderr, "Error in opening %s\n", name);
+        return -1;
+    }
+    if ( fwrite(mask, 1, n, ff) != (size_t)n ) {
+        fprintf(stderr, "Error in writing %s\n", name);
+        fclose(ff);
+        return -1;
+    }
+    fclose(ff);
+    return 0;
+}
+
+/*+++++++++++++++++++++recursive STA/LTA of x^2 in one pass: mask is 0 from sta seconds before a trigger
+                        (ratio > on) to sta seconds after it ends (ratio < off), 1 elsewhere; the first lta
+                        seconds only warm the averages up, and the LTA is held during a trigger (of lta seconds
+                        at most) so that a long coda does not end it early. Return number of samples masked++++++++*/
+int sta_lta_mask( const float *x, int n, float delta, float sta, float lta, float on, float off, char *mask ) {
+    int i, k, nsta = (int)(sta/delta + 0.5), nlta = (int)(lta/delta + 0.5), on_at = -1, tail = 0, nmask = 0;
+    float cs, cl, e, s = 0., l = 0.;
+
+    if ( nsta < 1 ) nsta = 1;
+    if ( nlta <= nsta ) nlta = nsta + 1;
+    cs = 1. / nsta; cl = 1. / nlta;
+
+    for ( i = 0; i < n; i ++ ) {
+        e = x[i] * x[i];
+        s += cs * (e - s);
+        if ( on_at < 0 ) l += cl * (e - l);     // LTA frozen during a trigger
+        mask[i] = 1;
+        if ( i < nlta ) continue;
+        if ( on_at < 0 && s > on * l ) {
+            // trigger on: mask back to sta seconds before it
+            on_at = i;
+            for ( k = i - nsta > 0 ? i - nsta : 0; k < i; k ++ ) {
+                nmask += mask[k];
+                mask[k] = 0;
+            }
+        }
+        else if ( on_at >= 0 && (s < off * l || i - on_at > nlta) ) {
+            on_at = -1;
+            tail = nsta;
+        }
+        if ( on_at >= 0 || tail > 0 ) {
+            mask[i] = 0;
+            nmask ++;
+            if ( on_at < 0 ) tail --;
+        }
+    }
+    return nmask;
+}
+
+/*++++++++++++++++++++++run absolute mean normalization over the valid samples (mask 1) of each window of
+                         2*npts+1 samples, clipped at both ends; masked samples are set to 0++++++++++++++++++++*/
+void normal_mask( const float *data, const char *mask, float *mean, int n, int npts ) {
+    int i, cnt = 0;
+    double sum = 0.;
+
+    for ( i = 0; i < npts && i < n; i ++ ) if ( mask[i] ) { sum += fabs(data[i]); cnt ++; }
+    for ( i = 0; i < n; i ++ ) {
+        if ( i + npts < n && mask[i+npts] ) { sum += fabs(data[i+npts]); cnt ++; }
+        if ( i - npts - 1 >= 0 && mask[i-npts-1] ) { sum -= fabs(data[i-npts-1]); cnt --; }
+        mean[i] = ( mask[i] && cnt > 0 && sum > 0. ) ? data[i] * cnt / sum : 0.;
+    }
+}
+
+/*+++++++++++++++++++++++++++++run absolute mean normalization of n samples in memory+++++++++++++++++++++++++++++++++*/
+void normal_data( const float *data, float *mean, int n, int npts ) {
+    int i;
+
+    run_abs_mean( data, mean, n, npts );
+    for ( i = 0; i < n; i ++ ) mean[i] = data[i] / mean[i];
+}
+
+/*++++++++++++++++++++++++++++++++run absolute mean of n samples that normal_data divides by+++++++++++++++++++++++++++*/
+void run_abs_mean( const float *data, float *mean, int n, int npts ) {
+    int i;
+    float tmp = 0;
 
     for ( i = 0; i < (2*npts+1); i ++ ) tmp += fabs(data[i]) / (2*npts+1);
 
 /*-----------------------------------run absolute mean smooth in middle part-----------------------------------------*/
 
-    for ( i = npts; i < (hd.npts-npts-1); i ++ ) {
-        mean[i] = data[i] / tmp;
+    for ( i = npts; i < (n-npts-1); i ++ ) {
+        mean[i] = tmp;
         tmp = tmp - fabs(data[i-npts])/(2*npts+1) + fabs(data[i+npts+1])/(2*npts+1);
     }
 /*------------------------------------run absolute mean smooth on each side------------------------------------------*/
 
     for ( i = 0; i < npts; i ++ ) {
-        mean[i] = data[i] / tmp;
-        mean[hd.npts-npts+i] = data[hd.npts-npts+i] / tmp;
+        mean[i] = tmp;
+        mean[n-npts+i] = tmp;
     }
-    write_sac(sacout, hd, mean);
-    free(data); free(mean);
+    if ( n-npts-1 >= 0 ) mean[n-npts-1] = tmp;      // left out by the loops above
 }
 
-
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++get 2's integral power+++++++++++++++++++++++++++++++++++++++++*/
 int pow_next2( int n ) {
     int m;
@@ -837,57 +1261,93 @@ int pow_next2( int n ) {
         return m;
     }
 }
-void bp ( char *sacin, char *sacout, float f1, float f2, float f3, float f4, int npow ) {
-    int i, j;
-    float *datain, *dataout, sp, f, pi = 3.1415926535;
+
+/* ------ inverse instrument response of a trace on the n bins of its spectrum, applied with the taper
+          of bp and to the shared spectra of cor_bands; none unless set_bp_response is called ------ */
+static const fftw_complex *(*bp_response)( const SACHEAD *hd, int n ) = NULL;
+
+void set_bp_response( const fftw_complex *(*resp)( const SACHEAD *hd, int n ) ) {
+    bp_response = resp;
+}
+
+int bp ( char *sacin, char *sacout, float f1, float f2, float f3, float f4, int npow ) {
+    float *data;
+    int ret;
+    SACHEAD hd;
+    STAT_BEGIN(STAT_BP);
+
+    if ( (data = read_sac( sacin, &hd )) == NULL ) return -1;
+    bp_data( data, data, &hd, f1, f2, f3, f4, npow );
+    ret = write_sac(sacout, hd, data) == -1 || mask_pass( sacin, sacout, hd.npts ) == -1 ? -1 : 0;
+    free(data);
+    STAT_END(STAT_BP);
+    return ret;
+}
+
+/*+++++++++++++++++++band-pass filtering of the hd->npts samples x into y (may be x) in memory, as bp+++++++++++++++++++*/
+void bp_data ( const float *x, float *y, const SACHEAD *hd, float f1, float f2, float f3, float f4, int npow ) {
+    int i, n = hd->npts;
+    float *taper;
     fftw_complex *in, *out;
+    const fftw_complex *inv = NULL;
     fftw_plan p1, p2;
-    SACHEAD hd;
+    BINS bins;
 
-    datain = read_sac( sacin, &hd );
-    sp = 1./hd.delta;
+    if ( bp_response != NULL && (inv = bp_response( hd, n )) != NULL ) {
+        // ends tapered in y, x is left as it is
+        memmove( y, x, sizeof(float) * n );
+        edge_taper( y, n );
+        x = y;
+    }
 
-    in = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * hd.npts);
-    out = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * hd.npts);
-    dataout = (float *) malloc(sizeof(float) * hd.npts);
+    in = fft_alloc(n);
+    out = fft_alloc(n);
+    taper = (float *) malloc(sizeof(float) * n);
+    STAT_ALLOC(sizeof(float) * n);
 
-    for ( i = 0; i < hd.npts; i ++ ) dataout[i] = 0.;
-    for ( i = 0; i < hd.npts; i ++ ) {
-        f = i*sp/hd.npts;
+    bp_taper( taper, n, hd->delta, f1, f2, f3, f4, npow );
+
+    for ( i = 0; i < n; i ++ ) {
+        in[i][0] = x[i];
+        in[i][1] = 0.;
+    }
+    p1 = fft_plan( n, in , out, FFTW_FORWARD );
+    fft_exec( p1, n, in, out );
+    fft_destroy(p1);
+    bins.x = bins.z = out; bins.inv = inv; bins.w = taper;
+    bin_loop( n, taper_bins, &bins );
+
+    p2 = fft_plan( n, out, in, FFTW_BACKWARD );
+    fft_exec( p2, n, out, in );
+    fft_destroy(p2);
+    for ( i = 0; i < n; i ++ ) y[i] = in[i][0]/n;
+
+    fftw_free(in); fftw_free(out); free(taper);
+}
+
+/*+++++++++++++++++++++++++++++cosine taper of band-pass filtering on n frequency points+++++++++++++++++++++++++++++++*/
+void bp_taper ( float *taper, int n, float delta, float f1, float f2, float f3, float f4, int npow ) {
+    int i, j;
+    float sp, f, pi = 3.1415926535;
+
+    sp = 1./delta;
+    for ( i = 0; i < n; i ++ ) taper[i] = 0.;
+    for ( i = 0; i < n; i ++ ) {
+        f = i*sp/n;
         if ( f < f1 ) continue;
         else if ( f >= f1 && f < f2 ) {
-            dataout[i] = 1.;
+            taper[i] = 1.;
             for ( j = 0; j < npow; j ++ )
-                dataout[i] = dataout[i]*(1.+sin(pi/2.*(f-f1)/(f2-f1))) / 2.;
+                taper[i] = taper[i]*(1.+sin(pi/2.*(f-f1)/(f2-f1))) / 2.;
         }
-        else if ( f >= f2 && f < f3 ) dataout[i] = 1.;
+        else if ( f >= f2 && f < f3 ) taper[i] = 1.;
         else if ( f >= f3 && f <= f4 ) {
-            dataout[i] = 1.;
+            taper[i] = 1.;
             for ( j = 0; j < npow; j ++ )
-                dataout[i] = dataout[i]*(1.+cos(pi/2.*(f-f3)/(f4-f3))) / 2.;
+                taper[i] = taper[i]*(1.+cos(pi/2.*(f-f3)/(f4-f3))) / 2.;
         }
         else continue;
     }
-
-    for ( i = 0; i < hd.npts; i ++ ) {
-        in[i][0] = datain[i];
-        in[i][1] = 0.;
-    }
-    p1 = fftw_plan_dft_1d( hd.npts, in , out, FFTW_FORWARD, FFTW_ESTIMATE );
-    fftw_execute(p1);
-    fftw_destroy_plan(p1);
-    for ( i = 0; i < hd.npts; i ++ ) {
-        out[i][0] = out[i][0] * dataout[i];
-        out[i][1] = out[i][1] * dataout[i];
-    }
-
-    p2 = fftw_plan_dft_1d( hd.npts, out, in, FFTW_BACKWARD, FFTW_ESTIMATE );
-    fftw_execute(p2);
-    fftw_destroy_plan(p2);
-    for ( i = 0; i < hd.npts; i ++ ) dataout[i] = in[i][0]/hd.npts;
-
-    write_sac(sacout, hd, dataout);
-    fftw_free(in); fftw_free(out); free(datain); free(dataout);
 }
 
 /*+++++++++++++++++++++++++++++++++++++++++++++++++++++++++spectral whitening+++++++++++++++++++++++++++++++++++++++++++++++*/
@@ -987,11 +1447,12 @@ int julian( int year, int mon, int day ) {
 }
 
 /*++++++++++++++++++++++++++++++calculate abslute time relative to 1970-01-01T00:00:00++++++++++++++++++++++++++++++++*/
-float abs_time(int year, int jday, int hour, int min, int sec, float msec) {
-    int yr, mn, nyday = 0;
-    float abssec;
+/* Returned in double: a float epoch in 2017 only resolves 128 s, far coarser than one sample. */
+double abs_time(int year, int jday, int hour, int min, int sec, float msec) {
+    int yr, nyday = 0;
+    double abssec;
 
-    for ( yr = 1971; yr < year; yr ++ ) {
+    for ( yr = 1970; yr < year; yr ++ ) {
         if ( 4*(yr/4) == yr ) nyday += 366;
         else nyday += 365;
     }
@@ -999,98 +1460,248 @@ float abs_time(int year, int jday, int hour, int min, int sec, float msec) {
     return abssec;
 }
 
-/*++++++++++++++++++++++++++++++++++++++++++++++++++cut SAC foramt file++++++++++++++++++++++++++++++++++++++++++++*/
-void cut_sac(char *sacin, char *sacout, float evt0, float startt0, int npts) {
-    int start_index, i;
-    float *cut_data, *data, sact0;
+/*++++++++++++++++++++++++++++++absolute time of the first sample of a SAC file+++++++++++++++++++++++++++++++++++++*/
+double sac_begin_time( SACHEAD *hd ) {
+    return abs_time(hd->nzyear, hd->nzjday, hd->nzhour, hd->nzmin, hd->nzsec, hd->nzmsec) + hd->b;
+}
+
+/*+++++++++++++++++++++++++++++++cut SAC foramt file, -1 if failed or no sample in the window+++++++++++++++++++++++++++++*/
+int cut_sac(char *sacin, char *sacout, double evt0, float startt0, int npts) {
+    float *cut_data;
+    char *mask;
+    int ret;
     SACHEAD hd;
+    STAT_BEGIN(STAT_CUT);
     cut_data = (float *) malloc( sizeof(float) * npts );
-    data = read_sac(sacin, &hd);
-    sact0 = abs_time(hd.nzyear, hd.nzjday, hd.nzhour, hd.nzmin, hd.nzsec, hd.nzmsec);
-    start_index = (int) ( (evt0 - sact0 + startt0 )/hd.delta);
-    for (i = 0; i < npts; i ++) cut_data[i] = data[i+start_index];
-    hd.b = 0.; hd.e = (npts-1) * hd.delta; hd.npts = npts;
-    write_sac(sacout, hd, cut_data);
-    free(data); free(cut_data);
+    mask = (char *) malloc( npts );
+    STAT_ALLOC((sizeof(float) + 1) * npts);
+    if ( cut_window(sacin, evt0, startt0, npts, cut_data, mask, &hd) == -1 ) {
+        free(cut_data); free(mask);
+        return -1;
+    }
+    ret = write_sac(sacout, hd, cut_data) == -1 || mask_save( sacout, mask, npts ) == -1 ? -1 : 0;
+    free(cut_data); free(mask);
+    STAT_END(STAT_CUT);
+    return ret;
+}
+
+/*+++++++++++++++++++++window of cut_sac into x and mask in memory, its header into hd: number of samples
+                     of the file in it, -1 if failed or none+++++++++++++++++++++++++++++++++++++++++++++++++++*/
+int cut_window(const char *sacin, double evt0, float startt0, int npts, float *x, char *mask, SACHEAD *hd) {
+    long start_index;
+    int nvalid;
+
+    if ( read_sac_head(sacin, hd) == -1 ) return -1;
+    start_index = lround( (evt0 + startt0 - sac_begin_time(hd)) / hd->delta );
+    nvalid = read_sac_range(sacin, hd, start_index, npts, x, mask);
+    if ( nvalid <= 0 ) {
+        if ( nvalid == 0 ) fprintf(stderr, "No sample of %s in the window\n", sacin);
+        return -1;
+    }
+    if ( nvalid < npts )
+        fprintf(stderr, "Warning: %s does not cover the whole window, zero filled\n", sacin);
+    hd->b = 0.; hd->e = (npts-1) * hd->delta; hd->npts = npts;
+    return nvalid;
 }
 
 /*+++++++++++++++++++++++++Spectral whitening: number of FFT points is 2^n(n is an integer)+++++++++++++++++++++++++*/
-void spe_whi ( char *sacin, char *sacout, int npts, float f1, float f2, float f3, float f4 ) {
-    float *data, *sqr, *sout, sum = 0, sp, f;
-    int i, j, k, f1_index, f4_index, fftn;
+int spe_whi ( char *sacin, char *sacout, int npts, float f1, float f2, float f3, float f4 ) {
+    float *data;
+    int ret;
+    SACHEAD hd;
+    STAT_BEGIN(STAT_WHITEN);
+
+    if ( (data = read_sac( sacin, &hd )) == NULL ) return -1;
+    spe_whi_data( data, data, hd.npts, hd.delta, npts, f1, f2, f3, f4 );
+    ret = write_sac( sacout, hd, data ) == -1 || mask_pass( sacin, sacout, hd.npts ) == -1 ? -1 : 0;
+    free(data);
+    STAT_END(STAT_WHITEN);
+    return ret;
+}
+
+/*+++++++++++++++++++++++++spectral whitening of n samples x into y (may be x) in memory, as spe_whi+++++++++++++++++++++++++*/
+void spe_whi_data ( const float *x, float *y, int n, float delta, int npts, float f1, float f2, float f3, float f4 ) {
+    int i, fftn;
     fftw_complex *in, *out;
     fftw_plan p;
-    SACHEAD hd;
 
-    data = read_sac( sacin, &hd );
-    sp = 1./hd.delta;
-    fftn = pow_next2(hd.npts);
-    f1_index = (int)(f1*fftn*hd.delta); f4_index = (int)(f4*fftn*hd.delta);
+    fftn = pow_next2(n);
 
-    in = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * fftn);
-    out = (fftw_complex *) fftw_malloc(sizeof(fftw_complex) * fftn);
-    sqr = (float *) malloc(sizeof(float) * hd.npts );
-    sout = (float *) malloc(sizeof(float) * hd.npts );
+    in = fft_alloc(fftn);
+    out = fft_alloc(fftn);
 
     for ( i = 0; i < fftn; i ++ ) {
-        if ( i < hd.npts ) in[i][0] = data[i];
+        if ( i < n ) in[i][0] = x[i];
         else in[i][0] = 0.; in[i][1] = 0.;
     }
-    p = fftw_plan_dft_1d( fftn, in, out, FFTW_FORWARD, FFTW_ESTIMATE );
-    fftw_execute(p);
-    fftw_destroy_plan(p);
+    p = fft_plan( fftn, in, out, FFTW_FORWARD );
+    fft_exec( p, fftn, in, out );
+    fft_destroy(p);
 
-    for ( i = 0; i < hd.npts; i ++ ) {
-        sqr[i] = sqrt( pow(out[i][0],2.) + pow(out[i][1],2.) );
-        sout[i] = 0.;
-    }
+    whiten_spec( out, fftn, n, delta, npts, f1, f4 );
+
+    p = fft_plan( fftn, out, in, FFTW_BACKWARD );
+    fft_exec( p, fftn, out, in );
+    fft_destroy(p);
+    for ( i = 0; i < n; i ++ ) y[i] = in[i][0]/fftn;
+    fftw_free(in); fftw_free(out);
+}
+
+/*+++++++++++++++++++Spectral whitening in place on the fftn-point spectrum of n samples, keeping [f1, f4]+++++++++++++++++++*/
+void whiten_spec ( fftw_complex *out, int fftn, int n, float delta, int npts, float f1, float f4 ) {
+    float *sout;
+    BINS bins;
+
+    sout = (float *) malloc(sizeof(float) * n );
+    STAT_ALLOC(sizeof(float) * n);
+    whiten_amp( out, fftn, n, delta, npts, f1, f4, sout );
+
+    bins.z = out; bins.w = sout;
+    bins.lo = (int)(f1*fftn*delta); bins.hi = (int)(f4*fftn*delta);
+    bin_loop( fftn, whiten_bins, &bins );
+    free(sout);
+}
+
+/*+++++++++++++++++++++++++++++smoothed amplitude spectrum in [f1, f4] that whiten_spec divides by++++++++++++++++++++++*/
+void whiten_amp ( const fftw_complex *out, int fftn, int n, float delta, int npts, float f1, float f4, float *sout ) {
+    float *sqr, sum = 0;
+    int i, f1_index, f4_index;
+    BINS bins;
+
+    f1_index = (int)(f1*fftn*delta); f4_index = (int)(f4*fftn*delta);
+    sqr = (float *) malloc(sizeof(float) * n );
+    STAT_ALLOC(sizeof(float) * n);
+
+    bins.x = out; bins.w = sqr; bins.v = sout;
+    bin_loop( n, amp_bins, &bins );
     for ( i = (f1_index - npts); i < (f1_index + npts); i ++ ) sum += sqr[i];
     for ( i = f1_index; i <= f4_index; i ++ ) {
         sout[i] = sum/(2*npts+1);
         sum = sum + sqr[i+npts] - sqr[i-npts];
     }
+    free(sqr);
+}
 
-    for ( i = 0; i < fftn; i ++ ) {
-        if ( i >= f1_index && i <= f4_index ) {
-            out[i][0] /= sout[i]; out[i][1] /= sout[i];
-        }
-        else {
-            out[i][0] = 0.; out[i][1] = 0.;
-        }
-    }
+/* ------------- output of cor_in_freq and cor_bands, write_sac unless redirected ------------- */
+static int (*cor_writer)( const char *name, SACHEAD hd, const float *ar ) = write_sac;
 
-    p = fftw_plan_dft_1d( fftn, out, in, FFTW_BACKWARD, FFTW_ESTIMATE );
-    fftw_execute(p);
-    fftw_destroy_plan(p);
-    for ( i = 0; i < hd.npts; i ++ ) data[i] = in[i][0]/fftn;
-    fftw_free(in); fftw_free(out);
+void set_cor_writer( int (*writer)( const char *name, SACHEAD hd, const float *ar ) ) {
+    cor_writer = writer == NULL ? write_sac : writer;
+}
 
-    write_sac( sacout, hd, data );
-    free(data);
+/* ------------- header of the correlation of hd1 and hd2: first station as the event ------------- */
+void cor_head( SACHEAD *hd1, SACHEAD *hd2, int lag_n ) {
+    double dist, az, baz, gcarc;
+
+    hd1->npts = 2 * lag_n + 1;
+    hd1->b = -(lag_n) * hd1->delta;
+    hd1->e = -hd1->b;
+    hd1->evla = hd1->stla; hd1->evlo = hd1->stlo;
+    hd1->stla = hd2->stla; hd1->stlo = hd2->stlo;
+    strncpy(hd1->kevnm, hd1->kstnm, 9);
+    strcpy(hd1->kstnm, hd2->kstnm);
+    if ( hd1->evla != SAC_FLOAT_UNDEF && hd1->evlo != SAC_FLOAT_UNDEF &&
+         hd1->stla != SAC_FLOAT_UNDEF && hd1->stlo != SAC_FLOAT_UNDEF ) {
+        distaz( hd1->evla, hd1->evlo, hd1->stla, hd1->stlo, &dist, &az, &baz, &gcarc );
+        hd1->dist = dist; hd1->az = az; hd1->baz = baz; hd1->gcarc = gcarc;
+    }
+}
+
+/* ------ great circle distance (km and degrees), azimuth and back azimuth from (lat1, lon1) to (lat2, lon2)
+          on a sphere of radius EARTH_R; within 0.5% of the ellipsoidal distance of SAC ------ */
+void distaz( double lat1, double lon1, double lat2, double lon2,
+             double *dist, double *az, double *baz, double *gcarc ) {
+    double d2r = M_PI / 180., p1 = lat1 * d2r, p2 = lat2 * d2r, dl = (lon2 - lon1) * d2r, h;
+
+    // haversine, well conditioned for stations a few km apart
+    h = sin((p2-p1)/2.) * sin((p2-p1)/2.) + cos(p1) * cos(p2) * sin(dl/2.) * sin(dl/2.);
+    *gcarc = 2. * atan2(sqrt(h), sqrt(1.-h)) / d2r;
+    *dist = *gcarc * d2r * EARTH_R;
+    *az = atan2(sin(dl) * cos(p2), cos(p1) * sin(p2) - sin(p1) * cos(p2) * cos(dl)) / d2r;
+    *baz = atan2(-sin(dl) * cos(p1), cos(p2) * sin(p1) - sin(p2) * cos(p1) * cos(dl)) / d2r;
+    *az = fmod(*az + 360., 360.);
+    *baz = fmod(*baz + 360., 360.);
 }
 
 /* ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
-/* ----------------- cross correlation in frequency domain ----------------------- */
-void cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name ) {
-    int nfft, i, n, cor_n, lag_n, n1, n2;
+/* ----------------- cross correlation in frequency domain, -1 if failed ----------------------- */
+int cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name ) {
+    int cor_n, ret;
     float *cor_xy, *x, *y;
-    fftw_complex *in1, *in2, *out1, *out2, *cor_in, *cor_out;
-    fftw_plan p1, p2, p3;
-    SACHEAD hd1, hd2;
+    char *m1, *m2;
+    SACHEAD hd1, hd2, hd;
+    STAT_BEGIN(STAT_COR);
 
     // Read in SAC data.
-    x = read_sac(sac1, &hd1);
-    y = read_sac(sac2, &hd2);
-    n1 = hd1.npts;
-    n2 = hd2.npts;
+    if ( (x = read_sac(sac1, &hd1)) == NULL ) return -1;
+    if ( (y = read_sac(sac2, &hd2)) == NULL ) {
+        free(x);
+        return -1;
+    }
 
     if( fabs(hd1.delta-hd2.delta) >= 1.0e-4 ) {
-        fprintf(stderr, "Temporal sampling interval are not same!\n");
-        exit(1);
+        fprintf(stderr, "Temporal sampling interval of %s and %s are not same!\n", sac1, sac2);
+        free(x); free(y);
+        return -1;
+    }
+
+    // Validity masks, NULL unless set_gap_mask was called.
+    m1 = mask_load( sac1, hd1.npts );
+    m2 = mask_load( sac2, hd2.npts );
+
+    cor_xy = ( float* ) malloc( sizeof(float) * cor_size( &hd1, lag_time ) );
+    cor_n = cor_data( x, m1, &hd1, y, m2, &hd2, lag_time, cor_xy, &hd );
+
+    ret = cor_write( cor_name, hd, cor_xy, cor_n );
+    free(x); free(y); free(cor_xy); free(m1); free(m2);
+    STAT_END(STAT_COR);
+    return ret;
+}
+
+/* ----------------- correlation of cor_n lags out through the cor_writer; a bad trace (e.g. all zeros,
+                     normalized to NaN) must not reach files or stacks: -1 if not finite or not written ----- */
+int cor_write( const char *cor_name, SACHEAD hd, const float *cor_xy, int cor_n ) {
+    if ( !lags_finite( cor_xy, cor_n ) ) {
+        fprintf(stderr, "Non-finite lags of %s, not written\n", cor_name);
+        return -1;
+    }
+    cor_writer(cor_name, hd, cor_xy);
+    return 0;
+}
+
+/* ----------------- lags cor_data writes at most for a trace of header hd1 ----------------------- */
+int cor_size( const SACHEAD *hd1, float lag_time ) {
+    int lag_n = (int)(lag_time/hd1->delta);
+
+    return lag_n > 0 ? 2 * lag_n + 1 : 1;
+}
+
+/* ----------------- cross correlation in frequency domain of x and y in memory, as cor_in_freq: lags into
+                     cor_xy (cor_size of them at most) and header into hd; masks m1 and m2 are NULL unless
+                     set_gap_mask was called. Return number of lags, -1 if the sampling intervals differ ----- */
+int cor_data( const float *x, const char *m1, const SACHEAD *hd1, const float *y, const char *m2,
+              const SACHEAD *hd2, float lag_time, float *cor_xy, SACHEAD *hd ) {
+    int nfft, i, n, cor_n, lag_n, n1, n2;
+    float s1 = 1., s2 = 1.;
+    fftw_complex *in1, *in2, *out1, *out2;
+    fftw_plan p1, p2;
+    SACHEAD h2;
+
+    n1 = hd1->npts;
+    n2 = hd2->npts;
+
+    if( fabs(hd1->delta-hd2->delta) >= 1.0e-4 ) {
+        fprintf(stderr, "Temporal sampling intervals %g and %g are not same!\n", hd1->delta, hd2->delta);
+        return -1;
+    }
+
+    if ( m1 != NULL ) {
+        s1 = mask_scale( m1, n1 );
+        s2 = mask_scale( m2, n2 );
     }
 
     // Get lag points.
-    lag_n = (int)(lag_time/hd1.delta);
+    lag_n = (int)(lag_time/hd1->delta);
 
 
     // Find maximum n of n1 and n2.
@@ -1101,23 +1712,19 @@ void cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name ) {
 
 
     // Allocate dynamic memory of FFT.
-    in1 = (fftw_complex*) fftw_malloc( sizeof(fftw_complex) * nfft );
-    in2 = (fftw_complex*) fftw_malloc( sizeof(fftw_complex) * nfft );
-    out1 =  (fftw_complex*) fftw_malloc( sizeof(fftw_complex) * nfft );
-    out2 =  (fftw_complex*) fftw_malloc( sizeof(fftw_complex) * nfft );
-
-    // Allocate dynamic memory of cross correlation .
-    cor_in = (fftw_complex*) fftw_malloc( sizeof(fftw_complex) * nfft );
-    cor_out = (fftw_complex*) fftw_malloc( sizeof(fftw_complex) * nfft );
+    in1 = fft_alloc( nfft );
+    in2 = fft_alloc( nfft );
+    out1 = fft_alloc( nfft );
+    out2 = fft_alloc( nfft );
 
     // Initialization of forward FFT.
     for ( i = 0; i < nfft; i ++ ) {
-        if ( i < n1 )
-            in1[i][0] = x[i];
+        if ( i < n1 && (m1 == NULL || m1[i]) )
+            in1[i][0] = m1 == NULL ? x[i] : x[i] * s1;
         else
             in1[i][0] = 0.;
-        if ( i < n2 )
-            in2[i][0]= y[i];
+        if ( i < n2 && (m2 == NULL || m2[i]) )
+            in2[i][0]= m2 == NULL ? y[i] : y[i] * s2;
         else
             in2[i][0] = 0.;
         in1[i][1] = 0.;
@@ -1125,46 +1732,89 @@ void cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name ) {
     }
 
     // Create forward FFT plans of data "x" and "y".
-    p1 = fftw_plan_dft_1d( nfft, in1, out1, FFTW_FORWARD, FFTW_ESTIMATE);
-    p2 = fftw_plan_dft_1d( nfft, in2, out2, FFTW_FORWARD, FFTW_ESTIMATE);
+    p1 = fft_plan( nfft, in1, out1, FFTW_FORWARD );
+    p2 = fft_plan( nfft, in2, out2, FFTW_FORWARD );
 
     // Execute FFT of data "x" and "y".
-    fftw_execute(p1);
-    fftw_execute(p2);
+    fft_exec( p1, nfft, in1, out1 );
+    fft_exec( p2, nfft, in2, out2 );
 
-    // Cross correlation in frequency domain.
-    for ( i = 0; i < nfft; i ++ ) {
-        // Real parts of cross correlation.
-        cor_in[i][0] = out1[i][0]*out2[i][0] + out1[i][1]*out2[i][1];
-
-        // Imaginary parts of cross correlation.
-        cor_in[i][1] = out1[i][1]*out2[i][0] - out1[i][0]*out2[i][1];
+    // Check lag points.
+    if( lag_n > (int)(nfft/2) ) {
+        fprintf(stderr, "Lag time is too long!\n");
+        lag_n = (int)(nfft/2) - 1;
     }
 
+    // Data points of cross-correlation.
+    cor_n = 2 * lag_n + 1;
+
+    // Cross correlation in frequency domain.
+    cor_spec( out1, out2, nfft, lag_n, cor_xy );
+
     // Destroy FFT of data "x" and "y".
-    fftw_destroy_plan(p1);
-    fftw_destroy_plan(p2);
+    fft_destroy(p1);
+    fft_destroy(p2);
 
     // Release dynamic memories of FFT of data "x" and "y".
     fftw_free(in1); fftw_free(in2); fftw_free(out1); fftw_free(out2);
 
-    // Create backward FFT plan of cross correlation.
-    p3 = fftw_plan_dft_1d( nfft, cor_in, cor_out, FFTW_BACKWARD, FFTW_ESTIMATE);
+    *hd = *hd1;
+    h2 = *hd2;
+    cor_head( hd, &h2, lag_n );
 
-    // Execute backward FFT plan of cross correlation.
-    fftw_execute(p3);
+    // Normalize each lag by the samples valid on both traces.
+    if ( m1 != NULL ) cor_overlap( m1, m2, n1, n2, nfft, lag_n, cor_xy, hd );
 
-    // Check lag points.
-    if( lag_n > (int)(nfft/2) ) {
-        fprintf(stderr, "Lag time is too long!\n");
-        lag_n = (int)(nfft/2) - 1;
+    return cor_n;
+}
+
+/* ----------------- nfft-point spectrum of the n samples x (n <= nfft) zero padded, as cor_data transforms
+                     a trace without a mask, for correlating the spectra with cor_spec ----------------------- */
+void cor_fft( const float *x, int n, int nfft, fftw_complex *out ) {
+    int i;
+    fftw_complex *in;
+    fftw_plan p;
+
+    in = fft_alloc( nfft );
+    for ( i = 0; i < nfft; i ++ ) {
+        in[i][0] = i < n ? x[i] : 0.;
+        in[i][1] = 0.;
     }
+    p = fft_plan( nfft, in, out, FFTW_FORWARD );
+    fft_exec( p, nfft, in, out );
+    fft_destroy(p);
+    fftw_free(in);
+}
 
-    // Data points of cross-correlation.
-    cor_n = 2 * lag_n + 1;
+/* ----------------- lags [-lag_n, lag_n] of the cross correlation of two nfft-point spectra ----------------------- */
+void cor_spec( fftw_complex *out1, fftw_complex *out2, int nfft, int lag_n, float *cor_xy ) {
+    fftw_complex *cor_in;
+    BINS bins;
 
-    // Allocate dynamic memory of cross correlation data.
-    cor_xy = ( float* ) malloc( sizeof(float) * cor_n );
+    // Allocate dynamic memory of cross correlation .
+    cor_in = fft_alloc( nfft );
+
+    // Cross spectrum out1 * conj(out2), bin by bin.
+    bins.x = out1; bins.y = out2; bins.z = cor_in;
+    bin_loop( nfft, cross_bins, &bins );
+
+    cor_lags( cor_in, nfft, lag_n, cor_xy );
+    fftw_free(cor_in);
+}
+
+/* ----------------- lags [-lag_n, lag_n] of the nfft-point cross spectrum cor_in ----------------------- */
+void cor_lags( fftw_complex *cor_in, int nfft, int lag_n, float *cor_xy ) {
+    int i;
+    fftw_complex *cor_out;
+    fftw_plan p3;
+
+    cor_out = fft_alloc( nfft );
+
+    // Create backward FFT plan of cross correlation.
+    p3 = fft_plan( nfft, cor_in, cor_out, FFTW_BACKWARD );
+
+    // Execute backward FFT plan of cross correlation.
+    fft_exec( p3, nfft, cor_in, cor_out );
 
     // Get real parts after executing cross correlation in frequency domain.
     // Center point of cross-correlation.
@@ -1177,18 +1827,613 @@ void cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name ) {
         cor_xy[i] = cor_out[nfft-1-lag_n+i][0];
     }
 
-    //for ( i = 0; i < 50; i ++ )
-    //    printf("cor_out: %f cor_xy: %f\n", cor_out[i+1][0], cor_xy[lag_n+1+i]);
-
     // Destroy backward FFT plan of cross correlation.
-    fftw_destroy_plan(p3);
+    fft_destroy(p3);
 
     // Release dynamic memories of cross correlation.
-    fftw_free(cor_in); fftw_free(cor_out);
+    fftw_free(cor_out);
+}
 
-    hd1.npts = cor_n;
-    hd1.b = -(lag_n) * hd1.delta;
-    hd1.e = -hd1.b;
-    write_sac(cor_name, hd1, cor_xy);
+/* ------ normalize lags [-lag_n, lag_n] of cor_xy by the number of samples valid on both traces, found by
+          correlating their masks m1 and m2 (n1 and n2 samples) on the same nfft points, and scale back to the
+          number of samples of the lag without gaps, so that traces without gaps are left unchanged. Lags
+          with less than min_overlap of their samples valid are set to 0; user0 of hd is set to the smallest
+          valid fraction and user1 to the number of lags set to 0, which is returned ------ */
+int cor_overlap( const char *m1, const char *m2, int n1, int n2, int nfft, int lag_n, float *cor_xy, SACHEAD *hd ) {
+    int i, j, k, full, cnt, nflag = 0;
+    float *ov, frac, fmin = 1.;
+    fftw_complex *in, *out1, *out2;
+    fftw_plan p;
+
+    in = fft_alloc( nfft );
+    out1 = fft_alloc( nfft );
+    out2 = fft_alloc( nfft );
+    ov = (float *) malloc( sizeof(float) * (2*lag_n+1) );
+
+    p = fft_plan( nfft, in, out1, FFTW_FORWARD );
+    for ( i = 0; i < nfft; i ++ ) { in[i][0] = i < n1 ? m1[i] : 0.; in[i][1] = 0.; }
+    fft_exec( p, nfft, in, out1 );
+    for ( i = 0; i < nfft; i ++ ) { in[i][0] = i < n2 ? m2[i] : 0.; in[i][1] = 0.; }
+    fft_exec( p, nfft, in, out2 );
+    fft_destroy(p);
+    cor_spec( out1, out2, nfft, lag_n, ov );
+
+    for ( i = 0; i < 2*lag_n+1; i ++ ) {
+        // samples of lag i without gaps, wrapped around nfft like the correlation itself;
+        // cor_spec puts lag i-lag_n-1 at i < lag_n
+        for ( full = 0, j = -1; j <= 1; j ++ ) {
+            k = (i < lag_n ? i - lag_n - 1 : i - lag_n) + j*nfft;
+            cnt = (n1 - k < n2 ? n1 - k : n2) - (k < 0 ? -k : 0);
+            if ( cnt > 0 ) full += cnt;
+        }
+        if ( full == 0 ) continue;
+        cnt = (int) lround( ov[i] / nfft );
+        frac = (float) cnt / full;
+        if ( frac < fmin ) fmin = frac;
+        if ( cnt <= 0 || frac < min_overlap ) {
+            cor_xy[i] = 0.;
+            nflag ++;
+        }
+        else if ( cnt != full ) cor_xy[i] *= (float) full / cnt;
+    }
+    hd->user0 = fmin;
+    hd->user1 = nflag;
+
+    fftw_free(in); fftw_free(out1); fftw_free(out2); free(ov);
+    return nflag;
+}
+
+/* ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+/* ------ cross correlation of two cut SAC files in several frequency bands ------ */
+/* The forward FFT of each trace is done once and shared by all bands; for every
+   band the taper of bp, the normalization of normal and the whitening of spe_whi
+   are applied in turn, and the whitened traces, cut to the n samples spe_whi
+   writes, are correlated as cor_in_freq does. */
+int cor_bands( char *sac1, char *sac2, int nband, float (*band)[4], int npow, int norm_npts,
+               int whi_npts, float lag_time, char **cor_name ) {
+    int i, k, n, nfft, lag_n, cor_n;
+    float *x, *y, *taper, *tr, *cor_xy;
+    char *m1, *m2, *bm = NULL;
+    int ret = 0;
+    fftw_complex *spec1, *spec2, *tmp, *whi1, *whi2;
+    const fftw_complex *inv1 = NULL, *inv2 = NULL;
+    fftw_plan pf, pb, pw, pm;
+    SACHEAD hd1, hd2, hd, *hdb;
+    STAT_BEGIN(STAT_COR);
+
+    if ( (x = read_sac(sac1, &hd1)) == NULL ) return -1;
+    if ( (y = read_sac(sac2, &hd2)) == NULL ) {
+        free(x);
+        return -1;
+    }
+    if ( fabs(hd1.delta-hd2.delta) >= 1.0e-4 || hd1.npts != hd2.npts ) {
+        fprintf(stderr, "%s and %s differ in sampling or length!\n", sac1, sac2);
+        free(x); free(y);
+        return -1;
+    }
+    n = hd1.npts;
+    nfft = pow_next2( n );
+
+    lag_n = (int)(lag_time/hd1.delta);
+    if( lag_n > (int)(nfft/2) ) {
+        fprintf(stderr, "Lag time is too long!\n");
+        lag_n = (int)(nfft/2) - 1;
+    }
+    cor_n = 2 * lag_n + 1;
+    hd = hd1;
+    cor_head( &hd, &hd2, lag_n );
+
+    // Validity masks, NULL unless set_gap_mask was called.
+    m1 = mask_load( sac1, n );
+    m2 = mask_load( sac2, n );
+
+    spec1 = fft_alloc( n );
+    spec2 = fft_alloc( n );
+    tmp = fft_alloc( nfft );
+    whi1 = fft_alloc( nfft );
+    whi2 = fft_alloc( nfft );
+    taper = (float *) malloc( sizeof(float) * n );
+    tr = (float *) malloc( sizeof(float) * 2 * n );
+    cor_xy = (float *) malloc( sizeof(float) * cor_n * nband );
+    hdb = (SACHEAD *) malloc( sizeof(SACHEAD) * nband );
+
+    // Shared forward FFT of both traces, same length as in bp.
+    if ( bp_response != NULL ) {
+        if ( (inv1 = bp_response( &hd1, n )) != NULL ) edge_taper( x, n );
+        if ( (inv2 = bp_response( &hd2, n )) != NULL ) edge_taper( y, n );
+    }
+    pf = fft_plan( n, tmp, spec1, FFTW_FORWARD );
+    for ( i = 0; i < n; i ++ ) { tmp[i][0] = x[i]; tmp[i][1] = 0.; }
+    fft_exec( pf, n, tmp, spec1 );
+    for ( i = 0; i < n; i ++ ) { tmp[i][0] = y[i]; tmp[i][1] = 0.; }
+    fft_exec( pf, n, tmp, spec2 );
+    fft_destroy(pf);
+    // response removed once from the shared spectra, for all bands
+    resp_spec( spec1, inv1, n );
+    resp_spec( spec2, inv2, n );
+
+    pb = fft_plan( n, tmp, tmp, FFTW_BACKWARD );
+    pw = fft_plan( nfft, tmp, whi1, FFTW_FORWARD );
+    pm = fft_plan( nfft, tmp, tmp, FFTW_BACKWARD );
+    // masks of the band, the transients of each band added to the gaps
+    if ( m1 != NULL ) bm = (char *) malloc( 2 * n );
+
+    for ( k = 0; k < nband; k ++ ) {
+        bp_taper( taper, n, hd1.delta, band[k][0], band[k][1], band[k][2], band[k][3], npow );
+        if ( m1 != NULL ) {
+            memcpy( bm, m1, n );
+            memcpy( bm + n, m2, n );
+        }
+
+        // band-pass, normalization and whitening of trace 1 and trace 2
+        band_whiten( spec1, taper, n, nfft, hd1.delta, norm_npts, whi_npts, band[k][0], band[k][3],
+                     tmp, tr, pb, pw, whi1, bm );
+        band_whiten( spec2, taper, n, nfft, hd1.delta, norm_npts, whi_npts, band[k][0], band[k][3],
+                     tmp, tr, pb, pw, whi2, bm == NULL ? NULL : bm + n );
+        // the whitened traces cut to n samples (and masked), as spe_whi writes them for cor_in_freq
+        mask_spec( whi1, bm, n, nfft, tmp, pm, pw );
+        mask_spec( whi2, bm == NULL ? NULL : bm + n, n, nfft, tmp, pm, pw );
+
+        cor_spec( whi1, whi2, nfft, lag_n, cor_xy + k*cor_n );
+        hdb[k] = hd;
+        if ( m1 != NULL ) cor_overlap( bm, bm + n, n, n, nfft, lag_n, cor_xy + k*cor_n, &hdb[k] );
+        if ( !lags_finite( cor_xy + k*cor_n, cor_n ) ) {
+            fprintf(stderr, "Non-finite lags of %s\n", cor_name[k]);
+            ret = -1;
+        }
+    }
+    // all bands of the pair or none of them, so that a pair done again is not stacked twice
+    for ( k = 0; ret == 0 && k < nband; k ++ ) cor_writer(cor_name[k], hdb[k], cor_xy + k*cor_n);
+
+    fft_destroy(pb); fft_destroy(pw); fft_destroy(pm);
+    fftw_free(spec1); fftw_free(spec2); fftw_free(tmp); fftw_free(whi1); fftw_free(whi2);
+    free(x); free(y); free(taper); free(tr); free(cor_xy); free(hdb); free(m1); free(m2); free(bm);
+    STAT_END(STAT_COR);
+    return ret;
+}
+
+/* ------ one band of one trace for cor_bands: spec is the shared n-point spectrum, whi the
+          whitened nfft-point spectrum (before spe_whi takes the real part of its first n samples), tmp/tr (2n samples) are work arrays and pb/pw plans on tmp;
+          mask (may be NULL) is the validity mask for normal_transient ------ */
+void band_whiten( fftw_complex *spec, float *taper, int n, int nfft, float delta, int norm_npts,
+                  int whi_npts, float f1, float f4, fftw_complex *tmp, float *tr,
+                  fftw_plan pb, fftw_plan pw, fftw_complex *whi, char *mask ) {
+    int i;
+
+    // bp: taper the shared spectrum and transform back.
+    for ( i = 0; i < n; i ++ ) {
+        tmp[i][0] = spec[i][0] * taper[i];
+        tmp[i][1] = spec[i][1] * taper[i];
+    }
+    fft_exec( pb, n, tmp, tmp );
+    for ( i = 0; i < n; i ++ ) tr[i] = tmp[i][0]/n;
 
+    // normal: run absolute mean normalization.
+    normal_transient( tr, tr + n, n, delta, norm_npts, mask );
+
+    // spe_whi: whitening of the zero padded spectrum.
+    for ( i = 0; i < nfft; i ++ ) {
+        tmp[i][0] = i < n ? tr[n+i] : 0.;
+        tmp[i][1] = 0.;
+    }
+    fft_exec( pw, nfft, tmp, whi );
+    whiten_spec( whi, nfft, n, delta, whi_npts, f1, f4 );
+}
+
+/* ++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++ */
+/* ------ nine-component correlation tensor of two three-component stations ------ */
+/* sac1 and sac2 are the cut E, N and Z files of each station. Every component is
+   band-passed as in bp, then the three components of a station are normalized in time
+   by the largest of their running absolute means and whitened by the mean of their
+   smoothed amplitude spectra, so that the ratios between components, and with them the
+   rotation, are kept. Each component is transformed once; E and N are rotated to R and T
+   on the spectra with the azimuth of the pair, and the nine cross spectra are formed
+   block by block in one pass over the bins. cor_name[3*p+q] gets component p of station
+   1 (Z, R, T) with component q of station 2, e.g. cor_name[1] is ZR. */
+int cor_tensor( char **sac1, char **sac2, float f1, float f2, float f3, float f4, int npow,
+                int norm_npts, int whi_npts, float lag_time, char **cor_name ) {
+    int i, k, c, s, n, nfft, lag_n, cor_n, f1_index, f4_index, ret = 0;
+    float *x[6], *taper, *tr, *w, *wmax, *amp, *amp3, *cor_xy;
+    const fftw_complex *inv;
+    fftw_complex *spec[6], *cross[9], *tmp;
+    fftw_plan pf, pb, pw;
+    SACHEAD hdc[6], hd, hdk[9];
+    const char *cmp = "ZRT";
+    STAT_BEGIN(STAT_COR);
+
+    for ( k = 0; k < 6; k ++ ) {
+        x[k] = read_sac( k < 3 ? sac1[k] : sac2[k-3], &hdc[k] );
+        if ( x[k] == NULL || fabs(hdc[k].delta-hdc[0].delta) >= 1.0e-4 || hdc[k].npts != hdc[0].npts ) {
+            if ( x[k] != NULL )
+                fprintf(stderr, "%s differs from %s in sampling or length!\n",
+                        k < 3 ? sac1[k] : sac2[k-3], sac1[0]);
+            for ( i = 0; i <= k; i ++ ) free(x[i]);
+            return -1;
+        }
+    }
+    n = hdc[0].npts;
+    nfft = pow_next2( n );
+    lag_n = (int)(lag_time/hdc[0].delta);
+    if( lag_n > (int)(nfft/2) ) {
+        fprintf(stderr, "Lag time is too long!\n");
+        lag_n = (int)(nfft/2) - 1;
+    }
+    hd = hdc[2];
+    cor_head( &hd, &hdc[5], lag_n );
+    if ( hd.evla == SAC_FLOAT_UNDEF || hd.stla == SAC_FLOAT_UNDEF ) {
+        fprintf(stderr, "No stla/stlo in %s or %s to rotate to R and T!\n", sac1[2], sac2[2]);
+        for ( k = 0; k < 6; k ++ ) free(x[k]);
+        return -1;
+    }
+
+    for ( k = 0; k < 6; k ++ ) spec[k] = fft_alloc( nfft );
+    tmp = fft_alloc( nfft );
+    taper = (float *) malloc( sizeof(float) * n );
+    tr = (float *) malloc( sizeof(float) * 3 * n );
+    w = (float *) malloc( sizeof(float) * n );
+    wmax = (float *) malloc( sizeof(float) * n );
+    amp = (float *) malloc( sizeof(float) * n );
+    amp3 = (float *) malloc( sizeof(float) * n );
+    STAT_ALLOC(sizeof(float) * 8 * n);
+
+    bp_taper( taper, n, hdc[0].delta, f1, f2, f3, f4, npow );
+    f1_index = (int)(f1*nfft*hdc[0].delta); f4_index = (int)(f4*nfft*hdc[0].delta);
+    pf = fft_plan( n, tmp, tmp, FFTW_FORWARD );
+    pb = fft_plan( n, tmp, tmp, FFTW_BACKWARD );
+    pw = fft_plan( nfft, tmp, spec[0], FFTW_FORWARD );
+
+    for ( s = 0; s < 2; s ++ ) {
+        // bp of the three components, with the response removed if set_bp_response was called
+        for ( c = 0; c < 3; c ++ ) {
+            k = 3*s + c;
+            inv = bp_response == NULL ? NULL : bp_response( &hdc[k], n );
+            if ( inv != NULL ) edge_taper( x[k], n );
+            for ( i = 0; i < n; i ++ ) { tmp[i][0] = x[k][i]; tmp[i][1] = 0.; }
+            fft_exec( pf, n, tmp, tmp );
+            resp_spec( tmp, inv, n );
+            for ( i = 0; i < n; i ++ ) { tmp[i][0] *= taper[i]; tmp[i][1] *= taper[i]; }
+            fft_exec( pb, n, tmp, tmp );
+            for ( i = 0; i < n; i ++ ) tr[c*n+i] = tmp[i][0]/n;
+        }
+
+        // normal: one weight for the three components, the largest running absolute mean
+        for ( c = 0; c < 3; c ++ ) {
+            run_abs_mean( tr + c*n, w, n, norm_npts );
+            for ( i = 0; i < n; i ++ ) wmax[i] = c == 0 || w[i] > wmax[i] ? w[i] : wmax[i];
+        }
+        for ( c = 0; c < 3; c ++ )
+            for ( i = 0; i < n; i ++ ) tr[c*n+i] = wmax[i] > 0. ? tr[c*n+i] / wmax[i] : 0.;
+
+        // spe_whi: one smoothed amplitude spectrum for the three components, their mean
+        for ( c = 0; c < 3; c ++ ) {
+            k = 3*s + c;
+            for ( i = 0; i < nfft; i ++ ) { tmp[i][0] = i < n ? tr[c*n+i] : 0.; tmp[i][1] = 0.; }
+            fft_exec( pw, nfft, tmp, spec[k] );
+            whiten_amp( spec[k], nfft, n, hdc[0].delta, whi_npts, f1, f4, amp );
+            for ( i = 0; i < n; i ++ ) amp3[i] = c == 0 ? amp[i] / 3. : amp3[i] + amp[i] / 3.;
+        }
+        for ( c = 0; c < 3; c ++ ) {
+            k = 3*s + c;
+            for ( i = 0; i < nfft; i ++ ) {
+                if ( i >= f1_index && i <= f4_index && amp3[i] > 0. ) {
+                    spec[k][i][0] /= amp3[i]; spec[k][i][1] /= amp3[i];
+                }
+                else {
+                    spec[k][i][0] = 0.; spec[k][i][1] = 0.;
+                }
+            }
+            hermitian_part( spec[k], nfft );
+        }
+    }
+    fft_destroy(pf); fft_destroy(pb); fft_destroy(pw);
+    fftw_free(tmp);
+    free(taper); free(tr); free(w); free(wmax); free(amp); free(amp3);
+    for ( k = 0; k < 6; k ++ ) free(x[k]);
+
+    // radial from station 1 towards station 2 at both ends
+    for ( k = 0; k < 9; k ++ ) cross[k] = fft_alloc( nfft );
+    cross_tensor( spec, hd.az, hd.baz + 180., nfft, cross );
+    for ( k = 0; k < 6; k ++ ) fftw_free(spec[k]);
+
+    cor_n = 2*lag_n + 1;
+    cor_xy = (float *) malloc( sizeof(float) * cor_n * 9 );
+    for ( k = 0; k < 9; k ++ ) {
+        cor_lags( cross[k], nfft, lag_n, cor_xy + k*cor_n );
+        hdk[k] = hd;
+        memset( hdk[k].kcmpnm, ' ', 8 );
+        hdk[k].kcmpnm[0] = cmp[k/3]; hdk[k].kcmpnm[1] = cmp[k%3];
+        fftw_free(cross[k]);
+        if ( !lags_finite( cor_xy + k*cor_n, cor_n ) ) {
+            fprintf(stderr, "Non-finite lags of %s\n", cor_name[k]);
+            ret = -1;
+        }
+    }
+    // all nine or none
+    for ( k = 0; ret == 0 && k < 9; k ++ ) cor_writer(cor_name[k], hdk[k], cor_xy + k*cor_n);
+    free(cor_xy);
+    STAT_END(STAT_COR);
+    return ret;
+}
+
+/* ------ the nine cross spectra of cor_tensor: spec holds E, N, Z of station 1 then of station 2,
+          az1 and az2 the radial directions (degrees) at each; cross[3*p+q] = S1_p * conj(S2_q) for
+          p, q in Z, R, T, with R = N cos(az) + E sin(az) and T = E cos(az) - N sin(az). Bins are taken
+          in blocks: the rotated components of a block are formed first, then each cross spectrum of
+          the block in a loop of its own; only half of the bins is computed, the rest being the
+          conjugates of real traces ------ */
+void cross_tensor( fftw_complex **spec, double az1, double az2, int nfft, fftw_complex **cross ) {
+    double a[3][TENSOR_BLOCK][2], b[3][TENSOR_BLOCK][2];
+    double c1 = cos(az1*M_PI/180.), s1 = sin(az1*M_PI/180.), c2 = cos(az2*M_PI/180.), s2 = sin(az2*M_PI/180.);
+    int i, i0, m, p, q, k;
+    fftw_complex *out;
+
+    for ( i0 = 0; i0 <= nfft/2; i0 += TENSOR_BLOCK ) {
+        m = nfft/2 + 1 - i0 < TENSOR_BLOCK ? nfft/2 + 1 - i0 : TENSOR_BLOCK;
+        for ( i = 0; i < m; i ++ ) for ( k = 0; k < 2; k ++ ) {
+            a[0][i][k] = spec[2][i0+i][k];
+            a[1][i][k] = spec[1][i0+i][k] * c1 + spec[0][i0+i][k] * s1;
+            a[2][i][k] = spec[0][i0+i][k] * c1 - spec[1][i0+i][k] * s1;
+            b[0][i][k] = spec[5][i0+i][k];
+            b[1][i][k] = spec[4][i0+i][k] * c2 + spec[3][i0+i][k] * s2;
+            b[2][i][k] = spec[3][i0+i][k] * c2 - spec[4][i0+i][k] * s2;
+        }
+        for ( p = 0; p < 3; p ++ ) for ( q = 0; q < 3; q ++ ) {
+            out = cross[3*p+q] + i0;
+            for ( i = 0; i < m; i ++ ) {
+                out[i][0] = a[p][i][0]*b[q][i][0] + a[p][i][1]*b[q][i][1];
+                out[i][1] = a[p][i][1]*b[q][i][0] - a[p][i][0]*b[q][i][1];
+            }
+        }
+    }
+    for ( k = 0; k < 9; k ++ )
+        for ( i = 1; i < nfft - nfft/2; i ++ ) {
+            cross[k][nfft-i][0] = cross[k][i][0];
+            cross[k][nfft-i][1] = -cross[k][i][1];
+        }
+}
+
+/* ------ FFTW calls of the processing stages, timed and counted under ABC_STATS ------ */
+/* the planner of FFTW is not thread safe: plans are made and destroyed under a lock, executed without */
+static pthread_mutex_t fft_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* transforms and per-bin loops of at least fft_min_n points run on fft_nthread threads */
+static int fft_nthread = 1, fft_min_n = 0, fft_init = 0;
+
+/* ------ threads of each transform and per-bin loop of at least min_n points from now on, 1 for none;
+          the transforms are planned on them by the threaded FFTW (make FFTW_THREADS=1), the loops over
+          bins are split in any build. Return 0, -1 if the transforms are not threaded in this build ------ */
+int set_fft_threads( int nthread, int min_n ) {
+    pthread_mutex_lock(&fft_lock);
+#ifdef ABC_FFTW_THREADS
+    if ( !fft_init && nthread > 1 ) fft_init = fftw_init_threads();
+#endif
+    fft_nthread = nthread < 1 ? 1 : nthread > FFT_MAX_THREADS ? FFT_MAX_THREADS : nthread;
+    fft_min_n = min_n;
+    pthread_mutex_unlock(&fft_lock);
+    return fft_init || fft_nthread == 1 ? 0 : -1;
+}
+
+static fftw_complex *fft_alloc( int n ) {
+    STAT_ALLOC(sizeof(fftw_complex) * n);
+    return (fftw_complex *) fftw_malloc( sizeof(fftw_complex) * n );
+}
+
+static fftw_plan fft_plan( int n, fftw_complex *in, fftw_complex *out, int sign ) {
+    fftw_plan p;
+    STAT_BEGIN(STAT_FFT_PLAN);
+    pthread_mutex_lock(&fft_lock);
+#ifdef ABC_FFTW_THREADS
+    if ( fft_init ) fftw_plan_with_nthreads( n >= fft_min_n ? fft_nthread : 1 );
+#endif
+    p = fftw_plan_dft_1d( n, in, out, sign, FFTW_ESTIMATE );
+    pthread_mutex_unlock(&fft_lock);
+    STAT_END(STAT_FFT_PLAN);
+    return p;
+}
+
+static void fft_destroy( fftw_plan p ) {
+    pthread_mutex_lock(&fft_lock);
+    fftw_destroy_plan(p);
+    pthread_mutex_unlock(&fft_lock);
+}
+
+/* ------ plan of howmany transforms of n points, one after the other in in and out, and its release,
+          under the lock of the planner, for the transforms made outside this file (ftan.c) ------ */
+fftw_plan fft_plan_many( int n, int howmany, fftw_complex *in, fftw_complex *out, int sign ) {
+    fftw_plan p;
+    STAT_BEGIN(STAT_FFT_PLAN);
+    pthread_mutex_lock(&fft_lock);
+#ifdef ABC_FFTW_THREADS
+    if ( fft_init ) fftw_plan_with_nthreads( n >= fft_min_n ? fft_nthread : 1 );
+#endif
+    p = fftw_plan_many_dft( 1, &n, howmany, in, NULL, 1, n, out, NULL, 1, n, sign, FFTW_ESTIMATE );
+    pthread_mutex_unlock(&fft_lock);
+    STAT_END(STAT_FFT_PLAN);
+    return p;
+}
+
+void fft_plan_free( fftw_plan p ) {
+    fft_destroy(p);
+}
+
+static void fft_exec( fftw_plan p, int n, fftw_complex *in, fftw_complex *out ) {
+    STAT_BEGIN(STAT_FFT_EXEC);
+    fftw_execute_dft( p, in, out );
+    STAT_END(STAT_FFT_EXEC);
+    STAT_FFT(n);
+}
+
+/* ------ body(arg, i0, i1) on bins [0, n), split into fft_nthread parts run at once if n is at least
+          fft_min_n; every bin is computed as in one pass, so the results are the same ------ */
+typedef struct bin_part {
+    void (*body)( void *arg, int i0, int i1 );
+    void *arg;
+    int i0, i1;
+} BINPART;
+
+static void *bin_part( void *arg ) {
+    BINPART *part = (BINPART *) arg;
+
+    part->body( part->arg, part->i0, part->i1 );
+    return NULL;
+}
+
+static void bin_loop( int n, void (*body)( void *arg, int i0, int i1 ), void *arg ) {
+    BINPART part[FFT_MAX_THREADS];
+    pthread_t tid[FFT_MAX_THREADS];
+    int k, started, nt = n >= fft_min_n ? fft_nthread : 1;
+
+    if ( nt <= 1 ) {
+        body( arg, 0, n );
+        return;
+    }
+    for ( k = 0; k < nt; k ++ ) {
+        part[k].body = body;
+        part[k].arg = arg;
+        part[k].i0 = (int)((long long) n * k / nt);
+        part[k].i1 = (int)((long long) n * (k + 1) / nt);
+    }
+    for ( started = 1; started < nt; started ++ )
+        if ( pthread_create( &tid[started], NULL, bin_part, &part[started] ) != 0 ) break;
+    for ( k = started; k < nt; k ++ ) bin_part( &part[k] );     // parts whose thread did not start
+    bin_part( &part[0] );
+    for ( k = 1; k < started; k ++ ) pthread_join( tid[k], NULL );
+}
+
+/* ------ per-bin loops of bp_data, whiten_spec, whiten_amp and cor_spec on bins [i0, i1) ------ */
+static void taper_bins( void *arg, int i0, int i1 ) {
+    BINS *b = (BINS *) arg;
+    double re, im;
+    int i;
+
+    if ( b->inv == NULL ) for ( i = i0; i < i1; i ++ ) {
+        b->z[i][0] = b->x[i][0] * b->w[i];
+        b->z[i][1] = b->x[i][1] * b->w[i];
+    }
+    else for ( i = i0; i < i1; i ++ ) {
+        // response removed in the same pass: taper times 1/H
+        re = b->x[i][0] * b->inv[i][0] - b->x[i][1] * b->inv[i][1];
+        im = b->x[i][0] * b->inv[i][1] + b->x[i][1] * b->inv[i][0];
+        b->z[i][0] = re * b->w[i];
+        b->z[i][1] = im * b->w[i];
+    }
+}
+
+static void whiten_bins( void *arg, int i0, int i1 ) {
+    BINS *b = (BINS *) arg;
+    int i;
+
+    for ( i = i0; i < i1; i ++ ) {
+        if ( i >= b->lo && i <= b->hi ) {
+            b->z[i][0] /= b->w[i]; b->z[i][1] /= b->w[i];
+        }
+        else {
+            b->z[i][0] = 0.; b->z[i][1] = 0.;
+        }
+    }
+}
+
+static void amp_bins( void *arg, int i0, int i1 ) {
+    BINS *b = (BINS *) arg;
+    int i;
+
+    for ( i = i0; i < i1; i ++ ) {
+        b->w[i] = sqrt( pow(b->x[i][0],2.) + pow(b->x[i][1],2.) );
+        b->v[i] = 0.;
+    }
+}
+
+static void cross_bins( void *arg, int i0, int i1 ) {
+    BINS *b = (BINS *) arg;
+    int i;
+
+    for ( i = i0; i < i1; i ++ ) {
+        // Real parts of cross correlation.
+        b->z[i][0] = b->x[i][0]*b->y[i][0] + b->x[i][1]*b->y[i][1];
+
+        // Imaginary parts of cross correlation.
+        b->z[i][1] = b->x[i][1]*b->y[i][0] - b->x[i][0]*b->y[i][1];
+    }
+}
+
+/* ------ mask of sacin passed on to sacout by the stages that keep the samples where they are ------ */
+static int mask_pass( const char *sacin, const char *sacout, int n ) {
+    char *mask = mask_load( sacin, n );
+    int ret = mask_save( sacout, mask, n );
+
+    free(mask);
+    return ret;
+}
+
+/* ------ 1 if all n lags are finite numbers ------ */
+static int lags_finite( const float *x, int n ) {
+    int i;
+
+    for ( i = 0; i < n; i ++ ) if ( !isfinite(x[i]) ) return 0;
+    return 1;
+}
+
+/* ------ whitening leaves the energy of a trace the same with or without gaps, all of it on the valid
+          samples: sqrt of the valid fraction brings it back to the level of a trace without gaps ------ */
+static float mask_scale( const char *mask, int n ) {
+    int i, cnt = 0;
+
+    for ( i = 0; i < n; i ++ ) cnt += mask[i];
+    return cnt > 0 ? sqrt( (double)cnt / n ) : 1.;
+}
+
+/* ------ the trace of the whitened spectrum whi as cor_in_freq reads the output of spe_whi: its real part
+          cut to n samples, the masked ones (mask may be NULL) zeroed and the others scaled; pb an in-place
+          backward and pf a forward plan (tmp to whi) of nfft points ------ */
+static void mask_spec( fftw_complex *whi, const char *mask, int n, int nfft,
+                       fftw_complex *tmp, fftw_plan pb, fftw_plan pf ) {
+    int i;
+    float s = (mask == NULL ? 1. : mask_scale( mask, n )) / nfft;
+
+    memcpy( tmp, whi, sizeof(fftw_complex) * nfft );
+    fft_exec( pb, nfft, tmp, tmp );
+    for ( i = 0; i < nfft; i ++ ) {
+        tmp[i][0] = i < n && (mask == NULL || mask[i]) ? tmp[i][0] * s : 0.;
+        tmp[i][1] = 0.;
+    }
+    fft_exec( pf, nfft, tmp, whi );
+}
+
+/* ------ cosine taper of 5% of the samples at each end, as SAC taper before transfer, so that the
+          truncation of the trace does not leak into the bins where 1/H is large ------ */
+static void edge_taper( float *x, int n ) {
+    int i, m = n / 20;
+
+    for ( i = 0; i < m; i ++ ) {
+        x[i] *= 0.5 * (1. - cos(M_PI * i / m));
+        x[n-1-i] *= 0.5 * (1. - cos(M_PI * i / m));
+    }
+}
+
+/* ------ multiply the n bins of spec by the inverse response inv, nothing if inv is NULL ------ */
+static void resp_spec( fftw_complex *spec, const fftw_complex *inv, int n ) {
+    int i;
+    double re;
+
+    if ( inv == NULL ) return;
+    for ( i = 0; i < n; i ++ ) {
+        re = spec[i][0] * inv[i][0] - spec[i][1] * inv[i][1];
+        spec[i][1] = spec[i][0] * inv[i][1] + spec[i][1] * inv[i][0];
+        spec[i][0] = re;
+    }
+}
+
+/* ------ spe_whi keeps the real part of the whitened trace: the hermitian part of its spectrum ------ */
+static void hermitian_part( fftw_complex *whi, int nfft ) {
+    int i;
+    double re, im;
+
+    whi[0][1] = 0.;
+    for ( i = 1; i < nfft/2; i ++ ) {
+        re = (whi[i][0] + whi[nfft-i][0]) / 2.;
+        im = (whi[i][1] - whi[nfft-i][1]) / 2.;
+        whi[i][0] = re;       whi[i][1] = im;
+        whi[nfft-i][0] = re;  whi[nfft-i][1] = -im;
+    }
+    whi[nfft/2][1] = 0.;
 }
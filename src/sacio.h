@@ -45,6 +45,9 @@
 #ifndef _SACIO_H
 #define _SACIO_H
 
+#include <stddef.h>
+#include <fftw3.h>
+
 /*******************************************************************************
                         SAC header structure
 
@@ -373,23 +376,78 @@ int read_sac_head(const char *name, SACHEAD *hd);
 float *read_sac(const char *name, SACHEAD *hd);
 int read_sac_xy(const char *name, SACHEAD *hd, float *xdata, float *ydata);
 float *read_sac_pdw(const char *name, SACHEAD *hd, int tmark, float t1, float t2);
+int read_sac_range(const char *name, SACHEAD *hd, long first, int npts, float *ar, char *mask);
 int write_sac(const char *name, SACHEAD hd, const float *ar);
 int write_sac_xy(const char *name, SACHEAD hd, const float *xdata, const float *ydata);
 SACHEAD new_sac_head(float dt, int ns, float b0);
 int sac_head_index(const char *name);
 int issac(const char *name);
 
+/* byte swap of 4-byte words, vectorized where the CPU allows */
+#define SAC_SWAP_BEST   -1
+#define SAC_SWAP_SCALAR  0
+#define SAC_SWAP_SSSE3   1
+#define SAC_SWAP_AVX2    2
+int sac_swap4_use(int level);
+void sac_swap4(char *pt, size_t n);
+void sac_swap4_copy(char *dst, const char *src, size_t n);
+
 
 /*------------------------Xuping's functions of processing seismic ambient noise-------------*/
+#define EARTH_R 6371.0      /* mean radius of the earth in km, for distaz */
+#define TENSOR_BLOCK 256    /* frequency bins per block of cross_tensor */
 int pow_next2 ( int n );
 int julian( int year, int mon, int day );
-float abs_time ( int year, int jday, int hour, int min, int sec, float msec );
-void cut_sac ( char *sacin, char *sacout, float evt0, float startt0, int npts );
-void bp ( char *sacin, char *sacout, float f1, float f2, float f3, float f4, int npow  );
+double abs_time ( int year, int jday, int hour, int min, int sec, float msec );
+double sac_begin_time ( SACHEAD *hd );
+int cut_sac ( char *sacin, char *sacout, double evt0, float startt0, int npts );
+int cut_window ( const char *sacin, double evt0, float startt0, int npts, float *x, char *mask, SACHEAD *hd );
+int bp ( char *sacin, char *sacout, float f1, float f2, float f3, float f4, int npow  );
+void bp_data ( const float *x, float *y, const SACHEAD *hd, float f1, float f2, float f3, float f4, int npow );
 void norm ( char *sacin, char *sacout, int npts  );
-void normal ( char *sacin, char *sacout, int npts  );
+int normal ( char *sacin, char *sacout, int npts  );
 void whiten_f ( char *sacin, char *sacout, int npts, float f1, float f2, float f3, float f4  );
-void spe_whi ( char *sacin, char *sacout, int npts, float f1, float f2, float f3, float f4  );
+int spe_whi ( char *sacin, char *sacout, int npts, float f1, float f2, float f3, float f4  );
+void spe_whi_data ( const float *x, float *y, int n, float delta, int npts, float f1, float f2, float f3, float f4 );
 void cor ( char *sac1, char *sac2, float lag_time, char *sac_cor );
-void cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name );
+int cor_in_freq( char *sac1, char *sac2, float lag_time, char *cor_name );
+int cor_size ( const SACHEAD *hd1, float lag_time );
+int cor_data ( const float *x, const char *m1, const SACHEAD *hd1, const float *y, const char *m2,
+               const SACHEAD *hd2, float lag_time, float *cor_xy, SACHEAD *hd );
+
+/*------------------------in-memory stages used by the functions above------------------------*/
+void bp_taper ( float *taper, int n, float delta, float f1, float f2, float f3, float f4, int npow );
+void normal_data ( const float *data, float *mean, int n, int npts );
+void run_abs_mean ( const float *data, float *mean, int n, int npts );
+void normal_transient ( const float *data, float *mean, int n, float delta, int npts, char *mask );
+void normal_mask ( const float *data, const char *mask, float *mean, int n, int npts );
+int sta_lta_mask ( const float *x, int n, float delta, float sta, float lta, float on, float off, char *mask );
+void set_sta_lta ( float sta, float lta, float on, float off );
+void set_gap_mask ( float frac );
+char *mask_load ( const char *sac, int n );
+int mask_save ( const char *sac, const char *mask, int n );
+void cor_fft ( const float *x, int n, int nfft, fftw_complex *out );
+void cor_spec ( fftw_complex *out1, fftw_complex *out2, int nfft, int lag_n, float *cor_xy );
+void cor_lags ( fftw_complex *cor_in, int nfft, int lag_n, float *cor_xy );
+int cor_overlap ( const char *m1, const char *m2, int n1, int n2, int nfft, int lag_n, float *cor_xy,
+                  SACHEAD *hd );
+void whiten_spec ( fftw_complex *out, int fftn, int n, float delta, int npts, float f1, float f4 );
+void whiten_amp ( const fftw_complex *out, int fftn, int n, float delta, int npts, float f1, float f4, float *sout );
+void band_whiten ( fftw_complex *spec, float *taper, int n, int nfft, float delta, int norm_npts,
+                   int whi_npts, float f1, float f4, fftw_complex *tmp, float *tr,
+                   fftw_plan pb, fftw_plan pw, fftw_complex *whi, char *mask );
+int cor_write ( const char *cor_name, SACHEAD hd, const float *cor_xy, int cor_n );
+void set_cor_writer ( int (*writer)( const char *name, SACHEAD hd, const float *ar ) );
+void set_bp_response ( const fftw_complex *(*resp)( const SACHEAD *hd, int n ) );
+int set_fft_threads ( int nthread, int min_n );
+fftw_plan fft_plan_many ( int n, int howmany, fftw_complex *in, fftw_complex *out, int sign );
+void fft_plan_free ( fftw_plan p );
+void cor_head ( SACHEAD *hd1, SACHEAD *hd2, int lag_n );
+void distaz ( double lat1, double lon1, double lat2, double lon2,
+              double *dist, double *az, double *baz, double *gcarc );
+int cor_bands ( char *sac1, char *sac2, int nband, float (*band)[4], int npow, int norm_npts,
+                int whi_npts, float lag_time, char **cor_name );
+int cor_tensor ( char **sac1, char **sac2, float f1, float f2, float f3, float f4, int npow,
+                 int norm_npts, int whi_npts, float lag_time, char **cor_name );
+void cross_tensor ( fftw_complex **spec, double az1, double az2, int nfft, fftw_complex **cross );
 #endif /* sacio.h */
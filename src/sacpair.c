@@ -0,0 +1,265 @@
+/*******************************************************************************
+ *                                  sacpair.c                                  *
+ *  Selection of station pairs:                                                *
+ *      sac_sta_load     read station coordinates from a list of SAC files     *
+ *      sac_pairs        pairs within a distance and azimuth range             *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sacpair.h"
+
+#define MAX_CELLS   (1 << 20)       /* grid cells per axis at most */
+
+/* station and its grid cell, ordered by cell */
+typedef struct cell {
+    long long   key;
+    int         i;
+} CELL;
+
+/* function prototype for local use */
+static unsigned int morton    (double lat, double lon);
+static int  sta_cmp           (const void *a, const void *b);
+static int  cell_cmp          (const void *a, const void *b);
+static int  int_cmp           (const void *a, const void *b);
+static int  in_range          (double az, double az1, double az2);
+static void copy_name         (char *dst, const char *src, int n);
+
+/*
+ *  sac_sta_load
+ *
+ *  Description: Read the coordinates of the stations of a list file. Each
+ *      line holds a SAC file name, optionally followed by the name to use
+ *      for the station in the pair list. Without it, the SAC file name is
+ *      used, or kstnm if use_kstnm is set (for abc_egf -i). A station
+ *      listed several times is kept once. Files without stla/stlo are
+ *      skipped.
+ *
+ *  IN:
+ *      const char *lst      : list file name
+ *      int        use_kstnm : name stations by kstnm instead of file name
+ *  OUT:
+ *      int        *nsta     : number of stations
+ *
+ *  Return: stations in Morton order of (lat, lon), NULL if failed.
+ *
+ */
+SACSTA *sac_sta_load(const char *lst, int use_kstnm, int *nsta)
+{
+    FILE    *ff;
+    SACSTA  *sta;
+    SACHEAD hd;
+    char    buff[512], file[SACPAIR_NAME_LEN], name[SACPAIR_NAME_LEN];
+    int     nmax = 64, n, k;
+
+    if ((ff = fopen(lst, "r")) == NULL) {
+        fprintf(stderr, "Unable to open %s\n", lst);
+        return NULL;
+    }
+
+    sta = (SACSTA *)malloc(sizeof(SACSTA) * nmax);
+    *nsta = 0;
+    while (fgets(buff, 512, ff)) {
+        n = sscanf(buff, "%255s %255s", file, name);
+        if (n < 1 || file[0] == '#') continue;
+        if (read_sac_head(file, &hd) == -1) continue;
+        if (hd.stla == SAC_FLOAT_UNDEF || hd.stlo == SAC_FLOAT_UNDEF) {
+            fprintf(stderr, "Warning: no stla/stlo in %s, skipped\n", file);
+            continue;
+        }
+
+        if (*nsta == nmax) {
+            nmax *= 2;
+            sta = (SACSTA *)realloc(sta, sizeof(SACSTA) * nmax);
+        }
+        copy_name(sta[*nsta].sta, hd.kstnm, SACPAIR_STA_LEN);
+        if (n == 2)         copy_name(sta[*nsta].name, name, SACPAIR_NAME_LEN);
+        else if (use_kstnm) copy_name(sta[*nsta].name, sta[*nsta].sta, SACPAIR_NAME_LEN);
+        else                copy_name(sta[*nsta].name, file, SACPAIR_NAME_LEN);
+        if (sta[*nsta].sta[0] == '\0' || strcmp(sta[*nsta].sta, "-12345") == 0)
+            copy_name(sta[*nsta].sta, sta[*nsta].name, SACPAIR_STA_LEN);
+
+        for (k = 0; k < *nsta; k ++)
+            if (strcmp(sta[k].name, sta[*nsta].name) == 0) break;
+        if (k < *nsta) continue;
+
+        sta[*nsta].lat = hd.stla;
+        sta[*nsta].lon = hd.stlo;
+        sta[*nsta].x[0] = cos(hd.stla * M_PI/180.) * cos(hd.stlo * M_PI/180.);
+        sta[*nsta].x[1] = cos(hd.stla * M_PI/180.) * sin(hd.stlo * M_PI/180.);
+        sta[*nsta].x[2] = sin(hd.stla * M_PI/180.);
+        (*nsta) ++;
+    }
+    fclose(ff);
+
+    qsort(sta, (size_t)*nsta, sizeof(SACSTA), sta_cmp);
+
+    return sta;
+}
+
+/*
+ *  sac_pairs
+ *
+ *  Description: Find the station pairs with dmin <= dist <= dmax whose
+ *      azimuth from the first station lies in [az1, az2] (through north
+ *      if az1 > az2). A pair whose azimuth only fits the other way round is
+ *      returned in that order. Pairs are grouped by the station earlier in
+ *      the order of sta, partners in the same order.
+ *
+ *  IN:
+ *      const SACSTA *sta   : stations from sac_sta_load
+ *      int          nsta   : number of stations
+ *      double       dmin   : smallest distance (km)
+ *      double       dmax   : largest distance (km), <= 0 for no limit
+ *      double       az1    : azimuth range (degrees); az1 < 0 for any
+ *      double       az2
+ *  OUT:
+ *      SACPAIR      **pairs: array of pairs, to be freed by the caller
+ *
+ *  Return: number of pairs, -1 if failed.
+ *
+ */
+int sac_pairs(const SACSTA *sta, int nsta, double dmin, double dmax,
+              double az1, double az2, SACPAIR **pairs)
+{
+    CELL    *cell, probe;
+    SACPAIR *pr;
+    double  h, dist, az, baz, gcarc;
+    long long m;
+    int     *cand, *ci, i, j, k, lo, hi, mid, nc, npair = 0, nmax = 1024;
+    int     dx, dy, dz, c[3];
+
+    /* cell width: chord of dmax, one cell for the whole sphere if no limit */
+    if (dmax <= 0. || dmax >= M_PI * EARTH_R) h = 2.01;
+    else h = 2. * sin(dmax / EARTH_R / 2.);
+    if (h < 2. / MAX_CELLS) h = 2. / MAX_CELLS;
+    m = (long long)(2. / h) + 1;
+
+    cell = (CELL *)malloc(sizeof(CELL) * (nsta > 0 ? nsta : 1));
+    ci   = (int *)malloc(sizeof(int) * 3 * (nsta > 0 ? nsta : 1));
+    cand = (int *)malloc(sizeof(int) * (nsta > 0 ? nsta : 1));
+    pr   = (SACPAIR *)malloc(sizeof(SACPAIR) * nmax);
+    if (cell == NULL || ci == NULL || cand == NULL || pr == NULL) {
+        fprintf(stderr, "Error in allocating memory for %d stations\n", nsta);
+        free(cell); free(ci); free(cand); free(pr);
+        return -1;
+    }
+    for (i = 0; i < nsta; i ++) {
+        for (k = 0; k < 3; k ++) {
+            ci[3*i+k] = (int)((sta[i].x[k] + 1.) / h);
+            if (ci[3*i+k] >= m) ci[3*i+k] = (int)m - 1;
+        }
+        cell[i].key = ((long long)ci[3*i] * m + ci[3*i+1]) * m + ci[3*i+2];
+        cell[i].i = i;
+    }
+    qsort(cell, (size_t)nsta, sizeof(CELL), cell_cmp);
+
+    for (i = 0; i < nsta; i ++) {
+        /* partners later in the order, from the 27 cells around station i */
+        nc = 0;
+        for (dx = -1; dx <= 1; dx ++) for (dy = -1; dy <= 1; dy ++) for (dz = -1; dz <= 1; dz ++) {
+            c[0] = ci[3*i] + dx; c[1] = ci[3*i+1] + dy; c[2] = ci[3*i+2] + dz;
+            if (c[0] < 0 || c[1] < 0 || c[2] < 0 || c[0] >= m || c[1] >= m || c[2] >= m) continue;
+            probe.key = ((long long)c[0] * m + c[1]) * m + c[2];
+            lo = 0; hi = nsta;
+            while (lo < hi) {
+                mid = (lo + hi) / 2;
+                if (cell[mid].key < probe.key) lo = mid + 1;
+                else hi = mid;
+            }
+            for (; lo < nsta && cell[lo].key == probe.key; lo ++)
+                if (cell[lo].i > i) cand[nc++] = cell[lo].i;
+        }
+        qsort(cand, (size_t)nc, sizeof(int), int_cmp);
+
+        for (k = 0; k < nc; k ++) {
+            j = cand[k];
+            distaz(sta[i].lat, sta[i].lon, sta[j].lat, sta[j].lon, &dist, &az, &baz, &gcarc);
+            if (dist < dmin || (dmax > 0. && dist > dmax)) continue;
+            if (npair == nmax) {
+                nmax *= 2;
+                pr = (SACPAIR *)realloc(pr, sizeof(SACPAIR) * nmax);
+            }
+            if (in_range(az, az1, az2)) {
+                pr[npair].i = i; pr[npair].j = j; pr[npair].az = az; pr[npair].baz = baz;
+            } else if (in_range(baz, az1, az2)) {
+                pr[npair].i = j; pr[npair].j = i; pr[npair].az = baz; pr[npair].baz = az;
+            } else continue;
+            pr[npair].dist = dist;
+            npair ++;
+        }
+    }
+
+    free(cell); free(ci); free(cand);
+    *pairs = pr;
+    return npair;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  morton: interleave the bits of 16-bit latitude and longitude
+ */
+static unsigned int morton(double lat, double lon)
+{
+    unsigned int a = (unsigned int)((lat + 90.) / 180. * 65535.);
+    unsigned int b = (unsigned int)((lon - 360. * floor((lon + 180.) / 360.) + 180.) / 360. * 65535.);
+    unsigned int code = 0;
+    int k;
+
+    for (k = 0; k < 16; k ++)
+        code |= ((a >> k) & 1u) << (2*k+1) | ((b >> k) & 1u) << (2*k);
+    return code;
+}
+
+static int sta_cmp(const void *a, const void *b)
+{
+    const SACSTA *s1 = (const SACSTA *)a;
+    const SACSTA *s2 = (const SACSTA *)b;
+    unsigned int m1 = morton(s1->lat, s1->lon), m2 = morton(s2->lat, s2->lon);
+
+    if (m1 != m2) return m1 < m2 ? -1 : 1;
+    return strcmp(s1->name, s2->name);
+}
+
+static int cell_cmp(const void *a, const void *b)
+{
+    const CELL *c1 = (const CELL *)a;
+    const CELL *c2 = (const CELL *)b;
+
+    if (c1->key != c2->key) return c1->key < c2->key ? -1 : 1;
+    return c1->i - c2->i;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/*
+ *  in_range: az within [az1, az2], through north if az1 > az2; any if az1 < 0
+ */
+static int in_range(double az, double az1, double az2)
+{
+    if (az1 < 0.) return 1;
+    if (az1 <= az2) return az >= az1 && az <= az2;
+    return az >= az1 || az <= az2;
+}
+
+/*
+ *  copy_name: copy a string without the trailing blanks of SAC strings
+ */
+static void copy_name(char *dst, const char *src, int n)
+{
+    int k;
+
+    snprintf(dst, (size_t)n, "%.*s", n - 1, src);
+    for (k = (int)strlen(dst); k > 0 && dst[k-1] == ' '; k --) dst[k-1] = '\0';
+}
@@ -0,0 +1,42 @@
+/*******************************************************************************
+    Name:     sacpair.h
+
+    Purpose:  selection of station pairs by interstation distance and
+        azimuth, from the station coordinates in SAC headers
+
+    Notes:
+        Stations are put on the unit sphere and binned in a 3-D grid whose
+        cells are as wide as the chord of the largest distance wanted, so the
+        partners of a station are all in the 27 cells around it and pairs
+        are found without testing all N^2 of them.
+
+        Stations are kept in Morton order of (lat, lon) and the pairs of a
+        station come one after another, partners in the same order, so the
+        data of a station is reused while it is hot.
+*******************************************************************************/
+
+#ifndef _SACPAIR_H
+#define _SACPAIR_H
+
+#include "sacio.h"
+
+#define SACPAIR_NAME_LEN    256
+#define SACPAIR_STA_LEN     16
+
+typedef struct sac_sta {
+    char    name[SACPAIR_NAME_LEN]; /* name of the station in the pair list */
+    char    sta[SACPAIR_STA_LEN];   /* station name (kstnm) for cor_name    */
+    double  lat, lon;               /* stla, stlo                           */
+    double  x[3];                   /* position on the unit sphere          */
+} SACSTA;
+
+typedef struct sac_pair {
+    int     i, j;                   /* stations, i is the "event" of cor    */
+    double  dist, az, baz;          /* km and degrees, from i to j          */
+} SACPAIR;
+
+SACSTA *sac_sta_load ( const char *lst, int use_kstnm, int *nsta );
+int sac_pairs ( const SACSTA *sta, int nsta, double dmin, double dmax,
+                double az1, double az2, SACPAIR **pairs );
+
+#endif /* sacpair.h */
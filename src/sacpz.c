@@ -0,0 +1,387 @@
+/*******************************************************************************
+ *                                   sacpz.c                                   *
+ *  Instrument response from SAC pole-zero files:                              *
+ *      pz_open          read the SAC_PZs files of a list                      *
+ *      pz_close         release the epochs and the cache                      *
+ *      pz_read          read the epochs of one SAC_PZs file                   *
+ *      pz_eval          response of an epoch at one frequency                 *
+ *      pz_find          epoch of the station of a trace at its begin time     *
+ *      pz_inverse       water-levelled 1/H on the bins of a spectrum, cached  *
+ *      pz_use           make pz_response use a response set                   *
+ *      pz_response      pz_inverse of that set, given to set_bp_response      *
+ *      pz_cache_free    release the cache of the calling thread               *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sacpz.h"
+
+/* response set used by pz_response */
+static SACRESP *cur_resp = NULL;
+
+/* inverse responses of the calling thread, and the entry replaced next */
+static __thread SACPZCACHE cache[SACPZ_CACHE];
+static __thread int cache_next = 0;
+
+/* function prototype for local use */
+static void    copy_name   (char *dst, const char *src);
+static int     same_name   (const char *pz, const char *hd, int any);
+static double  pz_time     (const char *str);
+static SACPZ  *new_epoch   (SACRESP *rs);
+
+/*
+ *  pz_open
+ *
+ *  Description: Read the SAC_PZs files of a list file. Each line holds a
+ *      file name, optionally followed by the station and channel of the
+ *      file, which replace those of its comments.
+ *
+ *  IN:
+ *      const char *lst : list file name
+ *      float      wl   : water level, fraction of the largest |H|
+ *
+ *  Return: pointer to the response set, NULL if failed.
+ *
+ */
+SACRESP *pz_open(const char *lst, float wl)
+{
+    FILE    *ff;
+    SACRESP *rs;
+    char    buff[512], file[256], sta[SACPZ_NAME_LEN], chn[SACPZ_NAME_LEN];
+    int     n;
+
+    if ((ff = fopen(lst, "r")) == NULL) {
+        fprintf(stderr, "Unable to open %s\n", lst);
+        return NULL;
+    }
+    rs = (SACRESP *)calloc(1, sizeof(SACRESP));
+    rs->wl = wl;
+
+    while (fgets(buff, 512, ff)) {
+        n = sscanf(buff, "%255s %15s %15s", file, sta, chn);
+        if (n < 1 || file[0] == '#') continue;
+        if (pz_read(rs, file, n > 1 ? sta : NULL, n > 2 ? chn : NULL) == -1) {
+            fclose(ff);
+            pz_close(rs);
+            return NULL;
+        }
+    }
+    fclose(ff);
+
+    if (rs->npz == 0) {
+        fprintf(stderr, "No pole-zero epoch in %s\n", lst);
+        pz_close(rs);
+        return NULL;
+    }
+    return rs;
+}
+
+/*
+ *  pz_close
+ *
+ *  Description: release a response set and the cache of the calling
+ *      thread, and stop pz_response using it. Other threads must have
+ *      released their caches before.
+ *
+ */
+void pz_close(SACRESP *rs)
+{
+    if (rs == NULL) return;
+    if (cur_resp == rs) cur_resp = NULL;
+    pz_cache_free();
+    free(rs->pz);
+    free(rs);
+}
+
+/*
+ *  pz_read
+ *
+ *  Description: Add the epochs of a SAC_PZs file to rs. An epoch ends at
+ *      its CONSTANT line and takes the station, channel and time range of
+ *      the comments read so far; sta and chn, if not NULL, are used
+ *      instead of the comments.
+ *
+ *  Return: number of epochs read, -1 if failed.
+ *
+ */
+int pz_read(SACRESP *rs, const char *file, const char *sta, const char *chn)
+{
+    FILE    *ff;
+    SACPZ   cur, *pz;
+    char    buff[512], key[64], val[256], *p;
+    double  re, im;
+    int     n, k = 0, nread = 0, state = 0; /* state: 1 in ZEROS, 2 in POLES */
+
+    if ((ff = fopen(file, "r")) == NULL) {
+        fprintf(stderr, "Unable to open %s\n", file);
+        return -1;
+    }
+
+    memset(&cur, 0, sizeof(SACPZ));
+    while (fgets(buff, 512, ff)) {
+        if (buff[0] == '*') {
+            /* "* STATION    (KSTNM): ANMO", "* START             : 2002-11-19T21:07:00" */
+            if ((p = strchr(buff, ':')) == NULL || sscanf(buff + 1, "%63s", key) != 1) continue;
+            if (sscanf(p + 1, "%255s", val) != 1) val[0] = '\0';
+            if      (strcmp(key, "NETWORK") == 0)  copy_name(cur.net, val);
+            else if (strcmp(key, "STATION") == 0)  copy_name(cur.sta, val);
+            else if (strcmp(key, "LOCATION") == 0) copy_name(cur.loc, val);
+            else if (strcmp(key, "CHANNEL") == 0)  copy_name(cur.chn, val);
+            else if (strcmp(key, "START") == 0)    cur.t0 = pz_time(val);
+            else if (strcmp(key, "END") == 0)      cur.t1 = pz_time(val);
+            continue;
+        }
+        if (sscanf(buff, "%63s %255s", key, val) < 1) continue;
+
+        if (strcmp(key, "ZEROS") == 0 || strcmp(key, "POLES") == 0) {
+            n = atoi(val);
+            if (n < 0 || n > SACPZ_MAX) {
+                fprintf(stderr, "Too many %s in %s (at most %d)\n", key, file, SACPZ_MAX);
+                fclose(ff);
+                return -1;
+            }
+            state = key[0] == 'Z' ? 1 : 2;
+            if (state == 1) { cur.nzero = n; memset(cur.zero, 0, sizeof(cur.zero)); }
+            else            { cur.npole = n; memset(cur.pole, 0, sizeof(cur.pole)); }
+            k = 0;
+        }
+        else if (strcmp(key, "CONSTANT") == 0) {
+            cur.constant = atof(val);
+            if (sta != NULL) copy_name(cur.sta, sta);
+            if (chn != NULL) copy_name(cur.chn, chn);
+            if (cur.sta[0] == '\0') {
+                fprintf(stderr, "Warning: no station for an epoch of %s, skipped\n", file);
+            } else {
+                pz = new_epoch(rs);
+                *pz = cur;
+                nread ++;
+            }
+            state = 0;
+        }
+        else if (state > 0 && sscanf(buff, "%lf %lf", &re, &im) == 2) {
+            if (k >= (state == 1 ? cur.nzero : cur.npole)) continue;
+            if (state == 1) { cur.zero[k][0] = re; cur.zero[k][1] = im; }
+            else            { cur.pole[k][0] = re; cur.pole[k][1] = im; }
+            k ++;
+        }
+    }
+    fclose(ff);
+    return nread;
+}
+
+/*
+ *  pz_eval
+ *
+ *  Description: displacement response H of an epoch at frequency f (Hz)
+ *
+ */
+void pz_eval(const SACPZ *pz, double f, double *re, double *im)
+{
+    double  w = 2. * M_PI * f, hr = pz->constant, hi = 0., a, b, t, d;
+    int     k;
+
+    for (k = 0; k < pz->nzero; k ++) {      /* times (i*w - zero) */
+        a = -pz->zero[k][0]; b = w - pz->zero[k][1];
+        t = hr * a - hi * b; hi = hr * b + hi * a; hr = t;
+    }
+    for (k = 0; k < pz->npole; k ++) {      /* over (i*w - pole) */
+        a = -pz->pole[k][0]; b = w - pz->pole[k][1];
+        d = a * a + b * b;
+        if (d == 0.) { hr = hi = 0.; break; }
+        t = (hr * a + hi * b) / d; hi = (hi * a - hr * b) / d; hr = t;
+    }
+    *re = hr;
+    *im = hi;
+}
+
+/*
+ *  pz_find
+ *
+ *  Description: epoch of the station (kstnm, which must be set) of a trace,
+ *      and of its channel, network and location when the trace and the
+ *      epoch both have them, that covers the begin time of the trace
+ *
+ *  Return: the epoch, NULL if none.
+ *
+ */
+const SACPZ *pz_find(const SACRESP *rs, const SACHEAD *hd)
+{
+    const SACPZ *pz;
+    double  tb;
+    int     i;
+
+    tb = abs_time(hd->nzyear, hd->nzjday, hd->nzhour, hd->nzmin, hd->nzsec, hd->nzmsec) + hd->b;
+    for (i = 0; i < rs->npz; i ++) {
+        pz = &rs->pz[i];
+        if (!same_name(pz->sta, hd->kstnm, 0)) continue;
+        if (pz->chn[0] != '\0' && !same_name(pz->chn, hd->kcmpnm, 1)) continue;
+        if (pz->net[0] != '\0' && !same_name(pz->net, hd->knetwk, 1)) continue;
+        if (pz->loc[0] != '\0' && !same_name(pz->loc, hd->khole, 1)) continue;
+        if (tb < pz->t0 || (pz->t1 > 0. && tb >= pz->t1)) continue;
+        return pz;
+    }
+    return NULL;
+}
+
+/*
+ *  pz_inverse
+ *
+ *  Description: Water-levelled inverse response 1/H of the epoch of a
+ *      trace on the n bins of its n-point spectrum (bin i at i/(n*delta),
+ *      bins above n/2 the conjugate of the negative frequencies). Where
+ *      |H| < wl * max|H|, |1/H| is held at 1/(wl * max|H|). Evaluated once
+ *      per epoch, n and delta.
+ *
+ *  Return: n values in the cache of the calling thread, NULL if the trace
+ *      has no response.
+ *
+ */
+const fftw_complex *pz_inverse(SACRESP *rs, const SACHEAD *hd, int n)
+{
+    const SACPZ  *pz;
+    SACPZCACHE   *c;
+    fftw_complex *inv;
+    double       re, im, amp, hmax = 0., w;
+    int          i;
+
+    if ((pz = pz_find(rs, hd)) == NULL) {
+        fprintf(stderr, "Warning: no response of %.8s %.8s, not removed\n", hd->kstnm, hd->kcmpnm);
+        return NULL;
+    }
+    for (i = 0; i < SACPZ_CACHE; i ++) {
+        c = &cache[i];
+        if (c->pz == pz && c->n == n && c->delta == hd->delta) return (const fftw_complex *)c->inv;
+    }
+
+    c = &cache[cache_next];
+    cache_next = (cache_next + 1) % SACPZ_CACHE;
+    if (c->n != n) {
+        fftw_free(c->inv);
+        c->inv = (fftw_complex *)fftw_malloc(sizeof(fftw_complex) * n);
+    }
+    c->pz = pz; c->n = n; c->delta = hd->delta;
+    inv = c->inv;
+
+    /* H on the bins up to Nyquist, its largest amplitude for the water level */
+    for (i = 0; i <= n/2; i ++) {
+        pz_eval(pz, i / (n * hd->delta), &re, &im);
+        inv[i][0] = re; inv[i][1] = im;
+        amp = sqrt(re * re + im * im);
+        if (amp > hmax) hmax = amp;
+    }
+    w = rs->wl * hmax;
+    for (i = 0; i <= n/2; i ++) {
+        re = inv[i][0]; im = inv[i][1];
+        amp = sqrt(re * re + im * im);
+        if (amp == 0.) { inv[i][0] = inv[i][1] = 0.; continue; }
+        amp *= amp > w ? amp : w;
+        inv[i][0] = re / amp; inv[i][1] = -im / amp;
+    }
+    for (i = n/2 + 1; i < n; i ++) {
+        inv[i][0] = inv[n-i][0]; inv[i][1] = -inv[n-i][1];
+    }
+    return (const fftw_complex *)inv;
+}
+
+/*
+ *  pz_use
+ *
+ *  Description: make pz_response use rs, NULL to stop
+ *
+ */
+void pz_use(SACRESP *rs)
+{
+    cur_resp = rs;
+}
+
+/*
+ *  pz_response
+ *
+ *  Description: pz_inverse of the set selected with pz_use. Given to
+ *      set_bp_response, it removes the response in bp and cor_bands.
+ *
+ *  Return: n values, NULL if no set is used or the trace has no response.
+ *
+ */
+const fftw_complex *pz_response(const SACHEAD *hd, int n)
+{
+    if (cur_resp == NULL) return NULL;
+    return pz_inverse(cur_resp, hd, n);
+}
+
+/*
+ *  pz_cache_free
+ *
+ *  Description: release the inverse responses cached by the calling
+ *      thread, e.g. before a worker thread exits
+ *
+ */
+void pz_cache_free(void)
+{
+    int i;
+
+    for (i = 0; i < SACPZ_CACHE; i ++) {
+        fftw_free(cache[i].inv);
+        memset(&cache[i], 0, sizeof(SACPZCACHE));
+    }
+    cache_next = 0;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  copy_name: station, channel... of a comment, empty for "--" or "N/A"
+ */
+static void copy_name(char *dst, const char *src)
+{
+    if (strcmp(src, "--") == 0 || strcmp(src, "N/A") == 0) src = "";
+    snprintf(dst, SACPZ_NAME_LEN, "%.*s", SACPZ_NAME_LEN-1, src);
+}
+
+/*
+ *  same_name: a name of an epoch against a SAC header string (8 chars,
+ *      blank padded); an undefined header string matches anything if any
+ */
+static int same_name(const char *pz, const char *hd, int any)
+{
+    char    s[SACPZ_NAME_LEN];
+    int     k;
+
+    strncpy(s, hd, 8);
+    s[8] = '\0';
+    for (k = (int)strlen(s); k > 0 && s[k-1] == ' '; k --) s[k-1] = '\0';
+    if (s[0] == '\0' || strcmp(s, "-12345") == 0) return any;
+    return strcmp(pz, s) == 0;
+}
+
+/*
+ *  pz_time: "2002-11-19T21:07:00.0000" as abs_time, 0 if not a time
+ */
+static double pz_time(const char *str)
+{
+    int     year, mon, day, hour = 0, min = 0;
+    double  sec = 0.;
+
+    if (sscanf(str, "%d-%d-%dT%d:%d:%lf", &year, &mon, &day, &hour, &min, &sec) < 3) return 0.;
+    if (year >= 2599) return 0.;            /* open epoch */
+    return abs_time(year, julian(year, mon, day), hour, min, (int)sec, (float)((sec - (int)sec) * 1000.));
+}
+
+/*
+ *  new_epoch: room for one more epoch
+ */
+static SACPZ *new_epoch(SACRESP *rs)
+{
+    if (rs->npz == rs->nmax) {
+        rs->nmax = rs->nmax == 0 ? 16 : 2 * rs->nmax;
+        rs->pz = (SACPZ *)realloc(rs->pz, sizeof(SACPZ) * rs->nmax);
+    }
+    return &rs->pz[rs->npz++];
+}
@@ -0,0 +1,77 @@
+/*******************************************************************************
+    Name:     sacpz.h
+
+    Purpose:  removal of the instrument response given by SAC pole-zero
+        (SAC_PZs) files, in the same frequency-domain pass as the band-pass
+        taper of bp and cor_bands
+
+    Notes:
+        A SAC_PZs file gives the displacement response in meters
+
+            H(f) = CONSTANT * prod(i*2*pi*f - zero) / prod(i*2*pi*f - pole)
+
+        and may hold several epochs, each after its comment block with
+        NETWORK, STATION, LOCATION, CHANNEL, START and END. Zeros not
+        listed are at the origin, as in SAC.
+
+        The list file holds one SAC_PZs file per line, optionally followed
+        by the station and channel to use when the file has no comments.
+        A trace gets the epoch of its kstnm (and kcmpnm, knetwk, khole when
+        both sides set them) that covers its begin time.
+
+        Deconvolution uses a water level: where |H| is below wl times the
+        largest |H| up to Nyquist, 1/H is limited to that level with the
+        phase kept, so the band edges of the sensor are not blown up.
+
+        The inverse response of an epoch is evaluated once for each length
+        and sampling interval of spectrum and kept in a small cache, so a
+        station used in many pairs costs one multiplication per bin.
+        The cache is kept per thread, so that the worker threads of
+        abc_egf -j share the epochs but never a cached response another
+        thread may replace; a thread releases its cache with pz_cache_free.
+*******************************************************************************/
+
+#ifndef _SACPZ_H
+#define _SACPZ_H
+
+#include <fftw3.h>
+#include "sacio.h"
+
+#define SACPZ_MAX       64          /* zeros or poles of an epoch at most   */
+#define SACPZ_CACHE     32          /* inverse responses kept               */
+#define SACPZ_NAME_LEN  16
+
+typedef struct sac_pz {
+    char    net[SACPZ_NAME_LEN], sta[SACPZ_NAME_LEN],
+            loc[SACPZ_NAME_LEN], chn[SACPZ_NAME_LEN];
+    double  t0, t1;                 /* epoch (abs_time), t1 = 0 if open     */
+    int     nzero, npole;
+    double  zero[SACPZ_MAX][2];     /* re, im (rad/s)                       */
+    double  pole[SACPZ_MAX][2];
+    double  constant;
+} SACPZ;
+
+typedef struct sac_pz_cache {
+    const SACPZ     *pz;            /* station and epoch                    */
+    int             n;              /* points of the spectrum               */
+    float           delta;
+    fftw_complex    *inv;           /* water-levelled 1/H of the n bins     */
+} SACPZCACHE;
+
+typedef struct sac_resp {
+    int         npz, nmax;
+    SACPZ       *pz;                /* all epochs of all files              */
+    float       wl;                 /* water level, fraction of max |H|     */
+} SACRESP;
+
+SACRESP *pz_open ( const char *lst, float wl );
+void pz_close ( SACRESP *rs );
+int pz_read ( SACRESP *rs, const char *file, const char *sta, const char *chn );
+void pz_eval ( const SACPZ *pz, double f, double *re, double *im );
+const SACPZ *pz_find ( const SACRESP *rs, const SACHEAD *hd );
+const fftw_complex *pz_inverse ( SACRESP *rs, const SACHEAD *hd, int n );
+void pz_use ( SACRESP *rs );
+const fftw_complex *pz_response ( const SACHEAD *hd, int n );
+void pz_cache_free ( void );
+
+#endif /* sacpz.h */
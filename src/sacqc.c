@@ -0,0 +1,301 @@
+/*******************************************************************************
+ *                                  sacqc.c                                    *
+ *  Quality screening of cut windows:                                          *
+ *      qc_open          read thresholds and open the rejection log            *
+ *      qc_close         print a summary and release                           *
+ *      qc_stats         statistics of a window                                *
+ *      qc_check         accept or reject a window, update the baseline        *
+ *      qc_window        qc_check on a cut window of known header              *
+ *      qc_file          qc_check on a cut SAC file                            *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sacqc.h"
+
+/* function prototype for local use */
+static QCBASE *find_base  (QC *qc, const char *sta);
+static void    head_field (char *out, const char *field);
+static void    reject     (QC *qc, const char *sta, const char *win, const char *why,
+                           double value, double limit);
+
+/*
+ *  qc_open
+ *
+ *  Description: Read the thresholds of a configuration file (see sacqc.h),
+ *      missing keys keep their default. conf may be NULL for the defaults.
+ *
+ *  Return: pointer to the screening state, NULL if failed.
+ *
+ */
+QC *qc_open(const char *conf)
+{
+    FILE    *ff;
+    QC      *qc;
+    char    buff[512], key[64], val[256], log[256] = "qc_reject.log";
+    double  v;
+
+    qc = (QC *)calloc(1, sizeof(QC));
+    qc->max_kurt = 50.; qc->max_amp = 0.; qc->max_zero_sec = 10.;
+    qc->min_eratio = 0.05; qc->max_eratio = 20.; qc->alpha = 0.1;
+
+    if (conf != NULL) {
+        if ((ff = fopen(conf, "r")) == NULL) {
+            fprintf(stderr, "Unable to open %s\n", conf);
+            free(qc);
+            return NULL;
+        }
+        while (fgets(buff, 512, ff)) {
+            if (sscanf(buff, "%63s %255s", key, val) != 2 || key[0] == '#') continue;
+            v = atof(val);
+            if      (strcmp(key, "max_kurt") == 0)     qc->max_kurt = v;
+            else if (strcmp(key, "max_amp") == 0)      qc->max_amp = v;
+            else if (strcmp(key, "max_zero_sec") == 0) qc->max_zero_sec = v;
+            else if (strcmp(key, "min_eratio") == 0)   qc->min_eratio = v;
+            else if (strcmp(key, "max_eratio") == 0)   qc->max_eratio = v;
+            else if (strcmp(key, "alpha") == 0)        qc->alpha = v;
+            else if (strcmp(key, "log") == 0)          strcpy(log, val);
+            else fprintf(stderr, "Warning: unknown key %s in %s\n", key, conf);
+        }
+        fclose(ff);
+    }
+    if (qc->alpha <= 0. || qc->alpha > 1.) qc->alpha = 0.1;
+
+    if ((qc->log = fopen(log, "a")) == NULL) {
+        fprintf(stderr, "Unable to open %s\n", log);
+        free(qc);
+        return NULL;
+    }
+    qc->nmax = 64;
+    qc->base = (QCBASE *)malloc(sizeof(QCBASE) * qc->nmax);
+    return qc;
+}
+
+/*
+ *  qc_close
+ *
+ *  Description: print the number of rejected windows and release qc
+ *
+ */
+void qc_close(QC *qc)
+{
+    if (qc == NULL) return;
+    fprintf(stderr, "QC: %ld of %ld windows rejected\n", qc->nreject, qc->nwin);
+    fclose(qc->log);
+    free(qc->base);
+    free(qc);
+}
+
+/*
+ *  qc_stats
+ *
+ *  Description: RMS, standard deviation, kurtosis, largest amplitude and
+ *      longest run of zeros of n samples. The mean is summed first and the
+ *      moments are those of the samples less the mean, so a large offset
+ *      does not cancel the variance or the kurtosis. Sums run in four
+ *      independent lanes of double precision, which breaks the dependency
+ *      chain; the run of zeros has a loop of its own, so the loops of the
+ *      sums stay free of branches.
+ *      eratio is left to qc_check.
+ *
+ */
+void qc_stats(const float *x, int n, QCSTAT *st)
+{
+    double  s1[4] = {0., 0., 0., 0.}, s2[4] = {0., 0., 0., 0.},
+            s4[4] = {0., 0., 0., 0.}, d, d2;
+    double  mean, m2, m4;
+    float   amax[4] = {0.f, 0.f, 0.f, 0.f}, a;
+    int     i, k, n4 = n & ~3, run = 0, zrun = 0;
+
+    memset(st, 0, sizeof(QCSTAT));
+    if (n <= 0) return;
+
+    for (i = 0; i < n4; i += 4)
+        for (k = 0; k < 4; k ++) {
+            s1[k] += x[i+k];
+            a = fabsf(x[i+k]);
+            amax[k] = a > amax[k] ? a : amax[k];
+        }
+    for (k = 0; i < n; i ++, k ++) {
+        s1[k] += x[i];
+        a = fabsf(x[i]);
+        amax[k] = a > amax[k] ? a : amax[k];
+    }
+    mean = (s1[0] + s1[1] + s1[2] + s1[3]) / n;
+
+    for (i = 0; i < n4; i += 4)
+        for (k = 0; k < 4; k ++) {
+            d = x[i+k] - mean; d2 = d * d;
+            s2[k] += d2; s4[k] += d2 * d2;
+        }
+    for (k = 0; i < n; i ++, k ++) {
+        d = x[i] - mean; d2 = d * d;
+        s2[k] += d2; s4[k] += d2 * d2;
+    }
+    m2 = (s2[0] + s2[1] + s2[2] + s2[3]) / n;
+    m4 = (s4[0] + s4[1] + s4[2] + s4[3]) / n;
+
+    for (i = 0; i < n; i ++) {
+        run = x[i] == 0.f ? run + 1 : 0;
+        if (run > zrun) zrun = run;
+    }
+
+    for (k = 1; k < 4; k ++)
+        if (amax[k] > amax[0]) amax[0] = amax[k];
+    st->amax = amax[0];
+    st->zrun = zrun;
+    st->rms = sqrt(m2 + mean * mean);
+    st->std = sqrt(m2);
+    if (st->std > SACQC_STD_FLOOR * st->amax)
+        st->kurt = m4 / (m2 * m2);
+}
+
+/*
+ *  qc_check
+ *
+ *  Description: Screen n samples of station sta. A rejected window is
+ *      logged with the first failed test; an accepted one updates the
+ *      energy baseline of the station.
+ *
+ *  IN:
+ *      const char  *sta    : station
+ *      const char  *win    : label of the window in the log
+ *      const float *x      : samples
+ *      int         n       : number of samples
+ *      float       delta   : sampling interval
+ *
+ *  Return: 0 if accepted, 1 if rejected.
+ *
+ */
+int qc_check(QC *qc, const char *sta, const char *win, const float *x, int n, float delta)
+{
+    QCSTAT  st;
+    QCBASE  *b;
+    double  e;
+
+    qc->nwin ++;
+    qc_stats(x, n, &st);
+    b = find_base(qc, sta);
+    e = st.std * st.std;
+    if (b->nwin > 0 && b->energy > 0.) st.eratio = e / b->energy;
+
+    if (st.std <= SACQC_STD_FLOOR * st.amax) {
+        reject(qc, sta, win, "dead", st.std, SACQC_STD_FLOOR * st.amax); return 1;
+    }
+    if (qc->max_zero_sec > 0. && st.zrun * delta > qc->max_zero_sec) {
+        reject(qc, sta, win, "zero_run", st.zrun * delta, qc->max_zero_sec); return 1;
+    }
+    if (qc->max_amp > 0. && st.amax >= qc->max_amp) {
+        reject(qc, sta, win, "max_amp", st.amax, qc->max_amp); return 1;
+    }
+    if (qc->max_kurt > 0. && st.kurt > qc->max_kurt) {
+        reject(qc, sta, win, "kurtosis", st.kurt, qc->max_kurt); return 1;
+    }
+    if (b->nwin > 0 && qc->max_eratio > 0. && st.eratio > qc->max_eratio) {
+        reject(qc, sta, win, "energy_high", st.eratio, qc->max_eratio); return 1;
+    }
+    if (b->nwin > 0 && qc->min_eratio > 0. && st.eratio < qc->min_eratio) {
+        reject(qc, sta, win, "energy_low", st.eratio, qc->min_eratio); return 1;
+    }
+
+    b->energy = b->nwin == 0 ? e : (1. - qc->alpha) * b->energy + qc->alpha * e;
+    b->nwin ++;
+    return 0;
+}
+
+/*
+ *  qc_window
+ *
+ *  Description: qc_check on the hd->npts samples x of a cut window, the
+ *      baseline being that of the kstnm and kcmpnm of its header (E, N
+ *      and Z of a station are screened apart), or of name if kstnm is not
+ *      set
+ *
+ *  Return: 0 if accepted, 1 if rejected.
+ *
+ */
+int qc_window(QC *qc, const SACHEAD *hd, const char *name, const char *win, const float *x)
+{
+    char    sta[SACQC_STA_LEN], kstnm[9], kcmpnm[9];
+
+    head_field(kstnm, hd->kstnm);
+    head_field(kcmpnm, hd->kcmpnm);
+    if (kstnm[0] == '\0')
+        snprintf(sta, SACQC_STA_LEN, "%s", name);
+    else if (kcmpnm[0] == '\0')
+        snprintf(sta, SACQC_STA_LEN, "%s", kstnm);
+    else
+        snprintf(sta, SACQC_STA_LEN, "%s.%s", kstnm, kcmpnm);
+    return qc_check(qc, sta, win, x, hd->npts, hd->delta);
+}
+
+/*
+ *  qc_file
+ *
+ *  Description: qc_window on the samples of a cut SAC file
+ *
+ *  Return: 0 if accepted, 1 if rejected, -1 if the file cannot be read.
+ *
+ */
+int qc_file(QC *qc, const char *sacfile, const char *win)
+{
+    SACHEAD hd;
+    float   *x;
+    int     status;
+
+    if ((x = read_sac(sacfile, &hd)) == NULL) return -1;
+    status = qc_window(qc, &hd, sacfile, win, x);
+    free(x);
+    return status;
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  find_base: baseline of a station, added if new
+ */
+static QCBASE *find_base(QC *qc, const char *sta)
+{
+    int i;
+
+    for (i = 0; i < qc->nbase; i ++)
+        if (strcmp(qc->base[i].sta, sta) == 0) return &qc->base[i];
+    if (qc->nbase == qc->nmax) {
+        qc->nmax *= 2;
+        qc->base = (QCBASE *)realloc(qc->base, sizeof(QCBASE) * qc->nmax);
+    }
+    memset(&qc->base[qc->nbase], 0, sizeof(QCBASE));
+    strncpy(qc->base[qc->nbase].sta, sta, SACQC_STA_LEN-1);
+    return &qc->base[qc->nbase++];
+}
+
+/*
+ *  head_field: the 8 characters of a header string, trailing blanks off,
+ *      empty if not set
+ */
+static void head_field(char *out, const char *field)
+{
+    int k;
+
+    memcpy(out, field, 8);
+    out[8] = '\0';
+    for (k = (int)strlen(out); k > 0 && out[k-1] == ' '; k --) out[k-1] = '\0';
+    if (strcmp(out, "-12345") == 0) out[0] = '\0';
+}
+
+/*
+ *  reject: log "station window reason value limit"
+ */
+static void reject(QC *qc, const char *sta, const char *win, const char *why,
+                   double value, double limit)
+{
+    qc->nreject ++;
+    fprintf(qc->log, "%s %s %s %g %g\n", sta, win, why, value, limit);
+    fflush(qc->log);
+}
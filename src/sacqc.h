@@ -0,0 +1,73 @@
+/*******************************************************************************
+    Name:     sacqc.h
+
+    Purpose:  quality screening of cut windows before any FFT is spent on
+        them: RMS, kurtosis, largest amplitude, longest run of zeros and
+        energy against a running baseline of the station
+
+    Notes:
+        Moments are taken about the mean of the window. A window whose
+        standard deviation is 0, or under SACQC_STD_FLOOR of its largest
+        amplitude (a constant offset), is rejected as dead. The energy of
+        a window is its variance, compared with the variance of the
+        windows of that station accepted so far (exponential moving
+        average), so a change of offset is no change of energy and one
+        noisy or dead day stands out against its own station only; each
+        component (kstnm.kcmpnm) has a baseline of its own.
+        The baseline depends on the order of the windows: abc_egf screens
+        every station window of file.lst once, in input order, before any
+        pair is correlated, whatever the threads.
+
+        Thresholds are read from a file of "key value" lines, a value of 0
+        turns a test off:
+
+            max_kurt        50      kurtosis (3 for gaussian noise, about
+                                    25 for the coda of the example)
+            max_amp         0       largest |amplitude|, e.g. the clip level
+            max_zero_sec    10      longest run of exact zeros (seconds)
+            min_eratio      0.05    variance / baseline of the station
+            max_eratio      20
+            alpha           0.1     weight of a new window in the baseline
+            log             qc_reject.log
+*******************************************************************************/
+
+#ifndef _SACQC_H
+#define _SACQC_H
+
+#include <stdio.h>
+#include "sacio.h"
+
+#define SACQC_STA_LEN   64
+#define SACQC_STD_FLOOR 1.e-6       /* dead: std <= floor * largest |amp|  */
+
+typedef struct qc_stat {
+    double  rms;                    /* root mean square                     */
+    double  std;                    /* standard deviation                   */
+    double  kurt;                   /* kurtosis, 3 for gaussian noise       */
+    double  amax;                   /* largest |amplitude|                  */
+    int     zrun;                   /* longest run of exact zeros (samples) */
+    double  eratio;                 /* variance / baseline, 0 if none       */
+} QCSTAT;
+
+typedef struct qc_base {
+    char    sta[SACQC_STA_LEN];     /* station.component (kstnm.kcmpnm)     */
+    double  energy;                 /* moving average of the variance       */
+    int     nwin;                   /* windows accepted                     */
+} QCBASE;
+
+typedef struct qc {
+    double  max_kurt, max_amp, max_zero_sec, min_eratio, max_eratio, alpha;
+    FILE    *log;                   /* rejected windows, one per line       */
+    int     nbase, nmax;
+    QCBASE  *base;                  /* baselines of the stations            */
+    long    nwin, nreject;
+} QC;
+
+QC *qc_open ( const char *conf );
+void qc_close ( QC *qc );
+void qc_stats ( const float *x, int n, QCSTAT *st );
+int qc_check ( QC *qc, const char *sta, const char *win, const float *x, int n, float delta );
+int qc_window ( QC *qc, const SACHEAD *hd, const char *name, const char *win, const float *x );
+int qc_file ( QC *qc, const char *sacfile, const char *win );
+
+#endif /* sacqc.h */
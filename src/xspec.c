@@ -0,0 +1,266 @@
+/*******************************************************************************
+ *                                   xspec.c                                   *
+ *  Split spectra and their cross spectra, see xspec.h:                        *
+ *      xspec_use        choose the scalar, AVX2 or AVX-512 kernel             *
+ *      xspec_alloc      spectrum of n bins                                    *
+ *      xspec_free       free it                                               *
+ *      xspec_split      from an FFTW spectrum                                 *
+ *      xspec_join       back to an FFTW spectrum                              *
+ *      xspec_cross      cross spectrum of segments, summed                    *
+ *                                                                             *
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <fftw3.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define XSPEC_X86
+#include <immintrin.h>
+#endif
+#include "xspec.h"
+#include "abcstat.h"
+
+/* products and sums as written, never fused, so that every kernel gives the same bits */
+#ifdef __GNUC__
+#define NO_FMA __attribute__((optimize("fp-contract=off")))
+#else
+#define NO_FMA
+#endif
+
+/* kernels of xspec_cross on bins [i, n), the best one the CPU supports is picked on first use, once for all threads */
+static void cross_scalar(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n);
+#ifdef XSPEC_X86
+static void cross_avx2(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n);
+static void cross_avx512(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n);
+#endif
+static void (*cross_kernel)(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n) = NULL;
+static pthread_once_t cross_once = PTHREAD_ONCE_INIT;
+static void cross_default(void);
+
+/*
+ *  xspec_use
+ *
+ *  Description: choose the kernel of xspec_cross used from now on, before
+ *      any thread crosses spectra (the kernel is not switched under them)
+ *
+ *  IN:
+ *      int level   :   XSPEC_SCALAR, XSPEC_AVX2, XSPEC_AVX512, or
+ *                      XSPEC_BEST for the best one the CPU supports
+ *
+ *  Return: level of the kernel actually chosen, lowered to what the CPU
+ *          supports
+ *
+ */
+int xspec_use(int level)
+{
+    int best = XSPEC_SCALAR;
+
+#ifdef XSPEC_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))    best = XSPEC_AVX2;
+    if (__builtin_cpu_supports("avx512f")) best = XSPEC_AVX512;
+#endif
+    if (level < 0 || level > best) level = best;
+
+    switch (level) {
+#ifdef XSPEC_X86
+        case XSPEC_AVX512: cross_kernel = cross_avx512; break;
+        case XSPEC_AVX2:   cross_kernel = cross_avx2;   break;
+#endif
+        default:           cross_kernel = cross_scalar; level = XSPEC_SCALAR;
+    }
+    return level;
+}
+
+/*
+ *  xspec_alloc
+ *
+ *  Description: spectrum of n bins, its parts in one block
+ *
+ *  Return: 0 if succeed, -1 if out of memory.
+ *
+ */
+int xspec_alloc(XSPEC *x, int n)
+{
+    x->n = n;
+    if ((x->re = (double *)fftw_malloc(sizeof(double) * 2 * (n > 0 ? n : 1))) == NULL) {
+        fprintf(stderr, "Out of memory for a spectrum of %d bins\n", n);
+        x->im = NULL;
+        return -1;
+    }
+    STAT_ALLOC(sizeof(double) * 2 * n);
+    x->im = x->re + n;
+    return 0;
+}
+
+/*
+ *  xspec_free
+ *
+ *  Description: free a spectrum of xspec_alloc
+ *
+ */
+void xspec_free(XSPEC *x)
+{
+    fftw_free(x->re);
+    x->re = x->im = NULL;
+}
+
+/*
+ *  xspec_split
+ *
+ *  Description: the x->n bins of an FFTW spectrum into x
+ *
+ */
+void xspec_split(const fftw_complex *in, XSPEC *x)
+{
+    int i;
+
+    for (i = 0; i < x->n; i ++) {
+        x->re[i] = in[i][0];
+        x->im[i] = in[i][1];
+    }
+}
+
+/*
+ *  xspec_join
+ *
+ *  Description: the x->n bins of x into an FFTW spectrum, e.g. for its
+ *      inverse transform
+ *
+ */
+void xspec_join(const XSPEC *x, fftw_complex *out)
+{
+    int i;
+
+    for (i = 0; i < x->n; i ++) {
+        out[i][0] = x->re[i];
+        out[i][1] = x->im[i];
+    }
+}
+
+/*
+ *  xspec_cross
+ *
+ *  Description: Cross spectrum x * conj(y) of nseg segments (or days)
+ *      summed, segment after segment, into acc, over the acc->n bins
+ *
+ *  IN:
+ *      const XSPEC *x  :   nseg spectra of the first station
+ *      const XSPEC *y  :   nseg spectra of the second station
+ *      int nseg        :   number of segments, at least 1 unless add
+ *      int add         :   1 to add to acc, 0 to write over it
+ *  OUT:
+ *      XSPEC *acc      :   cross spectrum
+ *
+ */
+void xspec_cross(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add)
+{
+    pthread_once(&cross_once, cross_default);
+    cross_kernel(x, y, nseg, acc, add, 0, acc->n);
+}
+
+/* the best kernel on first use, unless xspec_use chose one before */
+static void cross_default(void)
+{
+    if (cross_kernel == NULL) xspec_use(XSPEC_BEST);
+}
+
+/******************************************************************************
+ *                                                                            *
+ *              Functions below are only for local use!                       *
+ *                                                                            *
+ ******************************************************************************/
+
+/*
+ *  cross_scalar, cross_avx2, cross_avx512 : kernels of xspec_cross. The
+ *      SIMD ones take 4 or 8 bins at a time and leave the tail to the
+ *      scalar one. They are compiled for their own target only and never
+ *      called on a CPU lacking it.
+ */
+NO_FMA
+static void cross_scalar(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n)
+{
+    double r, m;
+    int    k;
+
+    for (; i < n; i ++) {
+        if (add) {
+            r = acc->re[i]; m = acc->im[i]; k = 0;
+        }
+        else {
+            r = x[0].re[i]*y[0].re[i] + x[0].im[i]*y[0].im[i];
+            m = x[0].im[i]*y[0].re[i] - x[0].re[i]*y[0].im[i];
+            k = 1;
+        }
+        for (; k < nseg; k ++) {
+            r += x[k].re[i]*y[k].re[i] + x[k].im[i]*y[k].im[i];
+            m += x[k].im[i]*y[k].re[i] - x[k].re[i]*y[k].im[i];
+        }
+        acc->re[i] = r; acc->im[i] = m;
+    }
+}
+
+#ifdef XSPEC_X86
+__attribute__((target("avx2"))) NO_FMA
+static void cross_avx2(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n)
+{
+    __m256d r, m, xr, xi, yr, yi;
+    int     k;
+
+    for (; i + 4 <= n; i += 4) {
+        if (add) {
+            r = _mm256_loadu_pd(acc->re + i);
+            m = _mm256_loadu_pd(acc->im + i);
+            k = 0;
+        }
+        else {
+            xr = _mm256_loadu_pd(x[0].re + i); xi = _mm256_loadu_pd(x[0].im + i);
+            yr = _mm256_loadu_pd(y[0].re + i); yi = _mm256_loadu_pd(y[0].im + i);
+            r = _mm256_add_pd(_mm256_mul_pd(xr, yr), _mm256_mul_pd(xi, yi));
+            m = _mm256_sub_pd(_mm256_mul_pd(xi, yr), _mm256_mul_pd(xr, yi));
+            k = 1;
+        }
+        for (; k < nseg; k ++) {
+            xr = _mm256_loadu_pd(x[k].re + i); xi = _mm256_loadu_pd(x[k].im + i);
+            yr = _mm256_loadu_pd(y[k].re + i); yi = _mm256_loadu_pd(y[k].im + i);
+            r = _mm256_add_pd(r, _mm256_add_pd(_mm256_mul_pd(xr, yr), _mm256_mul_pd(xi, yi)));
+            m = _mm256_add_pd(m, _mm256_sub_pd(_mm256_mul_pd(xi, yr), _mm256_mul_pd(xr, yi)));
+        }
+        _mm256_storeu_pd(acc->re + i, r);
+        _mm256_storeu_pd(acc->im + i, m);
+    }
+    cross_scalar(x, y, nseg, acc, add, i, n);
+}
+
+__attribute__((target("avx512f"))) NO_FMA
+static void cross_avx512(const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add, int i, int n)
+{
+    __m512d r, m, xr, xi, yr, yi;
+    int     k;
+
+    for (; i + 8 <= n; i += 8) {
+        if (add) {
+            r = _mm512_loadu_pd(acc->re + i);
+            m = _mm512_loadu_pd(acc->im + i);
+            k = 0;
+        }
+        else {
+            xr = _mm512_loadu_pd(x[0].re + i); xi = _mm512_loadu_pd(x[0].im + i);
+            yr = _mm512_loadu_pd(y[0].re + i); yi = _mm512_loadu_pd(y[0].im + i);
+            r = _mm512_add_pd(_mm512_mul_pd(xr, yr), _mm512_mul_pd(xi, yi));
+            m = _mm512_sub_pd(_mm512_mul_pd(xi, yr), _mm512_mul_pd(xr, yi));
+            k = 1;
+        }
+        for (; k < nseg; k ++) {
+            xr = _mm512_loadu_pd(x[k].re + i); xi = _mm512_loadu_pd(x[k].im + i);
+            yr = _mm512_loadu_pd(y[k].re + i); yi = _mm512_loadu_pd(y[k].im + i);
+            r = _mm512_add_pd(r, _mm512_add_pd(_mm512_mul_pd(xr, yr), _mm512_mul_pd(xi, yi)));
+            m = _mm512_add_pd(m, _mm512_sub_pd(_mm512_mul_pd(xi, yr), _mm512_mul_pd(xr, yi)));
+        }
+        _mm512_storeu_pd(acc->re + i, r);
+        _mm512_storeu_pd(acc->im + i, m);
+    }
+    cross_scalar(x, y, nseg, acc, add, i, n);
+}
+#endif
@@ -0,0 +1,49 @@
+/*******************************************************************************
+    Name:     xspec.h
+
+    Purpose:  spectra with split real and imaginary parts, and the cross
+        spectrum of two of them, or the sum of those of many segments or
+        days, by a kernel vectorized for the CPU it runs on
+
+    Notes:
+        An XSPEC holds n bins as two arrays, re[n] then im[n], where FFTW
+        interleaves them (fftw_complex). Split, four (AVX2) or eight
+        (AVX-512) bins of the real parts and of the imaginary parts are
+        loaded and multiplied at once, with no shuffling of pairs:
+
+            acc[i] (+)= sum over k of x[k][i] * conj(y[k][i])
+
+        the segments k summed in turn for each bin. Every lane works on
+        its own bin with the multiplications and additions of the scalar
+        loop in the same order, and no fused multiply-add, so all kernels
+        give the same bits, those of the loop of cor_spec.
+
+        The kernel is chosen on first use, the best the CPU supports, or
+        by xspec_use (e.g. to time them against each other, abc_bench).
+*******************************************************************************/
+
+#ifndef _XSPEC_H
+#define _XSPEC_H
+
+#include <fftw3.h>
+
+/* kernels of xspec_cross */
+#define XSPEC_BEST      -1
+#define XSPEC_SCALAR     0
+#define XSPEC_AVX2       1
+#define XSPEC_AVX512     2
+
+/* spectrum of n bins, real and imaginary parts apart */
+typedef struct xspec {
+    int     n;
+    double  *re, *im;
+} XSPEC;
+
+int xspec_use ( int level );
+int xspec_alloc ( XSPEC *x, int n );
+void xspec_free ( XSPEC *x );
+void xspec_split ( const fftw_complex *in, XSPEC *x );
+void xspec_join ( const XSPEC *x, fftw_complex *out );
+void xspec_cross ( const XSPEC *x, const XSPEC *y, int nseg, XSPEC *acc, int add );
+
+#endif /* xspec.h */